@@ -8,6 +8,7 @@
 #include <unistd.h>  // write
 #include <sys/uio.h> //readv
 #include <string.h>
+#include <errno.h>
 #include <memory>
 // 线程不安全 Buffer
 class Buffer {
@@ -21,6 +22,11 @@ public:
         return buffer_.get() + startPos_ ; 
     }
 
+    // 可写的起始位置，用于原地处理缓冲区中的数据（比如 WebSocket 反掩码）
+    char* BufferStart() {
+        return buffer_.get() + startPos_ ; 
+    }
+
     char* BufferEnd() const {
         return buffer_.get() + endPos_;
     }
@@ -48,28 +54,47 @@ public:
    
     bool Append(const char* str, size_t len){
         assert(str != nullptr);
+        EnsureWriteable(len) ; 
+        memcpy(BufferEnd() , str , len) ; 
+        this->endPos_ += len ; 
+        return true ;
+    }
+
+    // 保证 Buffer 尾部至少还有 len 字节的可写空间
+    void EnsureWriteable(size_t len){
         // 不够，则需要扩容，指数扩容
-        if(this->endPos_ + len >= this->bufferLen){
-            size_t buffer_used_size = BufferUsedSize() ; 
-            if(buffer_used_size + len < this->bufferLen) { // Buffer 总容量是够的，但是重新整理 buffer 空间
-                memcpy(this->buffer_.get() , this->buffer_.get() + this->startPos_ , buffer_used_size) ; 
-                memcpy(this->buffer_.get() + buffer_used_size , str , len) ; 
-                this->startPos_ = 0 ; this->endPos_ = buffer_used_size + len; 
-            }else { // 幂增扩容方式
-                while(this->bufferLen < buffer_used_size + len){
-                    this->bufferLen = this->bufferLen * 2 ; 
-                }
-                std::unique_ptr<char[]> tmpBuffer = std::make_unique<char[]>(this->bufferLen)  ;
-                memcpy(tmpBuffer.get() , this->buffer_.get() + this->startPos_ , buffer_used_size) ; 
-                memcpy(tmpBuffer.get() + buffer_used_size , str , len) ; 
-                this->buffer_ = std::move(tmpBuffer) ;
-                this->startPos_ = 0 ; this->endPos_ = buffer_used_size + len; 
+        if(this->endPos_ + len < this->bufferLen) return ; 
+        size_t buffer_used_size = BufferUsedSize() ; 
+        if(buffer_used_size + len < this->bufferLen) { // Buffer 总容量是够的，但是重新整理 buffer 空间
+            memmove(this->buffer_.get() , this->buffer_.get() + this->startPos_ , buffer_used_size) ; 
+        }else { // 幂增扩容方式
+            while(this->bufferLen <= buffer_used_size + len){
+                this->bufferLen = this->bufferLen * 2 ; 
             }
-        } else {
-            // buffer 充足，则直接在后面添加
-            memcpy(BufferEnd() , str , len) ; 
-            this->endPos_ += len ; 
+            std::unique_ptr<char[]> tmpBuffer = std::make_unique<char[]>(this->bufferLen)  ;
+            memcpy(tmpBuffer.get() , this->buffer_.get() + this->startPos_ , buffer_used_size) ; 
+            this->buffer_ = std::move(tmpBuffer) ;
         }
+        this->startPos_ = 0 ; this->endPos_ = buffer_used_size ; 
+    }
+
+    // 直接写入 BufferEnd() 之后，登记写入的长度
+    void HasWritten(size_t len){
+        assert(this->endPos_ + len <= this->bufferLen) ; 
+        this->endPos_ += len ; 
+    }
+
+    // 从文件 fd 的 offset 处读取 len 字节直接追加到 Buffer 尾部，省去中间临时缓冲区的拷贝
+    bool AppendFromFd(int fd , size_t len , off_t offset = 0){
+        EnsureWriteable(len) ; 
+        size_t readLen = 0 ; 
+        while(readLen < len) {
+            ssize_t n = pread(fd , BufferEnd() + readLen , len - readLen , offset + readLen) ; 
+            if(n < 0 && errno == EINTR) continue ; 
+            if(n <= 0) return false ; // 出错或者文件被截断了
+            readLen += n ; 
+        }
+        this->endPos_ += len ; 
         return true ;
     }
     // ssize_t 和 size_t 分别是：long int ; unsigned long int ; 
@@ -115,6 +140,15 @@ public:
         }
     }
 
+    // 撤销尾部最后写入的 len 字节
+    void Unwrite(size_t len){
+        if(len >= BufferUsedSize()){
+            clear() ; 
+        }else{
+            this->endPos_ -= len ;
+        }
+    }
+
     void RetrieveUntil(const char* end) {
         assert(BufferStart() <= end) ; 
         Retrieve(end - BufferStart()) ; 
@@ -0,0 +1,145 @@
+#ifndef COMPRESS_CACHE_H
+#define COMPRESS_CACHE_H
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <fcntl.h>       // open
+#include <unistd.h>      // pread, close
+#include <sys/stat.h>    // stat
+#include <zlib.h>        // deflate
+#include "../Log/log.h"
+#include "../Common/commonConfig.h"
+#include "../Common/singleFlight.h"
+
+// 静态文件 gzip 压缩结果缓存 
+// 1. 以文件身份（设备号、inode、大小、修改时间）为 key ，文件变了 key 自然就变了，旧的结果会被 LRU 淘汰
+// 2. 按字节数限制缓存总大小，LRU 淘汰
+// 3. 缓存的内容用 shared_ptr 共享，淘汰之后正在发送的连接依然持有，不会失效
+// 4. 同一个文件的并发未命中只压缩一次（SingleFlight），其他请求等待并共享结果
+class CompressCache {
+private :
+    typedef std::shared_ptr<const std::string> Content ;
+    struct Entry {
+        Content content ;
+        std::list<std::string>::iterator lruIter ;
+    };
+    const HttpConfigInfo& config_ ;
+    size_t usedSize_ ;                                       // 当前缓存的总字节数
+    std::list<std::string> lru_ ;                            // 最近使用的 key 放在最前面
+    std::unordered_map<std::string , Entry> cache_ ;
+    std::mutex mtx_ ;
+    SingleFlight<std::string , Content> flight_ ;            // 正在压缩的文件
+
+    CompressCache() : config_(HttpConfigInfo::Instance()) , usedSize_(0) {
+    }
+
+    // 读文件并压缩，结果放入缓存
+    Content compress_(const std::string &filePath , const struct stat &fileStat , const std::string &key) {
+        Content content = find(key) ; // 查找缓存之后、进入 SingleFlight 之前，上一次压缩可能刚刚完成
+        if(content != nullptr) return content ;
+        std::string data ;
+        if(readFile(filePath , fileStat.st_size , data) == false) {
+            LOG_ERROR("compress cache read file %s error" , filePath.data()) ;
+            return nullptr ;
+        }
+        std::shared_ptr<std::string> gzipData = std::make_shared<std::string>() ;
+        if(gzipCompress(data.data() , data.size() , *gzipData , config_.compressLevel) == false) {
+            LOG_ERROR("compress file %s error" , filePath.data()) ;
+            return nullptr ;
+        }
+        LOG_DEBUG("compress file %s %zu -> %zu" , filePath.data() , data.size() , gzipData->size()) ;
+        put(key , gzipData) ;
+        return gzipData ;
+    }
+
+public :
+    static CompressCache& Instance() {
+        static CompressCache inst ;
+        return inst ;
+    }
+
+    static std::string makeKey(const struct stat &fileStat) {
+        char buf[128] ;
+        snprintf(buf , sizeof(buf) , "%lx:%lx:%lx:%lx.%lx" , static_cast<unsigned long>(fileStat.st_dev) ,
+                 static_cast<unsigned long>(fileStat.st_ino) , static_cast<unsigned long>(fileStat.st_size) ,
+                 static_cast<unsigned long>(fileStat.st_mtim.tv_sec) , static_cast<unsigned long>(fileStat.st_mtim.tv_nsec)) ;
+        return buf ;
+    }
+
+    // 获取文件 gzip 压缩之后的内容，缓存没有则读文件压缩后放入缓存；失败返回 nullptr
+    Content getGzip(const std::string &filePath , const struct stat &fileStat) {
+        std::string key = makeKey(fileStat) ;
+        Content content = find(key) ;
+        if(content != nullptr) return content ;
+        return flight_.Do(key , [this , &filePath , &fileStat , &key]() { return compress_(filePath , fileStat , key) ; }) ;
+    }
+
+    Content find(const std::string &key) {
+        std::unique_lock<std::mutex> locker(mtx_) ;
+        auto iter = cache_.find(key) ;
+        if(iter == cache_.end()) return nullptr ;
+        lru_.splice(lru_.begin() , lru_ , iter->second.lruIter) ;
+        return iter->second.content ;
+    }
+
+    void put(const std::string &key , const Content &content) {
+        std::unique_lock<std::mutex> locker(mtx_) ;
+        if(content->size() > config_.compressCacheSize || cache_.count(key) != 0) return ;
+        while(usedSize_ + content->size() > config_.compressCacheSize && !lru_.empty()) {
+            auto iter = cache_.find(lru_.back()) ;
+            usedSize_ -= iter->second.content->size() ;
+            cache_.erase(iter) ;
+            lru_.pop_back() ;
+        }
+        lru_.push_front(key) ;
+        cache_[key] = Entry{content , lru_.begin()} ;
+        usedSize_ += content->size() ;
+    }
+
+    size_t usedSize() {
+        std::unique_lock<std::mutex> locker(mtx_) ;
+        return usedSize_ ;
+    }
+
+    void clear() {
+        std::unique_lock<std::mutex> locker(mtx_) ;
+        cache_.clear() ; lru_.clear() ;
+        usedSize_ = 0 ;
+    }
+
+    static bool readFile(const std::string &filePath , const size_t fileSize , std::string &data) {
+        int fd = open(filePath.data() , O_RDONLY) ;
+        if(fd == -1) return false ;
+        data.resize(fileSize) ;
+        size_t readLen = 0 ;
+        while(readLen < fileSize) {
+            ssize_t n = pread(fd , &data[readLen] , fileSize - readLen , readLen) ;
+            if(n < 0 && errno == EINTR) continue ;
+            if(n <= 0) break ;
+            readLen += n ;
+        }
+        close(fd) ;
+        return readLen == fileSize ;
+    }
+
+    // windowBits 15 + 16 表示输出 gzip 格式（带 gzip 头和 crc32 尾）
+    static bool gzipCompress(const char* data , const size_t len , std::string &out , const int level) {
+        z_stream stream ;
+        memset(&stream , 0 , sizeof(stream)) ;
+        if(deflateInit2(&stream , level , Z_DEFLATED , 15 + 16 , 8 , Z_DEFAULT_STRATEGY) != Z_OK) return false ;
+        out.resize(deflateBound(&stream , len)) ;
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data)) ;
+        stream.avail_in = len ;
+        stream.next_out = reinterpret_cast<Bytef*>(&out[0]) ;
+        stream.avail_out = out.size() ;
+        int ret = deflate(&stream , Z_FINISH) ;
+        out.resize(stream.total_out) ;
+        deflateEnd(&stream) ;
+        return ret == Z_STREAM_END ;
+    }
+} ;
+
+#endif
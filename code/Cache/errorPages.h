@@ -0,0 +1,89 @@
+#ifndef ERROR_PAGES_H
+#define ERROR_PAGES_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <sys/stat.h>    // stat
+#include "../Log/log.h"
+#include "../Common/commonConfig.h"
+#include "./compressCache.h"
+
+// 预先生成的错误页面：启动时按 CODE_PATH 读取 srcDir 下的 400/403/404.html ，文件不存在时使用内置模板
+// 错误响应直接发送缓存的内容，不再每次查找文件或者拼接 HTML ；页面文件变化时由 FileWatcher 通知重新加载
+class ErrorPages {
+public :
+    struct Page {
+        std::string head ;                                // Content-Length 以及头部结束的空行
+        std::shared_ptr<const std::string> body ;
+    };
+    typedef std::shared_ptr<const Page> PagePtr ;
+
+    static ErrorPages& Instance() {
+        static ErrorPages inst ;
+        return inst ;
+    }
+
+    // 没有预先生成的状态码返回 nullptr
+    PagePtr find(const int code) const {
+        auto iter = pages_.find(code) ;
+        if(iter == pages_.end()) return nullptr ;
+        return std::atomic_load(&iter->second) ;
+    }
+
+    // 文件发生变化，如果是错误页面就重新加载
+    void reload(const std::string &path) {
+        for(auto &page : pages_) {
+            if(filePath_(page.first) == path) std::atomic_store(&page.second , build_(page.first)) ;
+        }
+    }
+
+    void reloadAll() {
+        for(auto &page : pages_) std::atomic_store(&page.second , build_(page.first)) ;
+    }
+
+    // 内置的错误页面模板
+    static std::string Render(const int code) {
+        const HttpStatus* status = HttpConfigInfo::FindStatus(code) ;
+        std::string text(status != nullptr ? status->text : "Error") ;
+        std::string body ;
+        body += "<html><title>Error</title>" ;
+        body += "<body bgcolor=\"ffffff\">" ;
+        body += std::to_string(code) + " : " + text + "\n" ;
+        body += "<p>" + text + "</p>" ;
+        body += "<hr><em>TinyWebServer</em></body></html>" ;
+        return body ;
+    }
+
+private :
+    ErrorPages() : config_(HttpConfigInfo::Instance()) {
+        for(const auto &codePath : config_.CODE_PATH) pages_[codePath.first] = build_(codePath.first) ;
+    }
+
+    ErrorPages(const ErrorPages&) = delete ;
+    ErrorPages& operator=(const ErrorPages&) = delete ;
+
+    std::string filePath_(const int code) const {
+        return config_.srcDir + config_.CODE_PATH.at(code) ;
+    }
+
+    PagePtr build_(const int code) const {
+        std::shared_ptr<std::string> body = std::make_shared<std::string>() ;
+        std::string path = filePath_(code) ;
+        struct stat fileStat ;
+        if(stat(path.data() , &fileStat) != 0 || !S_ISREG(fileStat.st_mode) ||
+           CompressCache::readFile(path , fileStat.st_size , *body) == false) {
+            LOG_INFO("error page %s not found , use builtin page" , path.data()) ;
+            *body = Render(code) ;
+        }
+        std::shared_ptr<Page> page = std::make_shared<Page>() ;
+        page->head = "Content-Length: " + std::to_string(body->size()) + "\r\n\r\n" ;
+        page->body = body ;
+        return page ;
+    }
+
+    const HttpConfigInfo& config_ ;
+    std::unordered_map<int , PagePtr> pages_ ;           // 构造之后只替换 value ，不增删 key
+} ;
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <atomic>
+#include <string.h>      // strlen
+#include <sys/stat.h>    // stat
+#include "../Log/log.h"
+#include "../Common/commonConfig.h"
+#include "../Common/singleFlight.h"
+#include "./compressCache.h"
+
+// 静态文件元数据缓存
+// 1. 缓存 stat 的结果、预压缩的 .br/.gz 文件是否存在，以及小文件的内容，命中时一个请求不需要任何系统调用
+// 2. 缓存不做过期检查，文件的变化由 FileWatcher 通过 inotify 通知，收到事件立即删除对应的条目
+// 3. 不存在的路径（扫描器、favicon 等）也缓存一段时间，按字节数限制总大小，按加入的先后淘汰
+// 4. 同一个路径的并发未命中只加载一次（SingleFlight），部署之后或者失效之后的第一批请求不会重复读同一个文件
+// 5. 没有开启监听（或者监听失效）时每次查找都直接 stat ，不放入缓存
+class FileCache {
+public :
+    typedef std::shared_ptr<const std::string> Content ;
+
+    enum SIDECAR { SIDECAR_BR , SIDECAR_GZ , SIDECAR_COUNT } ;
+    static constexpr const char* SIDECAR_SUFFIX[SIDECAR_COUNT] = { ".br" , ".gz" } ;
+
+    struct Entry {
+        struct stat fileStat ;
+        bool hasSidecar[SIDECAR_COUNT] ;
+        struct stat sidecarStat[SIDECAR_COUNT] ;
+        Content content ;                    // 小文件的内容，nullptr 表示需要从文件读取
+    };
+    typedef std::shared_ptr<const Entry> EntryPtr ;
+
+    static FileCache& Instance() {
+        static FileCache inst ;
+        return inst ;
+    }
+
+    // 查找文件，不存在返回 nullptr
+    EntryPtr lookup(const std::string &path) {
+        bool cacheable = is_Enabled_ && isCanonical_(path) ;
+        if(cacheable) {
+            std::shared_lock<std::shared_timed_mutex> locker(mtx_) ;
+            auto iter = cache_.find(path) ;
+            if(iter != cache_.end()) return iter->second ;
+            if(missing_.count(path) != 0) return nullptr ;
+        }
+        if(cacheable == false) {
+            bool missing = false ;
+            return load_(path , false , missing) ;
+        }
+        return flight_.Do(path , [this , &path]() { return loadAndInsert_(path) ; }) ;
+    }
+
+    // 文件发生变化：删除文件本身，预压缩文件变化时同时删除原文件（原文件的条目里记录了预压缩文件）
+    // 返回被删除的条目，用于之后重新加载
+    std::vector<std::string> invalidate(const std::string &path) {
+        std::vector<std::string> erased ;
+        std::unique_lock<std::shared_timed_mutex> locker(mtx_) ;
+        ++generation_ ;
+        flight_.Forget(path) ; // 之后的请求不再等待失效之前开始的加载
+        eraseMissing_(path) ;
+        if(erase_(path)) erased.push_back(path) ;
+        for(const char* suffix : SIDECAR_SUFFIX) {
+            if(!endsWith_(path , suffix)) continue ;
+            std::string origin = path.substr(0 , path.size() - strlen(suffix)) ;
+            flight_.Forget(origin) ;
+            if(erase_(origin)) erased.push_back(std::move(origin)) ;
+        }
+        return erased ;
+    }
+
+    // 目录被删除、移走或者新建，目录下的条目全部删除
+    void invalidatePrefix(const std::string &dir) {
+        std::unique_lock<std::shared_timed_mutex> locker(mtx_) ;
+        ++generation_ ;
+        flight_.ForgetAll() ;
+        std::string prefix = dir + "/" ;
+        for(auto iter = cache_.begin() ; iter != cache_.end() ; ) {
+            if(iter->first.compare(0 , prefix.size() , prefix) == 0) {
+                if(iter->second->content != nullptr) contentSize_ -= iter->second->content->size() ;
+                iter = cache_.erase(iter) ;
+            }else {
+                ++iter ;
+            }
+        }
+        for(auto iter = missing_.begin() ; iter != missing_.end() ; ) {
+            auto next = std::next(iter) ;
+            if(iter->first.compare(0 , prefix.size() , prefix) == 0) eraseMissing_(iter->first) ;
+            iter = next ;
+        }
+    }
+
+    void clear() {
+        std::unique_lock<std::shared_timed_mutex> locker(mtx_) ;
+        ++generation_ ;
+        flight_.ForgetAll() ;
+        cache_.clear() ;
+        contentSize_ = 0 ;
+        missing_.clear() ; missingOrder_.clear() ;
+        missingSize_ = 0 ;
+    }
+
+    // 只有 inotify 监听生效时才缓存，否则无法知道文件什么时候变了
+    void setEnabled(bool enabled) {
+        if(enabled == false) clear() ;
+        is_Enabled_ = enabled ;
+    }
+
+    bool IsEnabled() const {
+        return is_Enabled_ ;
+    }
+
+    size_t size() {
+        std::shared_lock<std::shared_timed_mutex> locker(mtx_) ;
+        return cache_.size() ;
+    }
+
+    size_t contentSize() {
+        std::shared_lock<std::shared_timed_mutex> locker(mtx_) ;
+        return contentSize_ ;
+    }
+
+    size_t missingCount() {
+        std::shared_lock<std::shared_timed_mutex> locker(mtx_) ;
+        return missing_.size() ;
+    }
+
+private :
+    FileCache() : config_(HttpConfigInfo::Instance()) , is_Enabled_(false) , generation_(0) , contentSize_(0) , missingSize_(0) {
+    }
+
+    FileCache(const FileCache&) = delete ;
+    FileCache& operator=(const FileCache&) = delete ;
+
+    // inotify 报告的路径是 目录 + "/" + 文件名 ，带有 // 、. 、.. 的路径和它对不上，不能缓存
+    static bool isCanonical_(const std::string &path) {
+        if(path.empty() || path.back() == '/' || endsWith_(path , "/.") || endsWith_(path , "/..")) return false ;
+        return path.find("//") == std::string::npos && path.find("/./") == std::string::npos && path.find("/../") == std::string::npos ;
+    }
+
+    static bool endsWith_(const std::string &str , const char* suffix) {
+        size_t len = strlen(suffix) ;
+        return str.size() > len && str.compare(str.size() - len , len , suffix) == 0 ;
+    }
+
+    EntryPtr loadAndInsert_(const std::string &path) {
+        // 加载期间文件可能被修改，事件先于插入处理会留下旧的结果，所以加载前后代数不同就不放入缓存
+        uint64_t generation = generation_.load() ;
+        bool missing = false ;
+        std::shared_ptr<Entry> entry = load_(path , true , missing) ;
+
+        std::unique_lock<std::shared_timed_mutex> locker(mtx_) ;
+        if(generation != generation_.load()) return entry ;
+        if(entry == nullptr) {
+            if(missing) addMissing_(path) ;
+            return nullptr ;
+        }
+        auto iter = cache_.find(path) ;
+        if(iter != cache_.end()) return iter->second ; // 其他线程已经加载过了
+        if(entry->content != nullptr) {
+            if(contentSize_ + entry->content->size() > config_.fileCacheSize) {
+                entry->content = nullptr ; // 超过内容缓存的上限，只缓存元数据
+            }else {
+                contentSize_ += entry->content->size() ;
+            }
+        }
+        cache_[path] = entry ;
+        return entry ;
+    }
+
+    // missing 表示路径确实不存在，权限等其他错误不缓存
+    std::shared_ptr<Entry> load_(const std::string &path , bool withContent , bool &missing) {
+        std::shared_ptr<Entry> entry = std::make_shared<Entry>() ;
+        if(stat(path.data() , &entry->fileStat) < 0) {
+            missing = errno == ENOENT || errno == ENOTDIR ;
+            return nullptr ;
+        }
+        if(S_ISDIR(entry->fileStat.st_mode)) return entry ;
+        for(int i = 0 ; i < SIDECAR_COUNT ; ++i) {
+            std::string sidecarPath = path + SIDECAR_SUFFIX[i] ;
+            entry->hasSidecar[i] = stat(sidecarPath.data() , &entry->sidecarStat[i]) == 0 && S_ISREG(entry->sidecarStat[i].st_mode) ;
+        }
+        size_t fileSize = entry->fileStat.st_size ;
+        if(withContent && S_ISREG(entry->fileStat.st_mode) && (entry->fileStat.st_mode & S_IROTH) && fileSize < config_.smallFileSize) {
+            std::shared_ptr<std::string> content = std::make_shared<std::string>() ;
+            if(CompressCache::readFile(path , fileSize , *content)) entry->content = content ;
+        }
+        return entry ;
+    }
+
+    bool erase_(const std::string &path) {
+        auto iter = cache_.find(path) ;
+        if(iter == cache_.end()) return false ;
+        if(iter->second->content != nullptr) contentSize_ -= iter->second->content->size() ;
+        cache_.erase(iter) ;
+        return true ;
+    }
+
+    // 每个路径按 key 长度加上固定开销计算大小，超过 fileCacheMissingSize 时淘汰最早加入的
+    static size_t missingBytes_(const std::string &path) {
+        return path.size() + 64 ;
+    }
+
+    void addMissing_(const std::string &path) {
+        if(missing_.count(path) != 0 || missingBytes_(path) > config_.fileCacheMissingSize) return ;
+        while(missingSize_ + missingBytes_(path) > config_.fileCacheMissingSize && !missingOrder_.empty()) {
+            eraseMissing_(missingOrder_.front()) ;
+        }
+        missingOrder_.push_back(path) ;
+        missing_[path] = std::prev(missingOrder_.end()) ;
+        missingSize_ += missingBytes_(path) ;
+    }
+
+    void eraseMissing_(const std::string &path) {
+        auto iter = missing_.find(path) ;
+        if(iter == missing_.end()) return ;
+        missingSize_ -= missingBytes_(path) ;
+        auto orderIter = iter->second ;
+        missing_.erase(iter) ;
+        missingOrder_.erase(orderIter) ; // path 可能就是这个结点里的字符串，最后删除
+    }
+
+    const HttpConfigInfo& config_ ;
+    std::atomic<bool> is_Enabled_ ;
+    std::atomic<uint64_t> generation_ ;                  // 每次删除条目都加一
+    size_t contentSize_ ;                                // 缓存的文件内容总字节数
+    std::unordered_map<std::string , EntryPtr> cache_ ;
+    SingleFlight<std::string , EntryPtr> flight_ ;       // 正在加载的路径
+    size_t missingSize_ ;                                // 不存在路径的总字节数
+    std::list<std::string> missingOrder_ ;               // 不存在的路径，按加入的先后排列
+    std::unordered_map<std::string , std::list<std::string>::iterator> missing_ ;
+    mutable std::shared_timed_mutex mtx_ ;               // 读多写少
+} ;
+
+#endif
@@ -0,0 +1,278 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <unistd.h>       // read, close
+#include <dirent.h>       // opendir
+#include <sys/inotify.h>  // inotify
+#include <sys/timerfd.h>  // timerfd
+#include "../Log/log.h"
+#include "./fileCache.h"
+#include "./errorPages.h"
+
+// 用 inotify 监听静态资源目录（递归监听所有子目录），文件变化时让 FileCache 中对应的条目失效
+// 1. 两个 fd 都注册在主线程的 epoll 上：inotify 可读时读出事件，立即删除受影响的条目，保证下一个请求看到的是新文件
+// 2. 被删除的热点条目在事件停止 debounceMs 之后重新加载（timerfd 触发），部署时连续的写入只重新加载一次；
+//    事件一直不停时最多推迟 MAX_DELAY_TIMES 个 debounceMs
+// 3. 预先生成的错误页面文件变化时重新生成
+// 4. 新建或者移入的目录立即加入监听；事件队列溢出时清空整个缓存；根目录被删除或者移走时停用缓存，之后尝试重新监听
+// 5. watchFile 监听单个文件（比如资源包）被替换，同样在事件停止 debounceMs 之后调用回调
+// 6. 重新加载条目要 stat 和读文件，设置了 executor 时交给线程池，不阻塞主线程的事件循环
+class FileWatcher {
+public :
+    typedef std::function<void(std::function<void()>)> Executor ;
+
+    FileWatcher() : inotifyFd_(-1) , timerFd_(-1) , rootWd_(-1) , debounceMs_(0) , is_RootLost_(false) , is_Pending_(false) {
+    }
+
+    ~FileWatcher() {
+        FileCache::Instance().setEnabled(false) ;
+        if(inotifyFd_ != -1) close(inotifyFd_) ;
+        if(timerFd_ != -1) close(timerFd_) ;
+    }
+
+    bool init(const std::string &root , const int debounceMs) {
+        root_ = root ;
+        while(root_.size() > 1 && root_.back() == '/') root_.pop_back() ;
+        debounceMs_ = debounceMs ;
+        inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC) ;
+        timerFd_ = timerfd_create(CLOCK_MONOTONIC , TFD_NONBLOCK | TFD_CLOEXEC) ;
+        if(inotifyFd_ == -1 || timerFd_ == -1) {
+            LOG_ERROR("file watcher init error %d" , errno) ;
+            return false ;
+        }
+        if(watchRoot_() == false) return false ;
+        LOG_INFO("file watcher %s , %zu directories" , root_.data() , dirs_.size()) ;
+        return true ;
+    }
+
+    // 监听所在目录的写完和移入事件，rename 替换和直接覆盖都能发现；在 init 之后调用
+    bool watchFile(const std::string &path , std::function<void()> onChange) {
+        std::string::size_type idx = path.find_last_of('/') ;
+        std::string dir = idx == std::string::npos ? "." : path.substr(0 , idx) ;
+        std::string name = idx == std::string::npos ? path : path.substr(idx + 1) ;
+        int wd = inotify_add_watch(inotifyFd_ , dir.empty() ? "/" : dir.data() , IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR | IN_MASK_ADD) ;
+        if(wd < 0 || name.empty()) {
+            LOG_ERROR("file watcher watch %s error %d" , path.data() , errno) ;
+            return false ;
+        }
+        fileDirs_[wd] = dir ;
+        files_[dir + "/" + name] = std::move(onChange) ;
+        return true ;
+    }
+
+    // 重新加载条目的任务交给 executor 执行；没有设置时在主线程直接加载
+    void setExecutor(Executor executor) {
+        executor_ = std::move(executor) ;
+    }
+
+    int GetFd() const {
+        return inotifyFd_ ;
+    }
+
+    int GetTimerFd() const {
+        return timerFd_ ;
+    }
+
+    // inotify fd 可读，读出所有事件
+    void dealEvent() {
+        alignas(struct inotify_event) char buf[16 * 1024] ;
+        while(true) {
+            ssize_t len = read(inotifyFd_ , buf , sizeof(buf)) ;
+            if(len < 0 && errno == EINTR) continue ;
+            if(len <= 0) break ;
+            for(char* ptr = buf ; ptr < buf + len ; ) {
+                const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(ptr) ;
+                dealEvent_(event) ;
+                ptr += sizeof(struct inotify_event) + event->len ;
+            }
+        }
+        schedule_() ;
+    }
+
+    // 防抖定时器到期：重新加载被删除的条目，根目录丢失时尝试重新监听
+    void dealTimer() {
+        uint64_t expirations = 0 ;
+        while(read(timerFd_ , &expirations , sizeof(expirations)) > 0) {}
+        is_Pending_ = false ;
+        if(is_RootLost_) {
+            for(const auto &dir : dirs_) inotify_rm_watch(inotifyFd_ , dir.first) ;
+            dirs_.clear() ;
+            if(watchRoot_()) {
+                is_RootLost_ = false ;
+                ErrorPages::Instance().reloadAll() ;
+                LOG_INFO("file watcher %s rewatched" , root_.data()) ;
+            }else {
+                armTimer_(RETRY_MS) ;
+            }
+        }
+        if(!refresh_.empty()) {
+            // 加载期间文件又变了也没关系：新的事件在主线程先删除条目，之后再安排一次加载
+            auto refresh = [paths = std::vector<std::string>(refresh_.begin() , refresh_.end())]() {
+                for(const std::string &path : paths) FileCache::Instance().lookup(path) ;
+            } ;
+            refresh_.clear() ;
+            if(executor_) executor_(std::move(refresh)) ;
+            else refresh() ;
+        }
+        for(const std::string &path : changed_) files_[path]() ;
+        changed_.clear() ;
+    }
+
+private :
+    static constexpr uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE |
+                                           IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW ;
+    static constexpr int MAX_DELAY_TIMES = 10 ;
+    static constexpr int RETRY_MS = 1000 ;
+
+    void dealEvent_(const struct inotify_event* event) {
+        FileCache& cache = FileCache::Instance() ;
+        if(event->mask & IN_Q_OVERFLOW) { // 丢了事件，不知道哪些文件变了
+            LOG_WARN("file watcher queue overflow , clear file cache") ;
+            cache.clear() ;
+            ErrorPages::Instance().reloadAll() ;
+            refresh_.clear() ;
+            for(const auto &file : files_) changed_.insert(file.first) ;
+            return ;
+        }
+        auto fileDir = fileDirs_.find(event->wd) ;
+        if(fileDir != fileDirs_.end() && event->len > 0 && (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) {
+            std::string path = fileDir->second + "/" + event->name ;
+            if(files_.count(path) > 0) changed_.insert(path) ;
+        }
+        auto iter = dirs_.find(event->wd) ;
+        if(iter == dirs_.end()) return ; // 已经取消监听的目录
+        if(event->wd == rootWd_ && (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))) {
+            LOG_WARN("file watcher root %s removed , file cache disabled" , root_.data()) ;
+            cache.setEnabled(false) ;
+            is_RootLost_ = true ;
+            refresh_.clear() ;
+            armTimer_(RETRY_MS) ;
+            return ;
+        }
+        if(event->mask & IN_IGNORED) { // 目录被删除，监听已经被内核移除
+            dirs_.erase(iter) ;
+            return ;
+        }
+        if(event->len == 0) return ; // 子目录自身的事件，在父目录的事件中处理
+        std::string path = iter->second + "/" + event->name ;
+        if(event->mask & IN_ISDIR) {
+            if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                // 先监听再删除条目：监听生效之前目录里发生的变化也不会留在缓存里
+                if(watchTree_(path) == false) {
+                    LOG_ERROR("file watcher %s error , file cache disabled" , path.data()) ;
+                    cache.setEnabled(false) ;
+                }
+            }else if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                unwatchTree_(path) ;
+            }
+            cache.invalidatePrefix(path) ;
+            cache.invalidate(path) ;
+            return ;
+        }
+        for(std::string &key : cache.invalidate(path)) refresh_.insert(std::move(key)) ;
+        // 错误页面写完（IN_CLOSE_WRITE）、移入或者删除时重新生成，写的过程中不重复读取
+        if(!(event->mask & (IN_MODIFY | IN_ATTRIB))) ErrorPages::Instance().reload(path) ;
+    }
+
+    // 有需要重新加载的条目时推迟定时器，直到事件停止；第一次事件之后最多推迟 MAX_DELAY_TIMES 次
+    void schedule_() {
+        bool pending = !refresh_.empty() || !changed_.empty() ;
+        if(!pending || debounceMs_ <= 0) {
+            if(pending) dealTimer() ;
+            return ;
+        }
+        auto now = std::chrono::steady_clock::now() ;
+        if(is_Pending_ == false) {
+            is_Pending_ = true ;
+            pendingSince_ = now ;
+        }else if(now - pendingSince_ >= std::chrono::milliseconds(debounceMs_ * MAX_DELAY_TIMES)) {
+            return ; // 不再推迟，等已经设置的定时器到期
+        }
+        armTimer_(debounceMs_) ;
+    }
+
+    void armTimer_(const int ms) {
+        struct itimerspec spec = {} ;
+        spec.it_value.tv_sec = ms / 1000 ;
+        spec.it_value.tv_nsec = (ms % 1000) * 1000000L ;
+        timerfd_settime(timerFd_ , 0 , &spec , nullptr) ;
+    }
+
+    bool watchRoot_() {
+        rootWd_ = -1 ;
+        if(watchTree_(root_ , WATCH_MASK & ~IN_DONT_FOLLOW)) { // 根目录本身可以是符号链接
+            for(const auto &dir : dirs_) {
+                if(dir.second == root_) rootWd_ = dir.first ;
+            }
+        }
+        if(rootWd_ == -1) {
+            LOG_ERROR("file watcher %s error %d , file cache disabled" , root_.data() , errno) ;
+            FileCache::Instance().setEnabled(false) ;
+            return false ;
+        }
+        FileCache::Instance().setEnabled(true) ;
+        return true ;
+    }
+
+    // 监听目录以及所有子目录，不跟随符号链接；监听数量超过 max_user_watches 时失败
+    bool watchTree_(const std::string &dir , const uint32_t mask = WATCH_MASK) {
+        int wd = inotify_add_watch(inotifyFd_ , dir.data() , mask) ;
+        if(wd < 0) {
+            if(errno == ENOENT || errno == ENOTDIR) return true ; // 已经被删除或者替换了，之后会收到对应的事件
+            LOG_ERROR("inotify_add_watch %s error %d" , dir.data() , errno) ;
+            return false ;
+        }
+        dirs_[wd] = dir ;
+        DIR* dirp = opendir(dir.data()) ;
+        if(dirp == nullptr) return true ;
+        bool ret = true ;
+        struct dirent* item = nullptr ;
+        while(ret && (item = readdir(dirp)) != nullptr) {
+            if(strcmp(item->d_name , ".") == 0 || strcmp(item->d_name , "..") == 0) continue ;
+            std::string path = dir + "/" + item->d_name ;
+            bool isDir = item->d_type == DT_DIR ;
+            if(item->d_type == DT_UNKNOWN) {
+                struct stat fileStat ;
+                isDir = lstat(path.data() , &fileStat) == 0 && S_ISDIR(fileStat.st_mode) ;
+            }
+            if(isDir) ret = watchTree_(path) ;
+        }
+        closedir(dirp) ;
+        return ret ;
+    }
+
+    void unwatchTree_(const std::string &dir) {
+        std::string prefix = dir + "/" ;
+        for(auto iter = dirs_.begin() ; iter != dirs_.end() ; ) {
+            if(iter->second == dir || iter->second.compare(0 , prefix.size() , prefix) == 0) {
+                inotify_rm_watch(inotifyFd_ , iter->first) ;
+                iter = dirs_.erase(iter) ;
+            }else {
+                ++iter ;
+            }
+        }
+    }
+
+    int inotifyFd_ ;
+    int timerFd_ ;
+    int rootWd_ ;
+    int debounceMs_ ;
+    bool is_RootLost_ ;
+    bool is_Pending_ ;                                   // 定时器已经设置，还没有到期
+    std::string root_ ;
+    std::unordered_map<int , std::string> dirs_ ;       // 监听描述符 -> 目录路径
+    std::unordered_set<std::string> refresh_ ;          // 被删除的条目，定时器到期后重新加载
+    std::unordered_map<int , std::string> fileDirs_ ;   // watchFile 监听的目录
+    std::unordered_map<std::string , std::function<void()>> files_ ; // watchFile 监听的文件 -> 回调
+    std::unordered_set<std::string> changed_ ;          // 发生变化的文件，定时器到期后调用回调
+    std::chrono::steady_clock::time_point pendingSince_ ;
+    Executor executor_ ;                                // 执行重新加载任务，为空时在主线程执行
+} ;
+
+#endif
@@ -0,0 +1,53 @@
+#include "compressCache.h"
+#include <iostream>
+#include <fstream>
+#include <assert.h>
+using namespace std ; 
+
+string gunzip(const string &data){
+    z_stream stream ; 
+    memset(&stream , 0 , sizeof(stream)) ; 
+    inflateInit2(&stream , 15 + 16) ; 
+    string out(1024 * 1024 , '\0') ; 
+    stream.next_in = (Bytef*)data.data() ; stream.avail_in = data.size() ; 
+    stream.next_out = (Bytef*)&out[0] ; stream.avail_out = out.size() ; 
+    inflate(&stream , Z_FINISH) ; 
+    out.resize(stream.total_out) ; 
+    inflateEnd(&stream) ; 
+    return out ; 
+}
+
+// 测试 gzip 压缩之后能正确解压
+void test_gzip(){
+    string text ; 
+    for(int i = 0 ; i < 1000 ; ++i) text += R"({"isSystem":false,"fromName":"test","message":"hello"})" ; 
+    string out ; 
+    assert(CompressCache::gzipCompress(text.data() , text.size() , out , 6)) ; 
+    assert(out.size() < text.size()) ; 
+    assert(gunzip(out) == text) ; 
+    cout<<text.size()<<" -> "<<out.size()<<endl ; 
+}
+
+// 测试同一个文件第二次直接命中缓存
+void test_cache(){
+    std::ofstream outFile("./compress_test.txt" , std::ios::out) ; 
+    for(int i = 0 ; i < 1000 ; ++i) outFile << "Hello World " << i << "\n" ; 
+    outFile.close() ; 
+
+    struct stat fileStat ; 
+    stat("./compress_test.txt" , &fileStat) ; 
+    CompressCache& cache = CompressCache::Instance() ; 
+    auto content1 = cache.getGzip("./compress_test.txt" , fileStat) ; 
+    auto content2 = cache.getGzip("./compress_test.txt" , fileStat) ; 
+    assert(content1 != nullptr && content1 == content2) ; 
+    assert(cache.usedSize() == content1->size()) ; 
+    cache.clear() ; 
+    assert(cache.usedSize() == 0) ; 
+    unlink("./compress_test.txt") ; 
+}
+
+int main(){
+    test_gzip() ; 
+    test_cache() ; 
+    return 0 ; 
+}
@@ -0,0 +1,180 @@
+#include "fileWatcher.h"
+#include "warmup.h"
+#include <iostream>
+#include <fstream>
+#include <poll.h>
+#include <assert.h>
+using namespace std ;
+
+static const string ROOT = "/tmp/test_file_cache" ;
+
+static void writeFile(const string &path , const string &content){
+    ofstream out(path , ios::out | ios::trunc) ;
+    out << content ;
+}
+
+// 等待并处理 inotify 事件，返回是否有事件
+static bool pump(FileWatcher &watcher , int timeoutMs = 200){
+    struct pollfd pfd = { watcher.GetFd() , POLLIN , 0 } ;
+    if(poll(&pfd , 1 , timeoutMs) <= 0) return false ;
+    watcher.dealEvent() ;
+    return true ;
+}
+
+// 测试没有监听时不缓存，监听之后命中缓存，并且记录了预压缩文件和小文件内容
+void test_lookup(){
+    FileCache& cache = FileCache::Instance() ;
+    assert(cache.IsEnabled() == false) ;
+    assert(cache.lookup(ROOT + "/a.js") != nullptr && cache.size() == 0) ;
+
+    FileWatcher watcher ;
+    assert(watcher.init(ROOT + "/" , 20)) ;
+    auto entry = cache.lookup(ROOT + "/a.js") ;
+    assert(entry != nullptr && entry == cache.lookup(ROOT + "/a.js")) ;
+    assert(entry->content != nullptr && *entry->content == "var a = 1 ;") ;
+    assert(entry->hasSidecar[FileCache::SIDECAR_GZ] && !entry->hasSidecar[FileCache::SIDECAR_BR]) ;
+    assert(cache.lookup(ROOT + "/none.js") == nullptr && cache.size() == 1) ; // 不存在的文件只记录路径
+    assert(cache.lookup(ROOT + "//a.js") != nullptr && cache.size() == 1) ;   // 不规范的路径不缓存
+    auto dir = cache.lookup(ROOT + "/sub") ;
+    assert(dir != nullptr && S_ISDIR(dir->fileStat.st_mode)) ;
+    cout<<"test_lookup pass"<<endl ;
+}
+
+// 测试修改、删除、移动、新建目录之后条目失效，事件停止之后重新加载
+void test_invalidate(){
+    FileCache& cache = FileCache::Instance() ;
+    FileWatcher watcher ;
+    assert(watcher.init(ROOT , 20)) ;
+    auto old = cache.lookup(ROOT + "/a.js") ;
+
+    // 修改文件：立即失效，定时器到期之后重新加载
+    writeFile(ROOT + "/a.js" , "var a = 22 ;") ;
+    while(pump(watcher)) {}
+    assert(cache.size() == 0) ;
+    struct pollfd pfd = { watcher.GetTimerFd() , POLLIN , 0 } ;
+    assert(poll(&pfd , 1 , 1000) == 1) ;
+    watcher.dealTimer() ;
+    assert(cache.size() == 1) ;
+    auto entry = cache.lookup(ROOT + "/a.js") ;
+    assert(entry != old && *entry->content == "var a = 22 ;" && *old->content == "var a = 1 ;") ;
+
+    // 预压缩文件被删除，原文件的条目也要失效
+    unlink((ROOT + "/a.js.gz").data()) ;
+    while(pump(watcher)) {}
+    assert(cache.lookup(ROOT + "/a.js")->hasSidecar[FileCache::SIDECAR_GZ] == false) ;
+
+    // 移走文件
+    cache.lookup(ROOT + "/sub/b.css") ;
+    rename((ROOT + "/sub/b.css").data() , (ROOT + "/b.css").data()) ;
+    while(pump(watcher)) {}
+    assert(cache.lookup(ROOT + "/sub/b.css") == nullptr && cache.lookup(ROOT + "/b.css") != nullptr) ;
+
+    // 新建的目录也被监听
+    mkdir((ROOT + "/new").data() , 0755) ;
+    while(pump(watcher)) {}
+    writeFile(ROOT + "/new/c.html" , "<p>c</p>") ;
+    while(pump(watcher)) {}
+    assert(*cache.lookup(ROOT + "/new/c.html")->content == "<p>c</p>") ;
+    writeFile(ROOT + "/new/c.html" , "<p>cc</p>") ;
+    while(pump(watcher)) {}
+    assert(*cache.lookup(ROOT + "/new/c.html")->content == "<p>cc</p>") ;
+
+    // 整个目录被移走，目录下的条目全部失效
+    rename((ROOT + "/new").data() , (ROOT + "/moved").data()) ;
+    while(pump(watcher)) {}
+    assert(cache.lookup(ROOT + "/new/c.html") == nullptr) ;
+    assert(*cache.lookup(ROOT + "/moved/c.html")->content == "<p>cc</p>") ;
+    unlink((ROOT + "/moved/c.html").data()) ;
+    while(pump(watcher)) {}
+    assert(cache.lookup(ROOT + "/moved/c.html") == nullptr) ;
+
+    // 设置了 executor 时重新加载交给它执行，dealTimer 本身不读文件
+    vector<function<void()>> tasks ;
+    watcher.setExecutor([&](function<void()> task) { tasks.push_back(move(task)) ; }) ;
+    writeFile(ROOT + "/a.js" , "var a = 3 ;") ;
+    while(pump(watcher)) {}
+    size_t size = cache.size() ;
+    assert(poll(&pfd , 1 , 1000) == 1) ;
+    watcher.dealTimer() ;
+    assert(tasks.size() == 1 && cache.size() == size) ;
+    tasks[0]() ;
+    assert(cache.size() == size + 1) ;
+    assert(*cache.lookup(ROOT + "/a.js")->content == "var a = 3 ;") ;
+    watcher.setExecutor(nullptr) ;
+    cout<<"test_invalidate pass"<<endl ;
+}
+
+// 测试不存在的路径被缓存，文件或者上级目录出现之后失效，总大小受限
+void test_missing(){
+    FileCache& cache = FileCache::Instance() ;
+    FileWatcher watcher ;
+    assert(watcher.init(ROOT , 20)) ;
+    assert(cache.lookup(ROOT + "/wp-admin/setup.php") == nullptr && cache.missingCount() == 1) ;
+    assert(cache.lookup(ROOT + "/wp-admin/setup.php") == nullptr && cache.missingCount() == 1) ;
+    assert(cache.lookup(ROOT + "/favicon.ico") == nullptr && cache.missingCount() == 2) ;
+
+    writeFile(ROOT + "/favicon.ico" , "icon") ;
+    while(pump(watcher)) {}
+    assert(cache.missingCount() == 1 && *cache.lookup(ROOT + "/favicon.ico")->content == "icon") ;
+    mkdir((ROOT + "/wp-admin").data() , 0755) ;
+    writeFile(ROOT + "/wp-admin/setup.php" , "php") ;
+    while(pump(watcher)) {}
+    assert(cache.missingCount() == 0 && cache.lookup(ROOT + "/wp-admin/setup.php") != nullptr) ;
+
+    // 超过总大小时淘汰最早加入的路径
+    size_t limit = HttpConfigInfo::Instance().fileCacheMissingSize ;
+    for(int i = 0 ; i < 100000 ; ++i) cache.lookup(ROOT + "/scan/" + to_string(i)) ;
+    assert(cache.missingCount() > 0 && cache.missingCount() * (ROOT.size() + 64) < limit) ;
+    assert(cache.lookup(ROOT + "/scan/99999") == nullptr) ;
+    cout<<"test_missing pass"<<endl ;
+}
+
+// 测试错误页面预先生成，srcDir 下没有页面文件时使用内置模板
+void test_error_pages(){
+    ErrorPages& pages = ErrorPages::Instance() ;
+    for(int code : {400 , 403 , 404}) {
+        auto page = pages.find(code) ;
+        assert(page != nullptr && page == pages.find(code)) ;
+        assert(page->body->find(to_string(code) + " : ") != string::npos) ;
+        assert(page->head == "Content-Length: " + to_string(page->body->size()) + "\r\n\r\n") ;
+    }
+    assert(pages.find(200) == nullptr) ;
+    cout<<"test_error_pages pass"<<endl ;
+}
+
+// 测试预热：所有文件进入 FileCache ，小文件内容在内存中，大文件预读，文本类资源提前压缩
+void test_warmup(){
+    FileCache& cache = FileCache::Instance() ;
+    CompressCache::Instance().clear() ;
+    FileWatcher watcher ;
+    assert(watcher.init(ROOT , 20)) ;
+    string page ;
+    for(int i = 0 ; i < 200 ; ++i) page += "<p>line " + to_string(i) + "</p>\n" ;
+    writeFile(ROOT + "/sub/page.html" , page) ;
+    writeFile(ROOT + "/sub/big.bin" , string(HttpConfigInfo::Instance().smallFileSize * 4 , 'x')) ;
+    while(pump(watcher)) {}
+
+    Warmup::Result result = Warmup::Run(ROOT) ;
+    assert(result.files >= 4 && cache.size() == result.files) ;
+    assert(cache.lookup(ROOT + "/sub/page.html")->content != nullptr) ;
+    assert(cache.lookup(ROOT + "/sub/big.bin")->content == nullptr) ;
+    assert(result.readaheadBytes == HttpConfigInfo::Instance().smallFileSize * 4) ;
+    assert(result.compressedFiles == 1 && CompressCache::Instance().usedSize() > 0) ;
+    cout<<"test_warmup pass"<<endl ;
+}
+
+int main(){
+    system(("rm -rf " + ROOT).data()) ;
+    mkdir(ROOT.data() , 0755) ;
+    mkdir((ROOT + "/sub").data() , 0755) ;
+    writeFile(ROOT + "/a.js" , "var a = 1 ;") ;
+    writeFile(ROOT + "/a.js.gz" , "gzip") ;
+    writeFile(ROOT + "/sub/b.css" , "body {}") ;
+    test_lookup() ;
+    test_invalidate() ;
+    test_missing() ;
+    test_error_pages() ;
+    test_warmup() ;
+    system(("rm -rf " + ROOT).data()) ;
+    return 0 ;
+}
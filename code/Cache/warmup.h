@@ -0,0 +1,93 @@
+#ifndef WARMUP_H
+#define WARMUP_H
+
+#include <string>
+#include <chrono>
+#include <fcntl.h>       // open, readahead
+#include <unistd.h>      // close
+#include <dirent.h>      // opendir
+#include <sys/stat.h>    // lstat
+#include "../Log/log.h"
+#include "../Common/commonConfig.h"
+#include "./fileCache.h"
+#include "./compressCache.h"
+
+// 启动预热：遍历 srcDir 下的所有文件
+// 1. 查找一次 FileCache ，缓存 stat 结果、预压缩文件以及小文件内容（受 fileCacheSize 限制）
+// 2. 没有放进内存的文件用 readahead 预读进 page cache（受 warmupReadaheadSize 限制），之后的 sendfile / mmap 不再等磁盘
+// 3. 没有 .gz 预压缩文件的文本类资源提前在线压缩，放进 CompressCache（受 compressCacheSize 限制）
+// FileCache 只有在 FileWatcher 监听生效时才缓存，所以预热要在监听之后进行
+class Warmup {
+public :
+    struct Result {
+        size_t files = 0 ;
+        size_t cachedBytes = 0 ;                          // 放进 FileCache 的文件内容
+        size_t readaheadBytes = 0 ;                       // 预读进 page cache 的字节数
+        size_t compressedFiles = 0 ;                      // 提前压缩的文件个数
+        long long costMs = 0 ;
+    };
+
+    static Result Run(const std::string &root) {
+        Result result ;
+        auto start = std::chrono::steady_clock::now() ;
+        walk_(root , result) ;
+        result.costMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() ;
+        LOG_INFO("warmup %s : %zu files , cached %zu bytes , readahead %zu bytes , compressed %zu files , %lld ms" , root.data() ,
+                 result.files , result.cachedBytes , result.readaheadBytes , result.compressedFiles , result.costMs) ;
+        return result ;
+    }
+
+private :
+    // 不跟随符号链接指向的目录，和 FileWatcher 的监听范围一致
+    static void walk_(const std::string &dir , Result &result) {
+        DIR* dirp = opendir(dir.data()) ;
+        if(dirp == nullptr) {
+            LOG_WARN("warmup opendir %s error %d" , dir.data() , errno) ;
+            return ;
+        }
+        struct dirent* item = nullptr ;
+        while((item = readdir(dirp)) != nullptr) {
+            if(strcmp(item->d_name , ".") == 0 || strcmp(item->d_name , "..") == 0) continue ;
+            std::string path = dir + "/" + item->d_name ;
+            bool isDir = item->d_type == DT_DIR ;
+            if(item->d_type == DT_UNKNOWN) {
+                struct stat fileStat ;
+                isDir = lstat(path.data() , &fileStat) == 0 && S_ISDIR(fileStat.st_mode) ;
+            }
+            if(isDir) {
+                walk_(path , result) ;
+            }else {
+                warmFile_(path , result) ;
+            }
+        }
+        closedir(dirp) ;
+    }
+
+    static void warmFile_(const std::string &path , Result &result) {
+        const HttpConfigInfo& config = HttpConfigInfo::Instance() ;
+        FileCache::EntryPtr entry = FileCache::Instance().lookup(path) ;
+        if(entry == nullptr || !S_ISREG(entry->fileStat.st_mode) || !(entry->fileStat.st_mode & S_IROTH)) return ;
+        ++result.files ;
+        size_t fileSize = entry->fileStat.st_size ;
+        if(entry->content != nullptr) {
+            result.cachedBytes += fileSize ;
+        }else if(result.readaheadBytes + fileSize <= config.warmupReadaheadSize) {
+            int fd = open(path.data() , O_RDONLY) ;
+            if(fd != -1) {
+                if(readahead(fd , 0 , fileSize) == 0) result.readaheadBytes += fileSize ;
+                close(fd) ;
+            }
+        }
+
+        std::string::size_type idx = path.find_last_of('.') ;
+        const SuffixInfo* info = idx == std::string::npos ? nullptr : HttpConfigInfo::FindSuffix(std::string_view(path).substr(idx)) ;
+        if(info == nullptr || !HttpConfigInfo::IsCompressibleType(info->type) || entry->hasSidecar[FileCache::SIDECAR_GZ]) return ;
+        CompressCache& compressCache = CompressCache::Instance() ;
+        // 压缩结果按原文件大小估计，缓存放不下时停止，不挤掉已经预热的结果
+        if(fileSize < config.compressMinSize || fileSize > config.compressMaxSize ||
+           compressCache.usedSize() + fileSize > config.compressCacheSize) return ;
+        if(compressCache.getGzip(path , entry->fileStat) != nullptr) ++result.compressedFiles ;
+    }
+} ;
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef BASE64_H
+#define BASE64_H
+
 #include <string>
 
 std::string base64_encode(unsigned char const* , unsigned int len);
@@ -125,3 +128,5 @@ std::string base64_decode(std::string const& encoded_string) {
 
   return ret;
 }
+
+#endif
@@ -20,8 +20,12 @@
 #include "../Common/commonConfig.h"
 #include "./httpProtocol.h"
 #include "./webSocket.h"
+#include "./http2Protocol.h"
+#include "../Tls/tlsContext.h"
+#include "../Tls/transport.h"
 #include "../Server/epoller.h"
-#include "../Common/rwlockmap.h"
+#include "../PubSub/pubSub.h"
+#include "../PubSub/presence.h"
 #include "../Common/picojson.h"
 class ClientConn {
 private:
@@ -29,41 +33,67 @@ private:
     int fd_; 
     bool is_Close_ ; 
     uint32_t connEvent_ ;  
-    bool is_HttpPotocol_ ;              // 判断是否是 HTTP 协议还是 WebSocket 协议
+    enum PROTOCOL {
+        HTTP1 ,                         // 默认是 HTTP/1.1
+        HTTP2 ,                         // prior knowledge 或者 Upgrade: h2c 升级
+        WEBSOCKET ,                     // Upgrade: websocket 升级
+    };
+    std::atomic<PROTOCOL> protocol_ ;   // 当前连接使用的协议，主线程的心跳检查也会读
+    bool is_Heartbeat_ ;                // 已经加入心跳检查，只在主线程访问
     bool is_KeepAlive_ ;                // 是否保持 tcp 连接
     struct sockaddr_in addr_;  
     std::unique_ptr<Buffer> readBuff_; // 读缓冲区
     std::unique_ptr<Buffer> writeBuff_; // 写缓冲区
+    std::unique_ptr<Transport> transport_ ; // 读写通道，开启 TLS 时负责握手和加解密
     std::unique_ptr<HttpProtocol> http_ ; 
-    std::unique_ptr<WebSocket> webSocket_ ; 
+    std::shared_ptr<WebSocket> webSocket_ ; // 房间和用户索引的快照也持有，发布者遍历快照期间连接关闭了也不会被释放
+    std::unique_ptr<Http2Protocol> http2_ ; // 升级成 HTTP/2 时才创建
     std::mutex mtx_ ; 
+    std::mutex taskMtx_ ;               // 同一个连接的读写任务串行执行：其他连接投递消息时的 ModFd 会重新激活 EPOLLONESHOT ，同一个连接的事件可能同时交给两个工作线程
+    std::atomic<bool> is_ClosePending_ ;// 关闭时有读写任务正在执行，由持有 taskMtx_ 的任务结束之后关闭
     Epoller *epoller_ ;  
-    RWLockMap<std::string , WebSocket*> &userNames_ ;
+    PubSub<std::shared_ptr<WebSocket>> &userNames_ ;    // 用户名到该用户所有 WebSocket 连接（多端登录）的索引，按用户名 O(1) 找到接收者
+    PubSub<std::shared_ptr<WebSocket>> &topics_ ;       // 聊天室的房间，发布时只访问房间的订阅者
+    Presence &presence_ ;               // 带版本号的在线列表，上线时只给这个连接发快照，其他用户收到增量
+    std::vector<std::string> subscribed_ ; // 本连接加入的房间，关闭时退订
     std::string name ; 
 public : 
 
-    ClientConn(int fd , const sockaddr_in& addr , Epoller* epoll , RWLockMap<std::string , WebSocket*> &userName , const uint32_t connEvent): 
-               fd_(fd) , addr_(addr) , epoller_(epoll) , userNames_(userName), connEvent_(connEvent) , is_Close_(false) , is_KeepAlive_(false) , is_HttpPotocol_(true) {  
+    ClientConn(int fd , const sockaddr_in& addr , Epoller* epoll , PubSub<std::shared_ptr<WebSocket>> &userName , PubSub<std::shared_ptr<WebSocket>> &topics , Presence &presence , const uint32_t connEvent): 
+               fd_(fd) , addr_(addr) , epoller_(epoll) , userNames_(userName), topics_(topics) , presence_(presence) , connEvent_(connEvent) , is_Close_(false) , is_KeepAlive_(false) , protocol_(HTTP1) , is_Heartbeat_(false) , is_ClosePending_(false) {  
         epoller_->AddFd(fd_, connEvent_ | EPOLLIN) ; 
         readBuff_ = std::make_unique<Buffer>() ; 
         writeBuff_ = std::make_unique<Buffer>() ; 
-        http_ = std::make_unique<HttpProtocol>(fd_ , connEvent & EPOLLET , readBuff_.get() , writeBuff_.get() ) ; 
-        webSocket_ = std::make_unique<WebSocket>(fd_ , connEvent & EPOLLET , readBuff_.get() , writeBuff_.get() ) ;
+        transport_ = std::make_unique<Transport>(fd_ , TlsContext::Instance().GetCtx()) ; 
+        http_ = std::make_unique<HttpProtocol>(transport_.get() , connEvent & EPOLLET , readBuff_.get() , writeBuff_.get() ) ; 
+        webSocket_ = std::make_shared<WebSocket>(transport_.get() , connEvent & EPOLLET , readBuff_.get() , writeBuff_.get() ) ;
     }
 
     ~ClientConn() {
         Close() ; 
     } 
 
+    // 返回是否由这次调用关闭了连接；有读写任务正在执行时不等待（主线程不能被慢连接阻塞），
+    // 只标记等待关闭，任务释放 taskMtx_ 之后返回 CLOSE_CONNECTION ，由工作线程再调用一次
+    // 先标记再 try_lock ：加锁失败说明有任务持有 taskMtx_ ，它释放之后一定能看到标记
     bool Close() {
         if(is_Close_ == true) return false ;
+        is_ClosePending_ = true ; 
+        std::unique_lock<std::mutex> task(taskMtx_ , std::try_to_lock) ; 
+        if(task.owns_lock() == false) return false ; 
         std::lock_guard<std::mutex> locker(mtx_) ; // 主线程也会析构也会 Close ；包括定时器 Close ，防止同时进行
         if(is_Close_ == false){
             // 先保证 Epoller_DelFd 删除了，再 close(fd_) ，这很重要，因为一旦先关闭了 fd ,主线程就能 accpet 新的相同 fd 了，这样就会导致 epoller->Del(fd) 删除了新连接的 fd 
-            if(is_HttpPotocol_ == false){
-                webSocket_->close() ; userNames_.erase(name) ; 
+            if(protocol_ == WEBSOCKET){
+                webSocket_->close() ; 
+                if(!name.empty() && userNames_.Unsubscribe(name , webSocket_)) presence_.Leave(name) ; 
+                for(const std::string &topic : subscribed_) topics_.Unsubscribe(topic , webSocket_) ; 
+                subscribed_.clear() ; 
+            }else if(protocol_ == HTTP2){
+                http2_->close() ; 
             }
             if(epoller_->DelFd(fd_)){
+                transport_->close() ; // 先发送 close_notify ，再关闭 fd
                 int ret = close(fd_) ;
                 if(ret == -1){
                     LOG_ERROR("close Fd %d error" , fd_) ; 
@@ -97,9 +127,26 @@ public :
         return is_KeepAlive_ ; 
     }
 
+    // 连接已经升级成 WebSocket 、还没有加入心跳检查时返回 true ，只返回一次；只在主线程调用
+    bool NeedHeartbeat() {
+        if(is_Heartbeat_ || protocol_ != WEBSOCKET) return false ; 
+        is_Heartbeat_ = true ; 
+        return true ; 
+    }
+
+    // 心跳检查，在主线程的定时器中调用；返回下次检查距现在的秒数，-1 表示不再检查
+    // 只有 WebSocket 连接有心跳结点；发出了 ping 或者已经断开时监听写，由工作线程发送或者关闭
+    int Heartbeat(const int intervalS , const int timeoutS) {
+        if(is_Close_ || protocol_ != WEBSOCKET) return -1 ; 
+        return webSocket_->Heartbeat(intervalS , timeoutS , [this](int fd) { epoller_->ModFd(fd , connEvent_ | EPOLLOUT) ; }) ; 
+    }
+
     STATUS_CODE dealHttpRequest(const int needRead = true){
         STATUS_CODE retCode = http_->dealHttpRequest(needRead) ; 
-        if(retCode == CLOSE_CONNECTION){ // 客户端已经关闭了
+        if(retCode == CONTINUE_CODE){ // 请求还没有收完整，或者没有读到数据（比如 TLS 记录里只有握手消息），继续等待请求
+            epoller_->ModFd(fd_ , connEvent_ | EPOLLIN) ; 
+            return GOOD_CODE ; 
+        }else if(retCode == CLOSE_CONNECTION){ // 客户端已经关闭了
             LOG_INFO("Client[%d](%s:%d) already close", this->GetFd() , this->GetIP(), this->GetPort()) ;
             http_->close() ; return CLOSE_CONNECTION ; 
         }else if(retCode == BAD_REQUEST){ // 客户端请求报文错误
@@ -107,44 +154,41 @@ public :
                 LOG_ERROR("server make http response error !!") ; 
                 http_->close() ;  return CLOSE_CONNECTION ; 
             }
+        }else if(http_->isHttp2Preface()){ // prior knowledge 方式的 HTTP/2 
+            protocol_ = HTTP2 ; 
+            is_KeepAlive_ = true ; 
+            http_->close() ; 
+            http2_ = std::make_unique<Http2Protocol>(transport_.get() , connEvent_ & EPOLLET , readBuff_.get() , writeBuff_.get()) ; 
+            http2_->start() ; 
+            return dealHttp2Request(false) ; 
         }else {
-            if(http_->isUpgradeWebSocket()){// 是否升级成 WebSocket 协议了
-                is_HttpPotocol_ = false ; // 转交给 WebSocket 升级
+            if(http_->isUpgradeH2c()){ // Upgrade: h2c ，这个请求作为流 1 在 HTTP/2 中响应
+                protocol_ = HTTP2 ; 
+                is_KeepAlive_ = true ; 
+                http2_ = std::make_unique<Http2Protocol>(transport_.get() , connEvent_ & EPOLLET , readBuff_.get() , writeBuff_.get()) ; 
+                bool ret = http2_->upgrade(*http_) ; 
+                http_->close() ; 
+                if(ret == false){
+                    LOG_ERROR("http2 upgrade Error");
+                    return CLOSE_CONNECTION ; 
+                }
+            }else if(http_->isUpgradeWebSocket()){// 是否升级成 WebSocket 协议了
+                protocol_ = WEBSOCKET ; // 转交给 WebSocket 升级
                 is_KeepAlive_ = true ; 
                 std::string WebSocket_key = http_->get_WebSocket_key() ; 
+                std::string extensions = http_->get_WebSocket_extensions() ; 
                 this->name = http_->getUserName() ; 
                 http_->close() ; 
-                if(webSocket_->handshark(WebSocket_key) == false){
+                if(webSocket_->handshark(WebSocket_key , extensions) == false){
                     LOG_ERROR("WebSocket update Error");
                     return CLOSE_CONNECTION ; 
                 }  
-                // 握手成功，系统推送群发消息，所有在线用户都需要更新在线群聊好友情况
+                webSocket_->SetUserName(name) ; 
+                // 握手成功，完整的在线列表只发给这个连接，其他用户在窗口到期时收到合并之后的上线通知
                 if(this->name.size() > 0){ 
-                    userNames_[name] = webSocket_.get() ; // 问题，之前的连接还处于登录状态，但是不能接受到群聊消息，只有最新的连接才会加入到群聊中
-
-                    picojson::object message_json , nameMessage;  
-                    message_json["isSystem"] = picojson::value(true) ;  
-                    std::vector<picojson::value> vecName ; 
-                    for(const auto &iter : userNames_){
-                        if(iter.second->is_Close() == false){
-                            vecName.push_back(picojson::value(iter.first)) ;
-                        }
-                    } 
-                    message_json["message"] = picojson::value(vecName) ;
-
-                    // 将 picojson 对象转换为字符串
-                    std::string systemMessage = picojson::value(message_json).serialize(); 
-                    // 系统消息，也还要添加 WebSocket 头部字段
-                    std::string systemMessageHead = webSocket_->makeWebSocketHead(systemMessage.size()) ;
-                    systemMessage = systemMessageHead + systemMessage ;
-
-                    // 群发系统消息
-                    for(const auto &iter : userNames_){
-                        LOG_INFO("%d name:%s , send system message to new client go online %s",iter.second->GetFd() , iter.first.data() , systemMessage.data())
-                        if(iter.second->is_Close() == false){
-                            iter.second->makeWebSocketResponse(systemMessage) ;   
-                            epoller_->ModFd(iter.second->GetFd() , connEvent_ | EPOLLOUT) ;
-                        }
+                    userNames_.Subscribe(name , webSocket_) ; // 同一个用户的多个连接都保留，都能收到消息
+                    if(presence_.Join(name , [this](uint64_t version , const std::vector<std::string> &names) { sendRoster_(version , names) ; })) {
+                        LOG_INFO("name:%s go online , %zu users online" , name.data() , presence_.OnlineCount()) ;
                     }
                 }
             }else if(http_->makeHttpResponse(200) == false){// 设置 http 应答报文出错，关闭连接
@@ -164,45 +208,67 @@ public :
             http_->close() ; return CLOSE_CONNECTION ;
         } 
          
-        if(http_->IsKeepAlive()){       // 是否 保持连接
-            is_KeepAlive_ = true ; 
-        }
-        // 出现了粘包，缓冲区里还有数据，再次处理
-        if(readBuff_->BufferUsedSize() > 0) {
-            http_->close() ;// 关闭上一次的 http_ 请求资源，直接再处理这一次的
-            LOG_ERROR("maybe have Sticky package") ; 
+        is_KeepAlive_ = http_->IsKeepAlive() ; // 是否 保持连接
+        // 传输完成 , 本次 http 请求应答结束，故 http 关闭 ，但是 tcp 并没有关闭
+        http_->close() ;
+        // 出现了粘包，缓冲区里还有下一个请求（可能不完整），接着处理
+        if(is_KeepAlive_ && readBuff_->BufferUsedSize() > 0) {
+            LOG_DEBUG("maybe have Sticky package") ; 
             ret = this->dealHttpRequest(false) ; 
             if(ret == CLOSE_CONNECTION){
                 return CLOSE_CONNECTION ;
-            }if(ret == GOOD_CODE){
-                return CONTINUE_CODE ; // 请求处理成功了，所以 return continue_code 继续写这次的应答报文，
-            }  
+            }
+            // 生成了应答就 return continue_code 继续写，请求不完整则继续等待读
+            if(protocol_ != HTTP1 || http_->IsResponseDone() == false) return CONTINUE_CODE ; 
         }
-        // 传输完成 , 本次 http 请求应答结束，故 http 关闭 ，但是 tcp 并没有关闭
-        http_->close() ;
         return GOOD_CODE ;
     }
 
+    STATUS_CODE dealHttp2Request(const int needRead = true){
+        STATUS_CODE ret = http2_->dealHttp2Request(needRead) ; 
+        if(ret == CLOSE_CONNECTION){
+            LOG_INFO("Client[%d](%s:%d) already close", this->GetFd() , this->GetIP(), this->GetPort()) ;
+            return CLOSE_CONNECTION ; 
+        }
+        // 有要发送的帧就监听写，否则继续接收帧
+        epoller_->ModFd(fd_ , connEvent_ | (http2_->WantWrite() ? EPOLLOUT : EPOLLIN)) ; 
+        return GOOD_CODE ; 
+    }
+
     STATUS_CODE dealWebSocketRequest(){
         STATUS_CODE ret = webSocket_->dealWebSocketRequest() ; 
-        if(ret == BAD_REQUEST) {// WebSocket 请求解析出错，直接关闭连接
-            LOG_ERROR("server deal parse WebSocket request error !!") ;   
-            return CLOSE_CONNECTION ; 
-        } else if(ret == CLOSE_CONNECTION){ // 关闭连接
+        if(ret == CLOSE_CONNECTION){ // 关闭连接
             LOG_ERROR("WebSocket close !!") ;  
             return CLOSE_CONNECTION ; 
+        } else if(ret == CONTINUE_CODE){ // 没有完整的消息，继续接收
+            rearmWebSocket_() ; 
+            return GOOD_CODE ; 
         }// GOOD_CODE ; 
-        std::string message ; writeBuff_->RefRetrieveAllToStr(message) ; 
-        const std::string &responseName = webSocket_->getResponseName() ; 
-        // 群发消息
-        for(const auto &iter : userNames_){
-            if(iter.first != responseName && iter.second->is_Close() == false) {
-                iter.second->makeWebSocketResponse(message) ;   
-                epoller_->ModFd(iter.second->GetFd() , connEvent_ | EPOLLOUT) ;
+        auto wakeup = [this](int fd) { epoller_->ModFd(fd , connEvent_ | EPOLLOUT) ; } ; 
+        // 一次读事件可能解析出多条消息，按顺序处理
+        for(WebSocket::Message &message : webSocket_->getMessages()) {
+            if(message.type == WebSocket::ROSTER_MESSAGE) {
+                if(name.size() > 0) presence_.Snapshot([this](uint64_t version , const std::vector<std::string> &names) { sendRoster_(version , names) ; }) ; 
+                continue ; 
             }
+            if(message.type != WebSocket::CHAT_MESSAGE) {
+                dealTopicMessage_(message) ; 
+                continue ; 
+            }
+            // 私聊：按 toName 找到接收者的所有连接（多端登录），只推送给他们，其他用户看不到
+            // 每个连接只增加一次引用计数，不拷贝内容；压缩的帧按接收者的压缩上下文共享
+            if(name.empty()) {
+                LOG_WARN("Client[%d] not login , drop message to %s" , fd_ , message.toName.data()) ; 
+                continue ; 
+            }
+            size_t count = userNames_.Publish(message.toName , [&](const std::shared_ptr<WebSocket> &receiver) {
+                if(receiver != webSocket_) receiver->Deliver(message , wakeup) ; // 发给自己时不回显给发送的这个连接
+            }) ; 
+            if(count == 0) LOG_DEBUG("%s send to %s , not online" , name.data() , message.toName.data()) ; 
         }
-        // 接收消息
-        epoller_->ModFd(fd_ , connEvent_ | EPOLLIN); 
+        // 回复了 pong 或者关闭帧时先发送；收到关闭帧之后发送完就关闭连接
+        if(webSocket_->IsClosing()) is_KeepAlive_ = false ; 
+        rearmWebSocket_() ; 
         return GOOD_CODE ;
     }
 
@@ -217,34 +283,141 @@ public :
         return GOOD_CODE ;
     }
     
+    // TLS 握手：按 SSL 的需要等待可读或者可写，完成后客户端可能已经发来了请求，直接处理
+    STATUS_CODE dealHandshake() {
+        STATUS_CODE ret = transport_->Handshake() ; 
+        if(ret == CLOSE_CONNECTION) return CLOSE_CONNECTION ; 
+        if(ret == CONTINUE_CODE) {
+            epoller_->ModFd(fd_ , connEvent_ | (transport_->WantWrite() ? EPOLLOUT : EPOLLIN)) ; 
+            return GOOD_CODE ; 
+        }
+        return dealRequest_() ; 
+    }
+
+    // 读写任务的入口，由工作线程调用；连接已经关闭时什么也不做（fd 可能已经被新连接复用，不能再 ModFd）
+    // 工作线程的读写任务；任务执行期间其他线程要求关闭时，释放 taskMtx_ 之后返回 CLOSE_CONNECTION
     STATUS_CODE dealRequest() {
-        if(is_HttpPotocol_){
-            http_->init() ; 
+        STATUS_CODE ret = GOOD_CODE ; 
+        {
+            std::lock_guard<std::mutex> task(taskMtx_) ; 
+            if(is_Close_) return GOOD_CODE ; 
+            if(is_ClosePending_ == false) ret = dealRequest_() ; 
+        }
+        return is_ClosePending_ ? CLOSE_CONNECTION : ret ; 
+    }
+
+    STATUS_CODE dealResponse() {
+        STATUS_CODE ret = GOOD_CODE ; 
+        {
+            std::lock_guard<std::mutex> task(taskMtx_) ; 
+            if(is_Close_) return GOOD_CODE ; 
+            if(is_ClosePending_ == false) ret = dealResponse_() ; 
+        }
+        return is_ClosePending_ ? CLOSE_CONNECTION : ret ; 
+    }
+
+private :
+    STATUS_CODE dealRequest_() {
+        if(transport_->IsHandshakeDone() == false){
+            return dealHandshake() ; 
+        }
+        if(protocol_ == HTTP1){
+            if(http_->IsParsing() == false) http_->init() ; // 上一个请求没收完整时接着解析
             return dealHttpRequest() ; 
+        }else if(protocol_ == HTTP2){ // 读缓冲区里可能还有不完整的帧，不能清空
+            return dealHttp2Request() ; 
         }else {
             webSocket_->init() ; 
             return dealWebSocketRequest() ; 
         }  
     }
 
-    STATUS_CODE dealResponse() {
+    STATUS_CODE dealResponse_() {
+        if(transport_->IsHandshakeDone() == false){
+            return dealHandshake() ; 
+        }
         STATUS_CODE ret = CLOSE_CONNECTION ; 
-        if(is_HttpPotocol_){
+        if(protocol_ == HTTP1){
             ret = dealHttpResponse() ; 
+        }else if(protocol_ == HTTP2){
+            ret = http2_->dealHttp2Response() ; 
         }else {
             ret = dealWebsocketResponse() ; 
         }
-        if(ret == CLOSE_CONNECTION || is_KeepAlive_ == false){ // 是否出错，或者关闭连接
+        if(ret == CLOSE_CONNECTION){ // 出错
+            return CLOSE_CONNECTION ; 
+        }
+        if(ret == GOOD_CODE && is_KeepAlive_ == false){ // 短连接要等响应全部发完再关闭
             return CLOSE_CONNECTION ; 
         }
 
         if(ret == CONTINUE_CODE) { // 数据没有写完，需要继续写 
             epoller_->ModFd(fd_, connEvent_ | EPOLLOUT) ;
+        }else if(protocol_ == WEBSOCKET) { // 写的过程中其他连接可能又投递了消息
+            rearmWebSocket_() ; 
         }else { // 写完之后，同一个线程内重置EPOLLONESHOT事件： 把 client 置于可写 EPOLLIN ，接受 request ；
             epoller_->ModFd(fd_ , connEvent_ | EPOLLIN); 
         } 
         return GOOD_CODE ;
     }
+
+    // 和其他连接的 Deliver 在 WebSocket 的同一把锁里判断是否还有数据要写，刚投递的消息不会因为这里注册了 EPOLLIN 而丢失唤醒
+    void rearmWebSocket_() {
+        webSocket_->Rearm([this](bool wantWrite) { epoller_->ModFd(fd_ , connEvent_ | (wantWrite ? EPOLLOUT : EPOLLIN)) ; }) ; 
+    }
+
+    // 房间的订阅、退订和发布；发布只推送给房间的订阅者（不包括自己），必须先加入房间
+    void dealTopicMessage_(WebSocket::Message &message) {
+        const HttpConfigInfo &config = HttpConfigInfo::Instance() ; 
+        const std::string &topic = message.topic ; 
+        bool joined = std::find(subscribed_.begin() , subscribed_.end() , topic) != subscribed_.end() ; 
+        if(name.empty() || topic.empty() || topic.size() > config.wsMaxTopicLength) {
+            replyTopic_("error" , topic , "invalid topic") ; 
+        }else if(message.type == WebSocket::SUBSCRIBE_MESSAGE) {
+            if(joined == false && subscribed_.size() >= config.wsMaxTopics) {
+                replyTopic_("error" , topic , "too many topics") ; return ; 
+            }
+            if(joined == false && topics_.Subscribe(topic , webSocket_)) subscribed_.push_back(topic) ; 
+            replyTopic_("subscribed" , topic , "") ; 
+        }else if(message.type == WebSocket::UNSUBSCRIBE_MESSAGE) {
+            if(joined) {
+                topics_.Unsubscribe(topic , webSocket_) ; 
+                subscribed_.erase(std::find(subscribed_.begin() , subscribed_.end() , topic)) ; 
+            }
+            replyTopic_("unsubscribed" , topic , "") ; 
+        }else if(joined == false) {
+            replyTopic_("error" , topic , "not subscribed") ; 
+        }else {
+            auto wakeup = [this](int fd) { epoller_->ModFd(fd , connEvent_ | EPOLLOUT) ; } ; 
+            topics_.Publish(topic , [&](const std::shared_ptr<WebSocket> &subscriber) {
+                if(subscriber != webSocket_) subscriber->Deliver(message , wakeup) ; 
+            }) ; 
+        }
+    }
+
+    // 在线列表的快照 {"isSystem":true,"type":"roster","version","message":[names]}，只发给本连接
+    void sendRoster_(uint64_t version , const std::vector<std::string> &names) {
+        picojson::object message_json ; 
+        message_json["isSystem"] = picojson::value(true) ; 
+        message_json["type"] = picojson::value(std::string("roster")) ; 
+        message_json["version"] = picojson::value(static_cast<double>(version)) ; 
+        std::vector<picojson::value> vecName(names.begin() , names.end()) ; 
+        message_json["message"] = picojson::value(vecName) ; 
+        WebSocket::Message roster ; 
+        roster.frame = WebSocket::MakeFrame(picojson::value(message_json).serialize()) ; 
+        roster.coalesce = WebSocket::COALESCE_ROSTER ; // 发送队列满时只保留最新的快照
+        webSocket_->makeWebSocketResponse(roster) ; 
+    }
+
+    // 回复给本连接的系统消息 {"isSystem":true,"type","topic"[,"message"]}
+    void replyTopic_(const char* type , const std::string &topic , const char* error) {
+        picojson::object message_json ; 
+        message_json["isSystem"] = picojson::value(true) ; 
+        message_json["type"] = picojson::value(std::string(type)) ; 
+        message_json["topic"] = picojson::value(topic) ; 
+        if(error[0] != '\0') message_json["message"] = picojson::value(std::string(error)) ; 
+        webSocket_->makeWebSocketResponse(WebSocket::MakeFrame(picojson::value(message_json).serialize())) ; 
+    }
 } ; 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,315 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <stdint.h>
+
+// HPACK 头部压缩（RFC 7541），HTTP/2 的头部都要经过它编解码
+typedef std::vector<std::pair<std::string , std::string>> HeaderList ; 
+
+class Hpack {
+public : 
+    struct HuffmanCode {
+        uint32_t code ; 
+        uint8_t bits ; 
+    };
+    // 附录 B 的静态 Huffman 编码表，下标就是字节值，最后一个是 EOS
+    static constexpr HuffmanCode HUFFMAN_CODE[257] = {
+        {0x1ff8,13} , {0x7fffd8,23} , {0xfffffe2,28} , {0xfffffe3,28} , {0xfffffe4,28} , {0xfffffe5,28} , {0xfffffe6,28} , {0xfffffe7,28} ,
+        {0xfffffe8,28} , {0xffffea,24} , {0x3ffffffc,30} , {0xfffffe9,28} , {0xfffffea,28} , {0x3ffffffd,30} , {0xfffffeb,28} , {0xfffffec,28} ,
+        {0xfffffed,28} , {0xfffffee,28} , {0xfffffef,28} , {0xffffff0,28} , {0xffffff1,28} , {0xffffff2,28} , {0x3ffffffe,30} , {0xffffff3,28} ,
+        {0xffffff4,28} , {0xffffff5,28} , {0xffffff6,28} , {0xffffff7,28} , {0xffffff8,28} , {0xffffff9,28} , {0xffffffa,28} , {0xffffffb,28} ,
+        {0x14,6} , {0x3f8,10} , {0x3f9,10} , {0xffa,12} , {0x1ff9,13} , {0x15,6} , {0xf8,8} , {0x7fa,11} ,
+        {0x3fa,10} , {0x3fb,10} , {0xf9,8} , {0x7fb,11} , {0xfa,8} , {0x16,6} , {0x17,6} , {0x18,6} ,
+        {0x0,5} , {0x1,5} , {0x2,5} , {0x19,6} , {0x1a,6} , {0x1b,6} , {0x1c,6} , {0x1d,6} ,
+        {0x1e,6} , {0x1f,6} , {0x5c,7} , {0xfb,8} , {0x7ffc,15} , {0x20,6} , {0xffb,12} , {0x3fc,10} ,
+        {0x1ffa,13} , {0x21,6} , {0x5d,7} , {0x5e,7} , {0x5f,7} , {0x60,7} , {0x61,7} , {0x62,7} ,
+        {0x63,7} , {0x64,7} , {0x65,7} , {0x66,7} , {0x67,7} , {0x68,7} , {0x69,7} , {0x6a,7} ,
+        {0x6b,7} , {0x6c,7} , {0x6d,7} , {0x6e,7} , {0x6f,7} , {0x70,7} , {0x71,7} , {0x72,7} ,
+        {0xfc,8} , {0x73,7} , {0xfd,8} , {0x1ffb,13} , {0x7fff0,19} , {0x1ffc,13} , {0x3ffc,14} , {0x22,6} ,
+        {0x7ffd,15} , {0x3,5} , {0x23,6} , {0x4,5} , {0x24,6} , {0x5,5} , {0x25,6} , {0x26,6} ,
+        {0x27,6} , {0x6,5} , {0x74,7} , {0x75,7} , {0x28,6} , {0x29,6} , {0x2a,6} , {0x7,5} ,
+        {0x2b,6} , {0x76,7} , {0x2c,6} , {0x8,5} , {0x9,5} , {0x2d,6} , {0x77,7} , {0x78,7} ,
+        {0x79,7} , {0x7a,7} , {0x7b,7} , {0x7ffe,15} , {0x7fc,11} , {0x3ffd,14} , {0x1ffd,13} , {0xffffffc,28} ,
+        {0xfffe6,20} , {0x3fffd2,22} , {0xfffe7,20} , {0xfffe8,20} , {0x3fffd3,22} , {0x3fffd4,22} , {0x3fffd5,22} , {0x7fffd9,23} ,
+        {0x3fffd6,22} , {0x7fffda,23} , {0x7fffdb,23} , {0x7fffdc,23} , {0x7fffdd,23} , {0x7fffde,23} , {0xffffeb,24} , {0x7fffdf,23} ,
+        {0xffffec,24} , {0xffffed,24} , {0x3fffd7,22} , {0x7fffe0,23} , {0xffffee,24} , {0x7fffe1,23} , {0x7fffe2,23} , {0x7fffe3,23} ,
+        {0x7fffe4,23} , {0x1fffdc,21} , {0x3fffd8,22} , {0x7fffe5,23} , {0x3fffd9,22} , {0x7fffe6,23} , {0x7fffe7,23} , {0xffffef,24} ,
+        {0x3fffda,22} , {0x1fffdd,21} , {0xfffe9,20} , {0x3fffdb,22} , {0x3fffdc,22} , {0x7fffe8,23} , {0x7fffe9,23} , {0x1fffde,21} ,
+        {0x7fffea,23} , {0x3fffdd,22} , {0x3fffde,22} , {0xfffff0,24} , {0x1fffdf,21} , {0x3fffdf,22} , {0x7fffeb,23} , {0x7fffec,23} ,
+        {0x1fffe0,21} , {0x1fffe1,21} , {0x3fffe0,22} , {0x1fffe2,21} , {0x7fffed,23} , {0x3fffe1,22} , {0x7fffee,23} , {0x7fffef,23} ,
+        {0xfffea,20} , {0x3fffe2,22} , {0x3fffe3,22} , {0x3fffe4,22} , {0x7ffff0,23} , {0x3fffe5,22} , {0x3fffe6,22} , {0x7ffff1,23} ,
+        {0x3ffffe0,26} , {0x3ffffe1,26} , {0xfffeb,20} , {0x7fff1,19} , {0x3fffe7,22} , {0x7ffff2,23} , {0x3fffe8,22} , {0x1ffffec,25} ,
+        {0x3ffffe2,26} , {0x3ffffe3,26} , {0x3ffffe4,26} , {0x7ffffde,27} , {0x7ffffdf,27} , {0x3ffffe5,26} , {0xfffff1,24} , {0x1ffffed,25} ,
+        {0x7fff2,19} , {0x1fffe3,21} , {0x3ffffe6,26} , {0x7ffffe0,27} , {0x7ffffe1,27} , {0x3ffffe7,26} , {0x7ffffe2,27} , {0xfffff2,24} ,
+        {0x1fffe4,21} , {0x1fffe5,21} , {0x3ffffe8,26} , {0x3ffffe9,26} , {0xffffffd,28} , {0x7ffffe3,27} , {0x7ffffe4,27} , {0x7ffffe5,27} ,
+        {0xfffec,20} , {0xfffff3,24} , {0xfffed,20} , {0x1fffe6,21} , {0x3fffe9,22} , {0x1fffe7,21} , {0x1fffe8,21} , {0x7ffff3,23} ,
+        {0x3fffea,22} , {0x3fffeb,22} , {0x1ffffee,25} , {0x1ffffef,25} , {0xfffff4,24} , {0xfffff5,24} , {0x3ffffea,26} , {0x7ffff4,23} ,
+        {0x3ffffeb,26} , {0x7ffffe6,27} , {0x3ffffec,26} , {0x3ffffed,26} , {0x7ffffe7,27} , {0x7ffffe8,27} , {0x7ffffe9,27} , {0x7ffffea,27} ,
+        {0x7ffffeb,27} , {0xffffffe,28} , {0x7ffffec,27} , {0x7ffffed,27} , {0x7ffffee,27} , {0x7ffffef,27} , {0x7fffff0,27} , {0x3ffffee,26} ,
+        {0x3fffffff,30} ,    // EOS
+    };
+
+    // 附录 A 的静态表，下标从 1 开始
+    static constexpr std::pair<std::string_view , std::string_view> STATIC_TABLE[] = {
+        {"" , ""} , 
+        {":authority" , ""} , {":method" , "GET"} , {":method" , "POST"} , {":path" , "/"} , 
+        {":path" , "/index.html"} , {":scheme" , "http"} , {":scheme" , "https"} , {":status" , "200"} , 
+        {":status" , "204"} , {":status" , "206"} , {":status" , "304"} , {":status" , "400"} , 
+        {":status" , "404"} , {":status" , "500"} , {"accept-charset" , ""} , {"accept-encoding" , "gzip, deflate"} , 
+        {"accept-language" , ""} , {"accept-ranges" , ""} , {"accept" , ""} , {"access-control-allow-origin" , ""} , 
+        {"age" , ""} , {"allow" , ""} , {"authorization" , ""} , {"cache-control" , ""} , 
+        {"content-disposition" , ""} , {"content-encoding" , ""} , {"content-language" , ""} , {"content-length" , ""} , 
+        {"content-location" , ""} , {"content-range" , ""} , {"content-type" , ""} , {"cookie" , ""} , 
+        {"date" , ""} , {"etag" , ""} , {"expect" , ""} , {"expires" , ""} , 
+        {"from" , ""} , {"host" , ""} , {"if-match" , ""} , {"if-modified-since" , ""} , 
+        {"if-none-match" , ""} , {"if-range" , ""} , {"if-unmodified-since" , ""} , {"last-modified" , ""} , 
+        {"link" , ""} , {"location" , ""} , {"max-forwards" , ""} , {"proxy-authenticate" , ""} , 
+        {"proxy-authorization" , ""} , {"range" , ""} , {"referer" , ""} , {"refresh" , ""} , 
+        {"retry-after" , ""} , {"server" , ""} , {"set-cookie" , ""} , {"strict-transport-security" , ""} , 
+        {"transfer-encoding" , ""} , {"user-agent" , ""} , {"vary" , ""} , {"via" , ""} , 
+        {"www-authenticate" , ""} , 
+    };
+    static constexpr size_t STATIC_TABLE_SIZE = sizeof(STATIC_TABLE) / sizeof(STATIC_TABLE[0]) - 1 ; 
+
+    // 整数编码：前缀占 prefix 位，首字节其余的高位由调用者给出
+    static void encodeInt(std::string &out , uint8_t first , int prefix , uint64_t value) {
+        const uint64_t mask = (1u << prefix) - 1 ; 
+        if(value < mask) {
+            out.push_back(static_cast<char>(first | value)) ; 
+            return ; 
+        }
+        out.push_back(static_cast<char>(first | mask)) ; 
+        value -= mask ; 
+        while(value >= 128) {
+            out.push_back(static_cast<char>((value & 0x7f) | 0x80)) ; 
+            value >>= 7 ; 
+        }
+        out.push_back(static_cast<char>(value)) ; 
+    }
+
+    static bool decodeInt(const uint8_t* &p , const uint8_t* end , int prefix , uint64_t &value) {
+        if(p >= end) return false ; 
+        const uint64_t mask = (1u << prefix) - 1 ; 
+        value = *p++ & mask ; 
+        if(value < mask) return true ; 
+        for(int shift = 0 ; p < end && shift <= 28 ; shift += 7) {
+            uint8_t b = *p++ ; 
+            value += static_cast<uint64_t>(b & 0x7f) << shift ; 
+            if((b & 0x80) == 0) return true ; 
+        }
+        return false ; // 数据不完整或者整数过大
+    }
+
+    // 字符串编码：Huffman 编码后更短才使用
+    static void encodeString(std::string &out , std::string_view str) {
+        size_t bits = 0 ; 
+        for(unsigned char ch : str) bits += HUFFMAN_CODE[ch].bits ; 
+        size_t huffmanLen = (bits + 7) / 8 ; 
+        if(huffmanLen >= str.size()) {
+            encodeInt(out , 0x00 , 7 , str.size()) ; 
+            out.append(str.data() , str.size()) ; 
+            return ; 
+        }
+        encodeInt(out , 0x80 , 7 , huffmanLen) ; 
+        uint64_t acc = 0 ; 
+        int accBits = 0 ; 
+        for(unsigned char ch : str) {
+            acc = (acc << HUFFMAN_CODE[ch].bits) | HUFFMAN_CODE[ch].code ; 
+            accBits += HUFFMAN_CODE[ch].bits ; 
+            while(accBits >= 8) {
+                accBits -= 8 ; 
+                out.push_back(static_cast<char>(acc >> accBits)) ; 
+            }
+        }
+        if(accBits > 0) { // 用 EOS 的高位（全 1）补齐最后一个字节
+            out.push_back(static_cast<char>((acc << (8 - accBits)) | (0xff >> accBits))) ; 
+        }
+    }
+
+    static bool decodeString(const uint8_t* &p , const uint8_t* end , std::string &str) {
+        if(p >= end) return false ; 
+        bool huffman = (*p & 0x80) != 0 ; 
+        uint64_t len = 0 ; 
+        if(decodeInt(p , end , 7 , len) == false || len > static_cast<uint64_t>(end - p)) return false ; 
+        str.clear() ; 
+        if(huffman == false) {
+            str.assign(reinterpret_cast<const char*>(p) , len) ; 
+        }else if(huffmanDecode(p , len , str) == false) {
+            return false ; 
+        }
+        p += len ; 
+        return true ; 
+    }
+
+    // 按位走 Huffman 解码树；结尾的填充必须少于 8 位并且全是 1 ，不能出现 EOS
+    static bool huffmanDecode(const uint8_t* data , size_t len , std::string &str) {
+        const HuffmanTree &tree = huffmanTree_() ; 
+        int node = 0 , padBits = 0 ; 
+        bool padOnes = true ; 
+        for(size_t i = 0 ; i < len ; ++i) {
+            for(int shift = 7 ; shift >= 0 ; --shift) {
+                int bit = (data[i] >> shift) & 1 ; 
+                node = tree.nodes[node].child[bit] ; 
+                if(node <= 0) return false ; 
+                ++padBits ; padOnes = padOnes && bit == 1 ; 
+                int symbol = tree.nodes[node].symbol ; 
+                if(symbol >= 0) {
+                    if(symbol == 256) return false ; 
+                    str.push_back(static_cast<char>(symbol)) ; 
+                    node = 0 ; padBits = 0 ; padOnes = true ; 
+                }
+            }
+        }
+        return padBits <= 7 && padOnes ; 
+    }
+
+private : 
+    struct HuffmanTree {
+        struct Node {
+            int16_t child[2] ;              // 0 表示没有孩子，根节点不会是孩子
+            int16_t symbol ;                // 叶子节点的字节值，-1 表示内部节点
+        };
+        Node nodes[513] ;                   // 257 个叶子的满二叉树
+        int16_t size ; 
+    };
+
+    static const HuffmanTree& huffmanTree_() {
+        static const HuffmanTree tree = [] {
+            HuffmanTree t ; 
+            t.size = 1 ; 
+            t.nodes[0] = {{0 , 0} , -1} ; 
+            for(int symbol = 0 ; symbol < 257 ; ++symbol) {
+                int node = 0 ; 
+                for(int shift = HUFFMAN_CODE[symbol].bits - 1 ; shift >= 0 ; --shift) {
+                    int bit = (HUFFMAN_CODE[symbol].code >> shift) & 1 ; 
+                    if(t.nodes[node].child[bit] == 0) {
+                        t.nodes[t.size] = {{0 , 0} , -1} ; 
+                        t.nodes[node].child[bit] = t.size++ ; 
+                    }
+                    node = t.nodes[node].child[bit] ; 
+                }
+                t.nodes[node].symbol = static_cast<int16_t>(symbol) ; 
+            }
+            return t ; 
+        }() ; 
+        return tree ; 
+    }
+} ; 
+
+// 解码器有状态：动态表在整个连接内共享，所以每个连接一个
+class HpackDecoder {
+public : 
+    explicit HpackDecoder(size_t maxTableSize = 4096) : maxTableSize_(maxTableSize) , tableLimit_(maxTableSize) , tableSize_(0) {
+
+    }
+
+    // 解码一个完整的头部块，出错说明连接的压缩状态已经不一致了，只能断开连接
+    bool decode(const uint8_t* data , size_t len , HeaderList &headers) {
+        const uint8_t* p = data ; 
+        const uint8_t* end = data + len ; 
+        std::string name , value ; 
+        while(p < end) {
+            uint8_t first = *p ; 
+            uint64_t index = 0 ; 
+            if(first & 0x80) { // 索引字段
+                if(Hpack::decodeInt(p , end , 7 , index) == false || lookup_(index , name , value) == false) return false ; 
+                headers.emplace_back(name , value) ; 
+                continue ; 
+            }
+            if((first & 0xe0) == 0x20) { // 动态表大小更新
+                if(Hpack::decodeInt(p , end , 5 , index) == false || index > maxTableSize_) return false ; 
+                tableLimit_ = index ; 
+                evict_(0) ; 
+                continue ; 
+            }
+            // 字面量字段：01 加入动态表，0000 不加入，0001 永不加入
+            bool indexing = (first & 0xc0) == 0x40 ; 
+            if(Hpack::decodeInt(p , end , indexing ? 6 : 4 , index) == false) return false ; 
+            if(index == 0) {
+                if(Hpack::decodeString(p , end , name) == false) return false ; 
+            }else if(lookup_(index , name , value) == false) {
+                return false ; 
+            }
+            if(Hpack::decodeString(p , end , value) == false) return false ; 
+            if(indexing) insert_(name , value) ; 
+            headers.emplace_back(name , value) ; 
+        }
+        return true ; 
+    }
+
+    size_t tableSize() const {
+        return tableSize_ ; 
+    }
+
+private : 
+    static size_t entrySize_(const std::string &name , const std::string &value) {
+        return name.size() + value.size() + 32 ; 
+    }
+
+    bool lookup_(uint64_t index , std::string &name , std::string &value) const {
+        if(index == 0) return false ; 
+        if(index <= Hpack::STATIC_TABLE_SIZE) {
+            name = Hpack::STATIC_TABLE[index].first ; 
+            value = Hpack::STATIC_TABLE[index].second ; 
+            return true ; 
+        }
+        index -= Hpack::STATIC_TABLE_SIZE + 1 ; 
+        if(index >= table_.size()) return false ; 
+        name = table_[index].first ; 
+        value = table_[index].second ; 
+        return true ; 
+    }
+
+    void insert_(const std::string &name , const std::string &value) {
+        size_t size = entrySize_(name , value) ; 
+        evict_(size) ; 
+        if(size > tableLimit_) return ; // 比整个表还大，按规范清空表且不插入
+        table_.emplace_front(name , value) ; 
+        tableSize_ += size ; 
+    }
+
+    // 淘汰最旧的条目，直到还能放下 need 字节
+    void evict_(size_t need) {
+        while(!table_.empty() && tableSize_ + need > tableLimit_) {
+            tableSize_ -= entrySize_(table_.back().first , table_.back().second) ; 
+            table_.pop_back() ; 
+        }
+    }
+
+    const size_t maxTableSize_ ;            // SETTINGS_HEADER_TABLE_SIZE ，对端的大小更新不能超过它
+    size_t tableLimit_ ; 
+    size_t tableSize_ ; 
+    std::deque<HeaderList::value_type> table_ ; 
+} ; 
+
+// 编码器只用静态表和字面量，不维护动态表，因此是无状态的，所有流共用
+class HpackEncoder {
+public : 
+    static void encode(const HeaderList &headers , std::string &out) {
+        for(const auto &header : headers) {
+            size_t nameIndex = 0 ; 
+            for(size_t i = 1 ; i <= Hpack::STATIC_TABLE_SIZE ; ++i) {
+                if(Hpack::STATIC_TABLE[i].first != header.first) continue ; 
+                if(Hpack::STATIC_TABLE[i].second == header.second) { // 名字和值都命中，直接发索引
+                    nameIndex = i ; 
+                    break ; 
+                }
+                if(nameIndex == 0) nameIndex = i ; 
+            }
+            if(nameIndex != 0 && Hpack::STATIC_TABLE[nameIndex].second == header.second && !header.second.empty()) {
+                Hpack::encodeInt(out , 0x80 , 7 , nameIndex) ; 
+                continue ; 
+            }
+            // 不加入动态表的字面量
+            Hpack::encodeInt(out , 0x00 , 4 , nameIndex) ; 
+            if(nameIndex == 0) Hpack::encodeString(out , header.first) ; 
+            Hpack::encodeString(out , header.second) ; 
+        }
+    }
+} ; 
+
+#endif
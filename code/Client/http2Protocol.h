@@ -0,0 +1,674 @@
+#ifndef HTTP2_PROTOCOL_H
+#define HTTP2_PROTOCOL_H
+
+#include <string>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include "../Buffer/buffer.h"
+#include "../Log/log.h"
+#include "../Common/commonConfig.h"
+#include "./httpProtocol.h"
+#include "./hpack.h"
+#include "./base64.h"
+#include "../Tls/transport.h"
+
+// HTTP/2 明文（h2c）连接，支持 prior knowledge 和 Upgrade: h2c 两种方式建立
+// 每个流的请求翻译成 HTTP/1.1 报文交给独立的 HttpProtocol 处理，与 HTTP/1.1 共用路由和静态文件的全部逻辑；
+// 响应报文再拆成 HEADERS + DATA 帧，各个流按流控窗口轮流发送，一个大文件不会阻塞同一连接上的其他请求
+class Http2Protocol {
+private :
+    enum FRAME_TYPE {
+        FRAME_DATA = 0x0 , FRAME_HEADERS = 0x1 , FRAME_PRIORITY = 0x2 , FRAME_RST_STREAM = 0x3 ,
+        FRAME_SETTINGS = 0x4 , FRAME_PUSH_PROMISE = 0x5 , FRAME_PING = 0x6 , FRAME_GOAWAY = 0x7 ,
+        FRAME_WINDOW_UPDATE = 0x8 , FRAME_CONTINUATION = 0x9 ,
+    };
+    enum FRAME_FLAG {
+        FLAG_END_STREAM = 0x1 , FLAG_ACK = 0x1 , FLAG_END_HEADERS = 0x4 , FLAG_PADDED = 0x8 , FLAG_PRIORITY = 0x20 ,
+    };
+    enum SETTINGS_ID {
+        SETTINGS_HEADER_TABLE_SIZE = 0x1 , SETTINGS_ENABLE_PUSH = 0x2 , SETTINGS_MAX_CONCURRENT_STREAMS = 0x3 ,
+        SETTINGS_INITIAL_WINDOW_SIZE = 0x4 , SETTINGS_MAX_FRAME_SIZE = 0x5 , SETTINGS_MAX_HEADER_LIST_SIZE = 0x6 ,
+    };
+    enum ERROR_CODE {
+        H2_NO_ERROR = 0x0 , H2_PROTOCOL_ERROR = 0x1 , H2_INTERNAL_ERROR = 0x2 , H2_FLOW_CONTROL_ERROR = 0x3 ,
+        H2_STREAM_CLOSED = 0x5 , H2_FRAME_SIZE_ERROR = 0x6 , H2_REFUSED_STREAM = 0x7 , H2_CANCEL = 0x8 ,
+        H2_COMPRESSION_ERROR = 0x9 , H2_ENHANCE_YOUR_CALM = 0xb ,
+    };
+    enum SEND_STATE {
+        SEND_PROGRESS ,                     // 发出了一帧
+        SEND_BLOCKED ,                      // 流控窗口用完了，等待 WINDOW_UPDATE
+        SEND_FINISH ,                       // 响应发送完成，流关闭
+        SEND_FAILED ,                       // 读取响应出错，重置流
+    };
+    static constexpr size_t FRAME_HEADER_LEN = 9 ;
+    static constexpr uint32_t DEFAULT_FRAME_SIZE = 16384 ; // 我们不调大 SETTINGS_MAX_FRAME_SIZE ，收到的帧不能超过它
+    static constexpr int64_t DEFAULT_WINDOW_SIZE = 65535 ;
+    static constexpr int64_t MAX_WINDOW_SIZE = 0x7fffffff ;
+
+    struct Stream {
+        uint32_t id ;
+        bool is_Responding ;                // 请求已经收完（half closed remote），HttpProtocol 已经生成了响应
+        bool is_HeadersSent ;
+        HeaderList headers ;
+        std::string body ;                  // 请求 body
+        int64_t sendWindow ;
+        int64_t recvWindow ;
+        std::string pending ;               // 从 HttpProtocol 取出来还没有发送的响应内容
+        Buffer readBuff ;                   // 翻译后的 HTTP/1.1 请求
+        Buffer writeBuff ;                  // HttpProtocol 生成的响应
+        HttpProtocol http ;
+        Stream(uint32_t streamId , int64_t window , int64_t recv) : id(streamId) , is_Responding(false) , is_HeadersSent(false) ,
+               sendWindow(window) , recvWindow(recv) , http(nullptr , 0 , &readBuff , &writeBuff) {
+            http.init() ;
+        }
+    };
+
+    int fd_ ;
+    Transport* transport_ ;                 // 连接的读写通道（明文或 TLS）
+    int is_ET_ ;
+    Buffer* readBuff_ ;                     // 读缓冲区，与 ClientConn 共用
+    Buffer* writeBuff_ ;                    // 写缓冲区，与 ClientConn 共用
+    const HttpConfigInfo* http_config_ ;
+    HpackDecoder decoder_ ;
+    std::map<uint32_t , std::unique_ptr<Stream>> streams_ ; // 按流 id 排序，发送时依次轮转
+    bool is_PrefaceReceived_ ;
+    bool is_GoAway_ ;                       // 我们发出了 GOAWAY ，不再处理新的帧
+    bool is_PeerGoAway_ ;                   // 对端发出了 GOAWAY ，发完现有的响应就关闭连接
+    uint32_t lastStreamId_ ;                // 对端创建的最大流 id
+    uint32_t headerStreamId_ ;              // 正在接收 CONTINUATION 的流，0 表示没有
+    uint8_t headerFlags_ ;                  // 头部块第一帧 HEADERS 的标志位
+    std::string headerBlock_ ;              // 拼接 HEADERS + CONTINUATION 的头部块
+    int64_t connSendWindow_ ;
+    int64_t connRecvWindow_ ;
+    int64_t peerInitialWindow_ ;            // 对端 SETTINGS_INITIAL_WINDOW_SIZE ，新流的发送窗口
+    uint32_t peerMaxFrameSize_ ;            // 对端 SETTINGS_MAX_FRAME_SIZE ，发出的帧不能超过它
+
+public :
+    Http2Protocol(Transport* transport , const int isET , Buffer* read , Buffer* write) : fd_(transport->GetFd()) , transport_(transport) , is_ET_(isET) , readBuff_(read) , writeBuff_(write) ,
+        http_config_(&HttpConfigInfo::Instance()) , decoder_(4096) {
+        init() ;
+    }
+
+    void init() {
+        streams_.clear() ;
+        is_PrefaceReceived_ = false ; is_GoAway_ = false ; is_PeerGoAway_ = false ;
+        lastStreamId_ = 0 ; headerStreamId_ = 0 ; headerFlags_ = 0 ; headerBlock_.clear() ;
+        connSendWindow_ = DEFAULT_WINDOW_SIZE ;
+        connRecvWindow_ = DEFAULT_WINDOW_SIZE ;
+        peerInitialWindow_ = DEFAULT_WINDOW_SIZE ;
+        peerMaxFrameSize_ = DEFAULT_FRAME_SIZE ;
+    }
+
+    void close() {
+        streams_.clear() ; // 流的析构会关闭各自打开的文件
+    }
+
+    // prior knowledge ：读缓冲区里就是连接前言，服务端先发送自己的 SETTINGS
+    void start() {
+        sendPreface_() ;
+    }
+
+    // Upgrade: h2c ：先回 101 ，再把这个 HTTP/1.1 请求当作流 1 来响应
+    bool upgrade(const HttpProtocol &http) {
+        const auto &header = http.GetHeaders() ;
+        auto settings = header.find("HTTP2-Settings") ;
+        if(settings == header.end()) return false ;
+        // HTTP2-Settings 是 base64url 编码、不带填充的 SETTINGS 帧负载
+        std::string encoded = settings->second ;
+        std::replace(encoded.begin() , encoded.end() , '-' , '+') ;
+        std::replace(encoded.begin() , encoded.end() , '_' , '/') ;
+        while(encoded.size() % 4 != 0) encoded.push_back('=') ;
+        std::string payload = base64_decode(encoded) ;
+
+        writeBuff_->Append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n") ;
+        sendPreface_() ;
+        if(payload.size() % 6 != 0 || applySettings_(reinterpret_cast<const uint8_t*>(payload.data()) , payload.size()) == false) {
+            return false ;
+        }
+        std::unique_ptr<Stream> stream = std::make_unique<Stream>(1 , peerInitialWindow_ , http_config_->h2InitialWindowSize) ;
+        std::string path = http.GetPath() ;
+        if(!http.GetQuery().empty()) path += "?" + http.GetQuery() ;
+        stream->headers.emplace_back(":method" , http.GetMethod()) ;
+        stream->headers.emplace_back(":path" , path) ;
+        stream->headers.emplace_back(":scheme" , "http") ;
+        for(const auto &iter : header) {
+            std::string name = iter.first ;
+            std::transform(name.begin() , name.end() , name.begin() , ::tolower) ;
+            if(name == "host") name = ":authority" ;
+            if(name == "http2-settings" || isConnectionHeader_(name)) continue ;
+            if(name == ":authority") stream->headers.emplace(stream->headers.begin() , name , iter.second) ;
+            else stream->headers.emplace_back(name , iter.second) ;
+        }
+        lastStreamId_ = 1 ;
+        Stream &ref = *stream ;
+        streams_[1] = std::move(stream) ;
+        startStream_(ref) ;
+        return true ;
+    }
+
+    STATUS_CODE dealHttp2Request(const int needRead = true) {
+        if(needRead == true) {
+            int Errno = -1;
+            ssize_t len = -1;
+            do {
+                len = transport_->Read(readBuff_ , &Errno);
+                if (len <= 0) {
+                    if(Errno == EWOULDBLOCK ){// 读完了，跳出
+                        break ;
+                    }else if(Errno == EINTR) {// 被中断了，继续读
+                        continue;
+                    }else { // 对端关闭，或者 read 出错了
+                        LOG_ERROR("dealHttp2Request %d client already close or read Error!" , fd_) ;
+                        return CLOSE_CONNECTION ;
+                    }
+                }
+            }while (is_ET_) ;
+        }
+        if(processFrames_() == false) {
+            LOG_ERROR("server deal parse http2 frame error !!") ;
+        }
+        pump_() ;
+        return GOOD_CODE ;
+    }
+
+    // 返回 CONTINUE_CODE 表示还有数据要写，GOOD_CODE 表示暂时写完了，等待新的请求或者 WINDOW_UPDATE
+    STATUS_CODE dealHttp2Response() {
+        do {
+            if(writeBuff_->BufferUsedSize() == 0) {
+                writeBuff_->clear() ;
+                pump_() ;
+                if(writeBuff_->BufferUsedSize() == 0) break ;
+            }
+            ssize_t len = transport_->Write(writeBuff_->BufferStart() , writeBuff_->BufferUsedSize()) ;
+            if(len < 0) {
+                if(errno == EWOULDBLOCK) {// fd_缓冲区满了，等待下一次 EPOLLOUT 继续写
+                    return CONTINUE_CODE ;
+                }else if(errno == EINTR) {
+                    continue ;
+                }else { // 对端关闭,再写就会触发 SIGPIPE 信号 ，或者 Write 出错了
+                    LOG_ERROR("Write FD Error") ;
+                    return CLOSE_CONNECTION ;
+                }
+            }
+            writeBuff_->Retrieve(len) ;
+        }while(is_ET_) ;
+        if(writeBuff_->BufferUsedSize() == 0) pump_() ;
+        // LT 模式下只写一次，没写完的等下一次 EPOLLOUT 继续写
+        if(writeBuff_->BufferUsedSize() > 0) return CONTINUE_CODE ;
+        if(isFinished_()) return CLOSE_CONNECTION ; // GOAWAY 之后，现有的响应都发完了
+        return GOOD_CODE ;
+    }
+
+    bool WantWrite() const {
+        return writeBuff_->BufferUsedSize() > 0 ;
+    }
+
+private :
+    void sendPreface_() {
+        const HttpConfigInfo &config = *http_config_ ;
+        std::string payload ;
+        appendSetting_(payload , SETTINGS_MAX_CONCURRENT_STREAMS , config.h2MaxConcurrentStreams) ;
+        appendSetting_(payload , SETTINGS_INITIAL_WINDOW_SIZE , config.h2InitialWindowSize) ;
+        appendSetting_(payload , SETTINGS_MAX_HEADER_LIST_SIZE , config.h2MaxHeaderBlock) ;
+        writeFrame_(FRAME_SETTINGS , 0 , 0 , payload.data() , payload.size()) ;
+        // 连接级接收窗口没有对应的 SETTINGS ，只能用 WINDOW_UPDATE 扩大
+        if(config.h2InitialWindowSize > DEFAULT_WINDOW_SIZE) {
+            writeWindowUpdate_(0 , config.h2InitialWindowSize - DEFAULT_WINDOW_SIZE) ;
+            connRecvWindow_ = config.h2InitialWindowSize ;
+        }
+    }
+
+    static void appendSetting_(std::string &payload , uint16_t id , uint32_t value) {
+        char buf[6] = { static_cast<char>(id >> 8) , static_cast<char>(id) , static_cast<char>(value >> 24) ,
+                        static_cast<char>(value >> 16) , static_cast<char>(value >> 8) , static_cast<char>(value) } ;
+        payload.append(buf , 6) ;
+    }
+
+    static uint32_t readUint32_(const uint8_t* p) {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 8) | p[3] ;
+    }
+
+    void writeFrameHeader_(uint8_t type , uint8_t flags , uint32_t streamId , size_t len) {
+        char head[FRAME_HEADER_LEN] = {
+            static_cast<char>(len >> 16) , static_cast<char>(len >> 8) , static_cast<char>(len) ,
+            static_cast<char>(type) , static_cast<char>(flags) ,
+            static_cast<char>((streamId >> 24) & 0x7f) , static_cast<char>(streamId >> 16) ,
+            static_cast<char>(streamId >> 8) , static_cast<char>(streamId) } ;
+        writeBuff_->Append(head , FRAME_HEADER_LEN) ;
+    }
+
+    void writeFrame_(uint8_t type , uint8_t flags , uint32_t streamId , const char* payload , size_t len) {
+        writeFrameHeader_(type , flags , streamId , len) ;
+        if(len > 0) writeBuff_->Append(payload , len) ;
+    }
+
+    void writeUint32Frame_(uint8_t type , uint32_t streamId , uint32_t value) {
+        char buf[4] = { static_cast<char>(value >> 24) , static_cast<char>(value >> 16) , static_cast<char>(value >> 8) , static_cast<char>(value) } ;
+        writeFrame_(type , 0 , streamId , buf , 4) ;
+    }
+
+    void writeWindowUpdate_(uint32_t streamId , uint32_t increment) {
+        writeUint32Frame_(FRAME_WINDOW_UPDATE , streamId , increment) ;
+    }
+
+    // 连接错误：发送 GOAWAY ，丢弃所有流，写完之后关闭连接
+    bool connectionError_(ERROR_CODE code , const char* reason) {
+        LOG_ERROR("http2 connection %d error %d : %s" , fd_ , code , reason) ;
+        char buf[8] = { static_cast<char>((lastStreamId_ >> 24) & 0x7f) , static_cast<char>(lastStreamId_ >> 16) ,
+                        static_cast<char>(lastStreamId_ >> 8) , static_cast<char>(lastStreamId_) ,
+                        0 , 0 , 0 , static_cast<char>(code) } ;
+        writeFrame_(FRAME_GOAWAY , 0 , 0 , buf , 8) ;
+        is_GoAway_ = true ;
+        streams_.clear() ;
+        return false ;
+    }
+
+    // 流错误：只重置这一个流，连接继续使用
+    void streamError_(uint32_t streamId , ERROR_CODE code) {
+        LOG_WARN("http2 connection %d reset stream %u error %d" , fd_ , streamId , code) ;
+        writeUint32Frame_(FRAME_RST_STREAM , streamId , code) ;
+        streams_.erase(streamId) ;
+    }
+
+    bool isFinished_() const {
+        if(is_GoAway_ == false && is_PeerGoAway_ == false) return false ;
+        for(const auto &iter : streams_) {
+            if(iter.second->is_Responding) return false ;
+        }
+        return true ;
+    }
+
+    // 解析读缓冲区中所有完整的帧，不完整的留到下一次
+    bool processFrames_() {
+        if(is_PrefaceReceived_ == false) {
+            static const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" ;
+            const size_t prefaceLen = sizeof(PREFACE) - 1 ;
+            size_t len = std::min(readBuff_->BufferUsedSize() , prefaceLen) ;
+            if(memcmp(readBuff_->BufferStart() , PREFACE , len) != 0) return connectionError_(H2_PROTOCOL_ERROR , "bad preface") ;
+            if(len < prefaceLen) return true ;
+            readBuff_->Retrieve(prefaceLen) ;
+            is_PrefaceReceived_ = true ;
+        }
+        while(is_GoAway_ == false && readBuff_->BufferUsedSize() >= FRAME_HEADER_LEN) {
+            const uint8_t* head = reinterpret_cast<const uint8_t*>(readBuff_->BufferStart()) ;
+            size_t len = (static_cast<size_t>(head[0]) << 16) | (static_cast<size_t>(head[1]) << 8) | head[2] ;
+            if(len > DEFAULT_FRAME_SIZE) return connectionError_(H2_FRAME_SIZE_ERROR , "frame too large") ;
+            if(readBuff_->BufferUsedSize() < FRAME_HEADER_LEN + len) break ;
+            uint8_t type = head[3] , flags = head[4] ;
+            uint32_t streamId = readUint32_(head + 5) & 0x7fffffff ;
+            bool ok = handleFrame_(type , flags , streamId , head + FRAME_HEADER_LEN , len) ;
+            readBuff_->Retrieve(FRAME_HEADER_LEN + len) ;
+            if(ok == false) return false ;
+        }
+        return true ;
+    }
+
+    bool handleFrame_(uint8_t type , uint8_t flags , uint32_t streamId , const uint8_t* payload , size_t len) {
+        // 头部块必须连续，中间不能插入其他帧
+        if(headerStreamId_ != 0 && (type != FRAME_CONTINUATION || streamId != headerStreamId_)) {
+            return connectionError_(H2_PROTOCOL_ERROR , "expect CONTINUATION") ;
+        }
+        switch (type)
+        {
+        case FRAME_DATA :
+            return handleData_(flags , streamId , payload , len) ;
+        case FRAME_HEADERS :
+            return handleHeaders_(flags , streamId , payload , len) ;
+        case FRAME_CONTINUATION :
+            if(headerStreamId_ == 0) return connectionError_(H2_PROTOCOL_ERROR , "unexpected CONTINUATION") ;
+            return appendHeaderBlock_(flags , payload , len) ;
+        case FRAME_PRIORITY :
+            if(streamId == 0) return connectionError_(H2_PROTOCOL_ERROR , "PRIORITY on stream 0") ;
+            if(len != 5) streamError_(streamId , H2_FRAME_SIZE_ERROR) ;
+            return true ; // 不支持优先级，按流 id 轮流发送
+        case FRAME_RST_STREAM :
+            if(streamId == 0 || streamId > lastStreamId_) return connectionError_(H2_PROTOCOL_ERROR , "RST_STREAM on idle stream") ;
+            if(len != 4) return connectionError_(H2_FRAME_SIZE_ERROR , "bad RST_STREAM") ;
+            streams_.erase(streamId) ;
+            return true ;
+        case FRAME_SETTINGS :
+            if(streamId != 0) return connectionError_(H2_PROTOCOL_ERROR , "SETTINGS on stream") ;
+            if(flags & FLAG_ACK) {
+                return len == 0 ? true : connectionError_(H2_FRAME_SIZE_ERROR , "SETTINGS ACK with payload") ;
+            }
+            if(len % 6 != 0) return connectionError_(H2_FRAME_SIZE_ERROR , "bad SETTINGS") ;
+            if(applySettings_(payload , len) == false) return false ;
+            writeFrame_(FRAME_SETTINGS , FLAG_ACK , 0 , nullptr , 0) ;
+            return true ;
+        case FRAME_PING :
+            if(streamId != 0) return connectionError_(H2_PROTOCOL_ERROR , "PING on stream") ;
+            if(len != 8) return connectionError_(H2_FRAME_SIZE_ERROR , "bad PING") ;
+            if((flags & FLAG_ACK) == 0) writeFrame_(FRAME_PING , FLAG_ACK , 0 , reinterpret_cast<const char*>(payload) , 8) ;
+            return true ;
+        case FRAME_GOAWAY :
+            if(streamId != 0) return connectionError_(H2_PROTOCOL_ERROR , "GOAWAY on stream") ;
+            is_PeerGoAway_ = true ;
+            return true ;
+        case FRAME_WINDOW_UPDATE :
+            return handleWindowUpdate_(streamId , payload , len) ;
+        case FRAME_PUSH_PROMISE : // 客户端不能推送
+            return connectionError_(H2_PROTOCOL_ERROR , "PUSH_PROMISE from client") ;
+        default : // 未知类型的帧直接忽略
+            return true ;
+        }
+    }
+
+    bool applySettings_(const uint8_t* payload , size_t len) {
+        for(size_t i = 0 ; i + 6 <= len ; i += 6) {
+            uint16_t id = (static_cast<uint16_t>(payload[i]) << 8) | payload[i + 1] ;
+            uint32_t value = readUint32_(payload + i + 2) ;
+            if(id == SETTINGS_ENABLE_PUSH && value > 1) {
+                return connectionError_(H2_PROTOCOL_ERROR , "bad ENABLE_PUSH") ;
+            }else if(id == SETTINGS_INITIAL_WINDOW_SIZE) {
+                if(value > MAX_WINDOW_SIZE) return connectionError_(H2_FLOW_CONTROL_ERROR , "bad INITIAL_WINDOW_SIZE") ;
+                // 初始窗口的变化要作用到所有已经打开的流上
+                int64_t delta = static_cast<int64_t>(value) - peerInitialWindow_ ;
+                for(auto &iter : streams_) {
+                    iter.second->sendWindow += delta ;
+                    if(iter.second->sendWindow > MAX_WINDOW_SIZE) return connectionError_(H2_FLOW_CONTROL_ERROR , "window overflow") ;
+                }
+                peerInitialWindow_ = value ;
+            }else if(id == SETTINGS_MAX_FRAME_SIZE) {
+                if(value < DEFAULT_FRAME_SIZE || value > 16777215) return connectionError_(H2_PROTOCOL_ERROR , "bad MAX_FRAME_SIZE") ;
+                peerMaxFrameSize_ = value ;
+            }
+            // HEADER_TABLE_SIZE 约束的是我们的编码器动态表，编码器不使用动态表，可以忽略；其他未知的设置也忽略
+        }
+        return true ;
+    }
+
+    bool handleWindowUpdate_(uint32_t streamId , const uint8_t* payload , size_t len) {
+        if(len != 4) return connectionError_(H2_FRAME_SIZE_ERROR , "bad WINDOW_UPDATE") ;
+        uint32_t increment = readUint32_(payload) & 0x7fffffff ;
+        if(streamId == 0) {
+            if(increment == 0) return connectionError_(H2_PROTOCOL_ERROR , "zero WINDOW_UPDATE") ;
+            connSendWindow_ += increment ;
+            if(connSendWindow_ > MAX_WINDOW_SIZE) return connectionError_(H2_FLOW_CONTROL_ERROR , "window overflow") ;
+            return true ;
+        }
+        auto iter = streams_.find(streamId) ;
+        if(iter == streams_.end()) { // 流已经关闭了，对端可能还没收到 END_STREAM
+            if(streamId > lastStreamId_) return connectionError_(H2_PROTOCOL_ERROR , "WINDOW_UPDATE on idle stream") ;
+            return true ;
+        }
+        if(increment == 0) {
+            streamError_(streamId , H2_PROTOCOL_ERROR) ;
+            return true ;
+        }
+        iter->second->sendWindow += increment ;
+        if(iter->second->sendWindow > MAX_WINDOW_SIZE) streamError_(streamId , H2_FLOW_CONTROL_ERROR) ;
+        return true ;
+    }
+
+    // 去掉 PADDED 填充，返回 false 表示填充长度非法
+    static bool stripPadding_(uint8_t flags , const uint8_t* &payload , size_t &len) {
+        if((flags & FLAG_PADDED) == 0) return true ;
+        if(len < 1) return false ;
+        size_t padLen = payload[0] ;
+        if(padLen >= len) return false ;
+        payload += 1 ;
+        len -= 1 + padLen ;
+        return true ;
+    }
+
+    bool handleData_(uint8_t flags , uint32_t streamId , const uint8_t* payload , size_t len) {
+        if(streamId == 0) return connectionError_(H2_PROTOCOL_ERROR , "DATA on stream 0") ;
+        // 流控按整个帧负载计算，包括填充
+        connRecvWindow_ -= len ;
+        if(connRecvWindow_ < 0) return connectionError_(H2_FLOW_CONTROL_ERROR , "connection window exceeded") ;
+        if(connRecvWindow_ < http_config_->h2InitialWindowSize / 2) {
+            writeWindowUpdate_(0 , http_config_->h2InitialWindowSize - connRecvWindow_) ;
+            connRecvWindow_ = http_config_->h2InitialWindowSize ;
+        }
+        size_t frameLen = len ;
+        if(stripPadding_(flags , payload , len) == false) return connectionError_(H2_PROTOCOL_ERROR , "bad DATA padding") ;
+        auto iter = streams_.find(streamId) ;
+        if(iter == streams_.end() || iter->second->is_Responding) {
+            if(streamId > lastStreamId_) return connectionError_(H2_PROTOCOL_ERROR , "DATA on idle stream") ;
+            streamError_(streamId , H2_STREAM_CLOSED) ;
+            return true ;
+        }
+        Stream &stream = *iter->second ;
+        stream.recvWindow -= frameLen ;
+        if(stream.recvWindow < 0) {
+            streamError_(streamId , H2_FLOW_CONTROL_ERROR) ;
+            return true ;
+        }
+        if(stream.body.size() + len > http_config_->h2MaxRequestBody) {
+            streamError_(streamId , H2_ENHANCE_YOUR_CALM) ;
+            return true ;
+        }
+        stream.body.append(reinterpret_cast<const char*>(payload) , len) ;
+        if(flags & FLAG_END_STREAM) {
+            startStream_(stream) ;
+        }else if(stream.recvWindow < http_config_->h2InitialWindowSize / 2) {
+            writeWindowUpdate_(streamId , http_config_->h2InitialWindowSize - stream.recvWindow) ;
+            stream.recvWindow = http_config_->h2InitialWindowSize ;
+        }
+        return true ;
+    }
+
+    bool handleHeaders_(uint8_t flags , uint32_t streamId , const uint8_t* payload , size_t len) {
+        if(streamId == 0 || (streamId & 1) == 0) return connectionError_(H2_PROTOCOL_ERROR , "bad HEADERS stream id") ;
+        if(stripPadding_(flags , payload , len) == false) return connectionError_(H2_PROTOCOL_ERROR , "bad HEADERS padding") ;
+        if(flags & FLAG_PRIORITY) {
+            if(len < 5) return connectionError_(H2_FRAME_SIZE_ERROR , "bad HEADERS priority") ;
+            payload += 5 ; len -= 5 ;
+        }
+        if(streamId <= lastStreamId_) {
+            auto iter = streams_.find(streamId) ;
+            // 已经关闭的流，或者请求已经收完还发来 HEADERS
+            if(iter == streams_.end() || iter->second->is_Responding) return connectionError_(H2_STREAM_CLOSED , "HEADERS on closed stream") ;
+        }
+        headerStreamId_ = streamId ;
+        headerFlags_ = flags ;
+        headerBlock_.clear() ;
+        return appendHeaderBlock_(flags , payload , len) ;
+    }
+
+    bool appendHeaderBlock_(uint8_t flags , const uint8_t* payload , size_t len) {
+        headerBlock_.append(reinterpret_cast<const char*>(payload) , len) ;
+        if(headerBlock_.size() > http_config_->h2MaxHeaderBlock) return connectionError_(H2_ENHANCE_YOUR_CALM , "header block too large") ;
+        if((flags & FLAG_END_HEADERS) == 0) return true ;
+
+        uint32_t streamId = headerStreamId_ ;
+        headerStreamId_ = 0 ;
+        // 不管流是否被拒绝都要解码，否则动态表就和对端不一致了
+        HeaderList headers ;
+        if(decoder_.decode(reinterpret_cast<const uint8_t*>(headerBlock_.data()) , headerBlock_.size() , headers) == false) {
+            return connectionError_(H2_COMPRESSION_ERROR , "hpack decode error") ;
+        }
+        headerBlock_.clear() ;
+        bool endStream = (headerFlags_ & FLAG_END_STREAM) != 0 ;
+
+        auto iter = streams_.find(streamId) ;
+        if(iter != streams_.end()) { // 请求尾部的 trailers ，必须结束流，内容忽略
+            if(endStream == false) {
+                streamError_(streamId , H2_PROTOCOL_ERROR) ;
+                return true ;
+            }
+            startStream_(*iter->second) ;
+            return true ;
+        }
+        lastStreamId_ = streamId ;
+        if(is_PeerGoAway_ || streams_.size() >= http_config_->h2MaxConcurrentStreams) {
+            streamError_(streamId , H2_REFUSED_STREAM) ;
+            return true ;
+        }
+        std::unique_ptr<Stream> stream = std::make_unique<Stream>(streamId , peerInitialWindow_ , http_config_->h2InitialWindowSize) ;
+        stream->headers = std::move(headers) ;
+        Stream &ref = *stream ;
+        streams_[streamId] = std::move(stream) ;
+        if(endStream) startStream_(ref) ;
+        return true ;
+    }
+
+    static bool isConnectionHeader_(const std::string &name) {
+        return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+               name == "transfer-encoding" || name == "upgrade" ;
+    }
+
+    // accept-encoding -> Accept-Encoding ，HttpProtocol 按 HTTP/1.1 的写法查找头部
+    static std::string canonicalName_(const std::string &name) {
+        std::string result(name) ;
+        bool upper = true ;
+        for(char &ch : result) {
+            if(upper && ch >= 'a' && ch <= 'z') ch = ch - 'a' + 'A' ;
+            upper = ch == '-' ;
+        }
+        return result ;
+    }
+
+    // 请求收完了：翻译成 HTTP/1.1 报文交给 HttpProtocol ，生成的响应在 pump_ 中分帧发送
+    void startStream_(Stream &stream) {
+        std::string method , path , authority , cookie , lines ;
+        bool regular = false , malformed = false , hasLength = false ;
+        for(const auto &header : stream.headers) {
+            const std::string &name = header.first , &value = header.second ;
+            if(!name.empty() && name[0] == ':') {
+                if(regular) malformed = true ; // 伪头部必须在普通头部之前
+                if(name == ":method") method = value ;
+                else if(name == ":path") path = value ;
+                else if(name == ":authority") authority = value ;
+                else if(name != ":scheme") malformed = true ;
+                continue ;
+            }
+            regular = true ;
+            if(std::any_of(name.begin() , name.end() , [](char ch) { return ch >= 'A' && ch <= 'Z' ; }) ||
+               isConnectionHeader_(name) || (name == "te" && value != "trailers")) {
+                malformed = true ;
+            }else if(name == "cookie") { // HTTP/2 中 cookie 可以拆成多个头部，HTTP/1.1 要合并成一个
+                cookie += cookie.empty() ? value : "; " + value ;
+            }else if(name != "host" && name != "te") {
+                if(name == "content-length") {
+                    hasLength = true ;
+                    if(value != std::to_string(stream.body.size())) malformed = true ;
+                }
+                lines += canonicalName_(name) + ": " + value + "\r\n" ;
+            }
+        }
+        if(malformed || method.empty() || path.empty() || method == "CONNECT") {
+            streamError_(stream.id , H2_PROTOCOL_ERROR) ;
+            return ;
+        }
+        std::string request = method + " " + path + " HTTP/2.0\r\n" ;
+        if(!authority.empty()) request += "Host: " + authority + "\r\n" ;
+        if(!cookie.empty()) request += "Cookie: " + cookie + "\r\n" ;
+        if(!stream.body.empty() && hasLength == false) request += "Content-Length: " + std::to_string(stream.body.size()) + "\r\n" ;
+        request += lines + "\r\n" ;
+        stream.readBuff.Append(request) ;
+        stream.readBuff.Append(stream.body) ;
+        stream.body.clear() ;
+        stream.headers.clear() ;
+
+        STATUS_CODE retCode = stream.http.dealHttpRequest(false) ;
+        if(stream.http.makeHttpResponse(retCode == GOOD_CODE ? 200 : 400) == false) {
+            LOG_ERROR("server make http2 response error !!") ;
+            streamError_(stream.id , H2_INTERNAL_ERROR) ;
+            return ;
+        }
+        stream.is_Responding = true ;
+    }
+
+    // 各个响应的流轮流发送一帧，直到写缓冲区超过水位或者所有流都发不动了
+    void pump_() {
+        if(is_GoAway_) return ;
+        bool progress = true ;
+        while(progress && writeBuff_->BufferUsedSize() < http_config_->h2WriteWatermark) {
+            progress = false ;
+            for(auto iter = streams_.begin() ; iter != streams_.end() ; ) {
+                Stream &stream = *iter->second ;
+                SEND_STATE state = stream.is_Responding ? sendStream_(stream) : SEND_BLOCKED ;
+                if(state == SEND_FAILED) {
+                    writeUint32Frame_(FRAME_RST_STREAM , stream.id , H2_INTERNAL_ERROR) ;
+                }
+                if(state == SEND_FINISH || state == SEND_FAILED) {
+                    iter = streams_.erase(iter) ;
+                }else {
+                    ++iter ;
+                }
+                progress = progress || state != SEND_BLOCKED ;
+            }
+        }
+    }
+
+    SEND_STATE sendStream_(Stream &stream) {
+        if(stream.is_HeadersSent == false) {
+            HeaderList headers ;
+            if(readResponseHead_(stream , headers) == false) return SEND_FAILED ;
+            std::string block ;
+            HpackEncoder::encode(headers , block) ;
+            bool endStream = stream.pending.empty() && stream.http.IsResponseDone() ;
+            writeHeaders_(stream.id , block , endStream) ;
+            stream.is_HeadersSent = true ;
+            return endStream ? SEND_FINISH : SEND_PROGRESS ;
+        }
+        int64_t window = std::min(connSendWindow_ , stream.sendWindow) ;
+        if(window <= 0) return SEND_BLOCKED ;
+        size_t frameLen = std::min<size_t>(window , peerMaxFrameSize_) ;
+        if(stream.pending.size() < frameLen && stream.http.IsResponseDone() == false) {
+            size_t old = stream.pending.size() ;
+            stream.pending.resize(frameLen) ;
+            ssize_t n = stream.http.ReadResponse(&stream.pending[old] , frameLen - old) ;
+            if(n < 0) return SEND_FAILED ;
+            stream.pending.resize(old + n) ;
+        }
+        size_t len = std::min(frameLen , stream.pending.size()) ;
+        bool endStream = len == stream.pending.size() && stream.http.IsResponseDone() ;
+        writeFrame_(FRAME_DATA , endStream ? FLAG_END_STREAM : 0 , stream.id , stream.pending.data() , len) ;
+        stream.pending.erase(0 , len) ;
+        connSendWindow_ -= len ;
+        stream.sendWindow -= len ;
+        return endStream ? SEND_FINISH : SEND_PROGRESS ;
+    }
+
+    // 头部块超过对端的最大帧长度时拆成 HEADERS + CONTINUATION
+    void writeHeaders_(uint32_t streamId , const std::string &block , bool endStream) {
+        size_t pos = 0 ;
+        uint8_t type = FRAME_HEADERS ;
+        do {
+            size_t len = std::min<size_t>(block.size() - pos , peerMaxFrameSize_) ;
+            uint8_t flags = (pos + len == block.size()) ? FLAG_END_HEADERS : 0 ;
+            if(type == FRAME_HEADERS && endStream) flags |= FLAG_END_STREAM ;
+            writeFrame_(type , flags , streamId , block.data() + pos , len) ;
+            pos += len ;
+            type = FRAME_CONTINUATION ;
+        }while(pos < block.size()) ;
+    }
+
+    // 从 HttpProtocol 的响应中取出状态行和头部，转换成 HTTP/2 的头部列表，剩下的内容留在 pending 中
+    bool readResponseHead_(Stream &stream , HeaderList &headers) {
+        size_t end = std::string::npos ;
+        while((end = stream.pending.find("\r\n\r\n")) == std::string::npos) {
+            if(stream.http.IsResponseDone() || stream.pending.size() > http_config_->h2MaxHeaderBlock) return false ;
+            size_t old = stream.pending.size() ;
+            stream.pending.resize(old + 4096) ;
+            ssize_t n = stream.http.ReadResponse(&stream.pending[old] , 4096) ;
+            if(n < 0) return false ;
+            stream.pending.resize(old + n) ;
+        }
+        // HTTP/1.1 200 OK
+        if(stream.pending.size() < 12) return false ;
+        headers.emplace_back(":status" , stream.pending.substr(9 , 3)) ;
+        size_t pos = stream.pending.find("\r\n") + 2 ;
+        while(pos < end) {
+            size_t lineEnd = stream.pending.find("\r\n" , pos) ;
+            size_t colon = stream.pending.find(':' , pos) ;
+            if(colon != std::string::npos && colon < lineEnd) {
+                std::string name = stream.pending.substr(pos , colon - pos) ;
+                std::transform(name.begin() , name.end() , name.begin() , ::tolower) ;
+                size_t valueStart = stream.pending.find_first_not_of(' ' , colon + 1) ;
+                if(valueStart > lineEnd) valueStart = lineEnd ;
+                if(isConnectionHeader_(name) == false) {
+                    headers.emplace_back(name , stream.pending.substr(valueStart , lineEnd - valueStart)) ;
+                }
+            }
+            pos = lineEnd + 2 ;
+        }
+        stream.pending.erase(0 , end + 4) ;
+        return true ;
+    }
+} ;
+
+#endif
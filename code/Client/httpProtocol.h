@@ -3,50 +3,133 @@
 
 #include <string>
 #include <unordered_map>
+#include <vector>
+#include <random>
+#include <algorithm>     // search
+#include <strings.h>     // strcasecmp
+#include <limits.h>      // IOV_MAX
 #include <fcntl.h>       // open
 #include <sys/mman.h>    // mmap, munmap
+#include <sys/sendfile.h> // sendfile
+#include <netinet/in.h>
+#include <netinet/tcp.h>  // TCP_CORK
 #include "../Buffer/buffer.h"
 #include "../Log/log.h"
 #include "../Common/commonConfig.h"
 #include "../SqlPool/sqlConnectPool.h"
 #include "../JWT/jwt.h"
 #include "../Common/picojson.h"
+#include "../Cache/compressCache.h"
+#include "../Cache/fileCache.h"
+#include "../Cache/errorPages.h"
+#include "../Pack/resourcePack.h"
+#include "../Router/router.h"
+#include "../Tls/transport.h"
+#include "./upload.h"
+#include "./wsStats.h"
+
+class HttpProtocol ; 
+// 路由处理函数：要么通过 SetBody 直接返回内容，要么通过 RewritePath 改写路径后交给静态文件处理
+typedef std::function<void(HttpProtocol& , const RouteParams&)> RouteHandler ; 
+// 路由表中的一项：处理函数以及请求 body 的接收方式，请求头收完时就按路由决定 body 怎么收
+struct Route {
+    RouteHandler handler ; 
+    bool is_Upload = false ;                // 接收上传：multipart 和超过 maxRequestBody 的 body 写入 uploadDir 下的临时文件，最大 maxUploadSize 
+    bool is_Login = false ;                 // 需要登录，没有登录时不收 body 直接返回 401 
+    explicit operator bool() const { return static_cast<bool>(handler) ; }
+};
+// 流式响应的生产者：每次调用用 WriteChunk 写入下一段内容（至少写一段），返回 false 表示全部写完
+// 上一批内容发送出去之后才会再次调用，生成的速度跟随客户端的接收速度，内存占用不超过 streamWatermark 左右
+typedef std::function<bool(HttpProtocol&)> StreamProducer ; 
 
 class HttpProtocol{
 private : 
+    static constexpr char H2_PREFACE_LINE[] = "PRI * HTTP/2.0\r\n" ; // HTTP/2 连接前言的第一行
     int fd_ ; 
+    Transport* transport_ ;                 // 连接的读写通道（明文或 TLS），HTTP/2 的流没有自己的通道，为 nullptr
     int is_ET_ ; 
     bool is_Close_ ; 
     int response_code_ ; 
-    std::string response_status_ ;  
+    std::string_view response_status_ ;     // 指向 HttpConfigInfo::CODE_STATUS 中的常量 
     struct stat mmFileStat_ ;
     char* mmFile_ ; 
-    int iovCnt_ ;
-    struct iovec* write_iov_  ;
+    int fileFd_ ;                           // sendfile 模式下打开的文件，资源包中的资源是包文件的 fd
+    bool is_Cork_ ;                         // 是否开启了 TCP_CORK
+    enum SEGMENT_TYPE {
+        SEG_BUFFER ,                        // writeBuff_ 中的数据
+        SEG_MMAP ,                          // mmFile_ 中的数据
+        SEG_FILE ,                          // fileFd_ 中的数据，用 sendfile 发送
+        SEG_MEMORY ,                        // memBody_ 中的数据
+        SEG_PACK ,                          // pack_ 映射的内存中的数据
+    };
+    struct Segment {
+        SEGMENT_TYPE type ; 
+        size_t offset ;                     // 在 writeBuff_ / mmFile_ / fileFd_ / pack_ 中的偏移
+        size_t len ; 
+    };
+    std::vector<Segment> segments_ ;        // 响应报文按顺序拆成的片段
+    size_t segIdx_ ;                        // 当前写到第几个片段了，用于 EPOLLOUT 再次触发时续写
+    size_t bufMark_ ;                       // writeBuff_ 中已经划分到片段里的长度
+    std::vector<struct iovec> write_iov_ ;
+    std::vector<std::pair<size_t , size_t>> ranges_ ; // Range 请求的区间，(起始偏移 , 长度)
+    std::string boundary_ ;                 // multipart/byteranges 的分隔符
+    std::string contentEncoding_ ;          // 响应的 Content-Encoding ，空表示不压缩
+    std::string encodedSuffix_ ;            // 使用预压缩文件时的后缀 .br / .gz
+    bool is_Compressible_ ;                 // 资源有多个编码版本，响应需要带 Vary: Accept-Encoding
+    std::shared_ptr<const std::string> memBody_ ; // 内存中的内容：在线压缩的结果（CompressCache）或者缓存的小文件（FileCache）
+    std::shared_ptr<const ResourcePack> pack_ ; // 资源在资源包中时持有当前的包，发送过程中包被替换也不受影响
+    PackVariant packVariant_ ;              // 协商之后选中的版本：预生成的头部、ETag 以及内容在包中的位置
     Buffer* readBuff_;                      // 读缓冲区
     Buffer* writeBuff_;                     // 写缓冲区
     enum PARSE_STATE {
         REQUEST_LINE,
         HEADERS,
         BODY,
+        BODY_DATA,                          // 按 Content-Length 接收 body 
+        CHUNK_SIZE,                         // chunked 请求 body ：分块的长度行
+        CHUNK_DATA,                         // 分块的内容以及结尾的 \r\n
+        CHUNK_TRAILER,                      // 长度为 0 的分块之后的 trailer ，以空行结束
         FINISH,        
     };
-    PARSE_STATE status_; // 处理 http 请求分析
+    PARSE_STATE status_; // 处理 http 请求分析，请求没有收完整时保留状态，下次收到数据后接着解析
+    size_t headerBytes_ ;                   // 已经解析的请求行、请求头和 trailer 的字节数
+    size_t chunkRemain_ ;                   // 当前分块还没有收到的字节数
+    bool is_ContinueSent_ ;                 // 已经回复过 100 Continue
+    std::string requestBody_ ;              // 请求 body ，chunked 编码已经解码
+    size_t bodyRemain_ ;                    // Content-Length 方式还没有收到的 body 字节数
+    size_t bodySize_ ;                      // 已经收到的 body 字节数
+    size_t bodyLimit_ ;                     // 按路由决定的 body 上限：上传路由 maxUploadSize ，其他路由 maxRequestBody 
+    bool is_Upload_ ;                       // body 交给 upload_ 落盘：上传路由的 multipart 或者超过 maxRequestBody 的大 body 
+    int rejectCode_ ;                       // 拒绝了这个请求（401/413/415），body 不再读取，应答之后关闭连接；0 表示没有拒绝
+    UploadParser upload_ ;
+    StreamProducer producer_ ;              // 流式响应的生产者，为空表示普通响应
+    bool is_Chunked_ ;                      // 流式响应按 chunked 编码发送（HTTP/1.1）
+    bool is_StreamEnd_ ;                    // 生产者已经写完了
     std::string method_ , path_, version_ ;
+    std::string query_ ;                    // ? 后面的查询字符串
+    bool is_File_ ;                         // 是否返回静态文件，否则返回 body_
+    std::string body_ ;                     // 路由处理函数返回的内容
+    std::string_view bodyType_ ;            // body_ 的 Content-Type ，空则按路径后缀判断
     std::unordered_map<std::string, std::string> header_;
     std::unordered_map<std::string, std::string> post_;
-    HttpConfigInfo http_config_ ; 
+    const HttpConfigInfo* http_config_ ;    // 所有连接共享的只读配置
     bool is_JWToken_ ;                      // 是否颁发 JWToken 
-    std::unique_ptr<JWT> Jwt_;              // JWT
+    JWT* Jwt_;                              // JWT ，所有连接共享
 
 public : 
-    HttpProtocol(const int fd , const int isET , Buffer* read , Buffer* write) {
-        http_config_ = HttpConfigInfo() ;  
-        Jwt_ = std::make_unique<JWT>(http_config_.jwtSecret , http_config_.jwtExpire) ; 
-        fd_ = fd ; 
+    HttpProtocol(Transport* transport , const int isET , Buffer* read , Buffer* write) {
+        http_config_ = &HttpConfigInfo::Instance() ;  
+        Jwt_ = &SharedJwt() ; 
+        transport_ = transport ; 
+        fd_ = transport != nullptr ? transport->GetFd() : -1 ; 
         is_ET_ = isET ;
         readBuff_ = read ; 
         writeBuff_ = write ; 
+        is_Close_ = true ; 
+        status_ = REQUEST_LINE ; 
+        mmFile_ = nullptr ; 
+        fileFd_ = -1 ; 
+        is_Cork_ = false ; 
     }
 
     ~HttpProtocol() {
@@ -58,27 +141,53 @@ public :
         writeBuff_->clear() ; 
         is_Close_ = false ;  
         is_JWToken_ = false ; 
-        iovCnt_ = 0 ; 
-        write_iov_ = nullptr ; 
+        segments_.clear() ; segIdx_ = 0 ; bufMark_ = 0 ; 
+        write_iov_.clear() ; ranges_.clear() ; 
+        contentEncoding_.clear() ; encodedSuffix_.clear() ; 
+        is_Compressible_ = false ; memBody_ = nullptr ; 
+        pack_ = nullptr ; 
         mmFile_ = nullptr ; 
         mmFileStat_ = { 0 }; 
-        
+        fileFd_ = -1 ; 
+        is_Cork_ = false ; 
+        resetRequest_() ; 
     }
 
     void close(){
         if(is_Close_) return ;
         is_Close_ = true ; 
-        method_.clear() ; path_.clear() ; version_.clear() ;
-        header_.clear() ; post_.clear() ; 
-        iovCnt_ = 0 ; 
+        resetRequest_() ; 
+        segments_.clear() ; segIdx_ = 0 ; bufMark_ = 0 ; 
+        ranges_.clear() ; 
+        contentEncoding_.clear() ; encodedSuffix_.clear() ; 
+        is_Compressible_ = false ; memBody_ = nullptr ; 
         if(mmFile_ != nullptr) {
             munmap(mmFile_, mmFileStat_.st_size);
             mmFile_ = nullptr;
         }
-        if(write_iov_ != nullptr) {
-            delete write_iov_ ; 
-            write_iov_ = nullptr ; 
+        write_iov_.clear() ; 
+        if(fileFd_ != -1) {
+            if(pack_ == nullptr) ::close(fileFd_) ; // 包文件的 fd 由 ResourcePack 持有
+            fileFd_ = -1 ; 
         }
+        pack_ = nullptr ; 
+        setCork_(false) ; 
+    }
+
+    // 清理上一个请求的解析状态，准备解析下一个请求
+    void resetRequest_() {
+        status_ = REQUEST_LINE ; headerBytes_ = 0 ; chunkRemain_ = 0 ; is_ContinueSent_ = false ; 
+        method_.clear() ; path_.clear() ; version_.clear() ; query_.clear() ;
+        body_.clear() ; bodyType_ = std::string_view() ; 
+        header_.clear() ; post_.clear() ; requestBody_.clear() ; 
+        bodyRemain_ = 0 ; bodySize_ = 0 ; bodyLimit_ = 0 ; is_Upload_ = false ; rejectCode_ = 0 ; upload_.clear() ; 
+        is_JWToken_ = false ; 
+        producer_ = nullptr ; is_Chunked_ = false ; is_StreamEnd_ = false ; 
+    }
+
+    // 上一个请求还没有收完整，下次读到数据后要接着解析，不能清空读缓冲区
+    bool IsParsing() const {
+        return status_ != REQUEST_LINE || readBuff_->BufferUsedSize() > 0 ; 
     }
 
     std::string get_WebSocket_key() const {
@@ -87,21 +196,43 @@ public :
         }
         return "" ;  
     }
-    struct iovec* get_write_iovecAddr() const{
-        return write_iov_ ; 
-    }
 
-    int get_iovec_len() const {
-        return iovCnt_ ; 
+    std::string get_WebSocket_extensions() const {
+        if(header_.find("Sec-WebSocket-Extensions") != header_.end()){
+            return header_.find("Sec-WebSocket-Extensions")->second ; 
+        }
+        return "" ;  
     }
-
     bool IsKeepAlive() const {
+        if(response_code_ == 400 || rejectCode_ != 0) return false ; // 请求报文错误或者 body 没有读完，后面的数据也无法解析了
+        if(producer_ != nullptr && version_ == "HTTP/1.0") return false ; // 没有长度的流式响应以关闭连接结束
         if(header_.find("Connection") != header_.end()) {
+            if(strcasecmp(header_.find("Connection")->second.c_str() , "close") == 0) return false ; 
             return header_.find("Connection")->second == "keep-alive" || version_ >= "HTTP/1.1";
         }
         return false;
     }
 
+    // 客户端以 prior knowledge 方式直接发送 HTTP/2 连接前言
+    bool isHttp2Preface() const {
+        return readBuff_->BufferUsedSize() >= sizeof(H2_PREFACE_LINE) - 1 && 
+               memcmp(readBuff_->BufferStart() , H2_PREFACE_LINE , sizeof(H2_PREFACE_LINE) - 1) == 0 ; 
+    }
+
+    bool isHttp2PrefacePrefix_() const {
+        size_t len = readBuff_->BufferUsedSize() ; 
+        return len < sizeof(H2_PREFACE_LINE) - 1 && memcmp(readBuff_->BufferStart() , H2_PREFACE_LINE , len) == 0 ; 
+    }
+
+    // Upgrade: h2c ，带 body 的请求升级后还要把 body 转交给 HTTP/2 ，这里只升级 GET/HEAD
+    // TLS 连接通过 ALPN 协商 h2 ，不允许 h2c 升级
+    bool isUpgradeH2c() const {
+        if(transport_ != nullptr && transport_->IsTls()) return false ; 
+        auto upgrade = header_.find("Upgrade") ; 
+        return upgrade != header_.end() && upgrade->second == "h2c" && header_.count("HTTP2-Settings") != 0 && 
+               (method_ == "GET" || method_ == "HEAD") ; 
+    }
+
     bool isUpgradeWebSocket() const {
         if(header_.find("Connection") != header_.end() && 
             header_.find("Upgrade") != header_.end() && 
@@ -119,17 +250,33 @@ public :
        return userName ;
     }
 
-    std::string GetFileType_() {
-        /* 判断文件类型 */
+    // JWT 只保存密钥和过期时间，没有可变状态，所有连接共享一个
+    static JWT& SharedJwt() {
+        static JWT jwt(HttpConfigInfo::Instance().jwtSecret , HttpConfigInfo::Instance().jwtExpire) ; 
+        return jwt ; 
+    }
+
+    const SuffixInfo* GetSuffixInfo_() const {
         std::string::size_type idx = path_.find_last_of('.');
-        if(idx == std::string::npos) {
-            return "text/plain";
-        }
-        std::string suffix = path_.substr(idx);
-        if(http_config_.SUFFIX_TYPE.count(suffix) == 1) {
-            return http_config_.SUFFIX_TYPE.find(suffix)->second;
-        }
-        return "text/plain";
+        if(idx == std::string::npos) return nullptr ; 
+        return HttpConfigInfo::FindSuffix(std::string_view(path_).substr(idx)) ; 
+    }
+
+    std::string_view GetFileType_() const {
+        /* 判断文件类型 */
+        const SuffixInfo* info = GetSuffixInfo_() ; 
+        return info != nullptr ? info->type : "text/plain" ; 
+    }
+
+    std::string_view GetCacheControl_() const {
+        const SuffixInfo* info = GetSuffixInfo_() ; 
+        if(info != nullptr && !info->cacheControl.empty()) return info->cacheControl ; 
+        return http_config_->defaultCacheControl ; 
+    }
+
+    void setStatus_(const int code) {
+        response_code_ = code ; 
+        response_status_ = HttpConfigInfo::FindStatus(code)->text ; 
     }
 
     bool paresRequestLine(){
@@ -147,13 +294,11 @@ public :
         readBuff_->Retrieve(i + 2) ; 
         if(flag != 2) return false ;
         LOG_DEBUG("method: %s; path : %s; version: %s;" , method_.data() , path_.data() , version_.data()) ; 
-        // 路径进一步处理
-        if(path_ == "/") {
-            path_ = "/index.html" ; 
-        }else {
-            if(http_config_.DEFAULT_HTML.count(path_) != 0){
-                path_ = path_ + ".html" ; 
-            } 
+        // 查询字符串不参与路由和静态文件查找
+        std::string::size_type idx = path_.find('?') ; 
+        if(idx != std::string::npos) {
+            query_ = path_.substr(idx + 1) ; 
+            path_.resize(idx) ; 
         }
         this->status_ = HEADERS ; 
         return true ; 
@@ -167,16 +312,16 @@ public :
             if((*(strBegin + i)) == '\r' &&  (*(strBegin + i + 1)) == '\n') {
                 break ;
             }
-            if((*(strBegin + i)) == ':'){
+            if(flag == 0 && (*(strBegin + i)) == ':'){ // 只有第一个 : 是分隔符，值里面也可能有 : ，比如日期
                 ++flag ; ++i ; continue ;  // ++i 这里的作用是除掉: 后面的空格
             }
             if(flag == 0) key.push_back(*(strBegin + i)) ; 
             if(flag == 1) value.push_back(*(strBegin + i)) ;  
         }
         readBuff_->Retrieve(i + 2) ;  // 除了最后的 "\r\n"; header 与 body 之间还有个空行
-        if(flag == 0) {
+        if(i == 0) {
             this->status_ = BODY ; return true ;
-        }else if(value.size() == 0){
+        }else if(flag == 0 || value.size() == 0){
             return false ;
         }
         header_[key] = value ; 
@@ -184,88 +329,258 @@ public :
         return true ; 
     }
 
-    bool ParseBody() {
+    // 从 readBuff_ 开头找一行，返回不含 \r\n 的长度，还没有收到完整的一行返回 -1
+    ssize_t findLine_() const {
+        const char* begin = readBuff_->BufferStart() ; 
+        const char* end = begin + readBuff_->BufferUsedSize() ; 
+        static const char CRLF[] = "\r\n" ; 
+        const char* pos = std::search(begin , end , CRLF , CRLF + 2) ; 
+        return pos == end ? -1 : pos - begin ; 
+    }
+
+    // 严格解析长度：十进制的 Content-Length 或者十六进制的分块长度，不接受符号、空串和溢出
+    static bool parseSize_(const std::string &str , const int base , size_t &value) {
+        if(str.empty() || !isxdigit(static_cast<unsigned char>(str[0]))) return false ; 
+        errno = 0 ; 
+        char* end = nullptr ; 
+        unsigned long long ret = strtoull(str.c_str() , &end , base) ; 
+        while(*end == ' ' || *end == '\t') ++end ; 
+        if(errno == ERANGE || end == str.c_str() || *end != '\0') return false ; 
+        value = ret ; 
+        return true ; 
+    }
+
+    // 请求头收完了：先按路由决定 body 怎么收，再按 chunked 或者 Content-Length 接收 body ；multipart 边收边解析
+    // 只有标记了 is_Upload 的路由才会创建临时文件，其他路由的 body 只能放在内存里，不能超过 maxRequestBody 
+    // 不接受的请求在收 body 之前就返回最终的状态码，客户端带了 Expect: 100-continue 时不用一直等待
+    STATUS_CODE ParseBody() {
+        RouteParams params ; 
+        const Route* route = Routes().find(method_ , path_ , params) ; 
+        bool upload = route != nullptr && route->is_Upload ; 
+        if(route != nullptr && route->is_Login && Jwt_->judgeJWT(header_["Cookie"]) == false) return reject_(401) ; 
+        bodyLimit_ = upload ? http_config_->maxUploadSize : http_config_->maxRequestBody ; 
+        std::string boundary = UploadParser::GetBoundary(GetHeader("Content-Type")) ; 
+        if(!boundary.empty()) {
+            if(upload == false) return reject_(415) ; 
+            upload_.init(boundary , http_config_->uploadDir , http_config_->maxRequestBody , http_config_->maxUploadParts) ; 
+            is_Upload_ = true ; 
+        }
+        auto encoding = header_.find("Transfer-Encoding") ; 
+        if(encoding != header_.end()) {
+            if(encoding->second.find("chunked") == std::string::npos) return BAD_REQUEST ; // 只支持 chunked 
+            status_ = CHUNK_SIZE ; 
+            return GOOD_CODE ; 
+        }
+        auto length = header_.find("Content-Length") ; 
+        if(length == header_.end()) return finishBody_() ; 
+        size_t len = 0 ; 
+        if(parseSize_(length->second , 10 , len) == false) return BAD_REQUEST ; 
+        if(len > bodyLimit_) return reject_(413) ; 
+        bodyRemain_ = len ; 
+        status_ = BODY_DATA ; 
+        return GOOD_CODE ; 
+    }
+
+    // body 收到多少处理多少，不在读缓冲区里堆积
+    STATUS_CODE ParseBodyData() {
+        size_t len = std::min(bodyRemain_ , readBuff_->BufferUsedSize()) ; 
+        if(bodyData_(readBuff_->BufferStart() , len) == false) return BAD_REQUEST ; 
+        readBuff_->Retrieve(len) ; 
+        bodyRemain_ -= len ; 
+        // body 数据包不完整，等待后续数据
+        if(bodyRemain_ > 0) return CONTINUE_CODE ; 
+        return finishBody_() ; 
+    }
+
+    // 拒绝这个请求：剩下的 body 不再读取，应答 code 之后关闭连接
+    STATUS_CODE reject_(const int code) {
+        LOG_WARN("%s %s rejected %d" , method_.data() , path_.data() , code) ; 
+        rejectCode_ = code ; 
+        return BAD_REQUEST ; 
+    }
+
+    // body 的内容都经过这里：上传路由的 multipart 和超过 maxRequestBody 的 body 交给 upload_ 写入临时文件，其他的保存在 requestBody_ 中
+    bool bodyData_(const char* data , size_t len) {
+        bodySize_ += len ; 
+        if(bodySize_ > bodyLimit_) {
+            reject_(413) ; 
+            return false ; 
+        }
+        if(is_Upload_ == false && requestBody_.size() + len > http_config_->maxRequestBody) { // 只有上传路由会走到这里
+            // 已经收到的内容和后续的内容一起写入临时文件
+            if(upload_.initRaw(http_config_->uploadDir , GetHeader("Content-Type") , requestBody_) == false) return false ; 
+            std::string().swap(requestBody_) ; 
+            is_Upload_ = true ; 
+        }
+        if(is_Upload_) return upload_.feed(data , len) ; 
+        requestBody_.append(data , len) ; 
+        return true ; 
+    }
+
+    // 分块长度行：十六进制长度，后面可能带 ;扩展 ，长度为 0 表示最后一个分块
+    STATUS_CODE ParseChunkSize() {
+        ssize_t lineLen = findLine_() ; 
+        std::string line(readBuff_->BufferStart() , lineLen) ; 
+        readBuff_->Retrieve(lineLen + 2) ; 
+        size_t len = 0 ; 
+        if(parseSize_(line.substr(0 , line.find(';')) , 16 , len) == false) return BAD_REQUEST ; 
+        if(len == 0) {
+            status_ = CHUNK_TRAILER ; 
+            return GOOD_CODE ; 
+        }
+        if(bodySize_ + len > bodyLimit_) return reject_(413) ; 
+        chunkRemain_ = len ; 
+        status_ = CHUNK_DATA ; 
+        return GOOD_CODE ; 
+    }
+
+    // 分块内容可能分多次到达，收到多少解码多少
+    STATUS_CODE ParseChunkData() {
+        size_t len = std::min(chunkRemain_ , readBuff_->BufferUsedSize()) ; 
+        if(bodyData_(readBuff_->BufferStart() , len) == false) return BAD_REQUEST ; 
+        readBuff_->Retrieve(len) ; 
+        chunkRemain_ -= len ; 
+        if(chunkRemain_ > 0 || readBuff_->BufferUsedSize() < 2) return CONTINUE_CODE ; 
+        if(memcmp(readBuff_->BufferStart() , "\r\n" , 2) != 0) return BAD_REQUEST ; 
+        readBuff_->Retrieve(2) ; 
+        status_ = CHUNK_SIZE ; 
+        return GOOD_CODE ; 
+    }
+
+    // trailer 里的头部不使用，读到空行 body 就结束了
+    STATUS_CODE ParseChunkTrailer() {
+        ssize_t lineLen = findLine_() ; 
+        readBuff_->Retrieve(lineLen + 2) ; 
+        return lineLen == 0 ? finishBody_() : GOOD_CODE ; 
+    }
+
+    // body 收完整了，表单内容解码到 post_ 中
+    STATUS_CODE finishBody_() {
         status_ = FINISH ; 
-        if(readBuff_->BufferUsedSize() == 0 || header_.find("Content-Length") == header_.end()) return true ; 
-        // body 数据包不完整
-        if(readBuff_->BufferUsedSize() < stol(header_["Content-Length"])) return false ; 
- 
-        const char* strBegin = readBuff_->BufferStart() ; 
-        size_t len = stol(header_["Content-Length"]) ; 
-
-        // 如果是 urlencoded 则还需要解码步骤
-        if(method_ == "POST") {
-            // 1. 字符"a"-"z"，"A"-"Z"，"0"-"9"，"."，"-"，"*"，和"_" 都不会被编码;
-            // 2. 将空格转换为加号 (+) ;
-            // 3. 将非文本内容转换成"%xy"的形式,xy是两位16进制的数值;
-            // 4. 在每个 name=value 对之间放置 & 符号。
-            std::function<void()> ParseFromUrlencoded = [&](){ 
-                
-                auto ConverHex = [](const char ch) -> int {
-                    if(ch >= 'A' && ch <= 'F') return ch -'A' + 10;
-                    if(ch >= 'a' && ch <= 'f') return ch -'a' + 10;
-                    return ch - '0' ;
-                } ; 
-                std::string key, value ;
-                for(int i = 0 , flag = 1 ; i <= len ; ++i){ 
-                    if(i == len || strBegin[i] == '&' || strBegin[i] == '=') {
-                        if(i == len || strBegin[i] == '&'){
-                            post_[key] = value ; 
-                            LOG_DEBUG("Post key:%s, value:%s", key.data(), value.data());
-                            key.clear() ; value.clear() ;
-                        }
-                        flag *= -1 ; continue ; 
-                    } 
-                    char ch = *(strBegin + i) ;
-                    if(ch == '+'){
-                        ch = ' ' ; 
-                    }else if(ch == '%'){
-                        ch = static_cast<char>(ConverHex(*(strBegin + i + 1)) * 16 + ConverHex(*(strBegin + i + 2))) ; 
-                        i += 2 ;
-                    } 
-                    if(flag == 1) key.push_back(ch) ; 
-                    if(flag == -1) value.push_back(ch) ; 
+        if(is_Upload_) {
+            if(upload_.IsFinish() == false) return BAD_REQUEST ; // multipart 没有结束分隔符
+            upload_.finish() ; 
+            for(auto &field : upload_.GetFields()) post_[field.first] = std::move(field.second) ; 
+        }else if(method_ == "POST") {
+            // 如果是 urlencoded 则还需要解码步骤
+            ParseFromUrlencoded() ; 
+        }
+        return GOOD_CODE ; 
+    }
+
+    // 1. 字符"a"-"z"，"A"-"Z"，"0"-"9"，"."，"-"，"*"，和"_" 都不会被编码;
+    // 2. 将空格转换为加号 (+) ;
+    // 3. 将非文本内容转换成"%xy"的形式,xy是两位16进制的数值;
+    // 4. 在每个 name=value 对之间放置 & 符号。
+    void ParseFromUrlencoded() {
+        auto ConverHex = [](const char ch) -> int {
+            if(ch >= 'A' && ch <= 'F') return ch -'A' + 10;
+            if(ch >= 'a' && ch <= 'f') return ch -'a' + 10;
+            return ch - '0' ;
+        } ; 
+        const char* strBegin = requestBody_.data() ; 
+        size_t len = requestBody_.size() ; 
+        if(len == 0) return ; 
+        std::string key, value ;
+        for(size_t i = 0 , flag = 1 ; i <= len ; ++i){ 
+            if(i == len || strBegin[i] == '&' || strBegin[i] == '=') {
+                if(i == len || strBegin[i] == '&'){
+                    post_[key] = value ; 
+                    LOG_DEBUG("Post key:%s, value:%s", key.data(), value.data());
+                    key.clear() ; value.clear() ;
+                    flag = 1 ; 
+                }else {
+                    flag = 0 ; 
                 }
-            } ;
-            ParseFromUrlencoded() ;
+                continue ; 
+            } 
+            char ch = *(strBegin + i) ;
+            if(ch == '+'){
+                ch = ' ' ; 
+            }else if(ch == '%' && i + 2 < len){
+                ch = static_cast<char>(ConverHex(*(strBegin + i + 1)) * 16 + ConverHex(*(strBegin + i + 2))) ; 
+                i += 2 ;
+            } 
+            if(flag == 1) key.push_back(ch) ; 
+            if(flag == 0) value.push_back(ch) ; 
         }
-        readBuff_->Retrieve(len + 2) ;  
-        //LOG_DEBUG("Body:%s, len:%d", std::string(strBegin , len).data() , len);
-        return true ;
     }
 
-    bool parseHttpRequest() {
-        if(readBuff_->BufferUsedSize() <= 0){
-            LOG_ERROR("readBuff_->BufferUsedSize() <= 0") ; 
-            return false ;  
-        } 
-        status_ = REQUEST_LINE ; 
-        while(readBuff_->BufferUsedSize() && status_ != FINISH) {
+    // 客户端带了 Expect: 100-continue 时，要等我们回复之后才发送 body 
+    void sendContinue_() {
+        if(is_ContinueSent_ || transport_ == nullptr || version_ != "HTTP/1.1") return ; 
+        auto expect = header_.find("Expect") ; 
+        if(expect == header_.end() || strcasecmp(expect->second.c_str() , "100-continue") != 0) return ; 
+        is_ContinueSent_ = true ; 
+        static const char CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n" ; 
+        // 只有 25 个字节，发送失败也没关系，客户端等待超时后会直接发送 body 
+        transport_->Write(CONTINUE , sizeof(CONTINUE) - 1) ; 
+    }
+
+    // 请求可能分多次到达：按状态机解析已经收到的部分，数据不够时保留状态返回 CONTINUE_CODE ，收到更多数据后接着解析
+    STATUS_CODE parseHttpRequest() {
+        while(status_ != FINISH) {
+            if(status_ != BODY && status_ != BODY_DATA && status_ != CHUNK_DATA) { // 按行解析的状态，先确认收到了完整的一行
+                ssize_t lineLen = findLine_() ; 
+                if(lineLen < 0) {
+                    if(readBuff_->BufferUsedSize() > http_config_->maxRequestHeader) {
+                        LOG_ERROR("request line too long %zu" , readBuff_->BufferUsedSize()) ; 
+                        return BAD_REQUEST ; 
+                    }
+                    break ; 
+                }
+                if(status_ == REQUEST_LINE && lineLen == 0) { // 请求之前多余的空行直接忽略
+                    readBuff_->Retrieve(2) ; 
+                    continue ; 
+                }
+                if(status_ != CHUNK_SIZE) headerBytes_ += lineLen + 2 ; 
+                if(headerBytes_ > http_config_->maxRequestHeader) {
+                    LOG_ERROR("request header too large %zu" , headerBytes_) ; 
+                    return BAD_REQUEST ; 
+                }
+            }
+            STATUS_CODE ret = GOOD_CODE ; 
             switch (status_)
             {
             case REQUEST_LINE:
                 if(!paresRequestLine()){
                     LOG_ERROR("paresRequestLine Error %s" , readBuff_->BufferStart()) ; 
-                    return false ;
+                    return BAD_REQUEST ;
                 } 
                 break;
             case HEADERS :
                 if(!paresHeader()){
                     LOG_ERROR("paresHeader Error %s" , readBuff_->BufferStart()) ; 
-                    return false ; 
+                    return BAD_REQUEST ; 
                 }
                 break ; 
             case BODY :
-                if(!ParseBody()){
-                    LOG_ERROR("ParseBody Error %s" , readBuff_->BufferStart()) ; 
-                    return false ; 
-                } 
+                ret = ParseBody() ; 
                 break ;
+            case BODY_DATA :
+                ret = ParseBodyData() ; 
+                break ;
+            case CHUNK_SIZE :
+                ret = ParseChunkSize() ; 
+                break ; 
+            case CHUNK_DATA :
+                ret = ParseChunkData() ; 
+                break ; 
+            case CHUNK_TRAILER :
+                ret = ParseChunkTrailer() ; 
+                break ; 
             default:
                 break;
             }
+            if(ret == BAD_REQUEST) {
+                LOG_ERROR("ParseBody Error , state %d" , status_) ; 
+                return BAD_REQUEST ; 
+            }
+            if(ret == CONTINUE_CODE) break ; 
         } 
-        return true ; 
+        if(status_ == FINISH) return GOOD_CODE ; 
+        if(status_ != REQUEST_LINE && status_ != HEADERS) sendContinue_() ; 
+        return CONTINUE_CODE ; 
     }
     // 需要根据请求头判断头文件是否读取完毕
     STATUS_CODE dealHttpRequest(const int needRead = true){ 
@@ -273,7 +588,7 @@ public :
             int Errno = -1; 
             ssize_t len = -1;
             do {
-                len = readBuff_->ReadFd(fd_, &Errno);  
+                len = transport_->Read(readBuff_ , &Errno);  
                 if (len <= 0) {
                     if(Errno == EWOULDBLOCK ){// 读完了，跳出
                         break ; 
@@ -284,17 +599,33 @@ public :
                         return CLOSE_CONNECTION ;
                     }
                 }
+                // 大的 body 边读边处理，读缓冲区不随 body 变大；提前返回时 socket 里剩下的数据在重新注册 EPOLLIN 后继续读
+                if(readBuff_->BufferUsedSize() >= http_config_->requestBufferSize) {
+                    STATUS_CODE ret = parseRequest_() ; 
+                    if(ret != CONTINUE_CODE) return ret ; 
+                }
             }while (is_ET_) ;
         }
-        if(parseHttpRequest() == false) {
+        return parseRequest_() ; 
+    }
+
+    STATUS_CODE parseRequest_() {
+        if(readBuff_->BufferUsedSize() == 0) return CONTINUE_CODE ; // 没有读到应用数据
+        is_Close_ = false ; 
+        if(status_ == REQUEST_LINE) {
+            if(isHttp2Preface()) return GOOD_CODE ; // 交给 HTTP/2 处理
+            if(isHttp2PrefacePrefix_()) return CONTINUE_CODE ; // 可能是连接前言，也可能是 POST ，等收完第一行再判断
+        }
+        STATUS_CODE ret = parseHttpRequest() ; 
+        if(ret == BAD_REQUEST) {
             LOG_ERROR("server deal parse http request error !!") ; 
-            return BAD_REQUEST ; 
         } 
-        return GOOD_CODE ;
+        return ret ;
     }
     
     bool AddStateLine(){
-        return writeBuff_->Append("HTTP/1.1 " + std::to_string(response_code_) + " " + response_status_ + "\r\n") ; 
+        std::string_view line = HttpConfigInfo::FindStatus(response_code_)->line ; 
+        return writeBuff_->Append(line.data() , line.size()) ; 
     }
 
     bool AddHeader(){
@@ -311,95 +642,553 @@ public :
             std::string token = Jwt_->generateJWT(keyValue) ; 
             writeBuff_->Append("Set-Cookie: " + token + "\r\n");
         }
-        return writeBuff_->Append("Content-type: " + GetFileType_() + "\r\n");
+        if(is_File_ == false && !bodyType_.empty()) {
+            writeBuff_->Append("Content-type: ") ; 
+            writeBuff_->Append(bodyType_.data() , bodyType_.size()) ; 
+            return writeBuff_->Append("\r\n");
+        }
+        if(ranges_.size() > 1) { // 多区间 Range 请求，各区间的类型放在各自的分段头里
+            return writeBuff_->Append("Content-type: multipart/byteranges; boundary=" + boundary_ + "\r\n");
+        }
+        std::string_view fileType = GetFileType_() ; 
+        writeBuff_->Append("Content-type: ") ; 
+        writeBuff_->Append(fileType.data() , fileType.size()) ; 
+        return writeBuff_->Append("\r\n");
     }
 
+    // 根据要发送的字节数选择发送方式：
+    // 1. 小文件的内容已经在 FileCache 中时作为内存片段发送，否则直接 read 进 writeBuff_ ，与响应头一次 write 发出，省去 mmap/munmap 的开销
+    // 2. 中等文件 mmap + writev
+    // 3. 大文件 sendfile 零拷贝，避免 mmap 首次访问的缺页中断，配合 TCP_CORK 与响应头合并发送
+    // Range 请求只发送 ranges_ 中的区间，多个区间按 multipart/byteranges 格式组织；HEAD 请求只发送头部
     bool AddBody(){
-        std::string file_ = http_config_.srcDir + path_ ; 
-        bool file_exist = stat(file_.data() , &mmFileStat_) == 0 ;
-        if(!file_exist || S_ISDIR(mmFileStat_.st_mode)) { 
+        std::string file_ = http_config_->srcDir + path_ + encodedSuffix_ ; 
+        bool is_Resource = response_code_ == 200 || response_code_ == 206 || response_code_ == 304 || response_code_ == 416 ; 
+        // 请求的资源文件在 makeHttpResponse 中已经查找过了，错误页面由 ErrorPages 预先生成
+        if(!is_Resource || S_ISDIR(mmFileStat_.st_mode)) { 
             LOG_ERROR("file %s not exist!!!" , file_.data()); 
             return false ;
         }
+        if(response_code_ == 304) { // 客户端缓存仍然有效，不用打开文件，只发送头部
+            AddValidators_() ; 
+            return writeBuff_->Append("\r\n") ; 
+        }
+        size_t fileSize = memBody_ != nullptr ? memBody_->size() : mmFileStat_.st_size ; 
+        if(response_code_ == 416) {
+            writeBuff_->Append("Content-Range: bytes */" + std::to_string(fileSize) + "\r\n") ; 
+            return writeBuff_->Append("Content-Length: 0\r\n\r\n") ; 
+        }
 
         auto close_func = [](int* fd) {
             if (fd) {
-                ::close(*fd);
+                if(*fd != -1) ::close(*fd);
                 delete fd ;
                 fd = nullptr ; 
             }
         };
-        std::unique_ptr<int , decltype(close_func) > fd(new int(open(file_.data(), O_RDONLY)) , close_func);
-        if (*fd == -1) {
-            LOG_ERROR("open file %s error !!!" ,  file_.data()); 
-            return false ; 
+        std::unique_ptr<int , decltype(close_func) > fd(new int(-1) , close_func);
+        if(method_ != "HEAD" && memBody_ == nullptr && pack_ == nullptr) {
+            *fd = open(file_.data(), O_RDONLY) ; 
+            if (*fd == -1) {
+                LOG_ERROR("open file %s error !!!" ,  file_.data()); 
+                return false ; 
+            }
         }
 
-        char *dataFile = reinterpret_cast<char*>(mmap(nullptr, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE , *fd , 0)) ;
+        if(ranges_.empty()) ranges_.emplace_back(0 , fileSize) ; 
+        const size_t mark = writeBuff_->BufferUsedSize() ; // 出错时撤销本函数写入的内容
+        size_t bodyLen = 0 , contentLength = 0 ; 
+        std::vector<std::string> partHeads ; 
+        std::string partTail ; 
+        for(const auto &range : ranges_) bodyLen += range.second ; 
+        if(response_code_ == 200 || response_code_ == 206) {
+            writeBuff_->Append("Accept-Ranges: bytes\r\n") ; 
+            AddValidators_() ; 
+        }
+        if(ranges_.size() == 1) {
+            if(response_code_ == 206) {
+                writeBuff_->Append("Content-Range: " + contentRange_(ranges_[0] , fileSize) + "\r\n") ; 
+            }
+            contentLength = bodyLen ; 
+        }else {
+            std::string fileType(GetFileType_()) ; 
+            for(const auto &range : ranges_) {
+                partHeads.push_back("\r\n--" + boundary_ + "\r\nContent-Type: " + fileType + 
+                                    "\r\nContent-Range: " + contentRange_(range , fileSize) + "\r\n\r\n") ; 
+                contentLength += partHeads.back().size() ; 
+            }
+            partTail = "\r\n--" + boundary_ + "--\r\n" ; 
+            contentLength += bodyLen + partTail.size() ; 
+        }
+        writeBuff_->Append("Content-Length: " + std::to_string(contentLength) + "\r\n\r\n") ; 
+        if(method_ == "HEAD") return true ; 
 
-        if(dataFile  == MAP_FAILED) {
-            munmap(dataFile, mmFileStat_.st_size); dataFile = nullptr ; 
-            LOG_ERROR("mmap file %s error %d !!!" ,  file_.data() , errno); 
-            return false ; 
+        SEGMENT_TYPE type = SEG_BUFFER ; 
+        size_t base = 0 ; // 内容在片段数据源中的起始偏移
+        if(memBody_ != nullptr) {
+            type = SEG_MEMORY ; 
+        }else if(pack_ != nullptr) { // 资源包已经映射，大的 sendfile 包文件，其余直接 writev 映射的内存
+            type = bodyLen >= http_config_->sendfileSize ? SEG_FILE : SEG_PACK ; 
+            base = packVariant_.offset ; 
+            if(type == SEG_FILE) *fd = pack_->GetFd() ; 
+        }else if(bodyLen >= http_config_->sendfileSize) {
+            type = SEG_FILE ; 
+        }else if(bodyLen >= http_config_->smallFileSize) {
+            char *dataFile = reinterpret_cast<char*>(mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE , *fd , 0)) ;
+            if(dataFile == MAP_FAILED) {
+                LOG_ERROR("mmap file %s error %d !!!" ,  file_.data() , errno); 
+                writeBuff_->Unwrite(writeBuff_->BufferUsedSize() - mark) ; 
+                return false ; 
+            }
+            this->mmFile_ = dataFile ; 
+            type = SEG_MMAP ; 
+        }
+        for(size_t i = 0 ; i < ranges_.size() ; ++i) {
+            if(partHeads.size() > 0) writeBuff_->Append(partHeads[i]) ; 
+            if(type == SEG_BUFFER) {
+                if(writeBuff_->AppendFromFd(*fd , ranges_[i].second , ranges_[i].first) == false) {
+                    LOG_ERROR("read file %s error %d !!!" ,  file_.data() , errno); 
+                    writeBuff_->Unwrite(writeBuff_->BufferUsedSize() - mark) ; 
+                    return false ; 
+                }
+            }else {
+                addSegment_(type , base + ranges_[i].first , ranges_[i].second) ; 
+            }
+        }
+        writeBuff_->Append(partTail) ; 
+        if(type == SEG_FILE) {
+            fileFd_ = *fd ; *fd = -1 ;  // 文件 fd 的所有权交给 sendfile ，在 close() 中关闭（包文件的 fd 除外）
         }
-        writeBuff_->Append("Content-Length: " + std::to_string(mmFileStat_.st_size) + "\r\n\r\n");
-        this->mmFile_ = dataFile ; 
         return true ;
     }
 
-    bool makeHttpResponse(const int numStatus){
-        bool is_File = true ; 
-        std::string json_string ; 
-        /* 判断请求的资源文件 */
-        if(numStatus == 200){
-            // 处理 Post 请求,判断是否是用户登录，颁发 Token 
-            if(method_ == "POST" && (path_ == "/login.html" || path_ == "/register.html") ) { 
-                is_File = false ; // 返回 json 字符串
-                if(UserVerify(post_["username"], post_["password"])) {
-                    is_JWToken_ = true ; // 在头部的 Set-Cookie 里放入 Token 
-                    json_string = R"({"status":true})"; 
-                } else {
-                    json_string = R"({"status":false})"; 
-                }
+    // 先把 writeBuff_ 中还没划分的数据作为一个片段，再添加 mmap 或者 sendfile 的片段
+    void addSegment_(SEGMENT_TYPE type , size_t offset , size_t len) {
+        size_t used = writeBuff_->BufferUsedSize() ; 
+        if(used > bufMark_) {
+            segments_.push_back({SEG_BUFFER , bufMark_ , used - bufMark_}) ; 
+            bufMark_ = used ; 
+        }
+        if(len > 0) segments_.push_back({type , offset , len}) ; 
+    }
+
+    static std::string contentRange_(const std::pair<size_t , size_t> &range , const size_t fileSize) {
+        return "bytes " + std::to_string(range.first) + "-" + std::to_string(range.first + range.second - 1) + "/" + std::to_string(fileSize) ; 
+    }
+
+    // HTTP 日期格式，如 Sun, 06 Nov 1994 08:49:37 GMT
+    static std::string httpDate_(const time_t t) {
+        struct tm tmTime ; 
+        char buf[64] ; 
+        gmtime_r(&t , &tmTime) ; 
+        size_t len = strftime(buf , sizeof(buf) , "%a, %d %b %Y %H:%M:%S GMT" , &tmTime) ; 
+        return std::string(buf , len) ; 
+    }
+
+    static time_t parseHttpDate_(const std::string &date) {
+        struct tm tmTime = { 0 } ; 
+        const char* end = strptime(date.data() , "%a, %d %b %Y %H:%M:%S GMT" , &tmTime) ; 
+        if(end == nullptr) return -1 ; 
+        return timegm(&tmTime) ; 
+    }
+
+    // 强 ETag 由 inode 、文件大小和修改时间生成，文件内容变化时这三者至少有一个会变
+    // 在线压缩的版本内容不同，ETag 也要区分开
+    std::string GetETag_() const {
+        if(pack_ != nullptr) return std::string(packVariant_.etag) ; // 打包时已经生成
+        char buf[96] ; 
+        const char* fmt = isOnTheFlyGzip_() ? "\"%lx-%lx-%lx.%lx-gz\"" : "\"%lx-%lx-%lx.%lx\"" ; 
+        snprintf(buf , sizeof(buf) , fmt , static_cast<unsigned long>(mmFileStat_.st_ino) , 
+                 static_cast<unsigned long>(mmFileStat_.st_size) , static_cast<unsigned long>(mmFileStat_.st_mtim.tv_sec) , 
+                 static_cast<unsigned long>(mmFileStat_.st_mtim.tv_nsec)) ; 
+        return buf ; 
+    }
+
+    void AddValidators_() {
+        if(pack_ != nullptr) { // 资源包中预先生成了这部分头部
+            writeBuff_->Append(packVariant_.head.data() , packVariant_.head.size()) ; 
+            return ; 
+        }
+        writeBuff_->Append("ETag: " + GetETag_() + "\r\n") ; 
+        writeBuff_->Append("Last-Modified: " + httpDate_(mmFileStat_.st_mtime) + "\r\n") ; 
+        std::string_view cacheControl = GetCacheControl_() ; 
+        writeBuff_->Append("Cache-Control: ") ; 
+        writeBuff_->Append(cacheControl.data() , cacheControl.size()) ; 
+        writeBuff_->Append("\r\n") ; 
+        if(is_Compressible_) writeBuff_->Append("Vary: Accept-Encoding\r\n") ; 
+        if(!contentEncoding_.empty()) writeBuff_->Append("Content-Encoding: " + contentEncoding_ + "\r\n") ; 
+    }
+
+    bool isOnTheFlyGzip_() const {
+        return contentEncoding_ == "gzip" && encodedSuffix_.empty() ; 
+    }
+
+    // Accept-Encoding: gzip, deflate, br;q=0.8, *;q=0 ，q=0 表示不接受
+    static bool acceptEncoding_(const std::string &value , const std::string &encoding) {
+        bool wildcard = false ; 
+        size_t pos = 0 ; 
+        while(pos < value.size()) {
+            size_t comma = value.find(',' , pos) ; 
+            if(comma == std::string::npos) comma = value.size() ; 
+            std::string item = value.substr(pos , comma - pos) ; 
+            pos = comma + 1 ; 
+            size_t semi = item.find(';') ; 
+            std::string token = item.substr(0 , semi) ; 
+            token.erase(0 , token.find_first_not_of(' ')) ; 
+            token.erase(token.find_last_not_of(' ') + 1) ; 
+            bool accept = true ; 
+            if(semi != std::string::npos) {
+                size_t q = item.find("q=" , semi) ; 
+                if(q != std::string::npos) accept = atof(item.data() + q + 2) > 0 ; 
             }
-            // 处理 Get 请求，聊天界面，要验证 Token 
-            if(method_ == "GET" && path_ == "/chat.html") { 
-                if(Jwt_->judgeJWT(header_["Cookie"])) {
-                    path_ = "/chat.html";
-                }else {
-                    path_ = "/login.html";
-                }
+            if(strcasecmp(token.data() , encoding.data()) == 0) return accept ; 
+            if(token == "*") wildcard = accept ; 
+        }
+        return wildcard ; 
+    }
+
+    // 内容协商：优先使用预压缩好的 .br / .gz 文件，其次文本类资源在线 gzip 压缩（结果缓存在 CompressCache 中）
+    // 预压缩文件是否存在记录在 FileCache 的条目里，不需要再 stat
+    void negotiateEncoding_(const FileCache::Entry &entry) {
+        is_Compressible_ = HttpConfigInfo::IsCompressibleType(GetFileType_()) ; 
+        auto iter = header_.find("Accept-Encoding") ; 
+        if(iter == header_.end() || (method_ != "GET" && method_ != "HEAD")) return ; 
+        static const char* const ENCODINGS[FileCache::SIDECAR_COUNT] = { "br" , "gzip" } ; 
+        for(int i = 0 ; i < FileCache::SIDECAR_COUNT ; ++i) {
+            if(entry.hasSidecar[i] && acceptEncoding_(iter->second , ENCODINGS[i])) {
+                is_Compressible_ = true ; 
+                contentEncoding_ = ENCODINGS[i] ; encodedSuffix_ = FileCache::SIDECAR_SUFFIX[i] ; 
+                mmFileStat_ = entry.sidecarStat[i] ; 
+                return ; 
             }
-            // 获取用户名，返回 json 内容
-            if(method_ == "GET" && path_ == "/getUsername") { 
-                is_File = false ; // 返回 json 字符串
-                std::string userName = Jwt_->parseJWT(header_["Cookie"] , "name") ; 
-                if(userName.size() > 0){
-                    json_string = R"({"name":")" + userName + R"("})";  
+        }
+        // Range 请求针对的是原文件的字节，在线压缩时不支持，直接发送原文件
+        size_t fileSize = mmFileStat_.st_size ; 
+        if(is_Compressible_ && acceptEncoding_(iter->second , "gzip") && header_.count("Range") == 0 && 
+           fileSize >= http_config_->compressMinSize && fileSize <= http_config_->compressMaxSize) {
+            contentEncoding_ = "gzip" ; 
+        }
+    }
+
+    // 在当前的资源包中查找请求的路径，找到时持有这个包，并按资源的信息填写 mmFileStat_ 
+    bool findPackAsset_(PackAsset &asset) {
+        std::shared_ptr<const ResourcePack> pack = ResourcePack::Current() ; 
+        if(pack == nullptr || pack->find(path_ , asset) == false) return false ; 
+        pack_ = std::move(pack) ; 
+        mmFileStat_ = { 0 } ; 
+        mmFileStat_.st_mode = S_IFREG | 0444 ; 
+        mmFileStat_.st_size = asset.plain.size ; 
+        mmFileStat_.st_mtime = asset.mtime ; 
+        return true ; 
+    }
+
+    // 资源包中的 gzip 版本打包时已经压缩好，相当于预压缩文件，不再在线压缩
+    void negotiatePack_(const PackAsset &asset) {
+        packVariant_ = asset.plain ; 
+        auto iter = header_.find("Accept-Encoding") ; 
+        if(asset.gzip.size == 0 || iter == header_.end() || (method_ != "GET" && method_ != "HEAD")) return ; 
+        if(acceptEncoding_(iter->second , "gzip")) {
+            packVariant_ = asset.gzip ; 
+            contentEncoding_ = "gzip" ; encodedSuffix_ = ".gz" ; 
+            mmFileStat_.st_size = asset.gzip.size ; 
+        }
+    }
+
+    // If-None-Match 优先于 If-Modified-Since ，两者都满足条件说明客户端缓存仍然有效，返回 304
+    bool isNotModified_() const {
+        if(method_ != "GET" && method_ != "HEAD") return false ; 
+        auto iter = header_.find("If-None-Match") ; 
+        if(iter != header_.end()) {
+            // 值是 * 或者多个 ETag 的列表；GET 使用弱比较，去掉 W/ 前缀之后相同就算匹配
+            const std::string etag = GetETag_() ; 
+            std::string_view value(iter->second) ; 
+            while(!value.empty()) {
+                size_t comma = value.find(',') ; 
+                std::string_view item = value.substr(0 , comma) ; 
+                value = comma == std::string_view::npos ? std::string_view() : value.substr(comma + 1) ; 
+                while(!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1) ; 
+                while(!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1) ; 
+                if(item == "*") return true ; 
+                if(item.substr(0 , 2) == "W/") item.remove_prefix(2) ; 
+                if(item == etag) return true ; 
+            }
+            return false ; 
+        }
+        iter = header_.find("If-Modified-Since") ; 
+        if(iter != header_.end()) {
+            time_t since = parseHttpDate_(iter->second) ; 
+            return since != -1 && mmFileStat_.st_mtime <= since ; 
+        }
+        return false ; 
+    }
+
+    // If-Range 校验失败说明客户端缓存的文件已经变了，忽略 Range 发送整个文件
+    bool ifRangeMatch_() const {
+        auto iter = header_.find("If-Range") ; 
+        if(iter == header_.end()) return true ; 
+        const std::string &value = iter->second ; 
+        if(value.compare(0 , 2 , "W/") == 0) return false ; // If-Range 要求强比较，弱 ETag 一律不匹配
+        if(value.size() > 0 && value[0] == '"') return value == GetETag_() ; 
+        return value == httpDate_(mmFileStat_.st_mtime) ; 
+    }
+
+    // 解析 Range: bytes=0-499,500-999,-500,9500- ，结果放入 ranges_
+    // 返回 200 表示忽略 Range 发送整个文件，206 表示发送部分内容，416 表示有格式正确的区间但都不满足
+    // 重叠、相邻的区间按起始偏移排序之后合并；请求的总长度超过文件大小（比如 bytes=0-,0-,...）时发送整个文件
+    int parseRange_(const size_t fileSize) {
+        ranges_.clear() ; 
+        auto iter = header_.find("Range") ; 
+        if(iter == header_.end() || (method_ != "GET" && method_ != "HEAD")) return 200 ; 
+        if(ifRangeMatch_() == false) return 200 ; 
+        const std::string &value = iter->second ; 
+        if(value.compare(0 , 6 , "bytes=") != 0) return 200 ; 
+
+        auto toNumber = [](const std::string &str , size_t &num) -> bool {
+            if(str.empty() || str.size() > 18) return false ; 
+            num = 0 ; 
+            for(char ch : str) {
+                if(ch < '0' || ch > '9') return false ; 
+                num = num * 10 + (ch - '0') ; 
+            }
+            return true ; 
+        } ; 
+        size_t pos = 6 , parsed = 0 , requested = 0 ; 
+        while(pos < value.size()) {
+            size_t comma = value.find(',' , pos) ; 
+            if(comma == std::string::npos) comma = value.size() ; 
+            size_t left = value.find_first_not_of(' ' , pos) , right = value.find_last_not_of(' ' , comma - 1) ; 
+            pos = comma + 1 ; 
+            if(left == std::string::npos || left >= comma || right < left) continue ; 
+            std::string spec = value.substr(left , right - left + 1) ; 
+            size_t dash = spec.find('-') ; 
+            if(dash == std::string::npos) return 200 ; // 格式错误，按规范忽略 Range
+            std::string first = spec.substr(0 , dash) , last = spec.substr(dash + 1) ; 
+            size_t start = 0 , end = 0 ; 
+            if(first.empty()) { // 后缀区间，最后 N 个字节
+                if(toNumber(last , end) == false) return 200 ; 
+                ++parsed ; 
+                if(end == 0 || fileSize == 0) continue ; 
+                start = fileSize > end ? fileSize - end : 0 ; 
+                end = fileSize - 1 ; 
+            }else {
+                if(toNumber(first , start) == false) return 200 ; 
+                if(last.empty()) {
+                    end = fileSize - 1 ; 
+                }else if(toNumber(last , end) == false || end < start) {
+                    return 200 ; 
                 }
+                ++parsed ; 
+                if(start >= fileSize) continue ; // 该区间不满足
+                end = std::min(end , fileSize - 1) ; 
+            }
+            ranges_.emplace_back(start , end - start + 1) ; 
+            requested += end - start + 1 ; 
+            if(ranges_.size() > http_config_->maxRangeCount || requested > fileSize) { // 区间太多或者重复请求同一段内容，可能是恶意请求，直接发送整个文件
+                ranges_.clear() ; 
+                return 200 ; 
+            }
+        }
+        if(parsed == 0) return 200 ; // bytes= 、bytes=,, 没有区间，忽略 Range
+        if(ranges_.empty()) return 416 ; 
+        std::sort(ranges_.begin() , ranges_.end()) ; 
+        size_t merged = 0 ; 
+        for(size_t i = 1 ; i < ranges_.size() ; ++i) {
+            auto &last = ranges_[merged] ; 
+            if(ranges_[i].first <= last.first + last.second) { // 重叠或者相邻
+                last.second = std::max(last.first + last.second , ranges_[i].first + ranges_[i].second) - last.first ; 
+            }else {
+                ranges_[++merged] = ranges_[i] ; 
+            }
+        }
+        ranges_.resize(merged + 1) ; 
+        if(ranges_.size() > 1) {
+            static thread_local std::mt19937_64 rng(std::random_device{}()) ; 
+            char buf[32] ; 
+            snprintf(buf , sizeof(buf) , "%016llx" , static_cast<unsigned long long>(rng())) ; 
+            boundary_ = std::string("TinyWebServer_") + buf ; 
+        }
+        return 206 ; 
+    }
+
+    // 路由表启动时构建一次，之后只读；新的接口在这里注册即可
+    static Router<Route>& Routes() {
+        static Router<Route> router = DefaultRoutes_() ; 
+        return router ; 
+    }
+
+    static Router<Route> DefaultRoutes_() {
+        Router<Route> router ; 
+        // 不带后缀的页面改写为对应的 html 文件
+        router.add("GET" , "/" , {[](HttpProtocol& http , const RouteParams&) { http.RewritePath("/index.html") ; }}) ; 
+        for(const char* page : {"/index" , "/register" , "/login" , "/welcome" , "/video" , "/picture" , "/websocket"}) {
+            router.add("GET" , page , {[](HttpProtocol& http , const RouteParams&) { http.RewritePath(http.path_ + ".html") ; }}) ; 
+        }
+        // 处理 Post 请求,判断是否是用户登录，颁发 Token 
+        for(const char* page : {"/login" , "/login.html" , "/register" , "/register.html"}) {
+            router.add("POST" , page , {[](HttpProtocol& http , const RouteParams&) { http.handleLogin_() ; }}) ; 
+        }
+        // 处理 Get 请求，聊天界面，要验证 Token 
+        for(const char* page : {"/chat" , "/chat.html"}) {
+            router.add("GET" , page , {[](HttpProtocol& http , const RouteParams&) { 
+                http.RewritePath(http.Jwt_->judgeJWT(http.header_["Cookie"]) ? "/chat.html" : "/login.html") ; 
+            }}) ; 
+        }
+        // 图片页面上传图片，需要登录；multipart 中的文件已经写入临时文件，这里只是移动到 images 目录下
+        router.add("POST" , "/upload" , {[](HttpProtocol& http , const RouteParams&) { http.handleUpload_() ; } , true , true}) ; 
+        // 获取用户名，返回 json 内容
+        router.add("GET" , "/getUsername" , {[](HttpProtocol& http , const RouteParams&) { 
+            std::string userName = http.getUserName() ; 
+            http.SetBody(userName.size() > 0 ? R"({"name":")" + userName + R"("})" : "") ; 
+        }}) ; 
+        // WebSocket 发送队列的统计
+        router.add("GET" , "/ws/stats" , {[](HttpProtocol& http , const RouteParams&) { 
+            http.SetBody(WsStats::Instance().ToJson() , "application/json") ; 
+        }}) ; 
+        return router ; 
+    }
+
+    // 路由处理函数使用的接口
+    const std::string& GetMethod() const { return method_ ; }
+    const std::string& GetPath() const { return path_ ; }
+    const std::string& GetQuery() const { return query_ ; }
+    const std::unordered_map<std::string, std::string>& GetHeaders() const { return header_ ; }
+    std::string GetHeader(const std::string &key) const {
+        auto iter = header_.find(key) ; 
+        return iter == header_.end() ? "" : iter->second ; 
+    }
+    std::string GetPost(const std::string &key) const {
+        auto iter = post_.find(key) ; 
+        return iter == post_.end() ? "" : iter->second ; 
+    }
+    // 内存中的 body ；multipart 或者太大的 body 为空，内容在 GetUploads 的临时文件里
+    const std::string& GetBody() const { return requestBody_ ; }
+    std::vector<UploadPart>& GetUploads() { return upload_.GetUploads() ; }
+    // 直接返回内容，不再查找静态文件；type 为空则按请求路径后缀判断 Content-Type
+    void SetBody(std::string body , std::string_view type = std::string_view()) {
+        is_File_ = false ; 
+        body_ = std::move(body) ; 
+        bodyType_ = type ; 
+    }
+    // 流式返回内容，不需要提前知道长度：HTTP/1.1 按 chunked 编码发送，HTTP/1.0 发送完关闭连接，HTTP/2 由 END_STREAM 结束
+    void SetStream(StreamProducer producer , std::string_view type = std::string_view()) {
+        is_File_ = false ; 
+        producer_ = std::move(producer) ; 
+        bodyType_ = type ; 
+    }
+    // 只能在生产者中调用，每次调用是一个分块；空内容直接忽略，长度为 0 的分块表示结束
+    void WriteChunk(const char* data , size_t len) {
+        if(len == 0) return ; 
+        if(is_Chunked_) {
+            char head[24] ; 
+            int n = snprintf(head , sizeof(head) , "%zx\r\n" , len) ; 
+            writeBuff_->Append(head , n) ; 
+        }
+        writeBuff_->Append(data , len) ; 
+        if(is_Chunked_) writeBuff_->Append("\r\n" , 2) ; 
+    }
+    void WriteChunk(std::string_view data) {
+        WriteChunk(data.data() , data.size()) ; 
+    }
+    // 改写请求路径，交给静态文件处理
+    void RewritePath(std::string path) {
+        path_ = std::move(path) ; 
+    }
+
+    // 返回 {"status":true,"files":["/images/a.png"]} ，不是图片或者同名文件已经存在的跳过
+    // 路由标记了需要登录，没有登录的请求在收 body 之前已经返回 401 了
+    void handleUpload_() {
+        picojson::array files ; 
+        for(UploadPart &part : GetUploads()) {
+            std::string name = uploadName_(part.filename) ; 
+            if(name.empty()) {
+                LOG_WARN("upload file %s is not an image" , part.filename.data()) ; 
+                continue ; 
+            }
+            if(UploadParser::Save(part , http_config_->srcDir + std::string("/images/") + name)) {
+                files.push_back(picojson::value("/images/" + name)) ; 
             }
+        }
+        picojson::object result ; 
+        result["status"] = picojson::value(true) ; 
+        result["files"] = picojson::value(files) ; 
+        SetBody(picojson::value(result).serialize()) ; 
+    }
+
+    // 客户端的文件名只保留最后一段里的字母、数字、 . - _ ，后缀必须是图片（svg 里可以有脚本，不接受）
+    static std::string uploadName_(const std::string &filename) {
+        std::string name ; 
+        for(char ch : filename.substr(filename.find_last_of("/\\") + 1)) {
+            if(isalnum(static_cast<unsigned char>(ch)) || ch == '.' || ch == '-' || ch == '_') name.push_back(ch) ; 
+        }
+        std::string::size_type idx = name.find_last_of('.') ; 
+        if(name.empty() || name[0] == '.' || idx == std::string::npos) return "" ; 
+        const SuffixInfo* info = HttpConfigInfo::FindSuffix(std::string_view(name).substr(idx)) ; 
+        if(info == nullptr || info->type.substr(0 , 6) != "image/" || info->type == "image/svg+xml") return "" ; 
+        return name ; 
+    }
+
+    void handleLogin_() {
+        if(UserVerify(post_["username"], post_["password"])) {
+            is_JWToken_ = true ; // 在头部的 Set-Cookie 里放入 Token 
+            SetBody(R"({"status":true})") ; 
+        } else {
+            SetBody(R"({"status":false})") ; 
+        }
+    }
 
-            if(is_File == true) {
-                std::string filePath = http_config_.srcDir + path_ ;  
-                if(stat(filePath.data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) { 
-                    LOG_WARN("requests file %s Not Found" , filePath.data()) ; 
-                    response_code_ = 404; // 文件不存在
-                    response_status_ = "File Not Found" ; 
+    bool makeHttpResponse(const int numStatus){
+        is_File_ = true ; 
+        /* 判断请求的资源文件 */
+        if(numStatus == 200){
+            setStatus_(200) ; 
+            // 先查路由表，没有匹配的路由则按静态文件处理
+            RouteParams params ; 
+            const Route* route = Routes().find(method_ , path_ , params) ; 
+            if(route != nullptr) {
+                route->handler(*this , params) ; 
+            }
+
+            if(is_File_ == true) {
+                std::string filePath = http_config_->srcDir + path_ ;  
+                FileCache::EntryPtr entry ; 
+                PackAsset asset ; 
+                if(findPackAsset_(asset) == false) { // 资源包中没有的再查找 srcDir 
+                    entry = FileCache::Instance().lookup(filePath) ; 
+                    if(entry != nullptr) mmFileStat_ = entry->fileStat ; 
+                }
+                if(pack_ == nullptr && (entry == nullptr || S_ISDIR(mmFileStat_.st_mode))) { 
+                    LOG_DEBUG("requests file %s Not Found" , filePath.data()) ; // 扫描器的请求很多，不记录到 WARN 
+                    setStatus_(404) ; // 文件不存在
                     path_ = "/404.html"; 
-                }else if(!(mmFileStat_.st_mode & S_IROTH)) {
+                }else if(pack_ == nullptr && !(mmFileStat_.st_mode & S_IROTH)) {
                     LOG_WARN("requests file %s Forbidden" , filePath.data()) ; 
-                    response_code_ = 403; // 没有权限访问
-                    response_status_ = "Forbidden" ; 
+                    setStatus_(403) ; // 没有权限访问
                     path_ = "/403.html"; 
                 }else { 
-                    response_code_ = 200; // 成功 
-                    response_status_ = "OK" ; 
+                    if(pack_ != nullptr) negotiatePack_(asset) ; 
+                    else negotiateEncoding_(*entry) ; 
+                    if(isNotModified_()) {
+                        setStatus_(304) ; // 客户端缓存仍然有效
+                    }else {
+                        setStatus_(200) ; // 成功 
+                        if(isOnTheFlyGzip_()) {
+                            memBody_ = CompressCache::Instance().getGzip(filePath , mmFileStat_) ; 
+                            if(memBody_ == nullptr) contentEncoding_.clear() ; // 压缩失败，发送原文件
+                        }
+                        if(memBody_ == nullptr && encodedSuffix_.empty() && entry != nullptr) memBody_ = entry->content ; // 小文件的内容已经缓存，不用打开文件
+                        int rangeCode = parseRange_(memBody_ != nullptr ? memBody_->size() : mmFileStat_.st_size) ; 
+                        if(rangeCode == 206) {
+                            setStatus_(206) ; // 部分内容
+                        }else if(rangeCode == 416) {
+                            setStatus_(416) ; // 请求的区间不满足
+                        }
+                    }
                 }
             }
             
         }else {
-            response_code_ = 400; // 客户端请求错误
-            response_status_ = "Bad Request" ; 
+            setStatus_(rejectCode_ != 0 ? rejectCode_ : 400) ; // 客户端请求错误，或者在收 body 之前拒绝了请求
+            path_ = "/400.html" ; 
         } 
         if(AddStateLine() == false ){
             LOG_ERROR("server add state line error !!!") ; 
@@ -409,62 +1198,56 @@ public :
             LOG_ERROR("server add header error !!!") ; 
             return false ; 
         } 
-        if(is_File == false) {
-            writeBuff_->Append("Content-Length: " + std::to_string(json_string.size()) + "\r\n\r\n");
-            writeBuff_->Append(json_string) ; 
-
-        }else if(is_File == true && (response_code_ == 400 || AddBody() == false))  {
-             
-            auto ErrorContent = [&]() -> bool {
-                std::string body; 
-                body += "<html><title>Error</title>";
-                body += "<body bgcolor=\"ffffff\">";
-                // response_code_ = 404; // 文件不存在
-                // response_status_ = "Not Found" ;  
-                body += std::to_string(response_code_) + " : " + response_status_  + "\n";
-                body += "<p>" + response_status_ + "</p>";
-                body += "<hr><em>TinyWebServer</em></body></html>";
-                writeBuff_->Append("Content-Length: " + std::to_string(body.size()) + "\r\n\r\n");
-                return writeBuff_->Append(body);
-            } ; 
-
-            if(ErrorContent()) {
-                LOG_WARN("%s %d server send ErrorContent success!!!" , path_.data() , response_code_) ;  
-            }else {
+        ErrorPages::PagePtr errorPage ; 
+        if(producer_ != nullptr) { // 流式响应，内容在发送时由生产者逐批生成
+            is_Chunked_ = version_ == "HTTP/1.1" ; 
+            if(is_Chunked_) writeBuff_->Append("Transfer-Encoding: chunked\r\n") ; 
+            writeBuff_->Append("\r\n") ; 
+            is_StreamEnd_ = method_ == "HEAD" ; 
+        }else if(is_File_ == false) {
+            writeBuff_->Append("Content-Length: " + std::to_string(body_.size()) + "\r\n\r\n");
+            if(method_ != "HEAD") writeBuff_->Append(body_) ; 
+
+        }else if(is_File_ == true && (errorPage = ErrorPages::Instance().find(response_code_)) != nullptr) {
+            // 400 / 403 / 404 直接发送预先生成的页面
+            writeBuff_->Append(errorPage->head) ; 
+            if(method_ != "HEAD") {
+                memBody_ = errorPage->body ; 
+                addSegment_(SEG_MEMORY , 0 , memBody_->size()) ; 
+            }
+        }else if(is_File_ == true && (response_code_ == 400 || rejectCode_ != 0 || AddBody() == false))  {
+            // 文件读取失败等意外情况，发送内置模板生成的页面
+            std::string body = ErrorPages::Render(response_code_) ; 
+            writeBuff_->Append("Content-Length: " + std::to_string(body.size()) + "\r\n\r\n");
+            if(method_ != "HEAD" && writeBuff_->Append(body) == false) {
                 LOG_ERROR("server add file content error !!!") ;  
                 return false ;
-            } 
-        }
-        // 响应头文件内容信息
-        if(mmFile_ == nullptr){
-            write_iov_ = new iovec[1] ; 
-            if(write_iov_ == nullptr) {
-                LOG_ERROR("write iov new Fail") ; 
-                close() ; return false ;
             }
-            write_iov_[0].iov_base = const_cast<char*> (writeBuff_->BufferStart()) ;
-            write_iov_[0].iov_len = writeBuff_->BufferUsedSize() ; 
-            iovCnt_ = 1 ; 
-        }else {
-            write_iov_ = new iovec[2] ; 
-            if(write_iov_ == nullptr) {
-                LOG_ERROR("write iov new Fail") ; 
-                close() ; return false ;
-            }
-            write_iov_[0].iov_base = const_cast<char*> (writeBuff_->BufferStart()) ;
-            write_iov_[0].iov_len = writeBuff_->BufferUsedSize() ; 
-            /* mmap 文件 */
-            write_iov_[1].iov_base = mmFile_ ;
-            write_iov_[1].iov_len = mmFileStat_.st_size ;
-            iovCnt_ = 2 ;
+            LOG_WARN("%s %d server send ErrorContent success!!!" , path_.data() , response_code_) ;  
         }
+        // 剩余的响应头以及内存中的内容
+        addSegment_(SEG_BUFFER , 0 , 0) ; 
+        segIdx_ = 0 ; 
+        // sendfile 模式下，先 cork 住响应头，等文件内容一起发出，避免响应头单独成一个小包
+        if(fileFd_ != -1) setCork_(true) ; 
         return true ; 
     }
 
     STATUS_CODE dealHttpResponse() {   
         ssize_t len = -1 ; 
         do{
-            len = writev(fd_ , write_iov_ , iovCnt_) ;   
+            if(segIdx_ >= segments_.size()) {
+                if(IsResponseDone()) break ; 
+                nextStreamBatch_() ; // 流式响应：上一批发送完了才生成下一批
+                if(segIdx_ >= segments_.size()) break ; 
+            }
+            if(segments_[segIdx_].type == SEG_FILE) { // sendfile 写文件内容
+                off_t offset = segments_[segIdx_].offset ; 
+                len = transport_->Sendfile(fileFd_ , &offset , segments_[segIdx_].len) ; 
+            }else { // writev 一次写出后续连续的内存片段（响应头、writeBuff_ 中的内容、mmap 的文件）
+                int iovCnt = fillIov_() ; 
+                len = transport_->Writev(write_iov_.data() , iovCnt) ;   
+            }
             if(len < 0){
                 if(errno == EWOULDBLOCK) {// fd_缓冲区满了 EWOULDBLOCK 或者 被信号中断了，继续写，继续发送
                     return CONTINUE_CODE ; 
@@ -474,22 +1257,110 @@ public :
                     LOG_ERROR("Write FD Error") ;
                     close(); return CLOSE_CONNECTION ;
                 }
-            }else {
-                if(static_cast<size_t>(len) > write_iov_[0].iov_len){
-                    write_iov_[1].iov_base = (uint8_t*) write_iov_[1].iov_base + (len - write_iov_[0].iov_len);
-                    write_iov_[1].iov_len -= (len - write_iov_[0].iov_len);
-                    write_iov_[0].iov_base = write_iov_[1].iov_base ; 
-                    write_iov_[0].iov_len = write_iov_[1].iov_len ;
-                    writeBuff_->clear(); --iovCnt_ ; 
-                } else {
-                    write_iov_[0].iov_base = (uint8_t*)write_iov_[0].iov_base + len; 
-                    write_iov_[0].iov_len -= len; 
-                }
             }
-            if((write_iov_[0].iov_len <= 0)) { // 传输完成 , 本次 http 请求应答结束，故关闭
-                return GOOD_CODE ;
-            } 
+            if(len == 0 && segments_[segIdx_].type == SEG_FILE) { // 文件在发送过程中被截断了
+                LOG_ERROR("sendfile file truncated , remain %zu" , segments_[segIdx_].len) ; 
+                close(); return CLOSE_CONNECTION ;
+            }
+            advanceSegments_(len) ; 
         }while(is_ET_) ; 
+        // LT 模式下只写一次，没写完的等下一次 EPOLLOUT 继续写
+        if(IsResponseDone() == false) return CONTINUE_CODE ;
+        // 传输完成 , 本次 http 请求应答结束
+        setCork_(false) ; 
+        writeBuff_->clear() ; 
+        return GOOD_CODE ;
+    }
+
+    // 把从 segIdx_ 开始的连续内存片段填入 write_iov_
+    int fillIov_() {
+        write_iov_.clear() ; 
+        for(size_t i = segIdx_ ; i < segments_.size() && write_iov_.size() < IOV_MAX ; ++i) {
+            const Segment &seg = segments_[i] ; 
+            if(seg.type == SEG_FILE) break ; 
+            write_iov_.push_back({const_cast<char*>(segmentBase_(seg)) + seg.offset , seg.len}) ; 
+        }
+        return static_cast<int>(write_iov_.size()) ; 
+    }
+
+    const char* segmentBase_(const Segment &seg) const {
+        return seg.type == SEG_BUFFER ? writeBuff_->BufferStart() : 
+               seg.type == SEG_MMAP ? mmFile_ : 
+               seg.type == SEG_PACK ? pack_->GetData() : memBody_->data() ; 
+    }
+
+    // HTTP/2 需要自己组帧，不直接写 fd ：按顺序把剩余的响应报文（状态行、头部和内容）拷贝到 dst
+    // 返回拷贝的字节数，文件读取出错返回 -1 
+    ssize_t ReadResponse(char* dst , size_t len) {
+        size_t total = 0 ; 
+        while(total < len && IsResponseDone() == false) {
+            if(segIdx_ >= segments_.size()) {
+                nextStreamBatch_() ; 
+                continue ; 
+            }
+            const Segment &seg = segments_[segIdx_] ; 
+            size_t n = std::min(len - total , seg.len) ; 
+            if(seg.type == SEG_FILE) {
+                ssize_t ret = pread(fileFd_ , dst + total , n , seg.offset) ; 
+                if(ret < 0 && errno == EINTR) continue ; 
+                if(ret <= 0) { // 出错或者文件被截断了
+                    LOG_ERROR("read response file error %d , remain %zu" , errno , seg.len) ; 
+                    return -1 ; 
+                }
+                n = ret ; 
+            }else {
+                memcpy(dst + total , segmentBase_(seg) + seg.offset , n) ; 
+            }
+            advanceSegments_(n) ; 
+            total += n ; 
+        }
+        return total ; 
+    }
+
+    bool IsResponseDone() const {
+        return segIdx_ >= segments_.size() && (producer_ == nullptr || is_StreamEnd_) ; 
+    }
+
+    // 调用生产者生成下一批内容，超过水位就先发送；写完时追加 chunked 的结束块
+    void nextStreamBatch_() {
+        writeBuff_->clear() ; 
+        segments_.clear() ; segIdx_ = 0 ; bufMark_ = 0 ; 
+        bool more = true ; 
+        while(more && writeBuff_->BufferUsedSize() < http_config_->streamWatermark) {
+            size_t used = writeBuff_->BufferUsedSize() ; 
+            more = producer_(*this) ; 
+            if(more && writeBuff_->BufferUsedSize() == used) { // 没有数据又不结束，会一直被调用，直接结束响应
+                LOG_ERROR("%s stream producer write nothing" , path_.data()) ; 
+                more = false ; 
+            }
+        }
+        if(more == false) {
+            is_StreamEnd_ = true ; 
+            if(is_Chunked_) writeBuff_->Append("0\r\n\r\n" , 5) ; 
+        }
+        addSegment_(SEG_BUFFER , 0 , 0) ; 
+    }
+
+    // 部分写入之后，推进片段，下一次 EPOLLOUT 从断点处续写
+    void advanceSegments_(size_t len) {
+        while(len > 0 && segIdx_ < segments_.size()) {
+            Segment &seg = segments_[segIdx_] ; 
+            if(len < seg.len) {
+                seg.offset += len ; 
+                seg.len -= len ; 
+                return ; 
+            }
+            len -= seg.len ; 
+            seg.len = 0 ; 
+            ++segIdx_ ; 
+        }
+    }
+
+    void setCork_(bool on) {
+        if(is_Cork_ == on || fd_ < 0) return ; // HTTP/2 的流没有自己的 fd 
+        int opt = on ? 1 : 0 ; 
+        setsockopt(fd_ , IPPROTO_TCP , TCP_CORK , &opt , sizeof(opt)) ; 
+        is_Cork_ = on ; 
     }
     
     // 用户认证
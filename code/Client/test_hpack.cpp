@@ -0,0 +1,59 @@
+#include "hpack.h"
+#include <iostream>
+#include <assert.h>
+using namespace std ; 
+
+static string fromHex(const string &hex) {
+    string out ; 
+    for(size_t i = 0 ; i + 1 < hex.size() ; i += 2) out.push_back(static_cast<char>(stoi(hex.substr(i , 2) , nullptr , 16))) ; 
+    return out ; 
+}
+
+static bool decode(HpackDecoder &decoder , const string &block , HeaderList &headers) {
+    headers.clear() ; 
+    return decoder.decode(reinterpret_cast<const uint8_t*>(block.data()) , block.size() , headers) ; 
+}
+
+// 测试 RFC 7541 附录 C.4 中带 Huffman 编码的连续三个请求，动态表在请求之间共享
+void test_rfc_example(){
+    HpackDecoder decoder ; 
+    HeaderList headers ; 
+    assert(decode(decoder , fromHex("828684418cf1e3c2e5f23a6ba0ab90f4ff") , headers)) ; 
+    assert(headers.size() == 4 && headers[3].first == ":authority" && headers[3].second == "www.example.com") ; 
+    assert(decoder.tableSize() == 57) ; 
+
+    assert(decode(decoder , fromHex("828684be5886a8eb10649cbf") , headers)) ; 
+    assert(headers.size() == 5 && headers[3].second == "www.example.com" && headers[4].second == "no-cache") ; 
+    assert(decoder.tableSize() == 110) ; 
+
+    assert(decode(decoder , fromHex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf") , headers)) ; 
+    assert(headers.size() == 5 && headers[2].second == "/index.html" && headers[4].first == "custom-key" && headers[4].second == "custom-value") ; 
+    assert(decoder.tableSize() == 164) ; 
+    cout<<"test_rfc_example pass"<<endl ; 
+}
+
+// 测试编码后再解码得到原来的头部，以及错误输入
+void test_round_trip(){
+    HeaderList headers = { {":status" , "200"} , {":status" , "418"} , {"content-type" , "text/html"} , 
+                           {"content-length" , "12345"} , {"x-custom" , string(300 , 'a')} , {"etag" , "\"1a-2b-3c.4d\""} } ; 
+    string block ; 
+    HpackEncoder::encode(headers , block) ; 
+    assert(static_cast<uint8_t>(block[0]) == 0x88) ; // :status 200 直接使用静态表索引
+
+    HpackDecoder decoder ; 
+    HeaderList decoded ; 
+    assert(decode(decoder , block , decoded)) ; 
+    assert(decoded == headers) ; 
+
+    assert(decode(decoder , fromHex("80") , decoded) == false) ;           // 索引 0 
+    assert(decode(decoder , fromHex("be") , decoded) == false) ;           // 动态表里没有这个索引
+    assert(decode(decoder , fromHex("418cf1e3c2e5") , decoded) == false) ; // 字符串不完整
+    assert(decode(decoder , fromHex("3fe21f") , decoded) == false) ;       // 表大小超过 SETTINGS 的限制
+    cout<<"test_round_trip pass"<<endl ; 
+}
+
+int main(){
+    test_rfc_example() ; 
+    test_round_trip() ; 
+    return 0 ; 
+}
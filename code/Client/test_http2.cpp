@@ -0,0 +1,357 @@
+#include "http2Protocol.h"
+#include <iostream>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+using namespace std ;
+
+static const string PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" ;
+enum { DATA = 0x0 , HEADERS = 0x1 , RST_STREAM = 0x3 , SETTINGS = 0x4 , PING = 0x6 , GOAWAY = 0x7 , WINDOW_UPDATE = 0x8 } ;
+enum { END_STREAM = 0x1 , ACK = 0x1 , END_HEADERS = 0x4 } ;
+
+struct Frame {
+    uint8_t type ;
+    uint8_t flags ;
+    uint32_t stream ;
+    string payload ;
+};
+
+static string uint32Bytes(uint32_t value) {
+    return string{ static_cast<char>(value >> 24) , static_cast<char>(value >> 16) , static_cast<char>(value >> 8) , static_cast<char>(value) } ;
+}
+
+static uint32_t readUint32(const string &str , size_t pos) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(str.data() + pos) ;
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 8) | p[3] ;
+}
+
+static string frame(uint8_t type , uint8_t flags , uint32_t stream , const string &payload) {
+    size_t len = payload.size() ;
+    string head{ static_cast<char>(len >> 16) , static_cast<char>(len >> 8) , static_cast<char>(len) , static_cast<char>(type) , static_cast<char>(flags) } ;
+    return head + uint32Bytes(stream) + payload ;
+}
+
+static string setting(uint16_t id , uint32_t value) {
+    return string{ static_cast<char>(id >> 8) , static_cast<char>(id) } + uint32Bytes(value) ;
+}
+
+static string windowUpdate(uint32_t stream , uint32_t increment) {
+    return frame(WINDOW_UPDATE , 0 , stream , uint32Bytes(increment)) ;
+}
+
+// GET 请求的 HEADERS 帧，请求没有 body ，同时结束这个流
+static string request(uint32_t stream , const string &path) {
+    string block ;
+    HpackEncoder::encode({ {":method" , "GET"} , {":scheme" , "http"} , {":path" , path} , {":authority" , "x"} } , block) ;
+    return frame(HEADERS , END_HEADERS | END_STREAM , stream , block) ;
+}
+
+// /h2/:size 返回的内容
+static string content(size_t size) {
+    string body ;
+    for(size_t i = 0 ; i < size ; ++i) body.push_back(static_cast<char>('a' + i % 26)) ;
+    return body ;
+}
+
+// 测试用的 HTTP/2 连接：服务端使用 socketpair 的一端，测试代码作为客户端读写另一端
+struct Conn {
+    int fds[2] ;
+    Buffer read , write ;
+    unique_ptr<Transport> transport ;
+    unique_ptr<Http2Protocol> h2 ;
+    string inbox ;                          // 客户端收到还没有解析的数据
+
+    Conn() {
+        assert(socketpair(AF_UNIX , SOCK_STREAM , 0 , fds) == 0) ;
+        for(int fd : fds) fcntl(fd , F_SETFL , fcntl(fd , F_GETFL) | O_NONBLOCK) ;
+        transport = make_unique<Transport>(fds[0] , nullptr) ;
+    }
+
+    ~Conn() {
+        h2.reset() ;
+        transport.reset() ;
+        ::close(fds[0]) ; ::close(fds[1]) ;
+    }
+
+    // prior knowledge ：服务端先发送自己的 SETTINGS
+    void start() {
+        h2 = make_unique<Http2Protocol>(transport.get() , 1 , &read , &write) ;
+        h2->start() ;
+    }
+
+    void send(const string &data) {
+        assert(::write(fds[1] , data.data() , data.size()) == static_cast<ssize_t>(data.size())) ;
+    }
+
+    // 服务端处理客户端发来的数据，把能发送的都发出来；返回最后一次 dealHttp2Response 的结果
+    STATUS_CODE serve(const string &data = "") {
+        if(!data.empty()) {
+            send(data) ;
+            assert(h2->dealHttp2Request() == GOOD_CODE) ;
+        }
+        STATUS_CODE ret = CONTINUE_CODE ;
+        char buf[65536] ;
+        while(ret == CONTINUE_CODE) {
+            ret = h2->dealHttp2Response() ;
+            ssize_t n = 0 ;
+            while((n = ::read(fds[1] , buf , sizeof(buf))) > 0) inbox.append(buf , n) ;
+        }
+        return ret ;
+    }
+
+    // 取出收到的完整的帧
+    vector<Frame> frames() {
+        vector<Frame> result ;
+        while(inbox.size() >= 9) {
+            size_t len = (static_cast<size_t>(static_cast<uint8_t>(inbox[0])) << 16) | (static_cast<size_t>(static_cast<uint8_t>(inbox[1])) << 8) | static_cast<uint8_t>(inbox[2]) ;
+            if(inbox.size() < 9 + len) break ;
+            result.push_back({ static_cast<uint8_t>(inbox[3]) , static_cast<uint8_t>(inbox[4]) , readUint32(inbox , 5) & 0x7fffffff , inbox.substr(9 , len) }) ;
+            inbox.erase(0 , 9 + len) ;
+        }
+        assert(inbox.empty()) ;
+        return result ;
+    }
+};
+
+// 流上收到的 DATA 拼起来，检查是否以 END_STREAM 结束
+static string streamData(const vector<Frame> &frames , uint32_t stream , bool &ended) {
+    string data ;
+    ended = false ;
+    for(const Frame &f : frames) {
+        if(f.type != DATA || f.stream != stream) continue ;
+        assert(ended == false) ;
+        data += f.payload ;
+        ended = f.flags & END_STREAM ;
+    }
+    return data ;
+}
+
+static const Frame* findFrame(const vector<Frame> &frames , uint8_t type , uint32_t stream) {
+    for(const Frame &f : frames) {
+        if(f.type == type && f.stream == stream) return &f ;
+    }
+    return nullptr ;
+}
+
+static string responseStatus(const Frame &headers) {
+    HpackDecoder decoder ;
+    HeaderList list ;
+    assert(decoder.decode(reinterpret_cast<const uint8_t*>(headers.payload.data()) , headers.payload.size() , list)) ;
+    assert(!list.empty() && list[0].first == ":status") ;
+    return list[0].second ;
+}
+
+// 测试连接前言和 SETTINGS 交换：服务端先发 SETTINGS ，收到客户端的 SETTINGS 回复 ACK ，PING 原样回复
+void test_preface(){
+    const HttpConfigInfo &config = HttpConfigInfo::Instance() ;
+    Conn conn ;
+    conn.start() ;
+    conn.serve() ;
+    vector<Frame> frames = conn.frames() ;
+    assert(frames.size() >= 1 && frames[0].type == SETTINGS && frames[0].flags == 0 && frames[0].stream == 0) ;
+    const string &payload = frames[0].payload ;
+    assert(payload.size() % 6 == 0) ;
+    bool concurrent = false , window = false ;
+    for(size_t i = 0 ; i < payload.size() ; i += 6) {
+        uint16_t id = (static_cast<uint8_t>(payload[i]) << 8) | static_cast<uint8_t>(payload[i + 1]) ;
+        if(id == 0x3) concurrent = readUint32(payload , i + 2) == config.h2MaxConcurrentStreams ;
+        if(id == 0x4) window = readUint32(payload , i + 2) == config.h2InitialWindowSize ;
+    }
+    assert(concurrent && window) ;
+    if(config.h2InitialWindowSize > 65535) { // 连接级窗口用 WINDOW_UPDATE 扩大
+        assert(frames.size() == 2 && frames[1].type == WINDOW_UPDATE && frames[1].stream == 0) ;
+        assert(readUint32(frames[1].payload , 0) == config.h2InitialWindowSize - 65535) ;
+    }
+
+    // 前言分两次到达
+    conn.serve(PREFACE.substr(0 , 10)) ;
+    assert(conn.frames().empty()) ;
+    conn.serve(PREFACE.substr(10) + frame(SETTINGS , 0 , 0 , setting(0x4 , 100000)) + frame(SETTINGS , ACK , 0 , "") + frame(PING , 0 , 0 , "12345678")) ;
+    frames = conn.frames() ;
+    assert(frames.size() == 2) ;
+    assert(frames[0].type == SETTINGS && frames[0].flags == ACK && frames[0].payload.empty()) ;
+    assert(frames[1].type == PING && frames[1].flags == ACK && frames[1].payload == "12345678") ;
+
+    // 连接可以正常处理请求
+    assert(conn.serve(request(1 , "/h2/100")) == GOOD_CODE) ;
+    frames = conn.frames() ;
+    const Frame* headers = findFrame(frames , HEADERS , 1) ;
+    assert(headers != nullptr && responseStatus(*headers) == "200") ;
+    bool ended = false ;
+    assert(streamData(frames , 1 , ended) == content(100) && ended) ;
+    cout<<"test_preface pass"<<endl ;
+}
+
+// 测试 Upgrade: h2c ：先回 101 和 SETTINGS ，升级的请求作为流 1 响应，HTTP2-Settings 中的设置生效
+void test_upgrade(){
+    Conn conn ;
+    HttpProtocol http(conn.transport.get() , 1 , &conn.read , &conn.write) ;
+    http.init() ;
+    string settings = setting(0x4 , 100) ; // 初始窗口 100 ，流 1 只能先发 100 字节
+    string encoded = base64_encode(reinterpret_cast<const unsigned char*>(settings.data()) , settings.size()) ;
+    for(char &ch : encoded) ch = ch == '+' ? '-' : ch == '/' ? '_' : ch ; // base64url ，不带填充
+    encoded.erase(encoded.find_last_not_of('=') + 1) ;
+    conn.read.Append("GET /h2/1000 HTTP/1.1\r\nHost: x\r\nConnection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\nHTTP2-Settings: " + encoded + "\r\n\r\n") ;
+    assert(http.dealHttpRequest(false) == GOOD_CODE && http.isUpgradeH2c()) ;
+
+    // 与 ClientConn 一样，HTTP/2 沿用 HTTP/1.1 的读写缓冲区
+    conn.h2 = make_unique<Http2Protocol>(conn.transport.get() , 1 , &conn.read , &conn.write) ;
+    assert(conn.h2->upgrade(http)) ;
+    http.close() ;
+    conn.serve() ;
+    const string SWITCHING = "HTTP/1.1 101 Switching Protocols\r\n" ;
+    assert(conn.inbox.compare(0 , SWITCHING.size() , SWITCHING) == 0) ;
+    size_t end = conn.inbox.find("\r\n\r\n") ;
+    assert(end != string::npos && conn.inbox.find("Upgrade: h2c") < end) ;
+    conn.inbox.erase(0 , end + 4) ;
+    vector<Frame> frames = conn.frames() ;
+    assert(frames[0].type == SETTINGS && frames[0].flags == 0) ;
+    const Frame* headers = findFrame(frames , HEADERS , 1) ;
+    assert(headers != nullptr && responseStatus(*headers) == "200") ;
+    bool ended = false ;
+    assert(streamData(frames , 1 , ended) == content(100) && ended == false) ;
+
+    // 客户端随后发送连接前言，窗口扩大之后发完剩下的内容
+    conn.serve(PREFACE + frame(SETTINGS , 0 , 0 , "") + windowUpdate(1 , 10000)) ;
+    frames = conn.frames() ;
+    assert(frames[0].type == SETTINGS && frames[0].flags == ACK) ;
+    assert(streamData(frames , 1 , ended) == content(1000).substr(100) && ended) ;
+
+    // 带 body 的请求和 TLS 连接不升级
+    HttpProtocol post(conn.transport.get() , 1 , &conn.read , &conn.write) ;
+    post.init() ;
+    conn.read.Append("POST /h2/1 HTTP/1.1\r\nHost: x\r\nUpgrade: h2c\r\nHTTP2-Settings: AAMAAABk\r\nContent-Length: 0\r\n\r\n") ;
+    assert(post.dealHttpRequest(false) == GOOD_CODE && post.isUpgradeH2c() == false) ;
+    cout<<"test_upgrade pass"<<endl ;
+}
+
+// 测试两个并发的流：DATA 帧轮流发送，连接级窗口用完之后两个流都停下，WINDOW_UPDATE 之后继续
+void test_interleave(){
+    const size_t SIZE = 100000 ;
+    Conn conn ;
+    conn.start() ;
+    conn.serve(PREFACE + frame(SETTINGS , 0 , 0 , "")) ;
+    conn.frames() ;
+    conn.serve(request(1 , "/h2/" + to_string(SIZE)) + request(3 , "/h2/" + to_string(SIZE))) ;
+    vector<Frame> frames = conn.frames() ;
+    vector<uint32_t> order ;
+    size_t sent = 0 ;
+    for(const Frame &f : frames) {
+        if(f.type != DATA) continue ;
+        order.push_back(f.stream) ;
+        sent += f.payload.size() ;
+        assert(f.payload.size() <= 16384) ; // 不超过对端默认的 MAX_FRAME_SIZE
+    }
+    assert(sent == 65535) ; // 默认的连接级窗口
+    assert(order.size() >= 4) ;
+    for(size_t i = 1 ; i < order.size() ; ++i) assert(order[i] != order[i - 1]) ;
+    bool ended1 = false , ended3 = false ;
+    string body1 = streamData(frames , 1 , ended1) , body3 = streamData(frames , 3 , ended3) ;
+    assert(ended1 == false && ended3 == false) ;
+
+    // 只扩大连接级窗口：两个流的窗口也只有 65535 ，各自发到窗口用完
+    conn.serve(windowUpdate(0 , 1 << 20)) ;
+    frames = conn.frames() ;
+    bool ended = false ;
+    body1 += streamData(frames , 1 , ended) ;
+    body3 += streamData(frames , 3 , ended) ;
+    assert(body1.size() == 65535 && body3.size() == 65535) ;
+
+    conn.serve(windowUpdate(1 , SIZE) + windowUpdate(3 , SIZE)) ;
+    frames = conn.frames() ;
+    body1 += streamData(frames , 1 , ended1) ;
+    body3 += streamData(frames , 3 , ended3) ;
+    assert(ended1 && ended3) ;
+    assert(body1 == content(SIZE) && body3 == content(SIZE)) ;
+    cout<<"test_interleave pass"<<endl ;
+}
+
+// 测试流控窗口为 0 时只发 HEADERS 不发 DATA ，WINDOW_UPDATE 之后按增加的窗口发送
+void test_zero_window(){
+    Conn conn ;
+    conn.start() ;
+    conn.serve(PREFACE + frame(SETTINGS , 0 , 0 , setting(0x4 , 0))) ;
+    conn.frames() ;
+    assert(conn.serve(request(1 , "/h2/1000")) == GOOD_CODE) ;
+    vector<Frame> frames = conn.frames() ;
+    assert(frames.size() == 1 && frames[0].type == HEADERS && (frames[0].flags & END_STREAM) == 0) ;
+    assert(conn.serve() == GOOD_CODE && conn.frames().empty()) ; // 窗口为 0 ，没有可以发送的内容
+
+    conn.serve(windowUpdate(1 , 300)) ;
+    frames = conn.frames() ;
+    assert(frames.size() == 1 && frames[0].type == DATA && frames[0].payload == content(300) && frames[0].flags == 0) ;
+
+    // SETTINGS 调整初始窗口，作用到已经打开的流上
+    conn.serve(frame(SETTINGS , 0 , 0 , setting(0x4 , 200))) ;
+    frames = conn.frames() ;
+    assert(frames.size() == 2 && frames[0].type == SETTINGS && frames[0].flags == ACK) ;
+    assert(frames[1].type == DATA && frames[1].payload == content(500).substr(300)) ;
+
+    conn.serve(windowUpdate(1 , 10000)) ;
+    frames = conn.frames() ;
+    bool ended = false ;
+    assert(streamData(frames , 1 , ended) == content(1000).substr(500) && ended) ;
+    cout<<"test_zero_window pass"<<endl ;
+}
+
+// 测试错误的帧：流错误只用 RST_STREAM 重置这个流，连接错误发送 GOAWAY 并关闭连接
+void test_bad_frame(){
+    {
+        Conn conn ;
+        conn.start() ;
+        conn.serve(PREFACE + frame(SETTINGS , 0 , 0 , setting(0x4 , 0))) ;
+        conn.frames() ;
+        conn.serve(request(1 , "/h2/1000")) ;
+        conn.frames() ;
+        // 请求已经结束的流上又收到 DATA
+        conn.serve(frame(DATA , 0 , 1 , "x")) ;
+        vector<Frame> frames = conn.frames() ;
+        assert(frames.size() == 1 && frames[0].type == RST_STREAM && frames[0].stream == 1) ;
+        assert(readUint32(frames[0].payload , 0) == 0x5) ; // STREAM_CLOSED
+        conn.serve(windowUpdate(1 , 10000)) ; // 流已经重置，不再发送
+        assert(conn.frames().empty()) ;
+
+        // WINDOW_UPDATE 的增量为 0
+        conn.serve(request(3 , "/h2/1000")) ;
+        conn.frames() ;
+        conn.serve(windowUpdate(3 , 0)) ;
+        frames = conn.frames() ;
+        assert(frames.size() == 1 && frames[0].type == RST_STREAM && frames[0].stream == 3 && readUint32(frames[0].payload , 0) == 0x1) ;
+
+        // 连接仍然可用
+        conn.serve(frame(SETTINGS , 0 , 0 , setting(0x4 , 65535)) + request(5 , "/h2/100")) ;
+        frames = conn.frames() ;
+        bool ended = false ;
+        assert(streamData(frames , 5 , ended) == content(100) && ended) ;
+
+        // 长度错误的 SETTINGS 是连接错误：GOAWAY 带上最后处理的流 id ，之后的帧不再处理
+        assert(conn.serve(frame(SETTINGS , 0 , 0 , "12345") + request(7 , "/h2/100")) == CLOSE_CONNECTION) ;
+        frames = conn.frames() ;
+        assert(frames.size() == 1 && frames[0].type == GOAWAY && frames[0].stream == 0) ;
+        assert(readUint32(frames[0].payload , 0) == 5 && readUint32(frames[0].payload , 4) == 0x6) ; // FRAME_SIZE_ERROR
+    }
+    // 错误的连接前言、流 0 上的 DATA 、偶数 id 的 HEADERS 都是 PROTOCOL_ERROR
+    for(const string &bad : { string("GET / HTTP/1.1\r\n\r\n") + string(30 , ' ') , PREFACE + frame(DATA , 0 , 0 , "x") , PREFACE + request(2 , "/h2/1") }) {
+        Conn conn ;
+        conn.start() ;
+        conn.serve() ;
+        conn.frames() ;
+        assert(conn.serve(bad) == CLOSE_CONNECTION) ;
+        vector<Frame> frames = conn.frames() ;
+        assert(frames.size() == 1 && frames[0].type == GOAWAY && readUint32(frames[0].payload , 4) == 0x1) ;
+    }
+    cout<<"test_bad_frame pass"<<endl ;
+}
+
+int main(){
+    HttpProtocol::Routes().add("GET" , "/h2/:size" , {[](HttpProtocol &http , const RouteParams &params) {
+        http.SetBody(content(stoul(string(params.get("size")))) , "text/plain") ;
+    }}) ;
+    test_preface() ;
+    test_upgrade() ;
+    test_interleave() ;
+    test_zero_window() ;
+    test_bad_frame() ;
+    return 0 ;
+}
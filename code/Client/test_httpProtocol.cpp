@@ -0,0 +1,545 @@
+#include "httpProtocol.h"
+#include "../Pack/resourcePack.h"
+#include <iostream>
+#include <assert.h>
+#include <sys/socket.h>
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include <glob.h>
+using namespace std ;
+
+static string readFile(const string &path) {
+    ifstream in(path , ios::binary) ;
+    stringstream ss ; ss << in.rdbuf() ;
+    return ss.str() ;
+}
+
+// 把请求分成 step 字节一份依次放进读缓冲区，返回最后一次解析的结果以及之前出现 CONTINUE_CODE 的次数
+static STATUS_CODE feed(HttpProtocol &http , Buffer &read , const string &request , size_t step , int &continues) {
+    STATUS_CODE ret = CONTINUE_CODE ;
+    continues = 0 ;
+    for(size_t i = 0 ; i < request.size() ; i += step) {
+        read.Append(request.substr(i , step)) ;
+        ret = http.dealHttpRequest(false) ;
+        if(ret != CONTINUE_CODE) break ;
+        ++continues ;
+    }
+    return ret ;
+}
+
+// 测试请求分多次到达时保留解析状态，收完整之后才返回 GOOD_CODE
+void test_incremental(){
+    Buffer read , write ;
+    HttpProtocol http(nullptr , 0 , &read , &write) ;
+    http.init() ;
+    string request = "POST /login HTTP/1.1\r\nHost: x\r\nContent-Length: 31\r\n\r\nusername=test4&password=test%40" ;
+    int continues = 0 ;
+    assert(feed(http , read , request , 1 , continues) == GOOD_CODE) ;
+    assert(continues == static_cast<int>(request.size()) - 1) ;
+    assert(http.GetMethod() == "POST" && http.GetPath() == "/login" && http.GetHeader("Host") == "x") ;
+    assert(http.GetPost("username") == "test4" && http.GetPost("password") == "test@") ;
+    assert(read.BufferUsedSize() == 0) ;
+
+    // 两个请求粘在一起，第一个解析完之后剩下的是第二个请求
+    http.close() ; http.init() ;
+    read.Append(string("GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n")) ;
+    assert(http.dealHttpRequest(false) == GOOD_CODE && http.GetPath() == "/a") ;
+    assert(http.IsParsing()) ;
+    http.close() ;
+    assert(http.dealHttpRequest(false) == GOOD_CODE && http.GetPath() == "/b") ;
+    cout<<"test_incremental pass"<<endl ;
+}
+
+// 测试 chunked 请求 body 的解码：分块扩展、trailer 、任意位置的拆分以及错误的格式
+void test_chunked_body(){
+    Buffer read , write ;
+    HttpProtocol http(nullptr , 0 , &read , &write) ;
+    string head = "POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n" ;
+    string body = "5;name=value\r\nuser=\r\n19\r\nalice&password=0123456789\r\n0\r\nX-Trailer: 1\r\n\r\n" ;
+    for(size_t step : {1 , 3 , 7 , 1024}) {
+        http.init() ;
+        int continues = 0 ;
+        assert(feed(http , read , head + body , step , continues) == GOOD_CODE) ;
+        assert(http.GetBody() == "user=alice&password=0123456789") ;
+        assert(http.GetPost("user") == "alice" && http.GetPost("password") == "0123456789") ;
+        assert(read.BufferUsedSize() == 0) ;
+        http.close() ;
+    }
+    for(const string &bad : {"zz\r\n" , "5\r\nhelloXX" , "-1\r\n" , "ffffffffffffffffffff\r\n" , "40000001\r\n"}) {
+        http.init() ;
+        read.Append(head + bad) ;
+        assert(http.dealHttpRequest(false) == BAD_REQUEST) ;
+        http.close() ;
+    }
+    http.init() ;
+    read.Append(string("POST /echo HTTP/1.1\r\nContent-Length: 99999999999\r\n\r\n")) ;
+    assert(http.dealHttpRequest(false) == BAD_REQUEST) ;
+    cout<<"test_chunked_body pass"<<endl ;
+}
+
+// 测试 multipart 上传：任意位置拆分输入，文件写入临时文件，字段放入 post_ ，请求结束后临时文件被删除
+void test_multipart(){
+    Buffer read , write ;
+    HttpProtocol http(nullptr , 0 , &read , &write) ;
+    string file ;
+    for(int i = 0 ; i < 100000 ; ++i) file += static_cast<char>(i * 7 % 251) ;
+    file += "\r\n--boundar" ; // 和分隔符很像的内容
+    string body = "preamble\r\n--XyZ\r\nContent-Disposition: form-data; name=\"title\"\r\n\r\nhello world\r\n"
+                  "--XyZ\r\nContent-Disposition: form-data; name=\"file\"; filename=\"a b.png\"\r\nContent-Type: image/png\r\n\r\n" + file +
+                  "\r\n--XyZ--\r\nepilogue" ;
+    const string cookie = "Cookie: " + HttpProtocol::SharedJwt().generateJWT({{"name" , "alice"}}) + "\r\n" ;
+    string head = "POST /upload HTTP/1.1\r\n" + cookie + "Content-Type: multipart/form-data; boundary=XyZ\r\nContent-Length: " + to_string(body.size()) + "\r\n\r\n" ;
+    for(size_t step : {1 , 5 , 4096 , 1 << 20}) {
+        http.init() ;
+        int continues = 0 ;
+        assert(feed(http , read , head + body , step , continues) == GOOD_CODE) ;
+        assert(http.GetPost("title") == "hello world" && http.GetBody().empty()) ;
+        assert(http.GetUploads().size() == 1) ;
+        UploadPart part = http.GetUploads()[0] ;
+        assert(part.name == "file" && part.filename == "a b.png" && part.contentType == "image/png") ;
+        assert(part.size == file.size() && readFile(part.path) == file) ;
+        http.close() ;
+        assert(access(part.path.c_str() , F_OK) != 0) ;
+    }
+    // 保存之后临时文件不再删除
+    http.init() ;
+    read.Append(head + body) ;
+    assert(http.dealHttpRequest(false) == GOOD_CODE) ;
+    string saved = "/tmp/test_upload_saved.png" ;
+    unlink(saved.c_str()) ;
+    assert(UploadParser::Save(http.GetUploads()[0] , saved) && readFile(saved) == file) ;
+    assert(UploadParser::Save(http.GetUploads()[0] , saved) == false) ;
+    http.close() ;
+    assert(readFile(saved) == file) ;
+    unlink(saved.c_str()) ;
+
+    // 没有结束分隔符
+    http.init() ;
+    string broken = "--XyZ\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\nb\r\n" ;
+    read.Append("POST /upload HTTP/1.1\r\n" + cookie + "Content-Type: multipart/form-data; boundary=XyZ\r\nContent-Length: " + to_string(broken.size()) + "\r\n\r\n" + broken) ;
+    assert(http.dealHttpRequest(false) == BAD_REQUEST) ;
+    http.close() ;
+
+    // 所有普通字段加起来超过 maxRequestBody ，或者部分太多
+    auto multipart = [&](size_t count , size_t fieldSize) {
+        string parts ;
+        for(size_t i = 0 ; i < count ; ++i) {
+            parts += "--XyZ\r\nContent-Disposition: form-data; name=\"f" + to_string(i) + "\"\r\n\r\n" + string(fieldSize , 'v') + "\r\n" ;
+        }
+        parts += "--XyZ--\r\n" ;
+        http.init() ;
+        read.Append("POST /upload HTTP/1.1\r\n" + cookie + "Content-Type: multipart/form-data; boundary=XyZ\r\nContent-Length: " + to_string(parts.size()) + "\r\n\r\n" + parts) ;
+        STATUS_CODE ret = http.dealHttpRequest(false) ;
+        http.close() ;
+        read.RetrieveAllToStr() ;
+        return ret ;
+    } ;
+    const size_t maxBody = HttpConfigInfo::Instance().maxRequestBody , maxParts = HttpConfigInfo::Instance().maxUploadParts ;
+    assert(multipart(4 , maxBody / 4) == GOOD_CODE) ;
+    assert(multipart(5 , maxBody / 4) == BAD_REQUEST) ;
+    assert(multipart(maxParts , 1) == GOOD_CODE) ;
+    assert(multipart(maxParts + 1 , 1) == BAD_REQUEST) ;
+
+    // 超过 maxRequestBody 的普通 body 只有上传路由才写入临时文件
+    http.init() ;
+    string big(maxBody + 10 , 'x') ;
+    read.Append("POST /upload HTTP/1.1\r\n" + cookie + "Content-Length: " + to_string(big.size()) + "\r\n\r\n") ;
+    int continues = 0 ;
+    assert(feed(http , read , big , 65536 , continues) == GOOD_CODE) ;
+    assert(http.GetBody().empty() && http.GetUploads().size() == 1 && readFile(http.GetUploads()[0].path) == big) ;
+    http.close() ;
+    cout<<"test_multipart pass"<<endl ;
+}
+
+// uploadDir 下 mkstemp 创建的临时文件个数
+static size_t uploadTempFiles(){
+    glob_t result ;
+    if(glob((string(HttpConfigInfo::Instance().uploadDir) + "/tinyweb_upload_*").c_str() , 0 , nullptr , &result) != 0) return 0 ;
+    size_t count = result.gl_pathc ;
+    globfree(&result) ;
+    return count ;
+}
+
+// 请求头收完就被拒绝的请求：返回最终的状态码，不读 body ，不创建临时文件，应答之后关闭连接
+static int rejected(const string &head , const string &body = "") {
+    Buffer read , write ;
+    HttpProtocol http(nullptr , 0 , &read , &write) ;
+    http.init() ;
+    size_t files = uploadTempFiles() ;
+    read.Append(head + body) ;
+    if(http.dealHttpRequest(false) != BAD_REQUEST) return 0 ;
+    assert(uploadTempFiles() == files && http.GetUploads().empty() && http.GetBody().size() <= HttpConfigInfo::Instance().maxRequestBody) ;
+    assert(http.makeHttpResponse(400)) ;
+    assert(http.IsKeepAlive() == false) ;
+    string response(write.BufferStart() , write.BufferUsedSize()) ;
+    http.close() ;
+    return atoi(response.c_str() + 9) ;
+}
+
+// 测试按路由决定 body 的接收方式：只有上传路由能落盘，没有登录返回 401 ，其他路由的大 body 返回 413 ，multipart 返回 415
+void test_reject_body(){
+    const size_t maxBody = HttpConfigInfo::Instance().maxRequestBody ;
+    const string cookie = "Cookie: " + HttpProtocol::SharedJwt().generateJWT({{"name" , "alice"}}) + "\r\n" ;
+    const string multipart = "Content-Type: multipart/form-data; boundary=XyZ\r\n" ;
+    string body = "--XyZ\r\nContent-Disposition: form-data; name=\"file\"; filename=\"a.png\"\r\n\r\npng\r\n--XyZ--\r\n" ;
+    string big(maxBody + 1 , 'x') ;
+
+    // 没有登录的上传，带 Expect: 100-continue 时 body 还没有发送，也要马上得到应答
+    assert(rejected("POST /upload HTTP/1.1\r\n" + multipart + "Content-Length: " + to_string(body.size()) + "\r\n\r\n" , body) == 401) ;
+    assert(rejected("POST /upload HTTP/1.1\r\nExpect: 100-continue\r\n" + multipart + "Content-Length: " + to_string(body.size()) + "\r\n\r\n") == 401) ;
+    assert(rejected("POST /upload HTTP/1.1\r\nCookie: bad\r\nContent-Length: " + to_string(big.size()) + "\r\n\r\n" , big) == 401) ;
+    // 其他路由和静态文件：不接收 multipart ，body 不超过 maxRequestBody 
+    assert(rejected("POST /login HTTP/1.1\r\n" + cookie + multipart + "Content-Length: " + to_string(body.size()) + "\r\n\r\n" , body) == 415) ;
+    assert(rejected("POST /echo HTTP/1.1\r\n" + multipart + "Content-Length: " + to_string(body.size()) + "\r\n\r\n" , body) == 415) ;
+    assert(rejected("POST /login HTTP/1.1\r\nExpect: 100-continue\r\nContent-Length: " + to_string(big.size()) + "\r\n\r\n") == 413) ;
+    assert(rejected("POST /echo HTTP/1.1\r\nContent-Length: " + to_string(big.size()) + "\r\n\r\n" , big) == 413) ;
+    string chunked = "10000\r\n" + string(0x10000 , 'x') + "\r\n" ;
+    string chunks ;
+    for(size_t size = 0 ; size <= maxBody ; size += 0x10000) chunks += chunked ;
+    assert(rejected("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n" , chunks + "0\r\n\r\n") == 413) ;
+    assert(rejected("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n" , "fffff\r\n") == 0) ; // 没有超过上限，等待后续数据
+    assert(rejected("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n" , to_string(maxBody) + "1\r\n") == 413) ;
+    // 上传路由的上限是 maxUploadSize 
+    assert(rejected("POST /upload HTTP/1.1\r\n" + cookie + "Content-Length: " + to_string(HttpConfigInfo::Instance().maxUploadSize + 1) + "\r\n\r\n") == 413) ;
+
+    // 不超过 maxRequestBody 的普通 body 仍然在内存中
+    Buffer read , write ;
+    HttpProtocol http(nullptr , 0 , &read , &write) ;
+    http.init() ;
+    size_t files = uploadTempFiles() ;
+    string small(maxBody , 'x') ;
+    read.Append("POST /echo HTTP/1.1\r\nContent-Length: " + to_string(small.size()) + "\r\n\r\n" + small) ;
+    assert(http.dealHttpRequest(false) == GOOD_CODE && http.GetBody() == small && http.GetUploads().empty()) ;
+    assert(uploadTempFiles() == files) ;
+    http.close() ;
+    cout<<"test_reject_body pass"<<endl ;
+}
+
+// 测试流式响应：chunked 编码，而且只有上一批发送出去之后才会继续调用生产者
+void test_stream(){
+    const int total = 20000 ;
+    int calls = 0 ;
+    HttpProtocol::Routes().add("GET" , "/test_stream" , {[&calls , total](HttpProtocol &http , const RouteParams&) {
+        calls = 0 ;
+        http.SetStream([&calls , total](HttpProtocol &h) {
+            string line = "line " + to_string(calls) + "\n" ;
+            h.WriteChunk(line) ;
+            return ++calls < total ;
+        } , "text/plain") ;
+    }}) ;
+
+    int fds[2] ;
+    assert(socketpair(AF_UNIX , SOCK_STREAM , 0 , fds) == 0) ;
+    fcntl(fds[0] , F_SETFL , fcntl(fds[0] , F_GETFL) | O_NONBLOCK) ;
+    int sndbuf = 4096 ;
+    setsockopt(fds[0] , SOL_SOCKET , SO_SNDBUF , &sndbuf , sizeof(sndbuf)) ;
+    Transport transport(fds[0] , nullptr) ;
+    Buffer read , write ;
+    HttpProtocol http(&transport , 1 , &read , &write) ;
+    http.init() ;
+    read.Append(string("GET /test_stream HTTP/1.1\r\n\r\n")) ;
+    assert(http.dealHttpRequest(false) == GOOD_CODE) ;
+    assert(http.makeHttpResponse(200)) ;
+    assert(calls == 0) ; // 生成响应时还没有调用生产者
+
+    // 对端不读，socket 写满之后生产者就不再被调用
+    assert(http.dealHttpResponse() == CONTINUE_CODE) ;
+    assert(calls > 0 && calls < total) ;
+    int blocked = calls ;
+    assert(http.dealHttpResponse() == CONTINUE_CODE && calls == blocked) ;
+
+    string out ;
+    char buf[65536] ;
+    STATUS_CODE ret = CONTINUE_CODE ;
+    while(ret == CONTINUE_CODE) {
+        ssize_t n = ::read(fds[1] , buf , sizeof(buf)) ;
+        if(n > 0) out.append(buf , n) ;
+        ret = http.dealHttpResponse() ;
+    }
+    assert(ret == GOOD_CODE && calls == total && http.IsResponseDone()) ;
+    ssize_t n = 0 ;
+    fcntl(fds[1] , F_SETFL , fcntl(fds[1] , F_GETFL) | O_NONBLOCK) ;
+    while((n = ::read(fds[1] , buf , sizeof(buf))) > 0) out.append(buf , n) ;
+
+    // 解码 chunked ，内容和生产者写入的一致
+    size_t pos = out.find("\r\n\r\n") ;
+    assert(pos != string::npos && out.find("Transfer-Encoding: chunked") < pos) ;
+    pos += 4 ;
+    string body ;
+    while(true) {
+        size_t lineEnd = out.find("\r\n" , pos) ;
+        size_t len = stoul(out.substr(pos , lineEnd - pos) , nullptr , 16) ;
+        pos = lineEnd + 2 ;
+        if(len == 0) break ;
+        body += out.substr(pos , len) ;
+        pos += len + 2 ;
+    }
+    assert(out.substr(pos) == "\r\n") ;
+    string expect ;
+    for(int i = 0 ; i < total ; ++i) expect += "line " + to_string(i) + "\n" ;
+    assert(body == expect) ;
+    http.close() ;
+    ::close(fds[0]) ; ::close(fds[1]) ;
+    cout<<"test_stream pass"<<endl ;
+}
+
+static const string PACK_ROOT = "/tmp/test_http_conditional" ;
+
+// 静态文件放进资源包，不依赖 srcDir ：range.txt 100 字节，empty.txt 0 字节，page.html 有 gzip 版本
+static void loadPack(){
+    system(("rm -rf " + PACK_ROOT + " && mkdir -p " + PACK_ROOT + "/src").data()) ;
+    string digits ;
+    for(int i = 0 ; i < 100 ; ++i) digits += static_cast<char>('0' + i % 10) ;
+    ofstream(PACK_ROOT + "/src/range.txt" , ios::binary) << digits ;
+    ofstream(PACK_ROOT + "/src/empty.txt" , ios::binary) ;
+    string page ;
+    for(int i = 0 ; i < 200 ; ++i) page += "<p>line " + to_string(i) + "</p>\n" ;
+    ofstream(PACK_ROOT + "/src/page.html" , ios::binary) << page ;
+    assert(PackBuilder::Build(PACK_ROOT + "/src" , PACK_ROOT + "/site.pack" , true)) ;
+    assert(ResourcePack::Load(PACK_ROOT + "/site.pack")) ;
+}
+
+// 发送请求，返回完整的响应报文；发送缓冲区满时边读边写，sendfile 的大文件也能收完整
+static string respond(const string &path , const string &headers , const string &method = "GET") {
+    int fds[2] ;
+    assert(socketpair(AF_UNIX , SOCK_STREAM , 0 , fds) == 0) ;
+    for(int fd : fds) fcntl(fd , F_SETFL , fcntl(fd , F_GETFL) | O_NONBLOCK) ;
+    Transport transport(fds[0] , nullptr) ;
+    Buffer read , write ;
+    HttpProtocol http(&transport , 1 , &read , &write) ;
+    http.init() ;
+    read.Append(method + " " + path + " HTTP/1.1\r\nHost: x\r\n" + headers + "\r\n") ;
+    assert(http.dealHttpRequest(false) == GOOD_CODE && http.makeHttpResponse(200)) ;
+    string response ;
+    char buf[65536] ;
+    ssize_t n = 0 ;
+    STATUS_CODE ret = CONTINUE_CODE ;
+    while(ret == CONTINUE_CODE) {
+        ret = http.dealHttpResponse() ;
+        while((n = ::read(fds[1] , buf , sizeof(buf))) > 0) response.append(buf , n) ;
+    }
+    assert(ret == GOOD_CODE) ;
+    http.close() ;
+    ::close(fds[0]) ; ::close(fds[1]) ;
+    return response ;
+}
+
+static int statusOf(const string &response) {
+    return stoi(response.substr(9 , 3)) ;
+}
+
+static string headerOf(const string &response , const string &name) {
+    size_t pos = response.find("\r\n" + name + ": ") ;
+    if(pos == string::npos) return "" ;
+    pos += name.size() + 4 ;
+    return response.substr(pos , response.find("\r\n" , pos) - pos) ;
+}
+
+static string bodyOf(const string &response) {
+    return response.substr(response.find("\r\n\r\n") + 4) ;
+}
+
+// 按 multipart/byteranges 的格式拼出期望的 body ，ranges 是 (起始偏移 , 长度)
+static string byteranges(const string &content , const string &boundary , const string &type , const vector<pair<size_t , size_t>> &ranges) {
+    string body ;
+    for(const auto &range : ranges) {
+        body += "\r\n--" + boundary + "\r\nContent-Type: " + type + "\r\nContent-Range: bytes " + to_string(range.first) + "-" +
+                to_string(range.first + range.second - 1) + "/" + to_string(content.size()) + "\r\n\r\n" + content.substr(range.first , range.second) ;
+    }
+    return body + "\r\n--" + boundary + "--\r\n" ;
+}
+
+// 测试 srcDir 中文件的 Range（不使用资源包）：按发送的字节数走内存、read 进写缓冲区、mmap 、sendfile 四种方式，
+// 多区间的分段边界，重叠区间合并，重复请求超过文件大小时发送整个文件，以及 HEAD 请求只发送头部
+void test_range_files(){
+    const HttpConfigInfo &config = HttpConfigInfo::Instance() ;
+    assert(ResourcePack::Current() == nullptr) ;
+    const string dir = "/.test_range" , root = string(config.srcDir) + dir ;
+    assert(system(("rm -rf " + root + " && mkdir -p " + root).data()) == 0) ;
+    string small , big ;
+    for(size_t i = 0 ; i < config.smallFileSize / 2 ; ++i) small += static_cast<char>('a' + i % 26) ;
+    for(size_t i = 0 ; i < config.sendfileSize + 50000 ; ++i) big += static_cast<char>(i * 7 % 251) ;
+    ofstream(root + "/small.txt" , ios::binary) << small ;
+    ofstream(root + "/big.txt" , ios::binary) << big ;
+    const size_t mid = config.smallFileSize * 2 ; // 介于 smallFileSize 和 sendfileSize 之间，走 mmap
+    assert(mid < config.sendfileSize) ;
+
+    for(const string *content : {&small , &big}) {
+        const string path = dir + (content == &small ? "/small.txt" : "/big.txt") ;
+        const size_t size = content->size() ;
+        string full = respond(path , "") ;
+        assert(statusOf(full) == 200 && bodyOf(full) == *content) ;
+        const string type = headerOf(full , "Content-type") ;
+
+        // 单个区间：小文件在内存里，大文件按区间长度分别 read 、mmap 、sendfile
+        vector<pair<size_t , size_t>> singles = {{0 , 10} , {size - 100 , 100}} ;
+        if(content == &big) singles.insert(singles.end() , {{1000 , 1000} , {3 , mid} , {10 , config.sendfileSize + 1000}}) ;
+        for(const auto &range : singles) {
+            string last = to_string(range.first + range.second - 1) ;
+            string part = respond(path , "Range: bytes=" + to_string(range.first) + "-" + last + "\r\n") ;
+            assert(statusOf(part) == 206 && headerOf(part , "Content-Range") == "bytes " + to_string(range.first) + "-" + last + "/" + to_string(size)) ;
+            assert(headerOf(part , "Content-Length") == to_string(range.second) && bodyOf(part) == content->substr(range.first , range.second)) ;
+        }
+
+        // 多个区间：所有区间的总长度决定发送方式，每个分段的头和数据按顺序紧挨着
+        vector<vector<pair<size_t , size_t>>> multis = {{{0 , 10} , {100 , 20} , {size - 5 , 5}}} ;
+        if(content == &big) multis.insert(multis.end() , {{{0 , mid / 2} , {mid , mid / 2}} , {{5 , config.sendfileSize / 2} , {size - config.sendfileSize / 2 - 10 , config.sendfileSize / 2}}}) ;
+        for(const auto &ranges : multis) {
+            string spec = "bytes=" ;
+            for(const auto &range : ranges) spec += (spec.size() > 6 ? "," : "") + to_string(range.first) + "-" + to_string(range.first + range.second - 1) ;
+            string multi = respond(path , "Range: " + spec + "\r\n") ;
+            assert(statusOf(multi) == 206 && headerOf(multi , "Content-type").find("multipart/byteranges; boundary=") == 0) ;
+            string boundary = headerOf(multi , "Content-type").substr(strlen("multipart/byteranges; boundary=")) ;
+            string expect = byteranges(*content , boundary , type , ranges) ;
+            assert(bodyOf(multi) == expect && headerOf(multi , "Content-Length") == to_string(expect.size())) ;
+
+            // HEAD 请求：头部和 GET 相同的长度，不发送 body
+            string head = respond(path , "Range: " + spec + "\r\n" , "HEAD") ;
+            assert(statusOf(head) == 206 && headerOf(head , "Content-Length") == to_string(expect.size()) && bodyOf(head).empty()) ;
+        }
+        string head = respond(path , "Range: bytes=5-14\r\n" , "HEAD") ;
+        assert(statusOf(head) == 206 && headerOf(head , "Content-Range") == "bytes 5-14/" + to_string(size)) ;
+        assert(headerOf(head , "Content-Length") == "10" && bodyOf(head).empty()) ;
+
+        // 重叠、相邻、乱序的区间合并成一个
+        string merged = respond(path , "Range: bytes=150-199,0-99,50-149\r\n") ;
+        assert(statusOf(merged) == 206 && headerOf(merged , "Content-Range") == "bytes 0-199/" + to_string(size)) ;
+        assert(bodyOf(merged) == content->substr(0 , 200)) ;
+        string two = respond(path , "Range: bytes=20-29,0-9,5-14\r\n") ;
+        string boundary = headerOf(two , "Content-type").substr(strlen("multipart/byteranges; boundary=")) ;
+        assert(statusOf(two) == 206 && bodyOf(two) == byteranges(*content , boundary , type , {{0 , 15} , {20 , 10}})) ;
+
+        // 重复请求整个文件：总长度超过文件大小，发送整个文件而不是 N 份
+        string repeat = "bytes=0-" ;
+        for(size_t i = 1 ; i < config.maxRangeCount ; ++i) repeat += ",0-" ;
+        for(const string &range : {repeat , string("bytes=0-,0-") , "bytes=0-" + to_string(size / 2) + ",-" + to_string(size / 2 + 2)}) {
+            string response = respond(path , "Range: " + range + "\r\n") ;
+            assert(statusOf(response) == 200 && headerOf(response , "Content-Length") == to_string(size)) ;
+        }
+
+        // 没有区间的 Range 忽略；有格式正确的区间但都不满足时 416
+        for(const string &range : {"bytes=" , "bytes=,," , "bytes= , "}) {
+            string response = respond(path , "Range: " + range + "\r\n") ;
+            assert(statusOf(response) == 200 && bodyOf(response) == *content) ;
+        }
+        string unsatisfied = respond(path , "Range: bytes=," + to_string(size) + "-\r\n") ;
+        assert(statusOf(unsatisfied) == 416 && headerOf(unsatisfied , "Content-Range") == "bytes */" + to_string(size)) ;
+    }
+    assert(system(("rm -rf " + root).data()) == 0) ;
+    cout<<"test_range_files pass"<<endl ;
+}
+
+// 测试 Range ：单个、多个、后缀、开放区间，超出文件的区间裁剪或者 416 ，格式错误、区间太多和 If-Range 不匹配时发送整个文件
+void test_range(){
+    string full = respond("/range.txt" , "") ;
+    assert(statusOf(full) == 200 && headerOf(full , "Content-Length") == "100") ;
+    const string digits = full.substr(full.find("\r\n\r\n") + 4) ;
+    assert(digits.size() == 100) ;
+    string etag = headerOf(full , "ETag") , lastModified = headerOf(full , "Last-Modified") ;
+    assert(etag.size() > 2 && lastModified.size() > 0) ;
+
+    string part = respond("/range.txt" , "Range: bytes=10-19\r\n") ;
+    assert(statusOf(part) == 206 && headerOf(part , "Content-Range") == "bytes 10-19/100" && headerOf(part , "Content-Length") == "10") ;
+    assert(part.substr(part.find("\r\n\r\n") + 4) == digits.substr(10 , 10)) ;
+    assert(headerOf(respond("/range.txt" , "Range: bytes=-5\r\n") , "Content-Range") == "bytes 95-99/100") ;
+    assert(headerOf(respond("/range.txt" , "Range: bytes=-500\r\n") , "Content-Range") == "bytes 0-99/100") ;
+    assert(headerOf(respond("/range.txt" , "Range: bytes=90-\r\n") , "Content-Range") == "bytes 90-99/100") ;
+    assert(headerOf(respond("/range.txt" , "Range: bytes=50-1000\r\n") , "Content-Range") == "bytes 50-99/100") ;
+
+    // 多个区间用 multipart/byteranges ，不满足的区间被跳过
+    string multi = respond("/range.txt" , "Range: bytes=0-1, 5-6,200-300\r\n") ;
+    assert(statusOf(multi) == 206 && headerOf(multi , "Content-type").find("multipart/byteranges; boundary=") == 0) ;
+    string boundary = headerOf(multi , "Content-type").substr(strlen("multipart/byteranges; boundary=")) ;
+    string multiBody = multi.substr(multi.find("\r\n\r\n") + 4) ;
+    assert(to_string(multiBody.size()) == headerOf(multi , "Content-Length")) ;
+    assert(multiBody.find("Content-Range: bytes 0-1/100\r\n\r\n" + digits.substr(0 , 2) + "\r\n--" + boundary) != string::npos) ;
+    assert(multiBody.find("Content-Range: bytes 5-6/100\r\n\r\n" + digits.substr(5 , 2) + "\r\n--" + boundary + "--\r\n") != string::npos) ;
+    assert(multi.find("bytes 200") == string::npos) ;
+
+    // 所有区间都不满足：416
+    assert(statusOf(respond("/range.txt" , "Range: bytes=-0\r\n")) == 416) ;
+    assert(statusOf(respond("/range.txt" , "Range: bytes=100-\r\n")) == 416) ;
+    assert(statusOf(respond("/range.txt" , "Range: bytes=200-300,150-\r\n")) == 416) ;
+    assert(statusOf(respond("/empty.txt" , "Range: bytes=5-\r\n")) == 416) ;
+    assert(statusOf(respond("/empty.txt" , "Range: bytes=-5\r\n")) == 416) ;
+
+    // 格式错误、数字太长、区间太多时忽略 Range
+    for(const string &range : {"bytes=9-1" , "bytes=a-5" , "bytes=5" , "items=0-5" , "bytes=0-9999999999999999999" , "bytes=99999999999999999999-" , "bytes=" , "bytes=,,"}) {
+        string response = respond("/range.txt" , "Range: " + range + "\r\n") ;
+        assert(statusOf(response) == 200 && headerOf(response , "Content-Length") == "100") ;
+    }
+    size_t maxCount = HttpConfigInfo::Instance().maxRangeCount ;
+    string many = "bytes=" , enough = "bytes=" ;
+    for(size_t i = 0 ; i <= maxCount ; ++i) {
+        string spec = (i ? "," : "") + to_string(i * 2) + "-" + to_string(i * 2) ;
+        many += spec ;
+        if(i < maxCount) enough += spec ;
+    }
+    assert(statusOf(respond("/range.txt" , "Range: " + many + "\r\n")) == 200) ;
+    assert(statusOf(respond("/range.txt" , "Range: " + enough + "\r\n")) == 206) ;
+
+    // If-Range 强比较：ETag 或者 Last-Modified 相同时才按 Range 发送
+    assert(statusOf(respond("/range.txt" , "Range: bytes=0-4\r\nIf-Range: " + etag + "\r\n")) == 206) ;
+    assert(statusOf(respond("/range.txt" , "Range: bytes=0-4\r\nIf-Range: " + lastModified + "\r\n")) == 206) ;
+    assert(statusOf(respond("/range.txt" , "Range: bytes=0-4\r\nIf-Range: W/" + etag + "\r\n")) == 200) ;
+    assert(statusOf(respond("/range.txt" , "Range: bytes=0-4\r\nIf-Range: \"other\"\r\n")) == 200) ;
+    assert(statusOf(respond("/range.txt" , "Range: bytes=0-4\r\nIf-Range: Sun, 06 Nov 1994 08:49:37 GMT\r\n")) == 200) ;
+    // If-Range 不匹配时即使区间不满足也发送整个文件，而不是 416 
+    assert(statusOf(respond("/range.txt" , "Range: bytes=500-\r\nIf-Range: \"other\"\r\n")) == 200) ;
+    cout<<"test_range pass"<<endl ;
+}
+
+// 测试条件请求：If-None-Match 的列表、* 和弱比较，If-None-Match 优先于 If-Modified-Since ，压缩版本的 ETag 和原文件不同
+void test_conditional(){
+    string full = respond("/range.txt" , "") ;
+    string etag = headerOf(full , "ETag") , lastModified = headerOf(full , "Last-Modified") ;
+    const string future = "Fri, 01 Jan 2100 00:00:00 GMT" , past = "Sun, 06 Nov 1994 08:49:37 GMT" ;
+
+    string notModified = respond("/range.txt" , "If-None-Match: " + etag + "\r\n") ;
+    assert(statusOf(notModified) == 304 && headerOf(notModified , "ETag") == etag) ;
+    assert(notModified.substr(notModified.find("\r\n\r\n") + 4).empty()) ;
+    assert(statusOf(respond("/range.txt" , "If-None-Match: \"a\", " + etag + " ,\"b\"\r\n")) == 304) ;
+    assert(statusOf(respond("/range.txt" , "If-None-Match: *\r\n")) == 304) ;
+    assert(statusOf(respond("/range.txt" , "If-None-Match: W/" + etag + "\r\n")) == 304) ;
+    assert(statusOf(respond("/range.txt" , "If-None-Match: \"a\", \"b\"\r\n")) == 200) ;
+    assert(statusOf(respond("/range.txt" , "If-None-Match: \"a*b\"\r\n")) == 200) ;
+    // 只是包含 ETag 的值不算匹配
+    assert(statusOf(respond("/range.txt" , "If-None-Match: W/\"x" + etag.substr(1) + "\r\n")) == 200) ;
+
+    assert(statusOf(respond("/range.txt" , "If-Modified-Since: " + lastModified + "\r\n")) == 304) ;
+    assert(statusOf(respond("/range.txt" , "If-Modified-Since: " + future + "\r\n")) == 304) ;
+    assert(statusOf(respond("/range.txt" , "If-Modified-Since: " + past + "\r\n")) == 200) ;
+    assert(statusOf(respond("/range.txt" , "If-Modified-Since: not a date\r\n")) == 200) ;
+    // 有 If-None-Match 时忽略 If-Modified-Since
+    assert(statusOf(respond("/range.txt" , "If-None-Match: \"other\"\r\nIf-Modified-Since: " + future + "\r\n")) == 200) ;
+    assert(statusOf(respond("/range.txt" , "If-None-Match: " + etag + "\r\nIf-Modified-Since: " + past + "\r\n")) == 304) ;
+    // 304 优先于 Range
+    assert(statusOf(respond("/range.txt" , "If-None-Match: " + etag + "\r\nRange: bytes=0-4\r\n")) == 304) ;
+
+    // gzip 版本和原文件的 ETag 不同，缓存的原文件不能当作压缩版本使用，反之亦然
+    string plain = respond("/page.html" , "") ;
+    string gzip = respond("/page.html" , "Accept-Encoding: gzip\r\n") ;
+    string plainTag = headerOf(plain , "ETag") , gzipTag = headerOf(gzip , "ETag") ;
+    assert(headerOf(gzip , "Content-Encoding") == "gzip" && headerOf(plain , "Content-Encoding").empty()) ;
+    assert(headerOf(gzip , "Vary") == "Accept-Encoding" && headerOf(plain , "Vary") == "Accept-Encoding") ;
+    assert(!plainTag.empty() && !gzipTag.empty() && plainTag != gzipTag) ;
+    assert(statusOf(respond("/page.html" , "Accept-Encoding: gzip\r\nIf-None-Match: " + plainTag + "\r\n")) == 200) ;
+    assert(statusOf(respond("/page.html" , "If-None-Match: " + gzipTag + "\r\n")) == 200) ;
+    assert(statusOf(respond("/page.html" , "Accept-Encoding: gzip\r\nIf-None-Match: " + gzipTag + "\r\n")) == 304) ;
+    assert(statusOf(respond("/page.html" , "If-None-Match: " + plainTag + "\r\n")) == 304) ;
+    cout<<"test_conditional pass"<<endl ;
+}
+
+int main(){
+    test_incremental() ;
+    test_chunked_body() ;
+    test_multipart() ;
+    test_reject_body() ;
+    test_stream() ;
+    test_range_files() ;
+    loadPack() ;
+    test_range() ;
+    test_conditional() ;
+    return 0 ;
+}
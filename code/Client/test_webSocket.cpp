@@ -0,0 +1,551 @@
+#include "webSocket.h"
+#include <iostream>
+#include <random>
+#include <thread>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+using namespace std ;
+
+static const uint8_t KEY[4] = { 0x37 , 0xfa , 0x21 , 0x3d } ;
+
+// 客户端发送的帧：加掩码，长度按 7 / 16 / 64 位编码
+static string clientFrame(const string &payload , uint8_t opcode = WebSocket::TEXT_FRAME , bool fin = true , bool rsv1 = false) {
+    string frame(1 , static_cast<char>((fin ? 0x80 : 0) | (rsv1 ? 0x40 : 0) | opcode)) ;
+    size_t len = payload.size() ;
+    if(len <= 125) {
+        frame.push_back(static_cast<char>(0x80 | len)) ;
+    }else if(len <= 65535) {
+        frame.push_back(static_cast<char>(0x80 | 126)) ;
+        frame.push_back(static_cast<char>(len >> 8)) ; frame.push_back(static_cast<char>(len)) ;
+    }else {
+        frame.push_back(static_cast<char>(0x80 | 127)) ;
+        for(int i = 7 ; i >= 0 ; --i) frame.push_back(static_cast<char>(len >> (8 * i))) ;
+    }
+    frame.append(reinterpret_cast<const char*>(KEY) , 4) ;
+    string masked(payload) ;
+    WebSocket::Unmask(&masked[0] , masked.size() , KEY) ;
+    return frame + masked ;
+}
+
+static string chat(const string &to , const string &message) {
+    return "{\"toName\":\"" + to + "\",\"message\":\"" + message + "\"}" ;
+}
+
+// 服务端一侧的 WebSocket ，另一端模拟客户端
+struct Peer {
+    int fds[2] ;
+    Buffer read , write ;
+    unique_ptr<Transport> transport ;
+    unique_ptr<WebSocket> ws ;
+    Peer(int isET = 1) {
+        assert(socketpair(AF_UNIX , SOCK_STREAM , 0 , fds) == 0) ;
+        fcntl(fds[0] , F_SETFL , O_NONBLOCK) ;
+        transport = make_unique<Transport>(fds[0] , nullptr) ;
+        ws = make_unique<WebSocket>(transport.get() , isET , &read , &write) ;
+    }
+    ~Peer() { ws.reset() ; close(fds[0]) ; close(fds[1]) ; }
+    void send(const string &data) { assert(::write(fds[1] , data.data() , data.size()) == static_cast<ssize_t>(data.size())) ; }
+    STATUS_CODE deal() { ws->init() ; return ws->dealWebSocketRequest() ; }
+    // 服务端发出的数据
+    string flush() {
+        ws->dealWebSocketResponse() ;
+        char buf[4096] ;
+        fcntl(fds[1] , F_SETFL , O_NONBLOCK) ;
+        ssize_t n = ::read(fds[1] , buf , sizeof(buf)) ;
+        return n > 0 ? string(buf , n) : "" ;
+    }
+};
+
+// 模拟客户端的压缩流 / 解压流，跨消息保留上下文
+struct RawZ {
+    z_stream deflater , inflater ;
+    RawZ(int bits = 15) {
+        memset(&deflater , 0 , sizeof(deflater)) ; memset(&inflater , 0 , sizeof(inflater)) ;
+        assert(deflateInit2(&deflater , 6 , Z_DEFLATED , -bits , 8 , Z_DEFAULT_STRATEGY) == Z_OK) ;
+        assert(inflateInit2(&inflater , -15) == Z_OK) ;
+    }
+    ~RawZ() { deflateEnd(&deflater) ; inflateEnd(&inflater) ; }
+    string compress(const string &data) {
+        string out(data.size() + 1024 , '\0') ;
+        deflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data())) ; deflater.avail_in = data.size() ;
+        deflater.next_out = reinterpret_cast<Bytef*>(&out[0]) ; deflater.avail_out = out.size() ;
+        assert(deflate(&deflater , Z_SYNC_FLUSH) == Z_OK) ;
+        out.resize(out.size() - deflater.avail_out) ;
+        assert(out.substr(out.size() - 4) == string("\x00\x00\xff\xff" , 4)) ;
+        return out.substr(0 , out.size() - 4) ;
+    }
+    string decompress(string data) {
+        data.append("\x00\x00\xff\xff" , 4) ;
+        string out(1024 * 1024 , '\0') ;
+        inflater.next_in = reinterpret_cast<Bytef*>(&data[0]) ; inflater.avail_in = data.size() ;
+        inflater.next_out = reinterpret_cast<Bytef*>(&out[0]) ; inflater.avail_out = out.size() ;
+        assert(inflate(&inflater , Z_SYNC_FLUSH) == Z_OK && inflater.avail_in == 0) ;
+        out.resize(out.size() - inflater.avail_out) ;
+        return out ;
+    }
+};
+
+// 握手响应中确认的扩展
+static string handshake(Peer &peer , const string &extensions) {
+    assert(peer.ws->handshark("dGhlIHNhbXBsZSBub25jZQ==" , extensions)) ;
+    string response = peer.flush() ;
+    size_t pos = response.find("Sec-WebSocket-Extensions: ") ;
+    if(pos == string::npos) return "" ;
+    pos += strlen("Sec-WebSocket-Extensions: ") ;
+    return response.substr(pos , response.find("\r\n" , pos) - pos) ;
+}
+
+static string messageOf(const WebSocket::Message &message) {
+    picojson::value value ;
+    const string &frame = *message.frame ;
+    size_t head = static_cast<uint8_t>(frame[1]) <= 125 ? 2 : static_cast<uint8_t>(frame[1]) == 126 ? 4 : 10 ;
+    assert(picojson::parse(value , frame.substr(head)).empty()) ;
+    return value.get("message").to_str() ;
+}
+
+// 逐字节反掩码，作为对照
+static string unmaskSlow(const string &data , const uint8_t key[4] , size_t offset) {
+    string out(data) ;
+    for(size_t i = 0 ; i < out.size() ; ++i) out[i] ^= key[(offset + i) % 4] ;
+    return out ;
+}
+
+// 测试各种长度、起始相位以及不对齐的地址，结果和逐字节反掩码一致，两次反掩码恢复原文
+void test_unmask(){
+    mt19937 rng(42) ;
+    const uint8_t key[4] = { 0x37 , 0xfa , 0x21 , 0x3d } ;
+    for(size_t len : {0 , 1 , 3 , 7 , 8 , 15 , 16 , 17 , 31 , 32 , 33 , 63 , 64 , 100 , 1000 , 65536 + 5}) {
+        for(size_t offset = 0 ; offset < 4 ; ++offset) {
+            for(size_t shift = 0 ; shift < 3 ; ++shift) {
+                string data(len , '\0') ;
+                for(char &ch : data) ch = static_cast<char>(rng()) ;
+                string buf = string(shift , 'x') + data ;
+                WebSocket::Unmask(&buf[shift] , len , key , offset) ;
+                assert(buf.substr(shift) == unmaskSlow(data , key , offset)) ;
+                WebSocket::Unmask(&buf[shift] , len , key , offset) ;
+                assert(buf.substr(shift) == data) ;
+            }
+        }
+    }
+    // 分段反掩码和一次反掩码结果相同
+    string data(1000 , 'a') , whole(data) , parts(data) ;
+    WebSocket::Unmask(&whole[0] , whole.size() , key) ;
+    WebSocket::Unmask(&parts[0] , 333 , key , 0) ;
+    WebSocket::Unmask(&parts[333] , 667 , key , 333) ;
+    assert(whole == parts) ;
+    cout<<"test_unmask pass"<<endl ;
+}
+
+// 测试一次读到多个帧全部解析，帧被拆成多次到达时保留在缓冲区，等收完整再解析
+void test_multi_partial(){
+    Peer peer ;
+    peer.send(clientFrame(chat("a" , "m1")) + clientFrame(chat("b" , "m2")) + clientFrame(chat("c" , "m3"))) ;
+    assert(peer.deal() == GOOD_CODE) ;
+    const auto &messages = peer.ws->getMessages() ;
+    assert(messages.size() == 3 && messages[0].toName == "a" && messageOf(messages[2]) == "m3") ;
+
+    string frame = clientFrame(chat("d" , string(300 , 'x'))) + clientFrame(chat("e" , "m5")) ;
+    size_t first = frame.size() - clientFrame(chat("e" , "m5")).size() ; // 第一个帧的长度
+    for(size_t i = 0 ; i + 1 < frame.size() ; ++i) {
+        peer.send(frame.substr(i , 1)) ;
+        STATUS_CODE ret = peer.deal() ;
+        if(i + 1 == first) { // 第一个帧刚好收完整
+            assert(ret == GOOD_CODE && peer.ws->getMessages().size() == 1) ;
+            assert(messageOf(peer.ws->getMessages()[0]) == string(300 , 'x')) ;
+        }else {
+            assert(ret == CONTINUE_CODE && peer.ws->getMessages().empty()) ;
+        }
+    }
+    peer.send(frame.substr(frame.size() - 1)) ;
+    assert(peer.deal() == GOOD_CODE && peer.ws->getMessages()[0].toName == "e") ;
+    cout<<"test_multi_partial pass"<<endl ;
+}
+
+// 测试分片消息拼接，中间插入的 ping 原样回复 pong ；64 位长度的帧
+void test_fragment_control(){
+    Peer peer ;
+    string json = chat("f" , string(70000 , 'y')) ;
+    peer.send(clientFrame(json.substr(0 , 10) , WebSocket::TEXT_FRAME , false) + clientFrame("hi" , WebSocket::PING_FRAME)) ;
+    assert(peer.deal() == GOOD_CODE && peer.ws->getMessages().empty() && peer.ws->WantWrite()) ;
+    string pong = peer.flush() ;
+    assert(pong == string("\x8a\x02hi" , 4)) ;
+    peer.send(clientFrame(json.substr(10 , 20) , WebSocket::CONTINUATION_FRAME , false)) ;
+    assert(peer.deal() == CONTINUE_CODE) ;
+    peer.send(clientFrame(json.substr(30) , WebSocket::CONTINUATION_FRAME , true)) ;
+    assert(peer.deal() == GOOD_CODE && peer.ws->getMessages().size() == 1) ;
+    assert(messageOf(peer.ws->getMessages()[0]) == string(70000 , 'y')) ;
+
+    string big = chat("g" , string(70000 , 'z')) ;
+    peer.send(clientFrame(big)) ;
+    assert(peer.deal() == GOOD_CODE && messageOf(peer.ws->getMessages()[0]) == string(70000 , 'z')) ;
+    assert(peer.ws->IsClosing() == false) ;
+    cout<<"test_fragment_control pass"<<endl ;
+}
+
+// 测试关闭帧、协议错误和超长消息：回复关闭帧之后不再解析
+void test_close(){
+    {
+        Peer peer ;
+        peer.send(clientFrame(string("\x03\xe8" , 2) , WebSocket::CLOSE_FRAME) + clientFrame(chat("h" , "after close"))) ;
+        assert(peer.deal() == GOOD_CODE && peer.ws->IsClosing() && peer.ws->getMessages().empty()) ;
+        peer.ws->makeWebSocketResponse(WebSocket::MakeFrame("dropped")) ;
+        assert(peer.flush() == string("\x88\x02\x03\xe8" , 4)) ;
+    }
+    {
+        Peer peer ; // 没有加掩码
+        peer.send(string("\x81\x02hi" , 4)) ;
+        assert(peer.deal() == GOOD_CODE && peer.ws->IsClosing()) ;
+        assert(peer.flush() == string("\x88\x02\x03\xea" , 4)) ;
+    }
+    {
+        Peer peer ; // 没有开始分片就收到 continuation 
+        peer.send(clientFrame("x" , WebSocket::CONTINUATION_FRAME)) ;
+        assert(peer.deal() == GOOD_CODE && peer.ws->IsClosing()) ;
+    }
+    {
+        Peer peer ; // 帧头就能判断超过上限，不等 payload 
+        string frame = clientFrame(string(HttpConfigInfo::Instance().wsMaxMessageSize + 1 , 'x')) ;
+        peer.send(frame.substr(0 , 14)) ;
+        assert(peer.deal() == GOOD_CODE && peer.ws->IsClosing()) ;
+        assert(peer.flush() == string("\x88\x02\x03\xf1" , 4)) ;
+    }
+    {
+        Peer peer ; // JSON 格式错误
+        peer.send(clientFrame("{bad")) ;
+        assert(peer.deal() == GOOD_CODE && peer.ws->IsClosing()) ;
+        assert(peer.flush() == string("\x88\x02\x03\xef" , 4)) ;
+    }
+    cout<<"test_close pass"<<endl ;
+}
+
+// 测试 permessage-deflate 协商：跳过不能接受的 offer ，按 offer 和配置确定上下文和窗口
+void test_deflate_negotiate(){
+    { Peer peer ; assert(handshake(peer , "") == "") ; }
+    { Peer peer ; assert(handshake(peer , "x-webkit-deflate-frame") == "") ; }
+    { Peer peer ; assert(handshake(peer , "permessage-deflate; client_max_window_bits") == "permessage-deflate; server_no_context_takeover") ; }
+    { 
+        Peer peer ; // 未知参数、重复参数、服务端窗口 8 都不接受，选下一个
+        string accepted = handshake(peer , "permessage-deflate; foo, permessage-deflate; client_no_context_takeover; client_no_context_takeover, "
+                                           "permessage-deflate; server_max_window_bits=8, permessage-deflate; server_max_window_bits=10; client_no_context_takeover") ;
+        assert(accepted == "permessage-deflate; server_no_context_takeover; client_no_context_takeover; server_max_window_bits=10") ;
+    }
+    { Peer peer ; assert(handshake(peer , "permessage-deflate; server_max_window_bits=16") == "") ; }
+    { Peer peer ; assert(handshake(peer , "permessage-deflate; client_max_window_bits=\"12\"") == "permessage-deflate; server_no_context_takeover; client_max_window_bits=12") ; }
+    // 客户端保留上下文，每个连接一个解压流，计入内存
+    size_t used = WsDeflate::UsedMemory() ;
+    {
+        Peer peer ; 
+        handshake(peer , "permessage-deflate; client_max_window_bits=10") ;
+        assert(WsDeflate::UsedMemory() == used + WsDeflate::InflateMemory(10)) ;
+    }
+    assert(WsDeflate::UsedMemory() == used) ;
+    cout<<"test_deflate_negotiate pass"<<endl ;
+}
+
+// 测试收到压缩的消息：单帧、分片、跨消息的上下文；没有协商或者 continuation 带 RSV1 是协议错误
+void test_deflate_inflate(){
+    {
+        Peer peer ; 
+        handshake(peer , "permessage-deflate") ;
+        RawZ client ; 
+        string json = chat("a" , string(1000 , 'q')) ;
+        peer.send(clientFrame(client.compress(json) , WebSocket::TEXT_FRAME , true , true)) ;
+        assert(peer.deal() == GOOD_CODE && messageOf(peer.ws->getMessages()[0]) == string(1000 , 'q')) ;
+        // 第二条消息引用了第一条的内容，服务端的解压流保留了上下文
+        string compressed = client.compress(json) ;
+        assert(compressed.size() < 20) ;
+        peer.send(clientFrame(compressed.substr(0 , 3) , WebSocket::TEXT_FRAME , false , true) + clientFrame("hi" , WebSocket::PING_FRAME)
+                + clientFrame(compressed.substr(3) , WebSocket::CONTINUATION_FRAME , true)) ;
+        assert(peer.deal() == GOOD_CODE && peer.ws->getMessages().size() == 1) ;
+        assert(messageOf(peer.ws->getMessages()[0]) == string(1000 , 'q')) ;
+        peer.send(clientFrame(chat("b" , "plain"))) ; // 不压缩的消息
+        assert(peer.deal() == GOOD_CODE && messageOf(peer.ws->getMessages()[0]) == "plain") ;
+        assert(peer.ws->IsClosing() == false) ;
+    }
+    {
+        Peer peer ; // 解压之后超过上限
+        handshake(peer , "permessage-deflate") ;
+        RawZ client ; 
+        peer.send(clientFrame(client.compress(string(HttpConfigInfo::Instance().wsMaxMessageSize + 1 , ' ')) , WebSocket::TEXT_FRAME , true , true)) ;
+        assert(peer.deal() == GOOD_CODE && peer.ws->IsClosing()) ;
+        assert(peer.flush() == string("\x88\x02\x03\xf1" , 4)) ;
+    }
+    {
+        Peer peer ; // 压缩数据错误
+        handshake(peer , "permessage-deflate") ;
+        peer.send(clientFrame(string(16 , '\xff') , WebSocket::TEXT_FRAME , true , true)) ;
+        assert(peer.deal() == GOOD_CODE && peer.ws->IsClosing()) ;
+        assert(peer.flush() == string("\x88\x02\x03\xef" , 4)) ;
+    }
+    {
+        Peer peer ; // 没有协商
+        handshake(peer , "") ;
+        peer.send(clientFrame("x" , WebSocket::TEXT_FRAME , true , true)) ;
+        assert(peer.deal() == GOOD_CODE && peer.ws->IsClosing()) ;
+    }
+    {
+        Peer peer ; 
+        handshake(peer , "permessage-deflate") ;
+        peer.send(clientFrame("x" , WebSocket::TEXT_FRAME , false , true) + clientFrame("y" , WebSocket::CONTINUATION_FRAME , true , true)) ;
+        assert(peer.deal() == GOOD_CODE && peer.ws->IsClosing()) ;
+    }
+    cout<<"test_deflate_inflate pass"<<endl ;
+}
+
+// 测试群发：窗口相同的接收者共享同一个压缩帧，窗口不同的各压缩一次，没有协商的收到原始帧；太小的消息不压缩
+void test_deflate_broadcast(){
+    Peer a , b , c , d ; 
+    handshake(a , "permessage-deflate") ;
+    handshake(b , "permessage-deflate; client_no_context_takeover") ;
+    handshake(c , "permessage-deflate; server_max_window_bits=9") ;
+    handshake(d , "") ;
+    string content ;
+    for(int i = 0 ; i < 20 ; ++i) content += "{\"isSystem\":false,\"fromName\":\"user\",\"message\":\"hello\"}" ;
+    WebSocket::Message message ; 
+    message.frame = WebSocket::MakeFrame(content) ;
+    for(Peer* peer : { &a , &b , &c , &d }) peer->ws->makeWebSocketResponse(message) ;
+    assert(message.deflated[15] != nullptr && message.deflated[9] != nullptr && message.deflated[15] != message.deflated[9]) ;
+    assert(message.deflated[15].use_count() == 3) ; // message 本身加上 a 、b 的队列
+    assert(message.deflated[15]->size() < content.size() / 4) ;
+
+    for(Peer* peer : { &a , &b , &c }) {
+        string frame = peer->flush() ;
+        assert(static_cast<uint8_t>(frame[0]) == (0x80 | 0x40 | WebSocket::TEXT_FRAME)) ;
+        RawZ client ; 
+        assert(client.decompress(string(WebSocket::PayloadOf(frame))) == content) ;
+    }
+    assert(d.flush() == *message.frame) ;
+
+    WebSocket::Message small ; 
+    small.frame = WebSocket::MakeFrame("{}") ;
+    a.ws->makeWebSocketResponse(small) ;
+    assert(small.deflated[15] == nullptr && a.flush() == *small.frame) ;
+    // 服务端不保留上下文，同一个连接连续的消息都可以独立解压
+    a.ws->makeWebSocketResponse(message) ;
+    RawZ client ; 
+    assert(client.decompress(string(WebSocket::PayloadOf(a.flush()))) == content) ;
+    cout<<"test_deflate_broadcast pass"<<endl ;
+}
+
+// 测试房间消息的解析：发布和私聊的帧带上登录的用户名；不是对象的 JSON 是数据错误，未知的 type 忽略
+void test_topic_message(){
+    Peer peer ; 
+    peer.ws->SetUserName("alice") ;
+    peer.send(clientFrame("{\"type\":\"subscribe\",\"topic\":\"room1\"}") + clientFrame("{\"type\":\"publish\",\"topic\":\"room1\",\"message\":\"hi\"}")
+            + clientFrame("{\"type\":\"dance\"}") + clientFrame("{\"type\":\"unsubscribe\",\"topic\":7}")) ;
+    assert(peer.deal() == GOOD_CODE) ;
+    auto &messages = peer.ws->getMessages() ;
+    assert(messages.size() == 3) ;
+    assert(messages[0].type == WebSocket::SUBSCRIBE_MESSAGE && messages[0].topic == "room1" && messages[0].frame == nullptr) ;
+    assert(messages[1].type == WebSocket::PUBLISH_MESSAGE && messages[1].topic == "room1") ;
+    picojson::value value ;
+    assert(picojson::parse(value , string(WebSocket::PayloadOf(*messages[1].frame))).empty()) ;
+    assert(value.get("fromName").to_str() == "alice" && value.get("topic").to_str() == "room1" && value.get("message").to_str() == "hi") ;
+    assert(messages[2].type == WebSocket::UNSUBSCRIBE_MESSAGE && messages[2].topic.empty()) ;
+
+    // 私聊消息的 fromName 是发送者
+    peer.send(clientFrame(chat("bob" , "dm"))) ;
+    assert(peer.deal() == GOOD_CODE && messages.size() == 1 && messages[0].type == WebSocket::CHAT_MESSAGE && messages[0].toName == "bob") ;
+    assert(picojson::parse(value , string(WebSocket::PayloadOf(*messages[0].frame))).empty()) ;
+    assert(value.get("fromName").to_str() == "alice" && value.get("message").to_str() == "dm") ;
+
+    peer.send(clientFrame("[1,2]")) ;
+    assert(peer.deal() == GOOD_CODE && peer.ws->IsClosing()) ;
+    assert(peer.flush() == string("\x88\x02\x03\xef" , 4)) ;
+    cout<<"test_topic_message pass"<<endl ;
+}
+
+// 连续的编号帧，用于检查队列中剩下的是哪些帧
+static WebSocket::Frame numbered(int i , size_t size = 10) {
+    string payload = to_string(i) ;
+    payload.resize(size , ' ') ;
+    return WebSocket::MakeFrame(payload) ;
+}
+
+static int numberOf(const string &frame) {
+    return atoi(string(WebSocket::PayloadOf(frame)).data()) ;
+}
+
+// 从队列中取出所有帧（不写入 socket）
+static vector<string> drainFrames(Peer &peer) {
+    vector<string> frames ;
+    string data ;
+    while(!(data = peer.flush()).empty()) {
+        size_t pos = 0 ;
+        while(pos < data.size()) {
+            size_t len = static_cast<uint8_t>(data[pos + 1]) & 0x7F ;
+            frames.push_back(data.substr(pos , 2 + len)) ;
+            pos += 2 + len ;
+        }
+    }
+    return frames ;
+}
+
+// 测试发送队列的上限和各种处理方式，控制帧不计入上限也不会被丢弃
+void test_send_queue(){
+    WsStats &stats = WsStats::Instance() ;
+    {
+        Peer peer ; // 丢弃最旧的
+        peer.ws->SetQueuePolicy(1000 , 5 , WS_DROP_OLDEST , 0) ;
+        uint64_t dropped = stats.droppedOldest ;
+        peer.ws->makeWebSocketResponse(WebSocket::MakeFrame("p" , 1 , WebSocket::PONG_FRAME)) ;
+        for(int i = 0 ; i < 8 ; ++i) peer.ws->makeWebSocketResponse(numbered(i)) ;
+        assert(peer.ws->QueueFrames() == 5 && peer.ws->QueueBytes() == 4 * 12 && stats.droppedOldest == dropped + 4) ;
+        vector<string> frames = drainFrames(peer) ;
+        assert(frames.size() == 5 && static_cast<uint8_t>(frames[0][0]) == 0x8A) ;
+        for(int i = 1 ; i < 5 ; ++i) assert(numberOf(frames[i]) == i + 3) ;
+        assert(peer.ws->QueueBytes() == 0) ;
+    }
+    {
+        Peer peer ; // 丢弃新的，按字节数限制
+        peer.ws->SetQueuePolicy(50 , 100 , WS_DROP_NEWEST , 0) ;
+        uint64_t dropped = stats.droppedNewest ;
+        for(int i = 0 ; i < 8 ; ++i) peer.ws->makeWebSocketResponse(numbered(i)) ;
+        assert(peer.ws->QueueFrames() == 4 && stats.droppedNewest == dropped + 4) ;
+        vector<string> frames = drainFrames(peer) ;
+        assert(numberOf(frames[0]) == 0 && numberOf(frames[3]) == 3) ;
+    }
+    {
+        Peer peer ; // 同类的帧原地替换，没有同类时丢弃最旧的
+        peer.ws->SetQueuePolicy(1000 , 4 , WS_COALESCE , 0) ;
+        uint64_t coalesced = stats.coalesced ;
+        peer.ws->makeWebSocketResponse(numbered(0)) ;
+        peer.ws->makeWebSocketResponse(numbered(1) , WebSocket::COALESCE_ROSTER) ;
+        peer.ws->makeWebSocketResponse(numbered(2)) ;
+        peer.ws->makeWebSocketResponse(numbered(3)) ;
+        peer.ws->makeWebSocketResponse(numbered(4) , WebSocket::COALESCE_ROSTER) ;
+        peer.ws->makeWebSocketResponse(numbered(5)) ;
+        assert(stats.coalesced == coalesced + 1) ;
+        vector<string> frames = drainFrames(peer) ;
+        vector<int> numbers ;
+        for(const string &frame : frames) numbers.push_back(numberOf(frame)) ;
+        assert((numbers == vector<int>{ 4 , 2 , 3 , 5 })) ;
+    }
+    {
+        Peer peer ; // 宽限时间内积累到两倍上限，之后丢弃新的；超过宽限时间断开
+        peer.ws->SetQueuePolicy(1000 , 2 , WS_DISCONNECT , 50) ;
+        uint64_t evicted = stats.evicted ;
+        for(int i = 0 ; i < 6 ; ++i) peer.ws->makeWebSocketResponse(numbered(i)) ;
+        assert(peer.ws->QueueFrames() == 4 && peer.ws->IsEvicted() == false) ;
+        this_thread::sleep_for(chrono::milliseconds(60)) ;
+        peer.ws->makeWebSocketResponse(numbered(6)) ;
+        assert(peer.ws->IsEvicted() && stats.evicted == evicted + 1 && peer.ws->QueueFrames() == 0) ;
+        assert(peer.ws->dealWebSocketResponse() == CLOSE_CONNECTION) ;
+        char buf[16] ;
+        assert(::read(peer.fds[1] , buf , sizeof(buf)) == 0) ; // 对端读到 EOF 
+    }
+    {
+        Peer peer ; // 降到上限以下之后重新计算宽限时间
+        peer.ws->SetQueuePolicy(1000 , 2 , WS_DISCONNECT , 50) ;
+        for(int i = 0 ; i < 3 ; ++i) peer.ws->makeWebSocketResponse(numbered(i)) ;
+        drainFrames(peer) ;
+        this_thread::sleep_for(chrono::milliseconds(60)) ;
+        for(int i = 0 ; i < 3 ; ++i) peer.ws->makeWebSocketResponse(numbered(i)) ;
+        assert(peer.ws->IsEvicted() == false && peer.ws->QueueFrames() == 3) ;
+    }
+    cout<<"test_send_queue pass"<<endl ;
+}
+
+// 读出对端收到的所有数据
+static string readAll(Peer &peer) {
+    string data ;
+    char buf[65536] ;
+    fcntl(peer.fds[1] , F_SETFL , O_NONBLOCK) ;
+    ssize_t n = 0 ;
+    while((n = ::read(peer.fds[1] , buf , sizeof(buf))) > 0) data.append(buf , n) ;
+    return data ;
+}
+
+// 测试一次可写事件把写缓冲区和队列中的帧一起写出；socket 缓冲区满时从断点继续，帧的顺序和内容不变
+void test_batch_write(){
+    {
+        Peer peer(0) ; // LT 模式每次事件只写一次，也能一次写完整个队列
+        const string head = "HTTP/1.1 101 Switching Protocols\r\n\r\n" ;
+        peer.write.Append(head) ;
+        for(int i = 0 ; i < 100 ; ++i) peer.ws->makeWebSocketResponse(numbered(i)) ;
+        assert(peer.ws->dealWebSocketResponse() == GOOD_CODE && peer.ws->WantWrite() == false) ;
+        string data = readAll(peer) ;
+        assert(data.find(head) == 0 && data.size() == head.size() + 100 * 12) ;
+        for(int i = 0 ; i < 100 ; ++i) assert(numberOf(data.substr(head.size() + i * 12 , 12)) == i) ;
+    }
+    {
+        Peer peer ;
+        int size = 4096 ;
+        setsockopt(peer.fds[0] , SOL_SOCKET , SO_SNDBUF , &size , sizeof(size)) ;
+        const int COUNT = 500 ;
+        for(int i = 0 ; i < COUNT ; ++i) peer.ws->makeWebSocketResponse(numbered(i , 1000)) ;
+        string data ;
+        STATUS_CODE ret = CONTINUE_CODE ;
+        while(ret == CONTINUE_CODE) {
+            ret = peer.ws->dealWebSocketResponse() ;
+            data += readAll(peer) ;
+        }
+        assert(ret == GOOD_CODE) ;
+        size_t frameLen = 4 + 1000 ;
+        assert(data.size() == COUNT * frameLen) ;
+        for(int i = 0 ; i < COUNT ; ++i) {
+            string frame = data.substr(i * frameLen , frameLen) ;
+            assert(frame == *numbered(i , 1000)) ;
+        }
+    }
+    cout<<"test_batch_write pass"<<endl ;
+}
+
+// 测试心跳：空闲之后发送 ping ，收到 pong 之后重新计时，ping 之后超时没有回应就断开；发出 ping 和断开时才唤醒写
+void test_heartbeat(){
+    WsStats &stats = WsStats::Instance() ;
+    Peer peer ;
+    uint64_t pings = stats.pings , timeouts = stats.pingTimeouts ;
+    int woken = 0 ;
+    auto wakeup = [&](int) { ++woken ; } ;
+    assert(peer.ws->Heartbeat(1 , 1 , wakeup) == 1 && peer.ws->WantWrite() == false && woken == 0) ; // 刚连接，不发送
+    this_thread::sleep_for(chrono::milliseconds(1100)) ;
+    assert(peer.ws->Heartbeat(1 , 1 , wakeup) == 1 && stats.pings == pings + 1 && woken == 1) ;
+    assert(peer.flush() == string("\x89\x00" , 2)) ;
+    assert(peer.ws->Heartbeat(1 , 1 , wakeup) == 1 && peer.ws->WantWrite() == false && woken == 1) ; // 等待 pong 时不重复发送
+
+    peer.send(clientFrame("" , WebSocket::PONG_FRAME)) ;
+    assert(peer.deal() == CONTINUE_CODE) ;
+    assert(peer.ws->Heartbeat(1 , 1 , wakeup) == 1 && peer.ws->IsEvicted() == false && stats.pingTimeouts == timeouts) ;
+
+    this_thread::sleep_for(chrono::milliseconds(1100)) ;
+    assert(peer.ws->Heartbeat(1 , 1 , wakeup) == 1 && stats.pings == pings + 2 && woken == 2) ;
+    this_thread::sleep_for(chrono::milliseconds(1100)) ;
+    assert(peer.ws->Heartbeat(1 , 1 , wakeup) == -1 && peer.ws->IsEvicted() && stats.pingTimeouts == timeouts + 1 && woken == 3) ;
+    assert(peer.ws->dealWebSocketResponse() == CLOSE_CONNECTION) ;
+    assert(peer.ws->Heartbeat(1 , 1 , wakeup) == -1 && woken == 3) ; // 已经断开，不再检查
+    cout<<"test_heartbeat pass"<<endl ;
+}
+
+// 测试其他连接投递消息：没有关闭时入队并通知监听写，关闭之后不入队也不通知（fd 可能已经被新连接复用）
+void test_deliver(){
+    Peer peer ;
+    WebSocket::Message message ;
+    message.frame = WebSocket::MakeFrame("hello") ;
+    vector<int> woken ;
+    auto wakeup = [&](int fd) { woken.push_back(fd) ; } ;
+    assert(peer.ws->Deliver(message , wakeup) && peer.ws->QueueFrames() == 1) ;
+    assert((woken == vector<int>{ peer.fds[0] })) ;
+    assert(peer.flush() == *message.frame) ;
+    peer.ws->close() ;
+    assert(peer.ws->Deliver(message , wakeup) == false) ;
+    assert(woken.size() == 1 && peer.ws->QueueFrames() == 0) ;
+    cout<<"test_deliver pass"<<endl ;
+}
+
+int main(){
+    test_unmask() ;
+    test_multi_partial() ;
+    test_fragment_control() ;
+    test_close() ;
+    test_deflate_negotiate() ;
+    test_deflate_inflate() ;
+    test_deflate_broadcast() ;
+    test_topic_message() ;
+    test_send_queue() ;
+    test_batch_write() ;
+    test_heartbeat() ;
+    test_deliver() ;
+    return 0 ;
+}
@@ -0,0 +1,309 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <errno.h>
+#include <strings.h>
+#include "../Log/log.h"
+
+// 上传的文件先写入临时文件，请求结束时删除，处理函数需要保留的话用 rename 移走
+struct UploadPart {
+    std::string name ;                      // 表单字段名，非 multipart 的大 body 为空
+    std::string filename ;                  // 客户端提供的文件名，没有经过检查，不能直接用作路径
+    std::string contentType ;
+    std::string path ;                      // 临时文件路径，移走之后置空
+    size_t size ;
+};
+
+// 请求 body 边收边落盘，内存占用和 body 大小无关：
+// 1. multipart/form-data 增量解析，普通字段保存到 fields ，文件写入临时文件；只保留可能是分隔符开头的尾部数据
+//    所有普通字段加起来的字节数和部分的个数都有上限，超过时解析失败
+// 2. 其他太大的 body 整个作为一个没有名字的部分写入临时文件
+class UploadParser {
+public :
+    UploadParser() : state_(PREAMBLE) , fd_(-1) , fieldLimit_(0) , fieldBytes_(0) , partLimit_(0) , parts_(0) {
+
+    }
+
+    ~UploadParser() {
+        clear() ;
+    }
+
+    // Content-Type: multipart/form-data; boundary=----WebKitFormBoundary7MA4YWxkTrZu0gW
+    static std::string GetBoundary(const std::string &contentType) {
+        if(strncasecmp(contentType.c_str() , "multipart/form-data" , 19) != 0) return "" ;
+        size_t pos = contentType.find("boundary=") ;
+        if(pos == std::string::npos) return "" ;
+        std::string boundary = contentType.substr(pos + 9) ;
+        boundary = boundary.substr(0 , boundary.find(';')) ;
+        if(boundary.size() >= 2 && boundary.front() == '"' && boundary.back() == '"') boundary = boundary.substr(1 , boundary.size() - 2) ;
+        if(boundary.empty() || boundary.size() > 70) return "" ; // RFC 2046 规定最长 70 个字符
+        return boundary ;
+    }
+
+    // fieldLimit 是所有普通字段的总字节数上限，partLimit 是部分（字段和文件）的个数上限
+    void init(const std::string &boundary , const char* tmpDir , size_t fieldLimit , size_t partLimit) {
+        clear() ;
+        delimiter_ = "\r\n--" + boundary ;
+        carry_ = "\r\n" ;   // 第一个分隔符前面没有 \r\n ，补上之后所有分隔符的格式一样
+        tmpDir_ = tmpDir ;
+        fieldLimit_ = fieldLimit ;
+        partLimit_ = partLimit ;
+    }
+
+    // 不是 multipart 的 body ：已经收到的内容 prefix 和之后输入的内容都写入同一个临时文件
+    bool initRaw(const char* tmpDir , const std::string &contentType , const std::string &prefix) {
+        clear() ;
+        tmpDir_ = tmpDir ;
+        current_.contentType = contentType ;
+        current_.filename = "body" ;
+        if(startPart_() == false) return false ;
+        state_ = RAW ;
+        return writePart_(prefix.data() , prefix.size()) ;
+    }
+
+    // 删除还没有移走的临时文件
+    void clear() {
+        closeFile_() ;
+        for(const UploadPart &part : uploads_) {
+            if(!part.path.empty()) unlink(part.path.c_str()) ;
+        }
+        uploads_.clear() ; fields_.clear() ;
+        carry_.clear() ; field_.clear() ; current_ = UploadPart() ;
+        fieldBytes_ = 0 ; parts_ = 0 ;
+        state_ = PREAMBLE ;
+    }
+
+    // 输入一段 body ，格式错误或者写文件失败返回 false
+    bool feed(const char* data , size_t len) {
+        if(state_ == RAW) return writePart_(data , len) ;
+        carry_.append(data , len) ;
+        size_t pos = 0 ;
+        bool ok = true ;
+        while(ok && state_ != END) {
+            size_t used = 0 ;
+            if(state_ == PREAMBLE || state_ == DATA) ok = parseData_(pos , used) ;
+            else if(state_ == BOUNDARY) ok = parseBoundary_(pos , used) ;
+            else ok = parseHeader_(pos , used) ;
+            if(used == 0) break ; // 数据不够，等待下一次输入
+            pos += used ;
+        }
+        if(state_ == END) pos = carry_.size() ; // 结束分隔符之后的内容忽略
+        carry_.erase(0 , pos) ;
+        return ok ;
+    }
+
+    // 把临时文件保存到 path ，不覆盖已经存在的文件；临时目录和 path 不在同一个文件系统时退回到复制
+    static bool Save(UploadPart &part , const std::string &path) {
+        if(part.path.empty()) return false ;
+        chmod(part.path.c_str() , 0644) ; // mkstemp 创建的文件只有所有者可读，静态文件需要其他人可读
+        if(link(part.path.c_str() , path.c_str()) != 0) {
+            if(errno != EXDEV || copy_(part.path , path , part.size) == false) {
+                LOG_ERROR("save upload %s to %s error %d" , part.path.data() , path.data() , errno) ;
+                return false ;
+            }
+        }
+        unlink(part.path.c_str()) ;
+        part.path.clear() ;
+        return true ;
+    }
+
+    // multipart 读到了结束分隔符；RAW 由请求的长度决定什么时候结束
+    bool IsFinish() const {
+        return state_ == END || state_ == RAW ;
+    }
+
+    // body 结束了，关闭临时文件
+    void finish() {
+        closeFile_() ;
+    }
+
+    std::unordered_map<std::string , std::string>& GetFields() {
+        return fields_ ;
+    }
+
+    std::vector<UploadPart>& GetUploads() {
+        return uploads_ ;
+    }
+
+private :
+    enum STATE {
+        PREAMBLE ,                          // 第一个分隔符之前的内容，丢弃
+        BOUNDARY ,                          // 分隔符之后：-- 表示结束，\r\n 表示下一个部分
+        HEADER ,                            // 部分的头部，以空行结束
+        DATA ,                              // 部分的内容，直到下一个分隔符
+        END ,
+        RAW ,                               // 整个 body 写入一个临时文件
+    };
+    static constexpr size_t MAX_HEADER_LINE = 8192 ;
+
+    // 找分隔符，之前的内容都属于当前部分；找不到时保留可能是分隔符开头的尾部
+    bool parseData_(size_t pos , size_t &used) {
+        size_t found = carry_.find(delimiter_ , pos) ;
+        size_t end = found != std::string::npos ? found :
+                     std::max(pos , carry_.size() >= delimiter_.size() ? carry_.size() - delimiter_.size() + 1 : 0) ;
+        if(state_ == DATA && end > pos && writePart_(carry_.data() + pos , end - pos) == false) return false ;
+        used = end - pos ;
+        if(found != std::string::npos) {
+            if(state_ == DATA && finishPart_() == false) return false ;
+            used += delimiter_.size() ;
+            state_ = BOUNDARY ;
+        }
+        return true ;
+    }
+
+    bool parseBoundary_(size_t pos , size_t &used) {
+        size_t lineEnd = carry_.find("\r\n" , pos) ;
+        if(carry_.compare(pos , 2 , "--") == 0) {
+            state_ = END ; used = 2 ;
+            return true ;
+        }
+        if(lineEnd == std::string::npos) return carry_.size() - pos < MAX_HEADER_LINE ;
+        if(++parts_ > partLimit_) {
+            LOG_ERROR("multipart parts more than %zu" , partLimit_) ;
+            return false ;
+        }
+        // 分隔符和 \r\n 之间允许有空白
+        for(size_t i = pos ; i < lineEnd ; ++i) {
+            if(carry_[i] != ' ' && carry_[i] != '\t') return false ;
+        }
+        used = lineEnd + 2 - pos ;
+        state_ = HEADER ;
+        current_ = UploadPart() ; field_.clear() ;
+        return true ;
+    }
+
+    bool parseHeader_(size_t pos , size_t &used) {
+        size_t lineEnd = carry_.find("\r\n" , pos) ;
+        if(lineEnd == std::string::npos) return carry_.size() - pos < MAX_HEADER_LINE ;
+        used = lineEnd + 2 - pos ;
+        if(lineEnd == pos) return startPart_() ; // 空行，头部结束
+        std::string line = carry_.substr(pos , lineEnd - pos) ;
+        size_t colon = line.find(':') ;
+        if(colon == std::string::npos) return false ;
+        std::string key = line.substr(0 , colon) ;
+        std::string value = line.substr(std::min(line.find_first_not_of(' ' , colon + 1) , line.size())) ;
+        if(strcasecmp(key.c_str() , "Content-Disposition") == 0) {
+            current_.name = getParam_(value , "name") ;
+            current_.filename = getParam_(value , "filename") ;
+        }else if(strcasecmp(key.c_str() , "Content-Type") == 0) {
+            current_.contentType = value ;
+        }
+        return true ;
+    }
+
+    // form-data; name="file"; filename="a.png"
+    static std::string getParam_(const std::string &value , const std::string &key) {
+        size_t pos = 0 ;
+        while((pos = value.find(key + "=" , pos)) != std::string::npos) {
+            if(pos == 0 || value[pos - 1] == ' ' || value[pos - 1] == ';') break ;
+            pos += key.size() ;
+        }
+        if(pos == std::string::npos) return "" ;
+        pos += key.size() + 1 ;
+        if(pos < value.size() && value[pos] == '"') {
+            size_t end = value.find('"' , pos + 1) ;
+            return value.substr(pos + 1 , end == std::string::npos ? std::string::npos : end - pos - 1) ;
+        }
+        return value.substr(pos , value.find(';' , pos) - pos) ;
+    }
+
+    // 有 filename 的部分是文件，写入临时文件；否则是普通字段
+    bool startPart_() {
+        state_ = DATA ;
+        if(current_.filename.empty()) return true ;
+        std::string path = tmpDir_ + "/tinyweb_upload_XXXXXX" ;
+        fd_ = mkstemp(&path[0]) ;
+        if(fd_ < 0) {
+            LOG_ERROR("create upload file in %s error %d" , tmpDir_.data() , errno) ;
+            return false ;
+        }
+        current_.path = path ;
+        current_.size = 0 ;
+        uploads_.push_back(current_) ;
+        return true ;
+    }
+
+    bool writePart_(const char* data , size_t len) {
+        if(fd_ < 0) {
+            if(fieldBytes_ + len > fieldLimit_) {
+                LOG_ERROR("multipart fields too large , field %s" , current_.name.data()) ;
+                return false ;
+            }
+            fieldBytes_ += len ;
+            field_.append(data , len) ;
+            return true ;
+        }
+        while(len > 0) {
+            ssize_t n = write(fd_ , data , len) ;
+            if(n < 0 && errno == EINTR) continue ;
+            if(n < 0) {
+                LOG_ERROR("write upload file %s error %d" , uploads_.back().path.data() , errno) ;
+                return false ;
+            }
+            data += n ; len -= n ;
+            uploads_.back().size += n ;
+        }
+        return true ;
+    }
+
+    bool finishPart_() {
+        if(fd_ < 0) {
+            fields_[current_.name] = std::move(field_) ;
+            field_.clear() ;
+            return true ;
+        }
+        closeFile_() ;
+        return true ;
+    }
+
+    static bool copy_(const std::string &from , const std::string &to , size_t size) {
+        int in = open(from.c_str() , O_RDONLY) ;
+        if(in < 0) return false ;
+        int out = open(to.c_str() , O_WRONLY | O_CREAT | O_EXCL , 0644) ;
+        if(out < 0) {
+            ::close(in) ;
+            return false ;
+        }
+        off_t offset = 0 ;
+        while(static_cast<size_t>(offset) < size) {
+            ssize_t n = sendfile(out , in , &offset , size - offset) ;
+            if(n < 0 && errno == EINTR) continue ;
+            if(n <= 0) break ;
+        }
+        bool ok = static_cast<size_t>(offset) == size ;
+        ::close(in) ; ::close(out) ;
+        if(ok == false) unlink(to.c_str()) ;
+        return ok ;
+    }
+
+    void closeFile_() {
+        if(fd_ < 0) return ;
+        ::close(fd_) ;
+        fd_ = -1 ;
+    }
+
+    STATE state_ ;
+    std::string delimiter_ ;                // \r\n--boundary
+    std::string carry_ ;                    // 还没有处理完的输入
+    std::string tmpDir_ ;
+    int fd_ ;                               // 当前文件部分的临时文件
+    size_t fieldLimit_ ;                    // 所有普通字段的总字节数上限
+    size_t fieldBytes_ ;                    // 已经收到的普通字段字节数
+    size_t partLimit_ ;                     // 部分的个数上限
+    size_t parts_ ;                         // 已经开始的部分个数
+    UploadPart current_ ;
+    std::string field_ ;                    // 当前普通字段的内容
+    std::unordered_map<std::string , std::string> fields_ ;
+    std::vector<UploadPart> uploads_ ;
+} ;
+
+#endif
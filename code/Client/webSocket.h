@@ -2,38 +2,98 @@
 #define WEBSOCKET_H
 
 #include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <endian.h>       // be64toh
 #include <arpa/inet.h>    //for ntohl
+#include <sys/uio.h>      // writev
+#include <limits.h>       // IOV_MAX
+#include <sys/socket.h>   // shutdown
 #include <openssl/sha.h>
 #include <mutex>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>   // SSE2 / AVX2
+#endif
 #include "base64.h"
+#include "wsDeflate.h"
+#include "wsStats.h"
 #include "../Buffer/buffer.h"
 #include "../Log/log.h"
 #include "../Common/commonConfig.h"
 #include "../Common/picojson.h" 
-#include "../Common/lockList.h"
+#include "../Tls/transport.h"
 
 #define MAGIC_KEY "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
 class WebSocket{
 public : 
-    WebSocket(const int fd , const int isET ,  Buffer* read , Buffer* write) :
-     fd_(fd) , is_ET_(isET) , readBuff_(read) , writeBuff_(write) , is_Close_(false) {
-        
+    // 编码好的帧（头部 + 内容），只读且引用计数：群发时只编码一次，所有接收者的队列共享同一份，直接从这里写出
+    typedef std::shared_ptr<const std::string> Frame ; 
+
+    // Message::coalesce 的取值：在线列表是完整的快照，新的可以替换队列中旧的
+    static constexpr uint32_t COALESCE_ROSTER = 1 ; 
+
+    // 客户端消息的 type 字段：没有 type 的是原来的聊天消息 {"toName","message"} 
+    enum MESSAGE_TYPE {
+        CHAT_MESSAGE ,                      // 聊天消息
+        SUBSCRIBE_MESSAGE ,                 // {"type":"subscribe","topic"} 加入房间
+        UNSUBSCRIBE_MESSAGE ,               // {"type":"unsubscribe","topic"} 离开房间
+        PUBLISH_MESSAGE ,                   // {"type":"publish","topic","message"} 发给房间的所有订阅者
+        ROSTER_MESSAGE ,                    // {"type":"roster"} 在线列表的增量不连续时重新请求快照
+    };
+
+    // 解析出的一条客户端消息，由 ClientConn 分发
+    struct Message {
+        MESSAGE_TYPE type = CHAT_MESSAGE ; 
+        std::string toName ; 
+        std::string topic ;                 // 订阅、退订、发布的主题
+        Frame frame ;                       // 要推送的帧，订阅和退订没有
+        uint32_t coalesce = 0 ;             // 非 0 时发送队列满了可以用这个帧替换队列中同一类的旧帧
+        Frame deflated[16] ;                // 按服务端窗口位数缓存压缩之后的帧，窗口相同、不保留上下文的接收者共享
+    };
+
+    enum OPCODE {
+        CONTINUATION_FRAME = 0x0 ,
+        TEXT_FRAME = 0x1 ,
+        BINARY_FRAME = 0x2 ,
+        CLOSE_FRAME = 0x8 ,
+        PING_FRAME = 0x9 ,
+        PONG_FRAME = 0xA ,
+    };
+
+    // 关闭帧的状态码
+    enum CLOSE_CODE {
+        CLOSE_NORMAL = 1000 ,
+        CLOSE_PROTOCOL_ERROR = 1002 ,
+        CLOSE_INVALID_DATA = 1007 ,
+        CLOSE_TOO_BIG = 1009 ,
+    };
+
+    WebSocket(Transport* transport , const int isET ,  Buffer* read , Buffer* write) :
+     fd_(transport->GetFd()) , transport_(transport) , is_ET_(isET) , readBuff_(read) , writeBuff_(write) , is_Close_(false) , 
+     is_Closing_(false) , is_Evicted_(false) , lastRecvMs_(NowMs_()) , pingSentMs_(0) , queueBytes_(0) , sendOffset_(0) , sendingBytes_(0) , is_Fragmented_(false) , is_Compressed_(false) {
+        const HttpConfigInfo &config = HttpConfigInfo::Instance() ; 
+        SetQueuePolicy(config.wsQueueMaxBytes , config.wsQueueMaxFrames , config.wsQueuePolicy , config.wsQueueGraceMs) ; 
     }
 
     ~WebSocket() {
         close() ; 
     }
     
+    // 每次读事件之前清空上一次解析出的消息；没有收完整的帧和分片留在读缓冲区和 fragments_ 中
     void init(){ 
-        fin_ = 0 ; opcode_ = 0 ; mask_ = 0 ; payload_length_ = 0 ; responseName = "" ;
-        memset(masking_key_ , 0 , sizeof(masking_key_)) ;
+        messages_.clear() ; 
     }
 
     void close(){ 
         if(is_Close_ == true) return ; 
         std::unique_lock<std::mutex> locker(mtx_) ; 
         if(is_Close_ == false){
-            messageList.clear() ; 
+            clearQueue_() ; 
         }
         is_Close_ = true ;
     }
@@ -43,8 +103,8 @@ public :
         return is_Close_ ; 
     }
     
-    // 获得握手需要的报文信息
-    bool handshark(std::string WebSocket_key) {
+    // 获得握手需要的报文信息；extensions 是客户端的 Sec-WebSocket-Extensions ，能接受 permessage-deflate 时在响应中确认
+    bool handshark(std::string WebSocket_key , const std::string &extensions = "") {
         WebSocket_key += MAGIC_KEY ; // WebSocket 协议的规定，toBase64( sha1( Sec-WebSocket-Key + 258EAFA5-E914-47DA-95CA-C5AB0DC85B11 )  )
         
         unsigned char message_digest[SHA_DIGEST_LENGTH];
@@ -55,15 +115,22 @@ public :
         writeBuff_->Append("Connection: upgrade\r\n");
         writeBuff_->Append("Upgrade: websocket\r\n") ;
         writeBuff_->Append("Sec-WebSocket-Accept: ") ;
-        writeBuff_->Append(WebSocket_key + "\r\n\r\n") ; 
+        writeBuff_->Append(WebSocket_key + "\r\n") ; 
+        std::string accepted ; 
+        if(!extensions.empty() && deflate_.Negotiate(extensions , accepted)) {
+            writeBuff_->Append("Sec-WebSocket-Extensions: " + accepted + "\r\n") ; 
+        }
+        writeBuff_->Append("\r\n") ; 
         return true ; 
     }
 
+    // 每读一次就解析缓冲区中所有完整的帧，读缓冲区最多积累一个帧加一次读取的数据
+    // 返回 CONTINUE_CODE 表示没有需要处理的消息也没有要发送的帧，GOOD_CODE 表示有（包括准备关闭）
     STATUS_CODE dealWebSocketRequest(){
         int Errno = -1; 
         ssize_t len = -1;
         do {
-            len = readBuff_->ReadFd(fd_, &Errno);   
+            len = transport_->Read(readBuff_ , &Errno);   
             if (len <= 0) {
                 if(Errno == EWOULDBLOCK ){// 读完了，跳出
                     break ; 
@@ -73,29 +140,151 @@ public :
                     return CLOSE_CONNECTION ;
                 }
             }
-        }while (is_ET_) ;
-        // 解析 WebSocket 格式信息
-        return paresWebSocket() ; 
+            lastRecvMs_ = NowMs_() ; // 收到任何数据（包括 pong）都说明对端还活着
+            parseFrames_() ; 
+        }while (is_ET_ && !is_Closing_) ;
+        if(is_Closing_) readBuff_->clear() ; // 已经发出关闭帧，之后收到的数据都丢弃
+        if(messages_.empty() && !is_Closing_ && !WantWrite()) return CONTINUE_CODE ; 
+        return GOOD_CODE ; 
     }
 
-    void makeWebSocketResponse(std::string &message){
-        messageList.push_back(message) ; 
+    // 只把帧的指针放进队列，不拷贝内容；关闭帧之后不再发送其他帧
+    void makeWebSocketResponse(Frame frame , const uint32_t coalesce = 0){
+        if(is_Closing_) return ; 
+        enqueue_(std::move(frame) , coalesce) ; 
     }
 
-    void makeWebSocketResponse(std::string &&message){
-        messageList.push_back(std::move(message)) ; 
+    // 发送队列的上限和超过上限时的处理方式，默认来自配置
+    void SetQueuePolicy(const size_t maxBytes , const size_t maxFrames , const WS_QUEUE_POLICY policy , const int graceMs) {
+        std::lock_guard<std::mutex> locker(queueMtx_) ; 
+        queueMaxBytes_ = maxBytes ; queueMaxFrames_ = maxFrames ; queuePolicy_ = policy ; queueGraceMs_ = graceMs ; 
     }
 
-    STATUS_CODE dealWebSocketResponse() {  
-        // 如果 writeBuff 本来就还有数据，则先写之前的数据，比如握手等
-        if(writeBuff_->BufferUsedSize() <= 0){
-            std::string message ; 
-            if(messageList.tryPop(message) == false) return GOOD_CODE ; 
-            writeBuff_->Append(message) ; 
+    size_t QueueFrames() {
+        std::lock_guard<std::mutex> locker(queueMtx_) ; 
+        return queue_.size() ; 
+    }
+
+    size_t QueueBytes() {
+        std::lock_guard<std::mutex> locker(queueMtx_) ; 
+        return queueBytes_ ; 
+    }
+
+    // 发送队列长时间超过上限或者心跳超时，已经断开
+    bool IsEvicted() const {
+        return is_Evicted_ ; 
+    }
+
+    // 心跳检查，在主线程的定时器中调用；返回下次检查距现在的秒数，-1 表示已经断开
+    // 1. 最近 intervalS 秒内收到过数据的连接不发送 ping ，活跃的连接没有额外的流量
+    // 2. 空闲 intervalS 秒之后发送 ping ，之后 timeoutS 秒内仍然没有收到任何数据（pong）就断开
+    // 3. 发出 ping 或者断开时调用 wakeup(fd) 监听写，由工作线程发送或者关闭；和 Deliver 一样在关闭锁里，不会唤醒复用 fd 的新连接
+    int Heartbeat(const int intervalS , const int timeoutS , const std::function<void(int)> &wakeup) {
+        std::lock_guard<std::mutex> locker(mtx_) ; 
+        if(is_Close_ || is_Evicted_) return -1 ; 
+        int64_t now = NowMs_() , lastRecv = lastRecvMs_ , pingSent = pingSentMs_ ; 
+        if(pingSent > lastRecv) { // 发出的 ping 还没有回应
+            int64_t waited = now - pingSent ; 
+            if(waited < timeoutS * 1000LL) return SecondsOf_(timeoutS * 1000LL - waited) ; 
+            {
+                std::lock_guard<std::mutex> queueLocker(queueMtx_) ; 
+                LOG_WARN("Websocket %d no pong in %d s , disconnect" , fd_ , timeoutS) ; 
+                WsStats::Instance().pingTimeouts++ ; 
+                shutdown_() ; 
+            }
+            wakeup(fd_) ; 
+            return -1 ; 
+        }
+        int64_t idle = now - lastRecv ; 
+        if(idle < intervalS * 1000LL) return SecondsOf_(intervalS * 1000LL - idle) ; 
+        static const Frame ping = MakeFrame("" , 0 , PING_FRAME) ; 
+        pingSentMs_ = now ; 
+        makeWebSocketResponse(ping) ; 
+        WsStats::Instance().pings++ ; 
+        wakeup(fd_) ; 
+        return timeoutS ; 
+    }
+
+    // 群发的消息：协商了压缩时按本连接的压缩上下文选择帧
+    // 服务端不保留上下文时同一条消息按窗口位数只压缩一次，缓存在 message 中给后面的接收者共享；
+    // 保留上下文时用本连接的压缩流压缩，压缩和入队在同一把锁里，保证压缩顺序就是发送顺序
+    void makeWebSocketResponse(Message &message){
+        if(is_Closing_) return ; 
+        std::string_view payload = PayloadOf(*message.frame) ; 
+        if(deflate_.Enabled() == false || payload.size() < HttpConfigInfo::Instance().wsDeflateMinSize) {
+            makeWebSocketResponse(message.frame , message.coalesce) ; return ; 
+        }
+        std::string compressed ; 
+        uint8_t opcode = static_cast<uint8_t>(message.frame->front()) & 0x0F ; 
+        if(deflate_.SharedContext()) {
+            Frame &frame = message.deflated[deflate_.ServerBits()] ; 
+            if(frame == nullptr) {
+                if(WsDeflate::DeflateOnce(payload.data() , payload.size() , deflate_.ServerBits() , compressed)) {
+                    frame = MakeFrame(compressed.data() , compressed.size() , opcode , true) ; 
+                }else {
+                    frame = message.frame ; 
+                }
+            }
+            makeWebSocketResponse(frame , message.coalesce) ; 
+            return ; 
         }
+        std::unique_lock<std::mutex> locker(deflateMtx_) ; 
+        if(deflate_.Deflate(payload.data() , payload.size() , compressed) == false) {
+            LOG_ERROR("websocket %d deflate error" , fd_) ; 
+            return ; 
+        }
+        makeWebSocketResponse(MakeFrame(compressed.data() , compressed.size() , opcode , true) , message.coalesce) ; 
+    }
+
+    // 其他连接的线程把消息交给本连接，连接还没有关闭时入队并调用 wakeup(fd) 监听写；返回是否交付
+    // ClientConn 先关闭 WebSocket 再关闭 fd ，持有 mtx_ 期间 fd 不会被关闭和复用，wakeup 和队列满时的 shutdown 不会作用到新连接上
+    bool Deliver(Message &message , const std::function<void(int)> &wakeup) {
+        std::lock_guard<std::mutex> locker(mtx_) ; 
+        if(is_Close_) return false ; 
+        makeWebSocketResponse(message) ; 
+        wakeup(fd_) ; 
+        return true ; 
+    }
+
+    // 本连接的工作线程重新注册事件，rearm(是否还有数据要写) ；和 Deliver 的入队、唤醒互斥，不会丢失唤醒
+    void Rearm(const std::function<void(bool)> &rearm) {
+        std::lock_guard<std::mutex> locker(mtx_) ; 
+        if(is_Close_) return ; 
+        rearm(WantWrite()) ; 
+    }
+
+    // 本连接还有没有写完的数据
+    bool WantWrite() {
+        return writeBuff_->BufferUsedSize() > 0 || !sending_.empty() || QueueFrames() > 0 ; 
+    }
+
+    // 收到关闭帧或者协议错误，已经回复了关闭帧，发送完之后关闭连接
+    bool IsClosing() const {
+        return is_Closing_ ; 
+    }
+
+    // 一次分配编码出完整的帧；compressed 表示 payload 是 permessage-deflate 压缩过的（RSV1）
+    static Frame MakeFrame(const std::string &payload , const uint8_t opcode = TEXT_FRAME) {
+        return MakeFrame(payload.data() , payload.size() , opcode) ; 
+    }
+
+    static Frame MakeFrame(const char* payload , const size_t len , const uint8_t opcode = TEXT_FRAME , const bool compressed = false) {
+        std::string frame = makeWebSocketHead(len , opcode , compressed) ; 
+        frame.reserve(frame.size() + len) ; 
+        frame.append(payload , len) ; 
+        return std::make_shared<const std::string>(std::move(frame)) ; 
+    }
+
+    // 每次可写事件把队列中的帧一次取出（最多 IOV_MAX 个或者 wsWriteBatchBytes 字节），和写缓冲区中剩下的数据一起 writev 
+    STATUS_CODE dealWebSocketResponse() {  
+        if(is_Evicted_) return CLOSE_CONNECTION ; 
         ssize_t len = -1 ; 
         do{
-            len = write(fd_ , writeBuff_->BufferStart() , writeBuff_->BufferUsedSize()) ;   
+            // 如果 writeBuff 本来就还有数据，则先写之前的数据，比如握手等；之后直接从共享的帧写出
+            dequeueBatch_() ; 
+            int iovCnt = fillIov_() ; 
+            if(iovCnt == 0) return GOOD_CODE ; 
+            len = transport_->Writev(write_iov_.data() , iovCnt) ;   
             if(len < 0){
                 if(errno == EWOULDBLOCK) {// fd_缓冲区满了 EWOULDBLOCK 或者 被信号中断了，继续写，继续发送
                     return CONTINUE_CODE ; 
@@ -105,19 +294,50 @@ public :
                     LOG_ERROR("Write FD Error") ;
                     close(); return CLOSE_CONNECTION ;
                 }
-            }else {
-                writeBuff_->Retrieve(len) ; 
-                if(writeBuff_->BufferUsedSize() <= 0) { // 传输完成 , 本次 websocket 请求应答结束，故关闭
-                    if(messageList.empty()) return GOOD_CODE ; 
-                    return CONTINUE_CODE ; // 消息队列中还有数据，要接着写
-                } 
+            }
+            advance_(len) ; 
+            if(writeBuff_->BufferUsedSize() <= 0 && sending_.empty() && QueueFrames() == 0) {
+                return GOOD_CODE ; // 传输完成 , 本次 websocket 请求应答结束
             }
         }while(is_ET_) ; 
+        return CONTINUE_CODE ; // 还有数据，要接着写
+    }
+
+    // 原地反掩码：offset 是 data[0] 在整个 payload 中的位置，掩码从 offset % 4 开始
+    // 掩码按 4 字节循环，展开成 32 字节之后按 AVX2 32 字节、SSE2 16 字节、uint64_t 8 字节一次异或，最后剩下的逐字节处理
+    static void Unmask(char* data , const size_t len , const uint8_t key[4] , const size_t offset = 0) {
+        alignas(32) uint8_t pattern[32] ; 
+        for(size_t i = 0 ; i < sizeof(pattern) ; ++i) pattern[i] = key[(offset + i) % 4] ; 
+        size_t i = 0 ; 
+#if defined(__AVX2__)
+        const __m256i mask256 = _mm256_load_si256(reinterpret_cast<const __m256i*>(pattern)) ; 
+        for( ; i + 32 <= len ; i += 32) {
+            __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)) ; 
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i) , _mm256_xor_si256(value , mask256)) ; 
+        }
+#endif
+#if defined(__SSE2__)
+        const __m128i mask128 = _mm_load_si128(reinterpret_cast<const __m128i*>(pattern)) ; 
+        for( ; i + 16 <= len ; i += 16) {
+            __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)) ; 
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i) , _mm_xor_si128(value , mask128)) ; 
+        }
+#endif
+        uint64_t mask64 ; 
+        memcpy(&mask64 , pattern , sizeof(mask64)) ; 
+        for( ; i + 8 <= len ; i += 8) { // memcpy 处理不对齐的地址，编译器会优化成一次读写
+            uint64_t value ; 
+            memcpy(&value , data + i , sizeof(value)) ; 
+            value ^= mask64 ; 
+            memcpy(data + i , &value , sizeof(value)) ; 
+        }
+        for( ; i < len ; ++i) data[i] ^= pattern[i % 4] ; // i 是 4 的倍数之后才进入这里，和 pattern 的相位一致
     }
 
-    std::string makeWebSocketHead(const size_t len) const{
+    // 服务端发送的帧不分片（FIN = 1）、不加掩码
+    static std::string makeWebSocketHead(const size_t len , const uint8_t opcode = TEXT_FRAME , const bool compressed = false) {
         std::string header ; 
-        header.push_back((char) TEXT_FRAME) ; 
+        header.push_back((char)(0x80 | (compressed ? 0x40 : 0) | opcode)) ; 
         if(len <= 125) {
 
             header.push_back((char)len);
@@ -139,8 +359,21 @@ public :
         return header ; 
     }
 
-    const std::string &getResponseName() const{
-        return responseName;
+    // 服务端发出的不加掩码的帧中的 payload 
+    static std::string_view PayloadOf(const std::string &frame) {
+        uint8_t len = static_cast<uint8_t>(frame[1]) & 0x7F ; 
+        size_t headLen = len <= 125 ? 2 : len == 126 ? 4 : 10 ; 
+        return std::string_view(frame).substr(headLen) ; 
+    }
+
+    // 登录的用户名，私聊和发布到房间的消息中作为 fromName 
+    void SetUserName(const std::string &name) {
+        userName_ = name ; 
+    }
+
+    // 本次读事件解析出的所有消息，群发时会缓存压缩结果
+    std::vector<Message> &getMessages() {
+        return messages_ ; 
     }
     
     int GetFd() const {
@@ -149,123 +382,351 @@ public :
 
 private :
     int fd_ ; 
+    Transport* transport_ ;                 // 连接的读写通道（明文或 TLS）
     int is_ET_ ; 
-    std::atomic<bool> is_Close_ ; 
-    uint8_t fin_ ;                          // 1 个 bit 位
-    uint8_t opcode_ ;                       // 4 个 bit 位
-    uint8_t mask_ ;                         // 1 个 bit 位
-    uint8_t masking_key_[4] ;               // masking-key 4 个字节
-    uint64_t payload_length_ ;              // 最大 7 , 16 , 64 位 
-    
     Buffer* readBuff_;                      // 读缓冲区
     Buffer* writeBuff_;                     // 写缓冲区
-    std::string responseName ;              // 发送方名字
-    atomicList<std::string> messageList ;    // 消息缓冲区
+    std::atomic<bool> is_Close_ ; 
+    std::atomic<bool> is_Closing_ ;         // 已经回复了关闭帧，发送完之后关闭连接
+    std::atomic<bool> is_Evicted_ ;         // 发送队列超过上限的时间超过宽限时间或者心跳超时，已经 shutdown 
+    std::atomic<int64_t> lastRecvMs_ ;      // 最后一次收到数据的时间，单调时钟毫秒
+    std::atomic<int64_t> pingSentMs_ ;      // 最后一次发送 ping 的时间，大于 lastRecvMs_ 时还在等 pong 
+    // 发送队列中的帧；控制帧不计入上限，也不会被丢弃
+    struct Pending_ {
+        Frame frame ; 
+        uint32_t coalesce ; 
+        bool control ; 
+    };
+    std::deque<Pending_> queue_ ;           // 发送队列，存放共享帧的指针
+    size_t queueBytes_ ;                    // 队列中数据帧的字节数
+    size_t queueMaxBytes_ ; 
+    size_t queueMaxFrames_ ; 
+    WS_QUEUE_POLICY queuePolicy_ ; 
+    int queueGraceMs_ ; 
+    std::chrono::steady_clock::time_point overSince_ ; // 队列开始超过上限的时间，没有超过时是默认值
+    std::mutex queueMtx_ ; 
+    std::deque<Frame> sending_ ;            // 已经从队列中取出、正在写的帧，写完之前一直持有
+    size_t sendOffset_ ;                    // sending_ 第一个帧中已经写出的字节数
+    size_t sendingBytes_ ;                  // sending_ 中还没有写出的字节数
+    std::vector<struct iovec> write_iov_ ;  // 写缓冲区加上 sending_ 中的帧
+    std::vector<Message> messages_ ;        // 本次读事件解析出的消息
+    bool is_Fragmented_ ;                   // 正在接收一条分片的消息
+    bool is_Compressed_ ;                   // 正在接收的分片消息是压缩过的（第一个帧带 RSV1）
+    std::string fragments_ ;                // 分片消息已经收到的内容（已经反掩码）
+    std::string inflated_ ;                 // 解压之后的消息，复用内存
+    std::string userName_ ;                 // 登录的用户名
+    WsDeflate deflate_ ;                    // permessage-deflate 协商结果和本连接的 zlib 流
+    std::mutex deflateMtx_ ;                // 保留上下文时，其他线程群发给本连接的消息串行压缩
     std::mutex mtx_ ; 
 
-    enum WSFrameType {
-        ERROR_FRAME=0xFF00,
-        INCOMPLETE_FRAME=0xFE00,
-
-        OPENING_FRAME=0x3300,
-        CLOSING_FRAME=0x3400,
+    bool overLimit_(const size_t extraBytes) const {
+        return queueBytes_ + extraBytes > queueMaxBytes_ || queue_.size() + 1 > queueMaxFrames_ ; 
+    }
 
-        INCOMPLETE_TEXT_FRAME=0x01,
-        INCOMPLETE_BINARY_FRAME=0x02,
+    // 丢弃队列中最旧的数据帧
+    bool dropOldest_() {
+        for(auto iter = queue_.begin() ; iter != queue_.end() ; ++iter) {
+            if(iter->control) continue ; 
+            queueBytes_ -= iter->frame->size() ; 
+            WsStats::Instance().queuedBytes -= iter->frame->size() ; 
+            queue_.erase(iter) ; 
+            WsStats::Instance().droppedOldest++ ; 
+            return true ; 
+        }
+        return false ; 
+    }
 
-        TEXT_FRAME=0x81,
-        BINARY_FRAME=0x82,
+    // 同一类的新帧替换队列中最早的旧帧，位置不变
+    bool coalesce_(Frame &frame , const uint32_t coalesce) {
+        if(coalesce == 0) return false ; 
+        for(Pending_ &pending : queue_) {
+            if(pending.coalesce != coalesce) continue ; 
+            queueBytes_ = queueBytes_ - pending.frame->size() + frame->size() ; 
+            WsStats::Instance().queuedBytes += static_cast<int64_t>(frame->size()) - static_cast<int64_t>(pending.frame->size()) ; 
+            pending.frame = std::move(frame) ; 
+            WsStats::Instance().coalesced++ ; 
+            return true ; 
+        }
+        return false ; 
+    }
 
-        PING_FRAME=0x19,
-        PONG_FRAME=0x1A
-    };
-    
-    STATUS_CODE paresWebSocket() {
-        // WebSocket 数据包不完整
-        if(readBuff_->BufferUsedSize() < 2){
-            LOG_ERROR("Websocket package incomplete") ; 
-            return CLOSE_CONNECTION ; 
+    // 放入发送队列；数据帧超过上限时按 queuePolicy_ 处理
+    // 服务端保留压缩上下文时，后面的帧依赖前面的帧，不能丢弃或者替换，只能按 WS_DISCONNECT 处理，超过两倍上限立即断开
+    void enqueue_(Frame frame , const uint32_t coalesce) {
+        std::lock_guard<std::mutex> locker(queueMtx_) ; 
+        if(is_Evicted_) return ; 
+        const bool control = static_cast<uint8_t>(frame->front()) & 0x08 ; 
+        const size_t size = frame->size() ; 
+        if(!control && overLimit_(size)) {
+            const bool dependent = deflate_.Enabled() && !deflate_.SharedContext() ; 
+            WS_QUEUE_POLICY policy = dependent ? WS_DISCONNECT : queuePolicy_ ; 
+            if(policy == WS_COALESCE && coalesce_(frame , coalesce)) return ; 
+            if(policy == WS_DROP_OLDEST || policy == WS_COALESCE) {
+                while(overLimit_(size) && dropOldest_()) ; 
+                if(overLimit_(size)) policy = WS_DROP_NEWEST ; // 队列中只剩控制帧，新帧本身就超过上限
+            }else if(policy == WS_DISCONNECT) {
+                auto now = std::chrono::steady_clock::now() ; 
+                if(overSince_ == std::chrono::steady_clock::time_point()) overSince_ = now ; 
+                bool expired = now - overSince_ >= std::chrono::milliseconds(queueGraceMs_) ; 
+                bool hardLimit = queueBytes_ + size > 2 * queueMaxBytes_ || queue_.size() + 1 > 2 * queueMaxFrames_ ; 
+                if(expired || (hardLimit && dependent)) {
+                    evict_() ; return ; 
+                }
+                if(hardLimit) policy = WS_DROP_NEWEST ; // 宽限时间内最多积累两倍上限
+            }
+            if(policy == WS_DROP_NEWEST) {
+                WsStats::Instance().droppedNewest++ ; 
+                return ; 
+            }
         }
-        const char* strBegin = readBuff_->BufferStart() ; 
-        int pos = 0  ;  
-        fin_ = ((*(strBegin + pos)) >> 7) & 1 ; 
-        opcode_ = (*(strBegin + pos)) & 0x0F;
-        ++pos ; 
-        mask_ = ((*(strBegin + pos)) >> 7) & 1 ;
-        payload_length_ = (*(strBegin + pos)) & 0x7f;
-        ++pos ; 
-        if(payload_length_ == 126) {
-            uint16_t length = 0;
-            memcpy(&length, strBegin + pos , 2) ;
-            pos += 2;
-            payload_length_ = ntohs(length); // 网络字节序，大小端转化
-        } else if(payload_length_ == 127) {
-            uint32_t length = 0;
-            memcpy(&length, strBegin + pos, 4);
-            pos += 4;
-            payload_length_ = ntohl(length); // 网络字节序，大小端转化
+        if(!control) {
+            queueBytes_ += size ; 
+            WsStats::Instance().queuedBytes += size ; 
         }
-        readBuff_->Retrieve(2) ;
-        if(mask_ == 1) {
-            if(readBuff_->BufferUsedSize() < 4){
-                return BAD_REQUEST ; 
-            }
-            for(int i = 0 ; i < 4 ; ++i){
-                masking_key_[i] = *(strBegin + pos + i) ; 
+        queue_.push_back(Pending_{ std::move(frame) , coalesce , control }) ; 
+    }
+
+    // 一次加锁取出一批帧，正在写的帧加上新取出的不超过 IOV_MAX 个、wsWriteBatchBytes 字节（至少取一个）
+    void dequeueBatch_() {
+        const size_t budget = HttpConfigInfo::Instance().wsWriteBatchBytes ; 
+        std::lock_guard<std::mutex> locker(queueMtx_) ; 
+        while(!queue_.empty() && sending_.size() + 1 < IOV_MAX && (sending_.empty() || sendingBytes_ < budget)) {
+            Pending_ &pending = queue_.front() ; 
+            if(!pending.control) {
+                queueBytes_ -= pending.frame->size() ; 
+                WsStats::Instance().queuedBytes -= pending.frame->size() ; 
             }
-            pos += 4 ; 
-            readBuff_->Retrieve(4) ;
+            sendingBytes_ += pending.frame->size() ; 
+            sending_.push_back(std::move(pending.frame)) ; 
+            queue_.pop_front() ; 
         }
+        if(!overLimit_(0)) overSince_ = std::chrono::steady_clock::time_point() ; // 降到上限以下，重新计算宽限时间
+    }
 
-        if(readBuff_->BufferUsedSize() < payload_length_){
-            LOG_ERROR("Websocket package incomplete") ; 
-            return BAD_REQUEST ; // 数据包不完整
+    int fillIov_() {
+        write_iov_.clear() ; 
+        if(writeBuff_->BufferUsedSize() > 0) {
+            write_iov_.push_back({ writeBuff_->BufferStart() , writeBuff_->BufferUsedSize() }) ; 
+        }
+        size_t offset = sendOffset_ ; 
+        for(const Frame &frame : sending_) {
+            write_iov_.push_back({ const_cast<char*>(frame->data()) + offset , frame->size() - offset }) ; 
+            offset = 0 ; 
+        }
+        return static_cast<int>(write_iov_.size()) ; 
+    }
+
+    // 写出了 len 字节：先是写缓冲区，再依次是各个帧，写完的帧释放引用
+    void advance_(size_t len) {
+        size_t used = std::min<size_t>(len , writeBuff_->BufferUsedSize()) ; 
+        if(used > 0) writeBuff_->Retrieve(used) ; 
+        len -= used ; 
+        while(len > 0 && !sending_.empty()) {
+            size_t remain = sending_.front()->size() - sendOffset_ ; 
+            size_t n = std::min(len , remain) ; 
+            sendOffset_ += n ; sendingBytes_ -= n ; len -= n ; 
+            if(n == remain) {
+                sending_.pop_front() ; sendOffset_ = 0 ; 
+            }
         }
+    }
+
+    void clearQueue_() {
+        std::lock_guard<std::mutex> locker(queueMtx_) ; 
+        WsStats::Instance().queuedBytes -= queueBytes_ ; 
+        queue_.clear() ; 
+        queueBytes_ = 0 ; 
+    }
+
+    // 在 queueMtx_ 中调用；可能在其他连接的线程里，只 shutdown ，本连接的线程收到 EPOLLHUP / 读到 EOF 之后正常关闭
+    void evict_() {
+        LOG_WARN("Websocket %d send queue over limit %zu bytes %zu frames , disconnect" , fd_ , queueBytes_ , queue_.size()) ; 
+        WsStats::Instance().evicted++ ; 
+        shutdown_() ; 
+    }
+
+    // 在 queueMtx_ 中调用：丢弃队列，shutdown 之后本连接的线程正常关闭
+    void shutdown_() {
+        is_Evicted_ = true ; 
+        WsStats::Instance().queuedBytes -= queueBytes_ ; 
+        queue_.clear() ; 
+        queueBytes_ = 0 ; 
+        ::shutdown(fd_ , SHUT_RDWR) ; 
+    }
 
-        if(opcode_ == 0x8){
-            LOG_INFO("Websocket connect break off") ; 
-            return CLOSE_CONNECTION ; // 断开 WeSocket 连接
+    static int64_t NowMs_() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() ; 
+    }
+
+    // 定时器以秒为单位，向上取整，至少 1 秒
+    static int SecondsOf_(const int64_t ms) {
+        return static_cast<int>(std::max<int64_t>(1 , (ms + 999) / 1000)) ; 
+    }
+
+    // 解析读缓冲区中所有完整的帧：帧头没收完整或者 payload 没收完整时留在缓冲区，下次读到数据之后从帧头重新解析
+    // 帧头在 payload 收完整之前就检查长度，超过 wsMaxMessageSize 的不再继续接收
+    void parseFrames_() {
+        const size_t maxSize = HttpConfigInfo::Instance().wsMaxMessageSize ; 
+        while(is_Closing_ == false) {
+            size_t avail = readBuff_->BufferUsedSize() ; 
+            if(avail < 2) return ; 
+            const uint8_t* head = reinterpret_cast<const uint8_t*>(readBuff_->BufferStart()) ; 
+            bool fin = head[0] & 0x80 ; 
+            uint8_t rsv = head[0] & 0x70 ; 
+            uint8_t opcode = head[0] & 0x0F ; 
+            bool masked = head[1] & 0x80 ; 
+            uint64_t payloadLen = head[1] & 0x7F ; 
+            size_t headLen = 2 + (payloadLen == 126 ? 2 : payloadLen == 127 ? 8 : 0) + (masked ? 4 : 0) ; 
+            if(avail < headLen) return ; 
+            if(payloadLen == 126) {
+                uint16_t length = 0 ; 
+                memcpy(&length , head + 2 , 2) ; 
+                payloadLen = ntohs(length) ; // 网络字节序，大小端转化
+            }else if(payloadLen == 127) {
+                uint64_t length = 0 ; 
+                memcpy(&length , head + 2 , 8) ; 
+                payloadLen = be64toh(length) ; // 64 位长度，网络字节序
+            }
+
+            bool isControl = opcode & 0x08 ; 
+            // 只有协商了压缩时，消息的第一个帧可以带 RSV1 ；客户端发送的帧必须加掩码
+            bool compressed = rsv == 0x40 && deflate_.Enabled() && !isControl && opcode != CONTINUATION_FRAME ; 
+            if((rsv != 0 && !compressed) || masked == false) { 
+                fail_(CLOSE_PROTOCOL_ERROR , "bad frame header") ; return ; 
+            }
+            if(isControl) {
+                if(!fin || payloadLen > 125 || (opcode != CLOSE_FRAME && opcode != PING_FRAME && opcode != PONG_FRAME)) {
+                    fail_(CLOSE_PROTOCOL_ERROR , "bad control frame") ; return ; 
+                }
+            }else if(opcode == CONTINUATION_FRAME ? !is_Fragmented_ : (is_Fragmented_ || (opcode != TEXT_FRAME && opcode != BINARY_FRAME))) {
+                fail_(CLOSE_PROTOCOL_ERROR , "unexpected data frame") ; return ; 
+            }else if(payloadLen > maxSize - fragments_.size()) {
+                fail_(CLOSE_TOO_BIG , "message too big") ; return ; 
+            }
+            if(avail - headLen < payloadLen) return ; // 等待剩余的 payload 
+
+            uint8_t maskingKey[4] ; 
+            memcpy(maskingKey , head + headLen - 4 , 4) ; 
+            readBuff_->Retrieve(headLen) ; 
+            // 直接在读缓冲区里反掩码，不拷贝 payload 
+            char* payload = readBuff_->BufferStart() ; 
+            Unmask(payload , payloadLen , maskingKey) ; 
+            dealFrame_(fin , opcode , compressed , payload , payloadLen) ; 
+            readBuff_->Retrieve(payloadLen) ; 
         }
+    }
 
-        std::string content = "" ; 
-        strBegin = readBuff_->BufferStart() ; 
-        if(mask_ == 0){
-            content = std::string(strBegin , payload_length_) ;  
+    // 控制帧可以插在分片消息的中间，不影响正在拼接的消息
+    void dealFrame_(const bool fin , const uint8_t opcode , const bool compressed , const char* payload , const size_t len) {
+        if(opcode == CLOSE_FRAME) {
+            uint16_t code = CLOSE_NORMAL ; 
+            if(len >= 2) {
+                memcpy(&code , payload , 2) ; 
+                code = ntohs(code) ; 
+            }
+            LOG_INFO("Websocket connect break off , code %u" , code) ; 
+            close_(code) ; 
+        }else if(opcode == PING_FRAME) { // 原样回复 pong 
+            makeWebSocketResponse(MakeFrame(payload , len , PONG_FRAME)) ; 
+        }else if(opcode == PONG_FRAME) {
+            // 心跳的回应，收到数据时已经更新了 lastRecvMs_ ；客户端主动发送的 pong 不需要回复
+        }else if(fin && opcode != CONTINUATION_FRAME) { // 没有分片的消息直接在读缓冲区里解析
+            compressed ? inflateMessage_(payload , len) : dealMessage_(payload , len) ; 
         }else {
-            for(int i = 0 ; i < payload_length_ ; ++i){ 
-                char ch = strBegin[i] ^ masking_key_[i % 4] ;  
-                content.push_back(ch) ; 
+            if(opcode != CONTINUATION_FRAME) { 
+                is_Fragmented_ = true ; 
+                is_Compressed_ = compressed ; 
+            }
+            fragments_.append(payload , len) ; 
+            if(fin) {
+                is_Fragmented_ = false ; 
+                is_Compressed_ ? inflateMessage_(fragments_.data() , fragments_.size()) : dealMessage_(fragments_.data() , fragments_.size()) ; 
+                fragments_.clear() ; 
+                fragments_.shrink_to_fit() ; // 大消息的内存不一直占着
             }
         }
-        readBuff_->Retrieve(payload_length_) ;
+    }
+
+    // 解压之后再解析，解压之后的大小同样受 wsMaxMessageSize 限制
+    void inflateMessage_(const char* content , const size_t len) {
+        WsDeflate::INFLATE_CODE ret = deflate_.Inflate(content , len , inflated_ , HttpConfigInfo::Instance().wsMaxMessageSize) ; 
+        if(ret == WsDeflate::INFLATE_TOO_BIG) {
+            fail_(CLOSE_TOO_BIG , "inflated message too big") ; 
+        }else if(ret != WsDeflate::INFLATE_OK) {
+            fail_(CLOSE_INVALID_DATA , "inflate error") ; 
+        }else {
+            dealMessage_(inflated_.data() , inflated_.size()) ; 
+        }
+        if(inflated_.capacity() > 64 * 1024) std::string().swap(inflated_) ; // 大消息的内存不一直占着
+    }
 
-        // 解析客户端发送过来的数据 , json 格式
+    // 解析客户端发送过来的数据 , json 格式
+    void dealMessage_(const char* content , const size_t len) {
         picojson::value value_;   
-        std::string err = picojson::parse(value_, content);  // 解析JSON字符串，出错时err不为空
-        
+        std::string err ; 
+        picojson::parse(value_ , content , content + len , &err) ;  // 解析JSON字符串，出错时err不为空
         if (!err.empty()) {
-            LOG_ERROR("picojson parse error %s" , content.data()) ; 
-            return CLOSE_CONNECTION ; 
+            LOG_ERROR("picojson parse error %.*s" , static_cast<int>(std::min<size_t>(len , 256)) , content) ; 
+            fail_(CLOSE_INVALID_DATA , "invalid json") ; 
+            return ; 
         }
         
+        if(!value_.is<picojson::object>()) {
+            fail_(CLOSE_INVALID_DATA , "json is not an object") ; 
+            return ; 
+        }
+        Message message ; 
+        if(value_.contains("type")) { // 房间的订阅、退订和发布
+            const std::string type = value_.get("type").to_str() ; 
+            message.topic = value_.get("topic").is<std::string>() ? value_.get("topic").get<std::string>() : "" ; 
+            if(type == "subscribe") {
+                message.type = SUBSCRIBE_MESSAGE ; 
+            }else if(type == "unsubscribe") {
+                message.type = UNSUBSCRIBE_MESSAGE ; 
+            }else if(type == "roster") {
+                message.type = ROSTER_MESSAGE ; 
+            }else if(type == "publish") {
+                message.type = PUBLISH_MESSAGE ; 
+                picojson::object message_json ; 
+                message_json["isSystem"] = picojson::value(false) ; 
+                message_json["topic"] = picojson::value(message.topic) ; 
+                message_json["fromName"] = picojson::value(userName_) ; 
+                message_json["message"] = picojson::value(value_.get("message").to_str()) ; 
+                message.frame = MakeFrame(picojson::value(message_json).serialize()) ; // 只编码一次，房间的订阅者共享
+            }else {
+                LOG_WARN("Websocket %d unknown message type %s" , fd_ , type.data()) ; 
+                return ; 
+            }
+            messages_.push_back(std::move(message)) ; 
+            return ; 
+        }
+
         // 从JSON对象中取出 name 和 message 的值 ,并设置推送消息格式
         picojson::object message_json ; 
-        responseName = value_.get("toName").to_str() ; 
+        message.toName = value_.get("toName").to_str() ; 
         message_json["isSystem"] = picojson::value(false) ; 
-        message_json["fromName"] = picojson::value(responseName) ; 
+        message_json["fromName"] = picojson::value(userName_) ; // 接收者看到的是发送者
         message_json["message"] = picojson::value(value_.get("message").to_str() ) ; 
         // 将 picojson 对象转换为字符串
         std::string resContent = picojson::value(message_json).serialize(); 
-        writeBuff_->Append(makeWebSocketHead(resContent.size())) ; 
-        if(writeBuff_->Append(resContent) == false){
-            LOG_ERROR("writeBuff append response websocket Content") ; 
-            return CLOSE_CONNECTION ; 
-        }  
-        LOG_DEBUG("WebSocket Protocol, FIN %d , OPCODE %d , MASK %d , PAYLOADLEN %d , content : %s"
-            , fin_ , opcode_ , mask_ , resContent.size() , value_.get("message").to_str().data()) ;
-        return GOOD_CODE ;
+        message.frame = MakeFrame(resContent) ; // 只编码一次，所有接收者共享
+        LOG_DEBUG("WebSocket Protocol, PAYLOADLEN %zu , content : %s" , resContent.size() , value_.get("message").to_str().data()) ;
+        messages_.push_back(std::move(message)) ; 
+    }
+
+    // 回复关闭帧，之后不再解析和发送其他帧
+    void close_(const uint16_t code) {
+        if(is_Closing_) return ; 
+        uint16_t payload = htons(code) ; 
+        makeWebSocketResponse(MakeFrame(reinterpret_cast<const char*>(&payload) , 2 , CLOSE_FRAME)) ; 
+        is_Closing_ = true ; 
+    }
+
+    void fail_(const uint16_t code , const char* reason) {
+        LOG_WARN("Websocket %d %s , close %u" , fd_ , reason , code) ; 
+        close_(code) ; 
     }
 } ; 
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,277 @@
+#ifndef WS_DEFLATE_H
+#define WS_DEFLATE_H
+
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <algorithm>
+#include <zlib.h>        // deflate / inflate
+#include "../Log/log.h"
+#include "../Common/commonConfig.h"
+
+// WebSocket permessage-deflate 扩展（RFC 7692）
+// 1. 握手时从客户端的 Sec-WebSocket-Extensions 中选第一个能接受的 offer ，按配置决定上下文是否保留以及窗口大小
+// 2. 不保留上下文的一方每条消息独立压缩 / 解压，使用线程局部的 zlib 流，连接本身不占 zlib 内存；
+//    服务端不保留上下文时，同一条群发消息对所有窗口大小相同的连接压缩结果相同，只压缩一次
+// 3. 保留上下文时每个连接持有自己的压缩流或者解压流，按 windowBits 和 memLevel 估算内存，
+//    所有连接的总和不超过 wsDeflateMemory ，超过之后新连接协商为双方都不保留上下文
+class WsDeflate {
+public :
+    enum INFLATE_CODE {
+        INFLATE_OK = 0 ,
+        INFLATE_TOO_BIG ,        // 解压之后超过上限
+        INFLATE_ERROR ,          // 压缩数据错误
+    };
+
+    WsDeflate() : enable_(false) , serverNoContext_(true) , clientNoContext_(true) , serverBits_(15) , clientBits_(15) , reserved_(0) {
+    }
+
+    ~WsDeflate() {
+        usedMemory_() -= reserved_ ;
+    }
+
+    WsDeflate(const WsDeflate&) = delete ;
+    WsDeflate& operator=(const WsDeflate&) = delete ;
+
+    // 根据客户端的 offer 协商，成功时 response 是 Sec-WebSocket-Extensions 响应头的值
+    bool Negotiate(std::string_view offers , std::string &response) {
+        const HttpConfigInfo &config = HttpConfigInfo::Instance() ;
+        if(config.wsDeflate == false || enable_) return false ;
+        while(!offers.empty()) {
+            size_t comma = offers.find(',') ;
+            std::string_view offer = offers.substr(0 , comma) ;
+            offers = comma == std::string_view::npos ? std::string_view() : offers.substr(comma + 1) ;
+            if(accept_(offer , config)) break ;
+        }
+        if(enable_ == false) return false ;
+
+        // 保留上下文需要的内存超过总上限时，双方都改为不保留上下文
+        size_t need = (serverNoContext_ ? 0 : DeflateMemory(serverBits_ , config.wsDeflateMemLevel)) + (clientNoContext_ ? 0 : InflateMemory(clientBits_)) ;
+        if(need > 0 && reserve_(need , config.wsDeflateMemory) == false) {
+            LOG_WARN("websocket deflate memory exhausted , no context takeover") ;
+            serverNoContext_ = clientNoContext_ = true ;
+        }
+        if(serverNoContext_ == false) {
+            deflater_ = std::make_unique<Stream_>(true) ;
+            if(deflateInit2(&deflater_->stream , config.wsDeflateLevel , Z_DEFLATED , -serverBits_ , config.wsDeflateMemLevel , Z_DEFAULT_STRATEGY) != Z_OK) {
+                deflater_.reset() ; enable_ = false ; return false ;
+            }
+        }
+        if(clientNoContext_ == false) {
+            inflater_ = std::make_unique<Stream_>(false) ;
+            if(inflateInit2(&inflater_->stream , -clientBits_) != Z_OK) {
+                inflater_.reset() ; enable_ = false ; return false ;
+            }
+        }
+
+        response = "permessage-deflate" ;
+        if(serverNoContext_) response += "; server_no_context_takeover" ;
+        if(clientNoContext_) response += "; client_no_context_takeover" ;
+        if(serverBits_ < 15) response += "; server_max_window_bits=" + std::to_string(serverBits_) ;
+        if(clientBitsOffered_ && clientBits_ < 15) response += "; client_max_window_bits=" + std::to_string(clientBits_) ;
+        return true ;
+    }
+
+    bool Enabled() const {
+        return enable_ ;
+    }
+
+    // 服务端不保留上下文：压缩结果只和消息内容、窗口大小有关，可以在窗口大小相同的连接之间共享
+    bool SharedContext() const {
+        return serverNoContext_ ;
+    }
+
+    int ServerBits() const {
+        return serverBits_ ;
+    }
+
+    // 用本连接的压缩流压缩一条消息（保留上下文），调用者保证同一个连接的压缩顺序就是发送顺序
+    bool Deflate(const char* data , const size_t len , std::string &out) {
+        if(deflater_ == nullptr) return DeflateOnce(data , len , serverBits_ , out) ;
+        return deflate_(&deflater_->stream , data , len , out) ;
+    }
+
+    // 不保留上下文的压缩：每个线程每种窗口大小一个压缩流，每条消息之后重置
+    static bool DeflateOnce(const char* data , const size_t len , const int bits , std::string &out) {
+        thread_local std::unique_ptr<Stream_> streams[16] ;
+        std::unique_ptr<Stream_> &stream = streams[bits] ;
+        if(stream == nullptr) {
+            const HttpConfigInfo &config = HttpConfigInfo::Instance() ;
+            std::unique_ptr<Stream_> created = std::make_unique<Stream_>(true) ;
+            if(deflateInit2(&created->stream , config.wsDeflateLevel , Z_DEFLATED , -bits , config.wsDeflateMemLevel , Z_DEFAULT_STRATEGY) != Z_OK) return false ;
+            stream = std::move(created) ;
+        }
+        bool ok = deflate_(&stream->stream , data , len , out) ;
+        deflateReset(&stream->stream) ;
+        return ok ;
+    }
+
+    // 解压一条消息（分片已经拼接），结果超过 maxSize 时停止
+    INFLATE_CODE Inflate(const char* data , const size_t len , std::string &out , const size_t maxSize) {
+        static const char TAIL[4] = { 0x00 , 0x00 , static_cast<char>(0xff) , static_cast<char>(0xff) } ;
+        thread_local std::unique_ptr<Stream_> shared ;
+        z_stream* stream = inflater_ != nullptr ? &inflater_->stream : nullptr ;
+        if(stream == nullptr) { // 客户端不保留上下文，解压流可以线程共享，窗口取最大
+            if(shared == nullptr) {
+                std::unique_ptr<Stream_> created = std::make_unique<Stream_>(false) ;
+                if(inflateInit2(&created->stream , -15) != Z_OK) return INFLATE_ERROR ;
+                shared = std::move(created) ;
+            }
+            stream = &shared->stream ;
+        }
+        out.clear() ;
+        // 发送方去掉了 Z_SYNC_FLUSH 结尾的 00 00 ff ff ，解压前补上
+        INFLATE_CODE ret = inflate_(stream , data , len , out , maxSize) ;
+        if(ret == INFLATE_OK) ret = inflate_(stream , TAIL , sizeof(TAIL) , out , maxSize) ;
+        if(inflater_ == nullptr || ret != INFLATE_OK) inflateReset(stream) ;
+        return ret ;
+    }
+
+    // zlib 文档给出的内存估算
+    static size_t DeflateMemory(const int bits , const int memLevel) {
+        return (static_cast<size_t>(1) << (bits + 2)) + (static_cast<size_t>(1) << (memLevel + 9)) ;
+    }
+
+    static size_t InflateMemory(const int bits) {
+        return (static_cast<size_t>(1) << bits) + 7 * 1024 ;
+    }
+
+    // 所有连接保留的 zlib 内存
+    static size_t UsedMemory() {
+        return usedMemory_() ;
+    }
+
+private :
+    // zlib 流，释放时结束
+    struct Stream_ {
+        z_stream stream ;
+        bool isDeflate ;
+        explicit Stream_(const bool deflate) : isDeflate(deflate) { memset(&stream , 0 , sizeof(stream)) ; }
+        ~Stream_() { isDeflate ? deflateEnd(&stream) : inflateEnd(&stream) ; }
+    };
+
+    bool enable_ ;
+    bool serverNoContext_ ;                 // 服务端每条消息独立压缩
+    bool clientNoContext_ ;                 // 客户端每条消息独立压缩，服务端每条消息独立解压
+    bool clientBitsOffered_ = false ;       // 客户端的 offer 带了 client_max_window_bits ，响应中才能限制它
+    int serverBits_ ;                       // 服务端压缩的窗口位数
+    int clientBits_ ;                       // 客户端压缩的窗口位数，也是解压流的窗口
+    size_t reserved_ ;                      // 本连接计入总量的内存
+    std::unique_ptr<Stream_> deflater_ ;    // 保留上下文时本连接的压缩流
+    std::unique_ptr<Stream_> inflater_ ;    // 保留上下文时本连接的解压流
+
+    static std::atomic<size_t>& usedMemory_() {
+        static std::atomic<size_t> used(0) ;
+        return used ;
+    }
+
+    bool reserve_(const size_t need , const size_t limit) {
+        size_t used = usedMemory_().load() ;
+        do {
+            if(used + need > limit) return false ;
+        }while(!usedMemory_().compare_exchange_weak(used , used + need)) ;
+        reserved_ = need ;
+        return true ;
+    }
+
+    static std::string_view trim_(std::string_view value) {
+        while(!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1) ;
+        while(!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1) ;
+        if(value.size() >= 2 && value.front() == '"' && value.back() == '"') value = value.substr(1 , value.size() - 2) ;
+        return value ;
+    }
+
+    // 窗口位数 8 ~ 15 ；zlib 的 raw deflate 不支持 8 ，服务端压缩窗口至少 9
+    static int parseBits_(std::string_view value) {
+        if(value.size() == 1 && value[0] >= '8' && value[0] <= '9') return value[0] - '0' ;
+        if(value.size() == 2 && value[0] == '1' && value[1] >= '0' && value[1] <= '5') return 10 + value[1] - '0' ;
+        return -1 ;
+    }
+
+    // 参数重复、未知或者取值不合法的 offer 不接受，继续看下一个
+    bool accept_(std::string_view offer , const HttpConfigInfo &config) {
+        size_t semicolon = offer.find(';') ;
+        if(trim_(offer.substr(0 , semicolon)) != "permessage-deflate") return false ;
+        bool serverNoContext = false , clientNoContext = false , clientBitsOffered = false , serverBitsOffered = false ;
+        int serverBits = 15 , clientBits = 15 ;
+        while(semicolon != std::string_view::npos) {
+            offer = offer.substr(semicolon + 1) ;
+            semicolon = offer.find(';') ;
+            std::string_view param = offer.substr(0 , semicolon) ;
+            size_t equal = param.find('=') ;
+            std::string_view name = trim_(param.substr(0 , equal)) ;
+            std::string_view value = equal == std::string_view::npos ? std::string_view() : trim_(param.substr(equal + 1)) ;
+            bool hasValue = equal != std::string_view::npos ;
+            if(name == "server_no_context_takeover" && !serverNoContext && !hasValue) {
+                serverNoContext = true ;
+            }else if(name == "client_no_context_takeover" && !clientNoContext && !hasValue) {
+                clientNoContext = true ;
+            }else if(name == "server_max_window_bits" && !serverBitsOffered && hasValue) {
+                serverBits = parseBits_(value) ;
+                if(serverBits < 9) return false ;
+                serverBitsOffered = true ;
+            }else if(name == "client_max_window_bits" && !clientBitsOffered) {
+                clientBits = hasValue ? parseBits_(value) : 15 ;
+                if(clientBits < 8) return false ;
+                clientBitsOffered = true ;
+            }else {
+                return false ;
+            }
+        }
+        int maxBits = std::max(9 , std::min(15 , config.wsMaxWindowBits)) ;
+        enable_ = true ;
+        serverNoContext_ = serverNoContext || config.wsServerContextTakeover == false ;
+        clientNoContext_ = clientNoContext || config.wsClientContextTakeover == false ;
+        serverBits_ = std::min(serverBits , maxBits) ;
+        clientBitsOffered_ = clientBitsOffered ;
+        clientBits_ = clientBitsOffered ? std::min(clientBits , maxBits) : 15 ;
+        return true ;
+    }
+
+    // Z_SYNC_FLUSH 把消息完整地输出到字节边界，去掉结尾的 00 00 ff ff
+    static bool deflate_(z_stream* stream , const char* data , const size_t len , std::string &out) {
+        out.clear() ;
+        stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data)) ;
+        stream->avail_in = len ;
+        size_t chunk = deflateBound(stream , len) + 16 ;
+        do {
+            size_t used = out.size() ;
+            out.resize(used + chunk) ;
+            stream->next_out = reinterpret_cast<Bytef*>(&out[used]) ;
+            stream->avail_out = chunk ;
+            if(deflate(stream , Z_SYNC_FLUSH) == Z_STREAM_ERROR) return false ;
+            out.resize(used + chunk - stream->avail_out) ;
+        }while(stream->avail_out == 0) ;
+        if(out.size() < 4 || out.compare(out.size() - 4 , 4 , "\x00\x00\xff\xff" , 4) != 0) return false ;
+        out.resize(out.size() - 4) ;
+        return true ;
+    }
+
+    static INFLATE_CODE inflate_(z_stream* stream , const char* data , const size_t len , std::string &out , const size_t maxSize) {
+        stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data)) ;
+        stream->avail_in = len ;
+        do {
+            size_t used = out.size() ;
+            if(used > maxSize) return INFLATE_TOO_BIG ;
+            size_t chunk = std::min<size_t>(std::max<size_t>(len * 4 , 4096) , maxSize + 1 - used) ;
+            out.resize(used + chunk) ;
+            stream->next_out = reinterpret_cast<Bytef*>(&out[used]) ;
+            stream->avail_out = chunk ;
+            int ret = inflate(stream , Z_SYNC_FLUSH) ;
+            out.resize(used + chunk - stream->avail_out) ;
+            if(ret == Z_STREAM_END) { // 最后一个块带了 BFINAL ，之后的数据从新的流开始
+                inflateReset(stream) ;
+                if(stream->avail_in == 0) break ;
+            }else if(ret != Z_OK && ret != Z_BUF_ERROR) {
+                return INFLATE_ERROR ;
+            }else if(ret == Z_BUF_ERROR && stream->avail_out > 0) {
+                break ; // 输入用完了
+            }
+        }while(stream->avail_in > 0 || stream->avail_out == 0) ;
+        return out.size() > maxSize ? INFLATE_TOO_BIG : INFLATE_OK ;
+    }
+} ;
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef WS_STATS_H
+#define WS_STATS_H
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include "../Common/picojson.h"
+
+// WebSocket 发送队列和心跳的统计，所有连接共享，GET /ws/stats 以 json 返回
+class WsStats {
+public :
+    std::atomic<uint64_t> droppedOldest ;       // 队列满时丢弃的最旧的帧
+    std::atomic<uint64_t> droppedNewest ;       // 队列满时丢弃的新帧
+    std::atomic<uint64_t> coalesced ;           // 队列满时被同类新帧替换的旧帧
+    std::atomic<uint64_t> evicted ;             // 超过宽限时间仍然满、被断开的连接
+    std::atomic<uint64_t> pings ;               // 心跳发送的 ping 
+    std::atomic<uint64_t> pingTimeouts ;        // ping 之后超时没有回应、被断开的连接
+    std::atomic<int64_t> queuedBytes ;          // 所有连接队列中的字节数（共享帧按每个队列分别计算）
+
+    static WsStats& Instance() {
+        static WsStats inst ;
+        return inst ;
+    }
+
+    std::string ToJson() const {
+        picojson::object stats ;
+        stats["droppedOldest"] = picojson::value(static_cast<double>(droppedOldest.load())) ;
+        stats["droppedNewest"] = picojson::value(static_cast<double>(droppedNewest.load())) ;
+        stats["coalesced"] = picojson::value(static_cast<double>(coalesced.load())) ;
+        stats["evicted"] = picojson::value(static_cast<double>(evicted.load())) ;
+        stats["pings"] = picojson::value(static_cast<double>(pings.load())) ;
+        stats["pingTimeouts"] = picojson::value(static_cast<double>(pingTimeouts.load())) ;
+        stats["queuedBytes"] = picojson::value(static_cast<double>(queuedBytes.load())) ;
+        return picojson::value(stats).serialize() ;
+    }
+
+private :
+    WsStats() : droppedOldest(0) , droppedNewest(0) , coalesced(0) , evicted(0) , pings(0) , pingTimeouts(0) , queuedBytes(0) {
+    }
+} ;
+
+#endif
@@ -6,6 +6,7 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
+#include <string_view>
 #include <list>
 #include <vector>
 #include <assert.h> 
@@ -47,53 +48,195 @@ struct ConfigInfo{
     bool logWriteMethod = false ;                                    // true 异步写入，false 同步写入
     bool optLinger = true ;                                          // 优雅关闭：close() 之后等待一定时间，等套接字发送缓冲区中的数据发送完成
     int trigMode = 3 ;                                               // 采用的触发模式，0 水平触发；1 客户端 ET 服务端 LT ; 2  客户端 LT 服务端 ET; 3 客户端 ET 服务端 ET ; default = 3 ; 
+    bool openTls = false ;                                           // 是否开启 TLS ，开启后监听端口只接受 https
+    const char *tlsCertFile = "./resources/cert/server.crt" ;        // 证书链（PEM）
+    const char *tlsKeyFile = "./resources/cert/server.key" ;         // 私钥（PEM）
+    long tlsSessionTimeout = 60 * 60 ;                               // TLS 会话（含 session ticket）的有效期，单位是秒
 }; 
 
+struct SuffixInfo {
+    std::string_view suffix ;                                        // 文件后缀
+    std::string_view type ;                                          // Content-Type
+    std::string_view cacheControl ;                                  // Cache-Control ，空则使用 defaultCacheControl
+};
+
+struct HttpStatus {
+    int code ; 
+    std::string_view text ; 
+    std::string_view line ;                                          // 完整的状态行
+};
+
+// 编译期完美哈希：找一个种子使得所有后缀都落在不同的槽位上，查找只需要一次哈希加一次比较
+constexpr uint32_t SuffixHash(std::string_view str , uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed ; 
+    for(char ch : str) {
+        hash ^= static_cast<uint8_t>(ch) ; 
+        hash *= 16777619u ; 
+    }
+    return hash ; 
+}
+
+template<size_t SLOTS>
+struct SuffixIndex {
+    uint32_t seed ; 
+    int16_t slots[SLOTS] ;                                           // 槽位中存放后缀表的下标，-1 表示空
+};
+
+template<size_t SLOTS , size_t N>
+constexpr SuffixIndex<SLOTS> BuildSuffixIndex(const SuffixInfo (&table)[N]) {
+    static_assert(N < SLOTS , "suffix table is larger than hash slots") ; 
+    for(uint32_t seed = 0 ; ; ++seed) {
+        SuffixIndex<SLOTS> index{seed , {}} ; 
+        for(size_t i = 0 ; i < SLOTS ; ++i) index.slots[i] = -1 ; 
+        bool collision = false ; 
+        for(size_t i = 0 ; i < N && !collision ; ++i) {
+            size_t slot = SuffixHash(table[i].suffix , seed) % SLOTS ; 
+            if(index.slots[slot] != -1) collision = true ; 
+            index.slots[slot] = static_cast<int16_t>(i) ; 
+        }
+        if(!collision) return index ; 
+    }
+}
+
+// WebSocket 发送队列超过上限时的处理方式
+enum WS_QUEUE_POLICY {
+    WS_DROP_OLDEST ,     // 丢弃队列中最旧的帧
+    WS_DROP_NEWEST ,     // 丢弃新的帧
+    WS_COALESCE ,        // 同类的新帧替换队列中的旧帧（如在线列表），没有同类的帧时丢弃最旧的帧
+    WS_DISCONNECT ,      // 宽限时间内仍然超过上限就断开连接
+} ;
+
 struct HttpConfigInfo { 
     
     const char *srcDir = "/home/lec/File/Tiny_WebServer/resources" ;  // 服务器文件所在的地址
     const char* jwtSecret = "Chatroom" ;                             // JWT 中的密钥设置
     int jwtExpire = 60*60   ;                                        // JWT 中的 token 过期时间 1 小时 , 单位是秒
+    size_t smallFileSize = 16 * 1024 ;                               // 小于该值的文件直接 read 进写缓冲区与响应头一起发送
+    size_t sendfileSize = 256 * 1024 ;                               // 不小于该值的文件采用 sendfile 零拷贝发送，介于两者之间采用 mmap + writev
+    size_t maxRangeCount = 16 ;                                      // Range 请求最多允许的区间个数，超过则忽略 Range 发送整个文件
+    size_t compressMinSize = 1024 ;                                  // 文本类资源大于该值才在线 gzip 压缩，太小的压缩收益不大
+    size_t compressMaxSize = 4 * 1024 * 1024 ;                       // 大于该值的文件不在线压缩，避免占用过多内存和 CPU
+    size_t compressCacheSize = 64 * 1024 * 1024 ;                    // 在线压缩结果缓存的总字节数上限
+    int compressLevel = 6 ;                                          // gzip 压缩级别
+    bool openFileCache = true ;                                      // 缓存静态文件的元数据和小文件内容，inotify 监听 srcDir 使其失效，不再每个请求 stat
+    size_t fileCacheSize = 32 * 1024 * 1024 ;                        // 文件缓存中小文件内容的总字节数上限，超过之后只缓存元数据
+    size_t fileCacheMissingSize = 1024 * 1024 ;                      // 文件缓存中不存在路径的总字节数上限，按加入的先后淘汰
+    int fileCacheDebounceMs = 100 ;                                  // 文件变化停止该毫秒数之后再重新加载缓存条目，合并部署时连续的写入
+    bool openWarmup = true ;                                         // 启动时先预热静态资源，完成之后才开始监听端口
+    size_t warmupReadaheadSize = 256 * 1024 * 1024 ;                 // 预热时预读进 page cache 的文件总字节数上限
+    const char* packFile = "" ;                                      // 资源包路径（Pack/packTool 生成），包中的资源直接从映射的内存发送；为空则不使用
+    size_t maxRequestHeader = 64 * 1024 ;                            // 请求行加请求头的字节数上限
+    size_t maxRequestBody = 1024 * 1024 ;                            // 内存中保存的请求 body 上限，超过的写入 uploadDir 下的临时文件
+    size_t maxUploadSize = 1024 * 1024 * 1024 ;                      // 请求 body 的字节数上限（Content-Length 或者 chunked 解码之后）
+    size_t maxUploadParts = 64 ;                                     // multipart 请求中部分（字段和文件）的个数上限，所有字段的总字节数上限是 maxRequestBody
+    size_t requestBufferSize = 64 * 1024 ;                           // 读缓冲区超过该值就先解析，大的 body 边读边处理，不在缓冲区里堆积
+    const char* uploadDir = "/tmp" ;                                 // 上传文件的临时目录，和 srcDir 在同一个文件系统时保存文件不需要复制
+    size_t streamWatermark = 64 * 1024 ;                             // 流式响应每次生成的内容超过该值就先发送，等发完再继续生成
+    uint32_t h2MaxConcurrentStreams = 100 ;                          // HTTP/2 每个连接同时处理的流个数上限
+    uint32_t h2InitialWindowSize = 1024 * 1024 ;                     // HTTP/2 每个流的接收窗口，连接级窗口按同样大小扩大
+    size_t h2MaxHeaderBlock = 64 * 1024 ;                            // HTTP/2 单个请求头部块的字节数上限
+    size_t h2MaxRequestBody = 1024 * 1024 ;                          // HTTP/2 单个请求 body 的字节数上限
+    size_t h2WriteWatermark = 256 * 1024 ;                           // HTTP/2 写缓冲区超过该值就先发送，不再继续组帧
+    size_t wsMaxMessageSize = 1024 * 1024 ;                          // WebSocket 单条消息（分片拼接之后）的字节数上限
+    bool wsDeflate = true ;                                          // 客户端提出时协商 WebSocket permessage-deflate 压缩扩展
+    bool wsServerContextTakeover = false ;                           // 服务端压缩跨消息保留上下文：压缩率更高，但每个连接一个压缩流，群发的消息不能共享压缩结果
+    bool wsClientContextTakeover = true ;                            // 允许客户端压缩跨消息保留上下文，不允许时服务端解压不需要每个连接一个解压流
+    int wsMaxWindowBits = 15 ;                                       // 压缩的滑动窗口位数上限 9 ~ 15 ，越小每个压缩流占用的内存越少
+    int wsDeflateMemLevel = 8 ;                                      // 服务端压缩流的 memLevel 1 ~ 9
+    int wsDeflateLevel = 6 ;                                         // 服务端压缩级别
+    size_t wsDeflateMinSize = 64 ;                                   // 小于该值的消息不压缩
+    size_t wsDeflateMemory = 64 * 1024 * 1024 ;                      // 所有连接保留上下文的 zlib 流估算内存上限，超过之后新连接双方都不保留上下文
+    size_t wsQueueMaxBytes = 4 * 1024 * 1024 ;                       // 每个 WebSocket 连接发送队列的字节数上限
+    size_t wsQueueMaxFrames = 1024 ;                                 // 每个 WebSocket 连接发送队列的帧数上限
+    WS_QUEUE_POLICY wsQueuePolicy = WS_DROP_OLDEST ;                 // 发送队列超过上限时的处理方式
+    int wsQueueGraceMs = 10 * 1000 ;                                 // WS_DISCONNECT 时队列持续超过上限多少毫秒之后断开
+    size_t wsWriteBatchBytes = 256 * 1024 ;                          // WebSocket 每次可写事件从发送队列取出的字节数上限，取出的帧一次 writev 
+    size_t wsMaxTopics = 64 ;                                        // 每个 WebSocket 连接最多加入的房间个数
+    size_t wsMaxTopicLength = 64 ;                                   // 房间名的字节数上限
+    int wsPingIntervalS = 30 ;                                       // WebSocket 连接空闲多少秒之后服务端发送 ping ，<= 0 时不检查心跳
+    int wsPongTimeoutS = 10 ;                                        // ping 之后多少秒内没有收到任何数据就断开
+    int wsPresenceWindowMs = 200 ;                                   // 这段时间内的上线、下线合并成一条增量通知，<= 0 时立即通知
+    // 静态文件的缓存策略，按后缀在 SUFFIX_TYPE 中配置；html 页面可能随时更新，每次都要用 ETag 协商
+    std::string_view defaultCacheControl = "no-cache" ;
     
-    std::unordered_map<std::string, std::string> SUFFIX_TYPE = {
-        { ".html",  "text/html" },
-        { ".xml",   "text/xml" },
-        { ".xhtml", "application/xhtml+xml" },
-        { ".txt",   "text/plain" },
-        { ".rtf",   "application/rtf" },
-        { ".pdf",   "application/pdf" },
-        { ".word",  "application/nsword" },
-        { ".png",   "image/png" },
-        { ".gif",   "image/gif" },
-        { ".jpg",   "image/jpeg" },
-        { ".jpeg",  "image/jpeg" },
-        { ".au",    "audio/basic" },
-        { ".mpeg",  "video/mpeg" },
-        { ".mpg",   "video/mpeg" },
-        { ".avi",   "video/x-msvideo" },
-        { ".gz",    "application/x-gzip" },
-        { ".tar",   "application/x-tar" },
-        { ".css",   "text/css "},
-        { ".js",    "text/javascript "},
+    static constexpr SuffixInfo SUFFIX_TYPE[] = {
+        { ".html",  "text/html" ,                     "no-cache" },
+        { ".xml",   "text/xml" ,                      "" },
+        { ".xhtml", "application/xhtml+xml" ,         "" },
+        { ".txt",   "text/plain" ,                    "" },
+        { ".rtf",   "application/rtf" ,               "" },
+        { ".pdf",   "application/pdf" ,               "" },
+        { ".word",  "application/nsword" ,            "" },
+        { ".png",   "image/png" ,                     "public, max-age=604800" },
+        { ".gif",   "image/gif" ,                     "public, max-age=604800" },
+        { ".jpg",   "image/jpeg" ,                    "public, max-age=604800" },
+        { ".jpeg",  "image/jpeg" ,                    "public, max-age=604800" },
+        { ".au",    "audio/basic" ,                   "" },
+        { ".mpeg",  "video/mpeg" ,                    "public, max-age=604800" },
+        { ".mpg",   "video/mpeg" ,                    "public, max-age=604800" },
+        { ".avi",   "video/x-msvideo" ,               "public, max-age=604800" },
+        { ".mp4",   "video/mp4" ,                     "public, max-age=604800" },
+        { ".gz",    "application/x-gzip" ,            "" },
+        { ".tar",   "application/x-tar" ,             "" },
+        { ".css",   "text/css" ,                      "public, max-age=86400" },
+        { ".js",    "text/javascript" ,               "public, max-age=86400" },
+        { ".json",  "application/json" ,              "" },
+        { ".svg",   "image/svg+xml" ,                 "public, max-age=604800" },
+        { ".ico",   "image/x-icon" ,                  "public, max-age=604800" },
+        { ".woff",  "font/woff" ,                     "public, max-age=2592000" },
+        { ".woff2", "font/woff2" ,                    "public, max-age=2592000" },
+        { ".ttf",   "font/ttf" ,                      "public, max-age=2592000" },
+        { ".otf",   "font/otf" ,                      "public, max-age=2592000" },
+        { ".eot",   "application/vnd.ms-fontobject" , "public, max-age=2592000" },
     };
-    std::unordered_map<int, std::string> CODE_STATUS = {
-        { 200, "OK" },
-        { 400, "Bad Request" },
-        { 403, "Forbidden" },
-        { 404, "Not Found" },
+    static constexpr size_t SUFFIX_SLOTS = 128 ; 
+    static constexpr SuffixIndex<SUFFIX_SLOTS> SUFFIX_INDEX = BuildSuffixIndex<SUFFIX_SLOTS>(SUFFIX_TYPE) ; 
+
+    static constexpr HttpStatus CODE_STATUS[] = {
+        { 101, "Switching Protocols" ,   "HTTP/1.1 101 Switching Protocols\r\n" },
+        { 200, "OK" ,                    "HTTP/1.1 200 OK\r\n" },
+        { 206, "Partial Content" ,       "HTTP/1.1 206 Partial Content\r\n" },
+        { 304, "Not Modified" ,          "HTTP/1.1 304 Not Modified\r\n" },
+        { 400, "Bad Request" ,           "HTTP/1.1 400 Bad Request\r\n" },
+        { 401, "Unauthorized" ,          "HTTP/1.1 401 Unauthorized\r\n" },
+        { 403, "Forbidden" ,             "HTTP/1.1 403 Forbidden\r\n" },
+        { 404, "Not Found" ,             "HTTP/1.1 404 Not Found\r\n" },
+        { 413, "Content Too Large" ,     "HTTP/1.1 413 Content Too Large\r\n" },
+        { 415, "Unsupported Media Type" , "HTTP/1.1 415 Unsupported Media Type\r\n" },
+        { 416, "Range Not Satisfiable" , "HTTP/1.1 416 Range Not Satisfiable\r\n" },
+        { 500, "Internal Server Error" , "HTTP/1.1 500 Internal Server Error\r\n" },
     }; 
     std::unordered_map<int, std::string> CODE_PATH = {
         { 400, "/400.html" },
         { 403, "/403.html" },
         { 404, "/404.html" },
     };
-    std::unordered_set<std::string> DEFAULT_HTML{
-            "/index", "/register", "/login", "/welcome"
-             "/chat", "/video", "/picture", "/websocket"
-    } ;
-    std::unordered_map<std::string, int> DEFAULT_HTML_TAG {
-            {"/register.html", 0}, {"/login.html", 1},  
-    };
+
+    // 进程内只构建一次的只读配置，所有连接通过指针共享，不再每个连接拷贝一份
+    static const HttpConfigInfo& Instance() {
+        static const HttpConfigInfo inst ; 
+        return inst ; 
+    }
+
+    // 查找后缀对应的 Content-Type 等信息，不存在返回 nullptr
+    static const SuffixInfo* FindSuffix(std::string_view suffix) {
+        int16_t idx = SUFFIX_INDEX.slots[SuffixHash(suffix , SUFFIX_INDEX.seed) % SUFFIX_SLOTS] ; 
+        if(idx < 0 || SUFFIX_TYPE[idx].suffix != suffix) return nullptr ; 
+        return &SUFFIX_TYPE[idx] ; 
+    }
+
+    // 文本类资源压缩收益明显，在线 gzip 压缩
+    static bool IsCompressibleType(std::string_view fileType) {
+        return fileType.compare(0 , 5 , "text/") == 0 || fileType.find("javascript") != std::string_view::npos || 
+               fileType.find("json") != std::string_view::npos || fileType.find("xml") != std::string_view::npos ; 
+    }
+
+    static constexpr const HttpStatus* FindStatus(int code) {
+        for(const HttpStatus &status : CODE_STATUS) {
+            if(status.code == code) return &status ; 
+        }
+        return nullptr ; 
+    }
 } ; 
 
 enum STATUS_CODE {
@@ -0,0 +1,70 @@
+#ifndef SINGLE_FLIGHT_H
+#define SINGLE_FLIGHT_H
+
+#include <mutex>
+#include <memory>
+#include <future>
+#include <exception>
+#include <unordered_map>
+
+// 合并同一个 key 的并发调用：第一个调用者执行 func ，执行期间到达的调用者等待并共享它的结果，
+// 执行结束后 key 被移除，之后的调用重新执行。用于缓存未命中时避免多个线程重复加载同一份数据
+// Forget 让之后到达的调用者不再等待正在执行的调用（比如数据已经失效），重新执行一次
+template<typename K , typename V>
+class SingleFlight {
+public :
+    template<typename Func>
+    V Do(const K &key , Func &&func , bool* shared = nullptr) {
+        std::unique_lock<std::mutex> locker(mtx_) ;
+        auto iter = calls_.find(key) ;
+        if(iter != calls_.end()) {
+            std::shared_future<V> result = iter->second->result ;
+            locker.unlock() ;
+            if(shared != nullptr) *shared = true ;
+            return result.get() ;
+        }
+        std::shared_ptr<Call> call = std::make_shared<Call>() ;
+        call->result = call->promise.get_future().share() ;
+        calls_[key] = call ;
+        locker.unlock() ;
+
+        try {
+            call->promise.set_value(func()) ;
+        }catch(...) { // 异常同样交给所有等待的调用者
+            call->promise.set_exception(std::current_exception()) ;
+        }
+        locker.lock() ;
+        iter = calls_.find(key) ;
+        if(iter != calls_.end() && iter->second == call) calls_.erase(iter) ;
+        locker.unlock() ;
+        if(shared != nullptr) *shared = false ;
+        return call->result.get() ;
+    }
+
+    void Forget(const K &key) {
+        std::unique_lock<std::mutex> locker(mtx_) ;
+        calls_.erase(key) ;
+    }
+
+    void ForgetAll() {
+        std::unique_lock<std::mutex> locker(mtx_) ;
+        calls_.clear() ;
+    }
+
+    // 正在执行的调用个数
+    size_t Inflight() {
+        std::unique_lock<std::mutex> locker(mtx_) ;
+        return calls_.size() ;
+    }
+
+private :
+    struct Call {
+        std::promise<V> promise ;
+        std::shared_future<V> result ;
+    };
+
+    std::mutex mtx_ ;
+    std::unordered_map<K , std::shared_ptr<Call>> calls_ ;
+} ;
+
+#endif
@@ -0,0 +1,72 @@
+#include "singleFlight.h"
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <stdexcept>
+#include <assert.h>
+#include <unistd.h>
+using namespace std ;
+
+// 测试同一个 key 的并发调用只执行一次，所有调用者拿到同一个结果
+void test_coalesce(){
+    SingleFlight<string , shared_ptr<const string>> flight ;
+    atomic<int> calls(0) , shared(0) ;
+    vector<shared_ptr<const string>> results(16) ;
+    vector<thread> threads ;
+    for(int i = 0 ; i < 16 ; ++i) {
+        threads.emplace_back([&flight , &calls , &shared , &results , i]() {
+            bool isShared = false ;
+            results[i] = flight.Do("key" , [&calls]() {
+                ++calls ;
+                usleep(100 * 1000) ;
+                return make_shared<const string>("value") ;
+            } , &isShared) ;
+            if(isShared) ++shared ;
+        }) ;
+    }
+    for(auto &th : threads) th.join() ;
+    assert(calls == 1 && shared == 15 && flight.Inflight() == 0) ;
+    for(auto &result : results) assert(result == results[0] && *result == "value") ;
+
+    // 执行结束之后再调用会重新执行
+    flight.Do("key" , [&calls]() { ++calls ; return make_shared<const string>("again") ; }) ;
+    assert(calls == 2) ;
+    cout<<"test_coalesce pass"<<endl ;
+}
+
+// 测试 Forget 之后到达的调用者不再等待正在执行的调用
+void test_forget(){
+    SingleFlight<string , int> flight ;
+    atomic<int> calls(0) ;
+    thread slow([&flight , &calls]() {
+        assert(flight.Do("key" , [&calls]() { ++calls ; usleep(200 * 1000) ; return 1 ; }) == 1) ;
+    }) ;
+    while(flight.Inflight() == 0) usleep(1000) ;
+    flight.Forget("key") ;
+    assert(flight.Do("key" , [&calls]() { ++calls ; return 2 ; }) == 2) ;
+    slow.join() ;
+    assert(calls == 2 && flight.Inflight() == 0) ;
+    cout<<"test_forget pass"<<endl ;
+}
+
+// 测试异常交给所有等待的调用者
+void test_exception(){
+    SingleFlight<int , int> flight ;
+    bool caught = false ;
+    try {
+        flight.Do(1 , []() -> int { throw runtime_error("load error") ; }) ;
+    }catch(const runtime_error &e) {
+        caught = string(e.what()) == "load error" ;
+    }
+    assert(caught && flight.Inflight() == 0) ;
+    cout<<"test_exception pass"<<endl ;
+}
+
+int main(){
+    test_coalesce() ;
+    test_forget() ;
+    test_exception() ;
+    return 0 ;
+}
@@ -0,0 +1,24 @@
+#include "resourcePack.h"
+#include <iostream>
+#include <string.h>
+using namespace std ;
+
+// 打包工具：./pack <srcDir> <out.pack> [--no-gzip]
+// 输出先写到 <out.pack>.tmp 再 rename ，服务端监听到替换之后加载新包
+int main(int argc , char* argv[]){
+    if(argc < 3 || (argc == 4 && strcmp(argv[3] , "--no-gzip") != 0) || argc > 4) {
+        cerr<<"usage : "<<argv[0]<<" <srcDir> <out.pack> [--no-gzip]"<<endl ;
+        return 1 ;
+    }
+    if(PackBuilder::Build(argv[1] , argv[2] , argc == 3) == false) {
+        cerr<<"pack "<<argv[1]<<" -> "<<argv[2]<<" error : "<<strerror(errno)<<endl ;
+        return 1 ;
+    }
+    shared_ptr<const ResourcePack> pack = ResourcePack::Open(argv[2]) ;
+    if(pack == nullptr) {
+        cerr<<"pack "<<argv[2]<<" verify error"<<endl ;
+        return 1 ;
+    }
+    cout<<argv[2]<<" : "<<pack->GetCount()<<" assets"<<endl ;
+    return 0 ;
+}
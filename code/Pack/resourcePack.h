@@ -0,0 +1,329 @@
+#ifndef RESOURCE_PACK_H
+#define RESOURCE_PACK_H
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>       // open
+#include <unistd.h>      // close, write
+#include <dirent.h>      // opendir
+#include <sys/mman.h>    // mmap
+#include <sys/stat.h>    // stat
+#include "../Log/log.h"
+#include "../Common/commonConfig.h"
+#include "../Cache/compressCache.h"
+
+// 资源包：把 resources/ 目录打包成一个带索引的文件，服务端启动时整个 mmap 进来
+// 布局：PackHeader | 路径、预生成的头部、ETag 、文件内容、gzip 内容 | 按路径排序的 PackIndex 数组
+// 所有偏移都相对于文件开头，按本机字节序存放（打包和服务在同一种机器上）
+// 查找是在索引上二分，发送直接 writev 映射的内存或者 sendfile 包文件，不再 open / stat 单个文件；
+// 部署时 rename 替换整个包文件，新旧版本不会混在一起
+struct PackHeader {
+    char magic[8] ;                                      // "TWSPACK\0"
+    uint32_t version ;
+    uint32_t count ;                                     // 资源个数
+    uint64_t indexOffset ;
+    uint64_t fileSize ;                                  // 整个包的大小，用于检查文件是否完整
+};
+
+struct PackRecord {                                      // 资源的一个编码版本
+    uint64_t headOffset ;                                // 预生成的头部：ETag 、Last-Modified 、Cache-Control 等
+    uint64_t etagOffset ;
+    uint64_t dataOffset ;
+    uint64_t dataSize ;
+    uint32_t headLen ;
+    uint32_t etagLen ;
+};
+
+struct PackIndex {
+    uint64_t pathOffset ;
+    uint32_t pathLen ;
+    uint32_t reserved ;
+    int64_t mtime ;                                      // 原文件的修改时间，用于 If-Modified-Since
+    PackRecord plain ;
+    PackRecord gzip ;                                    // dataSize 为 0 表示没有 gzip 版本
+};
+
+// 查找结果，指向映射的内存
+struct PackVariant {
+    std::string_view head ;
+    std::string_view etag ;
+    uint64_t offset ;                                    // 内容在包文件中的偏移
+    uint64_t size ;
+};
+
+struct PackAsset {
+    std::string_view path ;
+    time_t mtime ;
+    PackVariant plain ;
+    PackVariant gzip ;
+};
+
+class ResourcePack {
+public :
+    static constexpr char MAGIC[8] = "TWSPACK" ;
+    static constexpr uint32_t VERSION = 1 ;
+
+    ~ResourcePack() {
+        if(data_ != nullptr) munmap(const_cast<char*>(data_) , size_) ;
+        if(fd_ != -1) ::close(fd_) ;
+    }
+
+    // 打开并检查包文件，格式不对返回 nullptr
+    static std::shared_ptr<const ResourcePack> Open(const std::string &path) {
+        std::shared_ptr<ResourcePack> pack(new ResourcePack()) ;
+        pack->fd_ = open(path.data() , O_RDONLY | O_CLOEXEC) ;
+        struct stat fileStat ;
+        if(pack->fd_ == -1 || fstat(pack->fd_ , &fileStat) != 0 || fileStat.st_size < static_cast<off_t>(sizeof(PackHeader))) {
+            LOG_ERROR("resource pack %s open error %d" , path.data() , errno) ;
+            return nullptr ;
+        }
+        pack->size_ = fileStat.st_size ;
+        void* data = mmap(nullptr , pack->size_ , PROT_READ , MAP_SHARED , pack->fd_ , 0) ;
+        if(data == MAP_FAILED) {
+            LOG_ERROR("resource pack %s mmap error %d" , path.data() , errno) ;
+            return nullptr ;
+        }
+        pack->data_ = static_cast<const char*>(data) ;
+        madvise(data , pack->size_ , MADV_WILLNEED) ;
+        if(pack->validate_() == false) {
+            LOG_ERROR("resource pack %s is corrupted" , path.data()) ;
+            return nullptr ;
+        }
+        LOG_INFO("resource pack %s loaded , %u assets , %zu bytes" , path.data() , pack->count_ , pack->size_) ;
+        return pack ;
+    }
+
+    // 当前使用的包，所有连接共享；替换之后正在发送的响应仍然持有旧的包
+    static std::shared_ptr<const ResourcePack> Current() {
+        return std::atomic_load(&current_()) ;
+    }
+
+    static bool Load(const std::string &path) {
+        std::shared_ptr<const ResourcePack> pack = Open(path) ;
+        if(pack == nullptr) return false ; // 新包有问题时继续使用旧包
+        std::atomic_store(&current_() , pack) ;
+        return true ;
+    }
+
+    static void Unload() {
+        std::atomic_store(&current_() , std::shared_ptr<const ResourcePack>()) ;
+    }
+
+    // 按请求路径二分查找
+    bool find(std::string_view path , PackAsset &asset) const {
+        const PackIndex* end = index_ + count_ ;
+        const PackIndex* iter = std::lower_bound(index_ , end , path , [this](const PackIndex &item , std::string_view key) {
+            return pathOf_(item) < key ;
+        }) ;
+        if(iter == end || pathOf_(*iter) != path) return false ;
+        asset.path = pathOf_(*iter) ;
+        asset.mtime = static_cast<time_t>(iter->mtime) ;
+        asset.plain = variantOf_(iter->plain) ;
+        asset.gzip = variantOf_(iter->gzip) ;
+        return true ;
+    }
+
+    const char* GetData() const {
+        return data_ ;
+    }
+
+    int GetFd() const {
+        return fd_ ;
+    }
+
+    uint32_t GetCount() const {
+        return count_ ;
+    }
+
+private :
+    ResourcePack() : fd_(-1) , data_(nullptr) , size_(0) , count_(0) , index_(nullptr) {
+    }
+
+    static std::shared_ptr<const ResourcePack>& current_() {
+        static std::shared_ptr<const ResourcePack> pack ;
+        return pack ;
+    }
+
+    std::string_view pathOf_(const PackIndex &item) const {
+        return std::string_view(data_ + item.pathOffset , item.pathLen) ;
+    }
+
+    PackVariant variantOf_(const PackRecord &record) const {
+        return PackVariant{ std::string_view(data_ + record.headOffset , record.headLen) ,
+                            std::string_view(data_ + record.etagOffset , record.etagLen) , record.dataOffset , record.dataSize } ;
+    }
+
+    bool inRange_(uint64_t offset , uint64_t len) const {
+        return offset <= size_ && len <= size_ - offset ;
+    }
+
+    bool validRecord_(const PackRecord &record) const {
+        return inRange_(record.headOffset , record.headLen) && inRange_(record.etagOffset , record.etagLen) &&
+               inRange_(record.dataOffset , record.dataSize) ;
+    }
+
+    // 加载时检查所有偏移和排序，之后的查找不再做边界检查
+    bool validate_() {
+        PackHeader header ;
+        memcpy(&header , data_ , sizeof(header)) ;
+        if(memcmp(header.magic , MAGIC , sizeof(MAGIC)) != 0 || header.version != VERSION || header.fileSize != size_) return false ;
+        if(header.indexOffset % alignof(PackIndex) != 0 || !inRange_(header.indexOffset , static_cast<uint64_t>(header.count) * sizeof(PackIndex))) return false ;
+        count_ = header.count ;
+        index_ = reinterpret_cast<const PackIndex*>(data_ + header.indexOffset) ;
+        for(uint32_t i = 0 ; i < count_ ; ++i) {
+            const PackIndex &item = index_[i] ;
+            if(!inRange_(item.pathOffset , item.pathLen) || !validRecord_(item.plain) || !validRecord_(item.gzip)) return false ;
+            if(i > 0 && !(pathOf_(index_[i - 1]) < pathOf_(item))) return false ;
+        }
+        return true ;
+    }
+
+    int fd_ ;                                            // 大的资源用 sendfile 从包文件发送
+    const char* data_ ;
+    size_t size_ ;
+    uint32_t count_ ;
+    const PackIndex* index_ ;
+} ;
+
+// 生成资源包：遍历目录，为每个文件预生成头部和 ETag ，文本类资源压缩后更小时附带 gzip 版本
+// ETag 和 Last-Modified 的格式与直接从磁盘发送时一致，同一台机器上切换到资源包不会让客户端缓存失效
+class PackBuilder {
+public :
+    // 先写临时文件再 rename ，服务端不会读到写了一半的包
+    static bool Build(const std::string &srcDir , const std::string &packPath , const bool withGzip) {
+        std::vector<std::string> files ;
+        std::string root = srcDir ;
+        while(root.size() > 1 && root.back() == '/') root.pop_back() ;
+        walk_(root , "" , files) ;
+        std::sort(files.begin() , files.end()) ;
+
+        std::string blob(sizeof(PackHeader) , '\0') ;
+        std::vector<PackIndex> index ;
+        for(const std::string &urlPath : files) {
+            std::string filePath = root + urlPath ;
+            struct stat fileStat ;
+            std::string content ;
+            if(stat(filePath.data() , &fileStat) != 0 || !S_ISREG(fileStat.st_mode) || !(fileStat.st_mode & S_IROTH) ||
+               CompressCache::readFile(filePath , fileStat.st_size , content) == false) {
+                LOG_WARN("pack skip %s" , filePath.data()) ;
+                continue ;
+            }
+            std::string_view fileType = fileType_(urlPath) ;
+            std::string gzipContent ;
+            bool hasGzip = withGzip && HttpConfigInfo::IsCompressibleType(fileType) && content.size() >= HttpConfigInfo::Instance().compressMinSize &&
+                           CompressCache::gzipCompress(content.data() , content.size() , gzipContent , 9) && gzipContent.size() < content.size() ;
+            bool vary = HttpConfigInfo::IsCompressibleType(fileType) || hasGzip ;
+
+            PackIndex item = {} ;
+            item.pathOffset = append_(blob , urlPath) ;
+            item.pathLen = urlPath.size() ;
+            item.mtime = fileStat.st_mtime ;
+            item.plain = record_(blob , urlPath , fileStat , content , false , vary) ;
+            if(hasGzip) {
+                item.gzip = record_(blob , urlPath , fileStat , gzipContent , true , vary) ;
+            }else {
+                item.gzip.headOffset = item.gzip.etagOffset = item.gzip.dataOffset = blob.size() ;
+            }
+            index.push_back(item) ;
+        }
+        blob.resize((blob.size() + alignof(PackIndex) - 1) / alignof(PackIndex) * alignof(PackIndex) , '\0') ;
+        PackHeader header = {} ;
+        memcpy(header.magic , ResourcePack::MAGIC , sizeof(header.magic)) ;
+        header.version = ResourcePack::VERSION ;
+        header.count = index.size() ;
+        header.indexOffset = blob.size() ;
+        blob.append(reinterpret_cast<const char*>(index.data()) , index.size() * sizeof(PackIndex)) ;
+        header.fileSize = blob.size() ;
+        memcpy(&blob[0] , &header , sizeof(header)) ;
+
+        std::string tmpPath = packPath + ".tmp" ;
+        int fd = open(tmpPath.data() , O_WRONLY | O_CREAT | O_TRUNC , 0644) ;
+        if(fd == -1) return false ;
+        size_t written = 0 ;
+        while(written < blob.size()) {
+            ssize_t n = ::write(fd , blob.data() + written , blob.size() - written) ;
+            if(n < 0 && errno == EINTR) continue ;
+            if(n <= 0) break ;
+            written += n ;
+        }
+        bool ok = written == blob.size() && fsync(fd) == 0 ;
+        ::close(fd) ;
+        if(!ok || rename(tmpPath.data() , packPath.data()) != 0) {
+            unlink(tmpPath.data()) ;
+            return false ;
+        }
+        LOG_INFO("pack %s -> %s , %zu assets , %zu bytes" , root.data() , packPath.data() , index.size() , blob.size()) ;
+        return true ;
+    }
+
+private :
+    static void walk_(const std::string &root , const std::string &dir , std::vector<std::string> &files) {
+        DIR* dirp = opendir((root + dir).data()) ;
+        if(dirp == nullptr) return ;
+        struct dirent* item = nullptr ;
+        while((item = readdir(dirp)) != nullptr) {
+            if(strcmp(item->d_name , ".") == 0 || strcmp(item->d_name , "..") == 0) continue ;
+            std::string path = dir + "/" + item->d_name ;
+            struct stat fileStat ;
+            if(stat((root + path).data() , &fileStat) != 0) continue ;
+            if(S_ISDIR(fileStat.st_mode)) {
+                walk_(root , path , files) ;
+            }else if(S_ISREG(fileStat.st_mode)) {
+                files.push_back(path) ;
+            }
+        }
+        closedir(dirp) ;
+    }
+
+    static const SuffixInfo* suffixInfo_(const std::string &path) {
+        std::string::size_type idx = path.find_last_of('.') ;
+        if(idx == std::string::npos) return nullptr ;
+        return HttpConfigInfo::FindSuffix(std::string_view(path).substr(idx)) ;
+    }
+
+    static std::string_view fileType_(const std::string &path) {
+        const SuffixInfo* info = suffixInfo_(path) ;
+        return info != nullptr ? info->type : "text/plain" ;
+    }
+
+    static uint64_t append_(std::string &blob , std::string_view data) {
+        uint64_t offset = blob.size() ;
+        blob.append(data.data() , data.size()) ;
+        return offset ;
+    }
+
+    // 头部和 HttpProtocol::AddValidators_ 生成的一致
+    static PackRecord record_(std::string &blob , const std::string &path , const struct stat &fileStat ,
+                              const std::string &content , const bool isGzip , const bool vary) {
+        char etag[96] ;
+        snprintf(etag , sizeof(etag) , isGzip ? "\"%lx-%lx-%lx.%lx-gz\"" : "\"%lx-%lx-%lx.%lx\"" , static_cast<unsigned long>(fileStat.st_ino) ,
+                 static_cast<unsigned long>(fileStat.st_size) , static_cast<unsigned long>(fileStat.st_mtim.tv_sec) ,
+                 static_cast<unsigned long>(fileStat.st_mtim.tv_nsec)) ;
+        char date[64] ;
+        struct tm tmTime ;
+        gmtime_r(&fileStat.st_mtime , &tmTime) ;
+        strftime(date , sizeof(date) , "%a, %d %b %Y %H:%M:%S GMT" , &tmTime) ;
+        const SuffixInfo* info = suffixInfo_(path) ;
+        std::string_view cacheControl = info != nullptr && !info->cacheControl.empty() ? info->cacheControl : HttpConfigInfo::Instance().defaultCacheControl ;
+
+        std::string head = "ETag: " + std::string(etag) + "\r\nLast-Modified: " + date + "\r\nCache-Control: " + std::string(cacheControl) + "\r\n" ;
+        if(vary) head += "Vary: Accept-Encoding\r\n" ;
+        if(isGzip) head += "Content-Encoding: gzip\r\n" ;
+
+        PackRecord record = {} ;
+        record.headOffset = append_(blob , head) ;
+        record.headLen = head.size() ;
+        record.etagOffset = record.headOffset + strlen("ETag: ") ; // ETag 就在头部里面
+        record.etagLen = strlen(etag) ;
+        record.dataOffset = append_(blob , content) ;
+        record.dataSize = content.size() ;
+        return record ;
+    }
+} ;
+
+#endif
@@ -0,0 +1,110 @@
+#include "resourcePack.h"
+#include <iostream>
+#include <fstream>
+#include <assert.h>
+using namespace std ;
+
+static const string ROOT = "/tmp/test_resource_pack" ;
+static const string PACK = ROOT + "/site.pack" ;
+
+static void writeFile(const string &path , const string &content){
+    ofstream out(path , ios::out | ios::trunc) ;
+    out << content ;
+}
+
+static string gunzip(string_view data){
+    z_stream stream ;
+    memset(&stream , 0 , sizeof(stream)) ;
+    assert(inflateInit2(&stream , 15 + 16) == Z_OK) ;
+    string out(64 * 1024 , '\0') ;
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data())) ;
+    stream.avail_in = data.size() ;
+    stream.next_out = reinterpret_cast<Bytef*>(&out[0]) ;
+    stream.avail_out = out.size() ;
+    assert(inflate(&stream , Z_FINISH) == Z_STREAM_END) ;
+    out.resize(stream.total_out) ;
+    inflateEnd(&stream) ;
+    return out ;
+}
+
+// 测试打包之后按路径查找，内容、头部和 gzip 版本正确
+void test_build_find(){
+    string page ;
+    for(int i = 0 ; i < 200 ; ++i) page += "<p>line " + to_string(i) + "</p>\n" ;
+    writeFile(ROOT + "/src/index.html" , page) ;
+    writeFile(ROOT + "/src/js/a.js" , "var a = 1 ;") ;
+    writeFile(ROOT + "/src/img.png" , string(4096 , 'p')) ;
+    assert(PackBuilder::Build(ROOT + "/src/" , PACK , true)) ;
+    assert(access((PACK + ".tmp").data() , F_OK) != 0) ;
+
+    auto pack = ResourcePack::Open(PACK) ;
+    assert(pack != nullptr && pack->GetCount() == 3) ;
+    PackAsset asset ;
+    assert(pack->find("/index.html" , asset)) ;
+    assert(string_view(pack->GetData() + asset.plain.offset , asset.plain.size) == page) ;
+    assert(asset.gzip.size > 0 && asset.gzip.size < asset.plain.size) ;
+    assert(gunzip(string_view(pack->GetData() + asset.gzip.offset , asset.gzip.size)) == page) ;
+    assert(asset.plain.head.find("ETag: " + string(asset.plain.etag) + "\r\n") == 0) ;
+    assert(asset.plain.head.find("Cache-Control: no-cache\r\n") != string_view::npos) ;
+    assert(asset.plain.head.find("Vary: Accept-Encoding\r\n") != string_view::npos) ;
+    assert(asset.gzip.head.find("Content-Encoding: gzip\r\n") != string_view::npos) ;
+    assert(asset.gzip.etag != asset.plain.etag) ;
+
+    struct stat fileStat ;
+    stat((ROOT + "/src/index.html").data() , &fileStat) ;
+    assert(asset.mtime == fileStat.st_mtime) ;
+
+    // 太小的文本和非文本资源没有 gzip 版本
+    assert(pack->find("/js/a.js" , asset) && asset.gzip.size == 0) ;
+    assert(pack->find("/img.png" , asset) && asset.gzip.size == 0) ;
+    assert(asset.plain.head.find("Vary") == string_view::npos) ;
+    assert(!pack->find("/js" , asset) && !pack->find("/none.html" , asset) && !pack->find("" , asset)) ;
+
+    // 不生成 gzip 版本
+    assert(PackBuilder::Build(ROOT + "/src" , PACK , false)) ;
+    pack = ResourcePack::Open(PACK) ;
+    assert(pack->find("/index.html" , asset) && asset.gzip.size == 0) ;
+    cout<<"test_build_find pass"<<endl ;
+}
+
+// 测试损坏或者截断的包不能加载，当前的包保持不变；替换之后旧包仍然可用
+void test_load_swap(){
+    assert(PackBuilder::Build(ROOT + "/src" , PACK , true)) ;
+    assert(ResourcePack::Load(PACK)) ;
+    auto old = ResourcePack::Current() ;
+    PackAsset asset ;
+    assert(old != nullptr && old->find("/js/a.js" , asset)) ;
+
+    string data ;
+    struct stat packStat ;
+    assert(stat(PACK.data() , &packStat) == 0 && CompressCache::readFile(PACK , packStat.st_size , data)) ;
+    writeFile(ROOT + "/bad.pack" , data.substr(0 , data.size() - 1)) ;
+    assert(ResourcePack::Load(ROOT + "/bad.pack") == false) ;
+    string corrupt = data ;
+    reinterpret_cast<PackHeader*>(&corrupt[0])->indexOffset = corrupt.size() ;
+    writeFile(ROOT + "/bad.pack" , corrupt) ;
+    assert(ResourcePack::Load(ROOT + "/bad.pack") == false) ;
+    assert(ResourcePack::Load(ROOT + "/none.pack") == false && ResourcePack::Current() == old) ;
+
+    writeFile(ROOT + "/src/js/a.js" , "var a = 22 ;") ;
+    assert(PackBuilder::Build(ROOT + "/src" , PACK , true)) ;
+    assert(ResourcePack::Load(PACK) && ResourcePack::Current() != old) ;
+    assert(ResourcePack::Current()->find("/js/a.js" , asset)) ;
+    assert(string_view(ResourcePack::Current()->GetData() + asset.plain.offset , asset.plain.size) == "var a = 22 ;") ;
+    assert(old->find("/js/a.js" , asset)) ; // 旧包的映射仍然有效
+    assert(string_view(old->GetData() + asset.plain.offset , asset.plain.size) == "var a = 1 ;") ;
+    ResourcePack::Unload() ;
+    assert(ResourcePack::Current() == nullptr) ;
+    cout<<"test_load_swap pass"<<endl ;
+}
+
+int main(){
+    system(("rm -rf " + ROOT).data()) ;
+    mkdir(ROOT.data() , 0755) ;
+    mkdir((ROOT + "/src").data() , 0755) ;
+    mkdir((ROOT + "/src/js").data() , 0755) ;
+    test_build_find() ;
+    test_load_swap() ;
+    system(("rm -rf " + ROOT).data()) ;
+    return 0 ;
+}
@@ -0,0 +1,180 @@
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>       // read, close
+#include <sys/timerfd.h>  // timerfd
+#include "../Log/log.h"
+
+// 在线列表（带版本号）和增量的上线、下线通知
+// 1. 同一个用户的多个连接按引用计数，第一个连接上线、最后一个连接下线时才改变在线列表
+// 2. 新连接只收到完整的快照 {version, names}；其他用户收到合并之后的增量 {base, version, join, leave}，
+//    一个窗口（windowMs）内的变化合并成一条，窗口内上线又下线的用户不通知
+// 3. 每发出一条增量版本号加一；客户端的版本号等于 base 时应用增量，小于等于已有版本的增量忽略，
+//    不连续（比如发送队列满了丢弃了增量）时重新请求快照
+// 4. 快照和增量在同一把锁下发送，同一个连接收到的快照和增量不会乱序
+// 5. 窗口定时器是 timerfd ，注册在主线程的 epoll 上；windowMs <= 0 或者创建失败时每次变化立即发送
+class Presence {
+public :
+    struct Delta {
+        uint64_t base ;                     // 上一条增量的版本号
+        uint64_t version ;                  // 这条增量之后的版本号
+        std::vector<std::string> join ;
+        std::vector<std::string> leave ;
+    } ;
+    typedef std::function<void(const Delta&)> Broadcast ;
+    typedef std::function<void(uint64_t , const std::vector<std::string>&)> SendSnapshot ;
+
+    Presence() : timerFd_(-1) , windowMs_(0) , version_(0) , is_Pending_(false) {
+    }
+
+    ~Presence() {
+        if(timerFd_ != -1) close(timerFd_) ;
+    }
+
+    Presence(const Presence&) = delete ;
+    Presence& operator=(const Presence&) = delete ;
+
+    // broadcast 把增量发给所有在线用户，在主线程（窗口到期）或者改变在线列表的线程（没有窗口）调用
+    bool init(int windowMs , Broadcast broadcast) {
+        if(timerFd_ != -1) {
+            close(timerFd_) ;
+            timerFd_ = -1 ;
+        }
+        broadcast_ = std::move(broadcast) ;
+        windowMs_ = windowMs ;
+        if(windowMs_ <= 0) return true ;
+        timerFd_ = timerfd_create(CLOCK_MONOTONIC , TFD_NONBLOCK | TFD_CLOEXEC) ;
+        if(timerFd_ == -1) {
+            LOG_ERROR("presence timer create error %d , send updates immediately" , errno) ;
+            windowMs_ = 0 ;
+            return false ;
+        }
+        return true ;
+    }
+
+    int GetTimerFd() const {
+        return timerFd_ ;
+    }
+
+    // 用户的一个连接上线，sendSnapshot 把当前的快照发给这个连接；返回用户是否是第一个连接
+    bool Join(const std::string &name , const SendSnapshot &sendSnapshot) {
+        bool changed = false ;
+        {
+            std::lock_guard<std::mutex> sendLocker(sendMtx_) ;
+            std::vector<std::string> names ;
+            uint64_t version = 0 ;
+            {
+                std::lock_guard<std::mutex> locker(mtx_) ;
+                changed = ++online_[name] == 1 ;
+                if(changed) change_(name , 1) ;
+                version = snapshot_(names) ;
+            }
+            sendSnapshot(version , names) ;
+        }
+        if(changed && windowMs_ <= 0) Flush() ;
+        return changed ;
+    }
+
+    // 用户的一个连接下线；返回是否是最后一个连接
+    bool Leave(const std::string &name) {
+        bool changed = false ;
+        {
+            std::lock_guard<std::mutex> locker(mtx_) ;
+            auto iter = online_.find(name) ;
+            if(iter == online_.end()) return false ;
+            changed = --iter->second == 0 ;
+            if(changed) {
+                online_.erase(iter) ;
+                change_(name , -1) ;
+            }
+        }
+        if(changed && windowMs_ <= 0) Flush() ;
+        return changed ;
+    }
+
+    // 客户端发现增量不连续时重新请求快照
+    void Snapshot(const SendSnapshot &sendSnapshot) {
+        std::lock_guard<std::mutex> sendLocker(sendMtx_) ;
+        std::vector<std::string> names ;
+        uint64_t version = 0 ;
+        {
+            std::lock_guard<std::mutex> locker(mtx_) ;
+            version = snapshot_(names) ;
+        }
+        sendSnapshot(version , names) ;
+    }
+
+    // 窗口到期：发送这个窗口内合并之后的增量
+    void dealTimer() {
+        uint64_t expirations = 0 ;
+        while(read(timerFd_ , &expirations , sizeof(expirations)) > 0) {}
+        Flush() ;
+    }
+
+    // 合并等待发送的变化，有变化时版本号加一并广播
+    void Flush() {
+        std::lock_guard<std::mutex> sendLocker(sendMtx_) ;
+        Delta delta ;
+        {
+            std::lock_guard<std::mutex> locker(mtx_) ;
+            is_Pending_ = false ;
+            for(const auto &change : pending_) {
+                if(change.second > 0) delta.join.push_back(change.first) ;
+                else if(change.second < 0) delta.leave.push_back(change.first) ;
+            }
+            pending_.clear() ;
+            if(delta.join.empty() && delta.leave.empty()) return ;
+            delta.base = version_ ;
+            delta.version = ++version_ ;
+        }
+        if(broadcast_) broadcast_(delta) ;
+    }
+
+    size_t OnlineCount() const {
+        std::lock_guard<std::mutex> locker(mtx_) ;
+        return online_.size() ;
+    }
+
+    uint64_t Version() const {
+        std::lock_guard<std::mutex> locker(mtx_) ;
+        return version_ ;
+    }
+
+private :
+    int timerFd_ ;
+    int windowMs_ ;
+    uint64_t version_ ;                                 // 已经发出的最后一条增量的版本号
+    bool is_Pending_ ;                                  // 窗口定时器已经设置
+    std::unordered_map<std::string , int> online_ ;     // 在线用户和连接个数
+    std::unordered_map<std::string , int> pending_ ;    // 上次发送之后的变化：上线 +1 ，下线 -1 ，上线又下线为 0
+    Broadcast broadcast_ ;
+    mutable std::mutex mtx_ ;                           // 保护在线列表和变化
+    std::mutex sendMtx_ ;                               // 快照和增量按版本顺序进入发送队列
+
+    // 上线和下线交替出现，累加之后只能是 -1 、0 、1
+    void change_(const std::string &name , int delta) {
+        if((pending_[name] += delta) == 0) pending_.erase(name) ;
+        if(is_Pending_ || windowMs_ <= 0) return ;
+        is_Pending_ = true ;
+        struct itimerspec spec = {} ;
+        spec.it_value.tv_sec = windowMs_ / 1000 ;
+        spec.it_value.tv_nsec = (windowMs_ % 1000) * 1000000L ;
+        timerfd_settime(timerFd_ , 0 , &spec , nullptr) ;
+    }
+
+    // 快照包括还没有发出的变化，之后收到的同一个窗口的增量重复应用也没有影响
+    uint64_t snapshot_(std::vector<std::string> &names) const {
+        names.reserve(online_.size()) ;
+        for(const auto &user : online_) names.push_back(user.first) ;
+        return version_ ;
+    }
+} ;
+
+#endif
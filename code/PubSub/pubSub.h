@@ -0,0 +1,117 @@
+#ifndef PUB_SUB_H
+#define PUB_SUB_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+
+// 按主题（房间）发布订阅
+// 1. 每个主题的订阅者是一个连续的 vector ，发布时顺序遍历，只访问这个主题的订阅者
+// 2. 订阅者列表写时复制：订阅、退订时复制一份修改之后替换，发布者拿到 shared_ptr 快照之后不加锁遍历；
+//    退订之后旧快照里仍然有这个订阅者，Subscriber 必须保证快照存在期间仍然有效（比如 shared_ptr ），
+//    投递时还要检查订阅者是否已经关闭
+// 3. 主题表按主题名哈希分片，每个分片一把读写锁，大量小房间的订阅和发布分散在不同的锁上
+// 4. 最后一个订阅者退订之后删除主题
+template<typename Subscriber>
+class PubSub {
+public :
+    typedef std::vector<Subscriber> Subscribers ;
+    typedef std::shared_ptr<const Subscribers> Snapshot ;
+
+    PubSub() = default ;
+    PubSub(const PubSub&) = delete ;
+    PubSub& operator=(const PubSub&) = delete ;
+
+    // 已经订阅过返回 false
+    bool Subscribe(const std::string &topic , const Subscriber &subscriber) {
+        Shard &shard = shardOf_(topic) ;
+        std::unique_lock<std::shared_timed_mutex> locker(shard.mtx) ;
+        Snapshot &current = shard.topics[topic] ;
+        if(current != nullptr && std::find(current->begin() , current->end() , subscriber) != current->end()) return false ;
+        std::shared_ptr<Subscribers> next = current == nullptr ? std::make_shared<Subscribers>() : std::make_shared<Subscribers>(*current) ;
+        next->push_back(subscriber) ;
+        current = std::move(next) ;
+        return true ;
+    }
+
+    // 没有订阅过返回 false ；和最后一个交换之后删除，订阅者的顺序不保证
+    bool Unsubscribe(const std::string &topic , const Subscriber &subscriber) {
+        Shard &shard = shardOf_(topic) ;
+        std::unique_lock<std::shared_timed_mutex> locker(shard.mtx) ;
+        auto iter = shard.topics.find(topic) ;
+        if(iter == shard.topics.end()) return false ;
+        const Subscribers &current = *iter->second ;
+        auto pos = std::find(current.begin() , current.end() , subscriber) ;
+        if(pos == current.end()) return false ;
+        if(current.size() == 1) {
+            shard.topics.erase(iter) ;
+            return true ;
+        }
+        std::shared_ptr<Subscribers> next = std::make_shared<Subscribers>(current) ;
+        (*next)[pos - current.begin()] = next->back() ;
+        next->pop_back() ;
+        iter->second = std::move(next) ;
+        return true ;
+    }
+
+    // 主题当前的订阅者快照，没有订阅者时返回 nullptr
+    Snapshot GetSubscribers(const std::string &topic) const {
+        const Shard &shard = shardOf_(topic) ;
+        std::shared_lock<std::shared_timed_mutex> locker(shard.mtx) ;
+        auto iter = shard.topics.find(topic) ;
+        return iter == shard.topics.end() ? nullptr : iter->second ;
+    }
+
+    // 把消息交给主题的每个订阅者，锁只在取快照时持有；返回订阅者个数
+    size_t Publish(const std::string &topic , const std::function<void(const Subscriber&)> &deliver) const {
+        Snapshot subscribers = GetSubscribers(topic) ;
+        if(subscribers == nullptr) return 0 ;
+        for(const Subscriber &subscriber : *subscribers) deliver(subscriber) ;
+        return subscribers->size() ;
+    }
+
+    // 遍历所有主题的订阅者快照，每个分片只在复制快照时加锁
+    void ForEachTopic(const std::function<void(const std::string& , const Subscribers&)> &visit) const {
+        std::vector<std::pair<std::string , Snapshot>> topics ;
+        for(const Shard &shard : shards_) {
+            topics.clear() ;
+            {
+                std::shared_lock<std::shared_timed_mutex> locker(shard.mtx) ;
+                topics.assign(shard.topics.begin() , shard.topics.end()) ;
+            }
+            for(const auto &topic : topics) visit(topic.first , *topic.second) ;
+        }
+    }
+
+    size_t TopicCount() const {
+        size_t count = 0 ;
+        for(const Shard &shard : shards_) {
+            std::shared_lock<std::shared_timed_mutex> locker(shard.mtx) ;
+            count += shard.topics.size() ;
+        }
+        return count ;
+    }
+
+private :
+    static constexpr size_t SHARD_COUNT = 16 ;
+    struct Shard {
+        mutable std::shared_timed_mutex mtx ;
+        std::unordered_map<std::string , Snapshot> topics ;
+    };
+    Shard shards_[SHARD_COUNT] ;
+
+    Shard& shardOf_(const std::string &topic) {
+        return shards_[std::hash<std::string>()(topic) % SHARD_COUNT] ;
+    }
+
+    const Shard& shardOf_(const std::string &topic) const {
+        return shards_[std::hash<std::string>()(topic) % SHARD_COUNT] ;
+    }
+} ;
+
+#endif
@@ -0,0 +1,177 @@
+#include "pubSub.h"
+#include "presence.h"
+#include <set>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <map>
+#include <assert.h>
+using namespace std ;
+
+// 测试订阅、退订、重复订阅、遍历主题以及最后一个订阅者退订之后删除主题
+void test_subscribe(){
+    PubSub<int> topics ;
+    assert(topics.Subscribe("room1" , 1) && topics.Subscribe("room1" , 2) && topics.Subscribe("room1" , 3)) ;
+    assert(topics.Subscribe("room1" , 2) == false) ;
+    assert(topics.Subscribe("room2" , 1)) ;
+    assert(topics.TopicCount() == 2 && topics.GetSubscribers("room1")->size() == 3) ;
+
+    // 发布只访问这个主题的订阅者
+    vector<int> delivered ;
+    assert(topics.Publish("room2" , [&](const int &subscriber) { delivered.push_back(subscriber) ; }) == 1) ;
+    assert(delivered == vector<int>{ 1 }) ;
+    assert(topics.Publish("none" , [&](const int &subscriber) { delivered.push_back(subscriber) ; }) == 0) ;
+
+    // 退订之后旧的快照不变
+    auto snapshot = topics.GetSubscribers("room1") ;
+    assert(topics.Unsubscribe("room1" , 1) && topics.Unsubscribe("room1" , 1) == false) ;
+    assert(snapshot->size() == 3 && topics.GetSubscribers("room1")->size() == 2) ;
+    auto rest = *topics.GetSubscribers("room1") ;
+    sort(rest.begin() , rest.end()) ;
+    assert((rest == vector<int>{ 2 , 3 })) ;
+
+    // 遍历所有主题
+    map<string , size_t> sizes ;
+    topics.ForEachTopic([&](const string &topic , const PubSub<int>::Subscribers &subscribers) { sizes[topic] = subscribers.size() ; }) ;
+    assert((sizes == map<string , size_t>{ { "room1" , 2 } , { "room2" , 1 } })) ;
+
+    assert(topics.Unsubscribe("room2" , 1) && topics.GetSubscribers("room2") == nullptr) ;
+    assert(topics.Unsubscribe("room2" , 1) == false && topics.TopicCount() == 1) ;
+    cout<<"test_subscribe pass"<<endl ;
+}
+
+// 测试 shared_ptr 订阅者：退订之后只要还有快照，订阅者就不会被释放，快照释放之后才析构
+void test_subscriber_lifetime(){
+    PubSub<shared_ptr<string>> topics ;
+    auto subscriber = make_shared<string>("alice") ;
+    weak_ptr<string> weak = subscriber ;
+    assert(topics.Subscribe("room" , subscriber)) ;
+    auto snapshot = topics.GetSubscribers("room") ;
+    assert(topics.Unsubscribe("room" , subscriber)) ;
+    subscriber.reset() ; // 连接关闭，ClientConn 释放自己的引用
+    assert(weak.expired() == false && *snapshot->front() == "alice") ;
+    snapshot.reset() ;
+    assert(weak.expired()) ;
+    cout<<"test_subscriber_lifetime pass"<<endl ;
+}
+
+// 测试多个线程同时订阅、退订和发布：发布看到的都是完整的快照，结束之后主题全部删除
+void test_concurrent(){
+    PubSub<int> topics ;
+    const int THREADS = 8 , ROOMS = 100 ;
+    atomic<bool> stop(false) ;
+    atomic<size_t> published(0) ;
+    thread publisher([&] {
+        while(!stop) {
+            for(int room = 0 ; room < ROOMS ; ++room) {
+                topics.Publish("room" + to_string(room) , [&](const int &subscriber) {
+                    assert(subscriber >= 0 && subscriber < THREADS) ;
+                    ++published ;
+                }) ;
+            }
+        }
+    }) ;
+    vector<thread> workers ;
+    for(int id = 0 ; id < THREADS ; ++id) {
+        workers.emplace_back([&topics , id] {
+            for(int round = 0 ; round < 20 ; ++round) {
+                for(int room = 0 ; room < ROOMS ; ++room) assert(topics.Subscribe("room" + to_string(room) , id)) ;
+                for(int room = 0 ; room < ROOMS ; ++room) assert(topics.Unsubscribe("room" + to_string(room) , id)) ;
+            }
+        }) ;
+    }
+    for(thread &worker : workers) worker.join() ;
+    stop = true ;
+    publisher.join() ;
+    assert(topics.TopicCount() == 0) ;
+    cout<<"test_concurrent pass"<<endl ;
+}
+
+// 测试在线列表：多端登录按引用计数，快照只给新连接，窗口内的变化合并成一条增量，上线又下线的不通知
+void test_presence(){
+    Presence presence ;
+    vector<Presence::Delta> deltas ;
+    assert(presence.init(1000 , [&](const Presence::Delta &delta) { deltas.push_back(delta) ; })) ;
+    assert(presence.GetTimerFd() != -1) ;
+    uint64_t version = 99 ;
+    set<string> roster ;
+    auto snapshot = [&](uint64_t v , const vector<string> &names) { version = v ; roster = set<string>(names.begin() , names.end()) ; } ;
+
+    assert(presence.Join("alice" , snapshot) && presence.Join("bob" , snapshot)) ;
+    assert(version == 0 && (roster == set<string>{ "alice" , "bob" })) ;
+    assert(presence.Join("bob" , snapshot) == false) ;          // 第二个连接
+    assert(presence.OnlineCount() == 2 && deltas.empty()) ;     // 窗口没有到期
+    presence.dealTimer() ;
+    assert(deltas.size() == 1 && deltas[0].base == 0 && deltas[0].version == 1) ;
+    assert((set<string>(deltas[0].join.begin() , deltas[0].join.end()) == set<string>{ "alice" , "bob" }) && deltas[0].leave.empty()) ;
+
+    // 只有最后一个连接下线才通知；窗口内上线又下线的 carol 和下线又上线的 alice 都不通知
+    assert(presence.Leave("bob") == false && presence.Leave("bob")) ;
+    assert(presence.Leave("nobody") == false) ;
+    assert(presence.Join("carol" , snapshot) && presence.Leave("carol")) ;
+    assert(presence.Leave("alice") && presence.Join("alice" , snapshot)) ;
+    assert(version == 1 && (roster == set<string>{ "alice" })) ;
+    presence.dealTimer() ;
+    assert(deltas.size() == 2 && deltas[1].base == 1 && deltas[1].version == 2) ;
+    assert(deltas[1].join.empty() && (deltas[1].leave == vector<string>{ "bob" })) ;
+    presence.dealTimer() ;                                      // 没有变化时不发送
+    assert(deltas.size() == 2 && presence.Version() == 2) ;
+
+    // 没有窗口时每次变化立即发送
+    Presence immediate ;
+    deltas.clear() ;
+    assert(immediate.init(0 , [&](const Presence::Delta &delta) { deltas.push_back(delta) ; })) ;
+    assert(immediate.GetTimerFd() == -1) ;
+    immediate.Join("alice" , snapshot) ;
+    immediate.Leave("alice") ;
+    assert(deltas.size() == 2 && (deltas[0].join == vector<string>{ "alice" }) && (deltas[1].leave == vector<string>{ "alice" })) ;
+    assert(deltas[1].base == 1 && deltas[1].version == 2) ;
+    cout<<"test_presence pass"<<endl ;
+}
+
+// 测试快照和增量的顺序：按收到的顺序应用（忽略旧版本，base 连续），最后的在线列表和服务端一致
+void test_presence_order(){
+    Presence presence ;
+    mutex mtx ;
+    uint64_t version = 0 ;
+    bool has_Roster = false , gap = false ;
+    set<string> roster ;
+    presence.init(0 , [&](const Presence::Delta &delta) {
+        lock_guard<mutex> locker(mtx) ;
+        if(!has_Roster || delta.version <= version) return ;
+        if(delta.base != version) { gap = true ; return ; }
+        version = delta.version ;
+        for(const string &name : delta.join) roster.insert(name) ;
+        for(const string &name : delta.leave) roster.erase(name) ;
+    }) ;
+    presence.Join("watcher" , [&](uint64_t v , const vector<string> &names) {
+        lock_guard<mutex> locker(mtx) ;
+        has_Roster = true ;
+        version = v ;
+        roster = set<string>(names.begin() , names.end()) ;
+    }) ;
+    vector<thread> workers ;
+    for(int id = 0 ; id < 8 ; ++id) {
+        workers.emplace_back([&presence , id] {
+            for(int round = 0 ; round < 200 ; ++round) {
+                string name = "user" + to_string((id * 7 + round) % 20) ;
+                presence.Join(name , [](uint64_t , const vector<string>&) {}) ;
+                if(round % 3 != 0) presence.Leave(name) ;
+            }
+        }) ;
+    }
+    for(thread &worker : workers) worker.join() ;
+    vector<string> names ;
+    presence.Snapshot([&](uint64_t v , const vector<string> &current) { assert(v == version) ; names = current ; }) ;
+    assert(gap == false && roster == set<string>(names.begin() , names.end())) ;
+    cout<<"test_presence_order pass"<<endl ;
+}
+
+int main(){
+    test_subscribe() ;
+    test_subscriber_lifetime() ;
+    test_concurrent() ;
+    test_presence() ;
+    test_presence_order() ;
+    return 0 ;
+}
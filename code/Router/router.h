@@ -0,0 +1,168 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <assert.h>
+#include "../Log/log.h"
+
+// 路由匹配到的路径参数，如 /user/:name 匹配 /user/tom 得到 name = tom
+// 参数保存的是请求路径上的 string_view ，查找过程不分配内存
+struct RouteParams {
+    static constexpr size_t MAX_PARAMS = 8 ; 
+    std::pair<std::string_view , std::string_view> params[MAX_PARAMS] ; 
+    size_t size = 0 ; 
+
+    std::string_view get(std::string_view name) const {
+        for(size_t i = 0 ; i < size ; ++i) {
+            if(params[i].first == name) return params[i].second ; 
+        }
+        return std::string_view() ; 
+    }
+};
+
+// 基于基数树（Radix Tree）的路由表
+// 1. 启动时注册 method + path 对应的处理函数，注册完成之后只读，多线程查找不用加锁
+// 2. 查找复杂度 O(path 长度)，静态路径优先于参数路径 :name ，参数只匹配一个路径段
+// 3. HEAD 请求没有单独注册时使用 GET 的处理函数
+template<typename Handler>
+class Router {
+public :
+    enum METHOD {
+        GET , HEAD , POST , PUT , DELETE , OPTIONS , PATCH , METHOD_NUM , UNKNOWN = -1 
+    };
+
+    static int methodIndex(std::string_view method) {
+        static const std::string_view METHODS[METHOD_NUM] = {
+            "GET" , "HEAD" , "POST" , "PUT" , "DELETE" , "OPTIONS" , "PATCH" 
+        };
+        for(int i = 0 ; i < METHOD_NUM ; ++i) {
+            if(METHODS[i] == method) return i ; 
+        }
+        return UNKNOWN ; 
+    }
+
+    Router() : root_(std::make_unique<Node>()) {} 
+
+    // 注册路由，pattern 必须以 / 开头，参数段写作 :name
+    bool add(std::string_view method , std::string_view pattern , Handler handler) {
+        int idx = methodIndex(method) ; 
+        if(idx == UNKNOWN || pattern.empty() || pattern[0] != '/') {
+            LOG_ERROR("router add %s %s error" , std::string(method).data() , std::string(pattern).data()) ; 
+            return false ; 
+        }
+        Node* node = root_.get() ; 
+        while(!pattern.empty()) {
+            if(pattern[0] == ':') { // 参数结点
+                size_t end = std::min(pattern.find('/') , pattern.size()) ; 
+                std::string_view name = pattern.substr(1 , end - 1) ; 
+                if(node->param == nullptr) {
+                    node->param = std::make_unique<Node>() ; 
+                    node->param->paramName = std::string(name) ; 
+                }else if(node->param->paramName != name) {
+                    LOG_ERROR("router param :%s conflict with :%s" , std::string(name).data() , node->param->paramName.data()) ; 
+                    return false ; 
+                }
+                node = node->param.get() ; 
+                pattern = pattern.substr(end) ; 
+                continue ; 
+            }
+            // 静态片段一直到下一个参数之前
+            std::string_view segment = pattern.substr(0 , std::min(pattern.find(':') , pattern.size())) ; 
+            Node* child = node->findChild(segment[0]) ; 
+            if(child == nullptr) {
+                node->children.push_back(std::make_unique<Node>()) ; 
+                child = node->children.back().get() ; 
+                child->path = std::string(segment) ; 
+            }else {
+                size_t common = 0 ; 
+                while(common < child->path.size() && common < segment.size() && child->path[common] == segment[common]) ++common ; 
+                if(common < child->path.size()) { // 公共前缀比子结点短，分裂子结点
+                    child = node->splitChild(child , common) ; 
+                }
+                segment = segment.substr(0 , common) ; 
+            }
+            node = child ; 
+            pattern = pattern.substr(segment.size()) ; 
+        }
+        if(node->handlers[idx]) {
+            LOG_WARN("router %s handler override" , std::string(method).data()) ; 
+        }
+        node->handlers[idx] = std::move(handler) ; 
+        return true ; 
+    }
+
+    // 查找路由，找不到返回 nullptr
+    const Handler* find(std::string_view method , std::string_view path , RouteParams &params) const {
+        int idx = methodIndex(method) ; 
+        if(idx == UNKNOWN) return nullptr ; 
+        params.size = 0 ; 
+        const Handler* handler = match_(root_.get() , path , idx , params) ; 
+        if(handler == nullptr && idx == HEAD) {
+            params.size = 0 ; 
+            handler = match_(root_.get() , path , GET , params) ; 
+        }
+        return handler ; 
+    }
+
+private : 
+    struct Node {
+        std::string path ;                              // 该结点对应的静态路径片段
+        std::string paramName ;                         // 参数结点的参数名
+        std::vector<std::unique_ptr<Node>> children ;   // 静态子结点，首字符各不相同
+        std::unique_ptr<Node> param ;                   // 参数子结点
+        Handler handlers[METHOD_NUM] ; 
+
+        Node* findChild(const char ch) const {
+            for(const auto &child : children) {
+                if(child->path[0] == ch) return child.get() ; 
+            }
+            return nullptr ; 
+        }
+
+        // 把子结点 child 从 pos 处一分为二，返回前半部分的新结点
+        Node* splitChild(Node* child , const size_t pos) {
+            for(auto &ptr : children) {
+                if(ptr.get() != child) continue ; 
+                std::unique_ptr<Node> prefix = std::make_unique<Node>() ; 
+                prefix->path = child->path.substr(0 , pos) ; 
+                child->path = child->path.substr(pos) ; 
+                prefix->children.push_back(std::move(ptr)) ; 
+                ptr = std::move(prefix) ; 
+                return ptr.get() ; 
+            }
+            assert(false) ; 
+            return nullptr ; 
+        }
+    };
+
+    const Handler* match_(const Node* node , std::string_view path , const int idx , RouteParams &params) const {
+        if(path.empty()) {
+            return node->handlers[idx] ? &node->handlers[idx] : nullptr ; 
+        }
+        // 静态子结点优先
+        const Node* child = node->findChild(path[0]) ; 
+        if(child != nullptr && path.compare(0 , child->path.size() , child->path) == 0) {
+            const Handler* handler = match_(child , path.substr(child->path.size()) , idx , params) ; 
+            if(handler != nullptr) return handler ; 
+        }
+        // 再尝试参数子结点，匹配失败要回溯
+        if(node->param != nullptr && params.size < RouteParams::MAX_PARAMS) {
+            size_t end = std::min(path.find('/') , path.size()) ; 
+            if(end == 0) return nullptr ; 
+            size_t size = params.size ; 
+            params.params[params.size++] = { node->param->paramName , path.substr(0 , end) } ; 
+            const Handler* handler = match_(node->param.get() , path.substr(end) , idx , params) ; 
+            if(handler != nullptr) return handler ; 
+            params.size = size ; 
+        }
+        return nullptr ; 
+    }
+
+    std::unique_ptr<Node> root_ ; 
+} ; 
+
+#endif
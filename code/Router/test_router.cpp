@@ -0,0 +1,56 @@
+#include "router.h"
+#include <iostream>
+#include <assert.h>
+using namespace std ; 
+
+typedef std::function<int(const RouteParams&)> Handler ; 
+
+// 测试静态路径、前缀分裂以及 HEAD 回退到 GET
+void test_static(){
+    Router<Handler> router ; 
+    router.add("GET" , "/login" , [](const RouteParams&){ return 1 ; }) ; 
+    router.add("GET" , "/login.html" , [](const RouteParams&){ return 2 ; }) ; 
+    router.add("GET" , "/logout" , [](const RouteParams&){ return 3 ; }) ; 
+    router.add("POST" , "/login" , [](const RouteParams&){ return 4 ; }) ; 
+    router.add("GET" , "/" , [](const RouteParams&){ return 5 ; }) ; 
+
+    RouteParams params ; 
+    assert((*router.find("GET" , "/login" , params))(params) == 1) ; 
+    assert((*router.find("GET" , "/login.html" , params))(params) == 2) ; 
+    assert((*router.find("GET" , "/logout" , params))(params) == 3) ; 
+    assert((*router.find("POST" , "/login" , params))(params) == 4) ; 
+    assert((*router.find("HEAD" , "/login" , params))(params) == 1) ; 
+    assert((*router.find("GET" , "/" , params))(params) == 5) ; 
+    assert(router.find("GET" , "/log" , params) == nullptr) ; 
+    assert(router.find("PUT" , "/login" , params) == nullptr) ; 
+    assert(router.find("GET" , "/index.html" , params) == nullptr) ; 
+    cout<<"test_static pass"<<endl ; 
+}
+
+// 测试路径参数，以及静态路径优先和匹配失败的回溯
+void test_param(){
+    Router<Handler> router ; 
+    router.add("GET" , "/api/user/:name" , [](const RouteParams&){ return 1 ; }) ; 
+    router.add("GET" , "/api/user/:name/room/:room" , [](const RouteParams&){ return 2 ; }) ; 
+    router.add("GET" , "/api/user/self" , [](const RouteParams&){ return 3 ; }) ; 
+
+    RouteParams params ; 
+    assert((*router.find("GET" , "/api/user/tom" , params))(params) == 1) ; 
+    assert(params.size == 1 && params.get("name") == "tom") ; 
+    assert((*router.find("GET" , "/api/user/tom/room/42" , params))(params) == 2) ; 
+    assert(params.get("name") == "tom" && params.get("room") == "42") ; 
+    assert((*router.find("GET" , "/api/user/self" , params))(params) == 3) ; 
+    assert(params.size == 0) ; 
+    // self 是静态结点，但是后面匹配不上，要回溯到参数结点
+    assert((*router.find("GET" , "/api/user/self/room/1" , params))(params) == 2) ; 
+    assert(params.get("name") == "self") ; 
+    assert(router.find("GET" , "/api/user/" , params) == nullptr) ; 
+    assert(router.find("GET" , "/api/user/tom/room" , params) == nullptr) ; 
+    cout<<"test_param pass"<<endl ; 
+}
+
+int main(){
+    test_static() ; 
+    test_param() ; 
+    return 0 ; 
+}
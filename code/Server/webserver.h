@@ -9,6 +9,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <signal.h>
 
 #include "epoller.h"
 #include "../Log/log.h"
@@ -17,7 +18,10 @@
 #include "../ThreadPool/threadPool.h" 
 #include "../Client/clientConn.h"
 #include "../Common/commonConfig.h"
-#include "../Common/rwlockmap.h"
+#include "../Tls/tlsContext.h"
+#include "../Cache/fileWatcher.h"
+#include "../Cache/warmup.h"
+#include "../Pack/resourcePack.h"
 
 class WebServer {
 private : 
@@ -30,10 +34,14 @@ private :
     std::mutex mtx ; 
     ConfigInfo config_ ; 
     std::unique_ptr<HeapTimer> timer_;
+    std::unique_ptr<HeapTimer> heartbeat_;          // WebSocket 心跳检查，升级之后的连接一个结点，只在主线程访问
     std::unique_ptr<ThreadPool> threadpool_;
     std::unique_ptr<Epoller> epoller_;
-    std::unordered_map<int, std::unique_ptr<ClientConn>> users_; 
-    RWLockMap<std::string , WebSocket*> userName ; // 主要用于 ChatRoom 聊天室，存储用户名对应的文件描述符，为什么不用上面的 users_ 原因是有些只是 http 连接而已。并且这个 map 要符合线程安全读多写少，故采用读写锁封装保证线程安全
+    std::unique_ptr<FileWatcher> watcher_;          // 监听静态资源目录，让文件缓存失效，在主线程处理
+    PubSub<std::shared_ptr<WebSocket>> topics_ ;    // 聊天室的房间和订阅者，在 users_ 之后析构，连接关闭时还要退订
+    PubSub<std::shared_ptr<WebSocket>> userName ;   // 主要用于 ChatRoom 聊天室，用户名对应该用户所有的 WebSocket 连接（多端登录）；有些只是 http 连接，所以不用 users_ 。读多写少，快照读不加锁
+    Presence presence_ ;                            // 带版本号的在线列表，上线、下线按窗口合并成增量群发
+    std::unordered_map<int, std::shared_ptr<ClientConn>> users_; // 线程池里的读写任务也持有，fd 被新连接复用时旧连接等任务结束之后才析构
 
 public:
     WebServer() : isClose_(false){
@@ -52,10 +60,24 @@ public:
                     LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", config_.default_thread_size_, config_.default_thread_size_);
                 }
             }
+            HttpConfigInfo::Instance() ; // 启动时就构建好所有连接共享的只读配置
+            ErrorPages::Instance() ;     // 启动时生成错误页面，错误响应不再读文件
+            // 对端关闭后再写（包括 SSL_shutdown 发送 close_notify）会触发 SIGPIPE ，默认处理是终止进程
+            signal(SIGPIPE , SIG_IGN) ; 
+            if(config_.openTls && !TlsContext::Instance().init(config_.tlsCertFile , config_.tlsKeyFile , config_.tlsSessionTimeout)) {
+                isClose_ = true ; 
+                LOG_ERROR("server init tls fail") ;
+            }
             timer_ = std::make_unique<HeapTimer>() ;
+            heartbeat_ = std::make_unique<HeapTimer>() ;
             threadpool_ = std::make_unique<ThreadPool>();
             epoller_ = std::make_unique<Epoller>() ; 
             this->userCount = 0 ; 
+            InitFileWatcher_() ; 
+            InitPresence_() ; 
+            InitResourcePack_() ; 
+            // 预热完成之后才监听端口，负载均衡的健康检查通过时静态资源已经在内存和 page cache 中
+            if(HttpConfigInfo::Instance().openWarmup) Warmup::Run(HttpConfigInfo::Instance().srcDir) ; 
             if(!InitSocket_()) { 
                 close(listenFd_) ;
                 isClose_ = true; 
@@ -73,9 +95,14 @@ public:
         if(isClose_ == false) { LOG_INFO("========== Server start =========="); }
         while(isClose_ == false){
             // 定时器，等待 timeMS 时间后，必有一个连接事件到期，如果期间它没有重新发生交互的话。
+            timeS = -1 ; 
             if(config_.timeoutS > 0) {
                 timeS = timer_->GetNextTick(); // 发生一次心跳   
             }
+            if(HttpConfigInfo::Instance().wsPingIntervalS > 0) { // 和 WebSocket 心跳检查取较早的一个
+                int heartbeatS = heartbeat_->GetNextTick() ; 
+                if(heartbeatS != -1 && (timeS == -1 || heartbeatS < timeS)) timeS = heartbeatS ; 
+            }
             int eventCnt = epoller_->Wait(timeS) ;
             for(int i = 0 ; i < eventCnt ; ++i){
                 if(isClose_) break ; 
@@ -84,12 +111,18 @@ public:
                 uint32_t events = epoller_->GetEvents(i);
                 if(fd == listenFd_) {
                     DealListen_();
+                }else if(watcher_ != nullptr && fd == watcher_->GetFd()) {
+                    watcher_->dealEvent() ;  // 静态文件发生变化
+                }else if(watcher_ != nullptr && fd == watcher_->GetTimerFd()) {
+                    watcher_->dealTimer() ;  // 文件变化停止了，重新加载缓存
+                }else if(fd == presence_.GetTimerFd()) {
+                    presence_.dealTimer() ;  // 上线、下线的合并窗口到期，群发增量
                 }else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) { 
                     CloseConn_(users_[fd].get());  // 断开连接 
                 }else if(events & EPOLLIN) { 
-                    DealRead_(users_[fd].get());   // 处理读请求
+                    DealRead_(users_[fd]);   // 处理读请求
                 }else if(events & EPOLLOUT) { 
-                    DealWrite_(users_[fd].get());  // 处理写请求
+                    DealWrite_(users_[fd]);  // 处理写请求
                 } else {
                     LOG_ERROR("Unexpected event");
                 }
@@ -161,6 +194,59 @@ private:
         return true;
     }
 
+    // 监听失败时文件缓存保持停用，每个请求直接 stat
+    void InitFileWatcher_() {
+        const HttpConfigInfo& httpConfig = HttpConfigInfo::Instance() ; 
+        if(httpConfig.openFileCache == false) return ; 
+        watcher_ = std::make_unique<FileWatcher>() ; 
+        if(!watcher_->init(httpConfig.srcDir , httpConfig.fileCacheDebounceMs) || 
+           !epoller_->AddFd(watcher_->GetFd() , EPOLLIN) || !epoller_->AddFd(watcher_->GetTimerFd() , EPOLLIN)) {
+            LOG_WARN("file watcher init fail , file cache disabled") ;
+            watcher_ = nullptr ; 
+            return ; 
+        }
+        // 重新加载缓存条目要读文件，放到线程池里做，主线程只负责删除失效的条目
+        watcher_->setExecutor([this](std::function<void()> task) { threadpool_->commitTask(std::move(task)) ; }) ; 
+    }
+
+    // 在线列表的增量 {"isSystem":true,"type":"presence","base","version","join":[],"leave":[]} 编码（压缩）一次，所有在线用户共享
+    void InitPresence_() {
+        Presence::Broadcast broadcast = [this](const Presence::Delta &delta) {
+            picojson::object message_json ; 
+            message_json["isSystem"] = picojson::value(true) ; 
+            message_json["type"] = picojson::value(std::string("presence")) ; 
+            message_json["base"] = picojson::value(static_cast<double>(delta.base)) ; 
+            message_json["version"] = picojson::value(static_cast<double>(delta.version)) ; 
+            message_json["join"] = picojson::value(std::vector<picojson::value>(delta.join.begin() , delta.join.end())) ; 
+            message_json["leave"] = picojson::value(std::vector<picojson::value>(delta.leave.begin() , delta.leave.end())) ; 
+            WebSocket::Message notice ; 
+            notice.frame = WebSocket::MakeFrame(picojson::value(message_json).serialize()) ; 
+            LOG_INFO("presence version %llu , %zu join , %zu leave" , static_cast<unsigned long long>(delta.version) , delta.join.size() , delta.leave.size()) ;
+            auto wakeup = [this](int fd) { epoller_->ModFd(fd , connEvent_ | EPOLLOUT) ; } ; 
+            userName.ForEachTopic([&](const std::string & , const PubSub<std::shared_ptr<WebSocket>>::Subscribers &sockets) {
+                for(const std::shared_ptr<WebSocket> &socket : sockets) socket->Deliver(notice , wakeup) ; 
+            }) ; 
+        } ; 
+        presence_.init(HttpConfigInfo::Instance().wsPresenceWindowMs , broadcast) ; 
+        if(presence_.GetTimerFd() != -1 && !epoller_->AddFd(presence_.GetTimerFd() , EPOLLIN)) {
+            LOG_ERROR("presence timer add error , send updates immediately") ;
+            presence_.init(0 , broadcast) ; 
+        }
+    }
+
+    // 加载资源包，包文件被替换（rename 或者覆盖）之后重新加载；新包有问题时继续使用旧包
+    void InitResourcePack_() {
+        const HttpConfigInfo& httpConfig = HttpConfigInfo::Instance() ; 
+        if(httpConfig.packFile[0] == '\0') return ; 
+        std::string packFile = httpConfig.packFile ; 
+        if(ResourcePack::Load(packFile) == false) {
+            LOG_WARN("resource pack %s load fail , serve files from %s" , packFile.data() , httpConfig.srcDir) ;
+        }
+        if(watcher_ == nullptr || !watcher_->watchFile(packFile , [packFile]() { ResourcePack::Load(packFile) ; })) {
+            LOG_WARN("resource pack %s is not watched , restart to reload" , packFile.data()) ;
+        }
+    }
+
     void InitEventMode_(int trigMode) {
         // EPOLLRDHUP作用： 当使用边沿触发（EPOLLET）时，EPOLLRDHUP将会在连接断开时触发一次EPOLLIN事件， 此时epoll_wait()函数将返回一个EPOLLIN事件，并且read()操作将返回一个零字节的值。
         // EPOLLONESHOT 作用： 使用EPOLLONESHOT事件类型可以避免并发问题，确保一个文件描述符在任何时候都只会被一个线程处理，防止多个线程同时对一个文件描述符进行操作。
@@ -211,7 +297,7 @@ private:
             } 
             if(fd > 0){
                 // 添加客户端的 fd   
-                users_[fd] = std::make_unique<ClientConn>(fd , addr , epoller_.get() , userName , connEvent_) ;
+                users_[fd] = std::make_shared<ClientConn>(fd , addr , epoller_.get() , userName , topics_ , presence_ , connEvent_) ;
                 LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd, inet_ntoa(addr.sin_addr) , ntohs(addr.sin_port) , ++userCount);
                 if(config_.timeoutS > 0) {// 小根堆，处理超时连接，绑定关闭的回调函数
                     timer_->add(fd, config_.timeoutS , std::bind(&WebServer::CloseConn_, this , users_[fd].get())); 
@@ -231,6 +317,24 @@ private:
         close(fd) ; 
     }
 
+    // 连接升级成 WebSocket 之后才加入心跳检查：握手的应答注册了写事件，主线程分发读写事件时发现已经升级就添加结点
+    void AddHeartbeat_(const std::shared_ptr<ClientConn> &client) {
+        const int intervalS = HttpConfigInfo::Instance().wsPingIntervalS ; 
+        if(intervalS <= 0 || client->NeedHeartbeat() == false) return ; 
+        heartbeat_->add(client->GetFd() , intervalS , std::bind(&WebServer::Heartbeat_ , this , std::weak_ptr<ClientConn>(client))) ; 
+    }
+
+    // 心跳检查到期，按连接的状态安排下一次检查；结点只持有弱引用，连接关闭、fd 被复用之后旧结点到期时不再检查
+    // 同一个 fd 的新连接升级之后覆盖这个结点
+    void Heartbeat_(const std::weak_ptr<ClientConn> &weak) {
+        std::shared_ptr<ClientConn> client = weak.lock() ; 
+        if(client == nullptr) return ; 
+        const HttpConfigInfo &config = HttpConfigInfo::Instance() ; 
+        int next = client->Heartbeat(config.wsPingIntervalS , config.wsPongTimeoutS) ; 
+        if(next > 0) heartbeat_->add(client->GetFd() , next , std::bind(&WebServer::Heartbeat_ , this , weak)) ; 
+    }
+
+    // 主线程（断开、超时）和工作线程都会调用；连接正在处理读写任务时不等待，由任务结束之后关闭，只在真正关闭时计数
     void CloseConn_(ClientConn* client){
         assert(client); 
         if(client->Close()){
@@ -238,14 +342,16 @@ private:
         } 
     }
 
-    void DealWrite_(ClientConn* client) {
+    void DealWrite_(const std::shared_ptr<ClientConn> &client) {
         assert(client); 
+        AddHeartbeat_(client) ; 
         // 线程池处理写任务
         threadpool_->commitTask(std::bind(&WebServer::OnWrite_, this, client));
     }
     
-    void DealRead_(ClientConn* client){
+    void DealRead_(const std::shared_ptr<ClientConn> &client){
         assert(client); 
+        AddHeartbeat_(client) ; 
         // 线程池处理读任务
         if(config_.timeoutS > 0){ // 先更新小根堆叭，避免极端情况线程异步处理的时候，主线程把 fd close 了
             timer_->adjust(client->GetFd() , Clock::now() + std::chrono::seconds(config_.timeoutS)) ; 
@@ -254,20 +360,14 @@ private:
     }
 
     // 读取客户端发送过来的消息
-    void OnRead_(ClientConn* client) { 
+    void OnRead_(const std::shared_ptr<ClientConn> &client) { 
         STATUS_CODE ret = client->dealRequest();
-        if(ret == CLOSE_CONNECTION) { 
-            LOG_INFO("Client[%d](%s:%d) out , userCount:%d", client->GetFd() , client->GetIP(), client->GetPort(), --userCount) ;
-            client->Close(); 
-        }
+        if(ret == CLOSE_CONNECTION) CloseConn_(client.get()) ; // 关闭失败时另一个任务持有 taskMtx_ ，由它结束之后关闭
     }
 
-    void OnWrite_(ClientConn* client) { 
+    void OnWrite_(const std::shared_ptr<ClientConn> &client) { 
         STATUS_CODE ret = client->dealResponse() ;
-        if(ret == CLOSE_CONNECTION) { 
-            LOG_INFO("Client[%d](%s:%d) out , userCount:%d", client->GetFd() , client->GetIP(), client->GetPort(), --userCount) ;
-            client->Close();   
-        }
+        if(ret == CLOSE_CONNECTION) CloseConn_(client.get()) ; 
     }
 };
 
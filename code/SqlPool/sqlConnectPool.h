@@ -168,6 +168,7 @@ public :
         }else {
             condition_close_.notify_all() ; 
         }
+        return true ; 
     }
     bool queueEmpty(std::queue<std::pair<MYSQL* , int>> &que){
         std::lock_guard<std::mutex> locker(mtx_) ; 
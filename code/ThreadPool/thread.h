@@ -110,6 +110,7 @@ public:
             processTask() ; // 尝试获得任务执行
         }
         LOG_INFO("%d thread achieve %d tasks" , std::this_thread::get_id()  , total_task_num_) ; 
+        return true ; 
     }
 
     // 检查辅助线程是否在使用中
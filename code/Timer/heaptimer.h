@@ -89,11 +89,12 @@ public:
         if(heap_.empty()) return;
         while(!heap_.empty()) {
             TimerNode& node = heap_.front();
-            if(std::chrono::duration_cast<S>(node.expires - Clock::now()).count() > 0) { 
+            if(node.expires > Clock::now()) { // 还没有到期；按秒截断会提前触发，回调中重新添加的结点会在这里空转
                 break; 
             }
-            node.cb(); // 已经超时了，调用回调函数
-            popFront();
+            TimeoutCallBack cb = std::move(node.cb) ; 
+            popFront(); // 先删除再回调，回调中可以重新添加同一个 fd 
+            cb(); // 已经超时了，调用回调函数
         }
     }
 
@@ -101,7 +102,8 @@ public:
         tick();
         int res = -1;
         if(!heap_.empty()) {
-            res = std::chrono::duration_cast<S>(heap_.front().expires - Clock::now()).count();
+            // 向上取整到秒，醒来时堆顶一定已经到期
+            res = std::chrono::ceil<S>(heap_.front().expires - Clock::now()).count();
             if(res < 0) { res = 0; }
         }
         return res;
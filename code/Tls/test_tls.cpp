@@ -0,0 +1,213 @@
+#include "tlsContext.h"
+#include "transport.h"
+#include <iostream>
+#include <thread>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <openssl/x509.h>
+#include <openssl/pem.h>
+#include <openssl/ec.h>
+using namespace std ;
+
+static const string CERT_FILE = "/tmp/test_tls.crt" ;
+static const string KEY_FILE = "/tmp/test_tls.key" ;
+
+// 生成一次性的 P-256 私钥和自签名证书，测试不依赖外部的证书文件
+static void makeCertificate(){
+    EVP_PKEY* key = nullptr ;
+    EVP_PKEY_CTX* keyCtx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC , nullptr) ;
+    assert(keyCtx != nullptr && EVP_PKEY_keygen_init(keyCtx) == 1) ;
+    assert(EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keyCtx , NID_X9_62_prime256v1) == 1) ;
+    assert(EVP_PKEY_keygen(keyCtx , &key) == 1) ;
+    EVP_PKEY_CTX_free(keyCtx) ;
+
+    X509* cert = X509_new() ;
+    X509_set_version(cert , 2) ;
+    ASN1_INTEGER_set(X509_get_serialNumber(cert) , 1) ;
+    X509_gmtime_adj(X509_getm_notBefore(cert) , -60) ;
+    X509_gmtime_adj(X509_getm_notAfter(cert) , 24 * 3600) ;
+    X509_set_pubkey(cert , key) ;
+    X509_NAME* name = X509_get_subject_name(cert) ;
+    X509_NAME_add_entry_by_txt(name , "CN" , MBSTRING_ASC , reinterpret_cast<const unsigned char*>("localhost") , -1 , -1 , 0) ;
+    X509_set_issuer_name(cert , name) ;
+    assert(X509_sign(cert , key , EVP_sha256()) > 0) ;
+
+    FILE* file = fopen(CERT_FILE.data() , "w") ;
+    assert(file != nullptr && PEM_write_X509(file , cert) == 1) ;
+    fclose(file) ;
+    file = fopen(KEY_FILE.data() , "w") ;
+    assert(file != nullptr && PEM_write_PrivateKey(file , key , nullptr , nullptr , 0 , nullptr , nullptr) == 1) ;
+    fclose(file) ;
+    X509_free(cert) ;
+    EVP_PKEY_free(key) ;
+}
+
+// 明文模式：Read / Writev / Sendfile 直接作用在 fd 上
+void test_plain(){
+    int fds[2] ;
+    assert(socketpair(AF_UNIX , SOCK_STREAM , 0 , fds) == 0) ;
+    Transport server(fds[0] , nullptr) ;
+    assert(server.IsTls() == false && server.IsHandshakeDone()) ;
+
+    struct iovec iov[2] = { {(void*)"hello " , 6} , {(void*)"world" , 5} } ;
+    assert(server.Writev(iov , 2) == 11) ;
+    char out[32] = {0} ;
+    assert(read(fds[1] , out , sizeof(out)) == 11 && string(out) == "hello world") ;
+
+    FILE* file = tmpfile() ;
+    fputs("0123456789" , file) ; fflush(file) ;
+    off_t offset = 3 ;
+    assert(server.Sendfile(fileno(file) , &offset , 4) == 4 && offset == 7) ;
+    memset(out , 0 , sizeof(out)) ;
+    assert(read(fds[1] , out , sizeof(out)) == 4 && string(out) == "3456") ;
+    fclose(file) ;
+
+    Buffer buff ; int Errno = -1 ;
+    assert(write(fds[1] , "ping" , 4) == 4) ;
+    assert(server.Read(&buff , &Errno) == 4 && buff.RetrieveAllToStr() == "ping") ;
+    close(fds[0]) ; close(fds[1]) ;
+    cout<<"test_plain pass"<<endl ;
+}
+
+// TLS 模式：服务端非阻塞握手，客户端在另一个线程阻塞握手，然后双向收发，最后用 ticket 恢复会话
+void test_tls(){
+    SSL_CTX* clientCtx = SSL_CTX_new(TLS_client_method()) ;
+    static const unsigned char ALPN[] = "\x02h2" ;
+    SSL_CTX_set_alpn_protos(clientCtx , ALPN , sizeof(ALPN) - 1) ;
+    SSL_SESSION* session = nullptr ;
+
+    for(int round = 0 ; round < 2 ; ++round){
+        int fds[2] ;
+        assert(socketpair(AF_UNIX , SOCK_STREAM , 0 , fds) == 0) ;
+        fcntl(fds[0] , F_SETFL , fcntl(fds[0] , F_GETFL) | O_NONBLOCK) ;
+        Transport server(fds[0] , TlsContext::Instance().GetCtx()) ;
+        assert(server.IsTls() && server.IsHandshakeDone() == false) ;
+
+        bool reused = false ;
+        thread client([&](){
+            SSL* ssl = SSL_new(clientCtx) ;
+            SSL_set_fd(ssl , fds[1]) ;
+            if(session != nullptr) SSL_set_session(ssl , session) ;
+            assert(SSL_connect(ssl) == 1) ;
+            const unsigned char* proto = nullptr ; unsigned int protoLen = 0 ;
+            SSL_get0_alpn_selected(ssl , &proto , &protoLen) ;
+            assert(protoLen == 2 && memcmp(proto , "h2" , 2) == 0) ;
+            assert(SSL_write(ssl , "ping" , 4) == 4) ;
+            char out[16] = {0} ;
+            assert(SSL_read(ssl , out , sizeof(out)) == 11 && string(out) == "hello world") ;
+            reused = SSL_session_reused(ssl) ;
+            if(session == nullptr) session = SSL_get1_session(ssl) ; // TLS 1.3 的 ticket 在第一次 SSL_read 时收到
+            SSL_shutdown(ssl) ;
+            SSL_free(ssl) ;
+        }) ;
+
+        STATUS_CODE ret = CONTINUE_CODE ;
+        while((ret = server.Handshake()) == CONTINUE_CODE) usleep(1000) ;
+        assert(ret == GOOD_CODE && server.IsHandshakeDone()) ;
+        Buffer buff ; int Errno = -1 ; ssize_t len = -1 ;
+        while((len = server.Read(&buff , &Errno)) < 0 && Errno == EWOULDBLOCK) usleep(1000) ;
+        assert(len == 4 && buff.RetrieveAllToStr() == "ping") ;
+        struct iovec iov[2] = { {(void*)"hello " , 6} , {(void*)"world" , 5} } ;
+        assert(server.Writev(iov , 2) == 11) ; // 两个片段合并成一个 TLS 记录
+        client.join() ;
+        assert(reused == (round == 1)) ;
+        server.close() ;
+        close(fds[0]) ; close(fds[1]) ;
+    }
+    SSL_SESSION_free(session) ;
+    SSL_CTX_free(clientCtx) ;
+    cout<<"test_tls pass"<<endl ;
+}
+
+// 用户态加密下的非阻塞语义：WANT_READ / WANT_WRITE 转换成 EWOULDBLOCK ，sendfile 退回 pread + SSL_write
+void test_tls_io(){
+    SSL_CTX* clientCtx = SSL_CTX_new(TLS_client_method()) ;
+    int fds[2] ;
+    assert(socketpair(AF_UNIX , SOCK_STREAM , 0 , fds) == 0) ;
+    fcntl(fds[0] , F_SETFL , fcntl(fds[0] , F_GETFL) | O_NONBLOCK) ;
+    Transport server(fds[0] , TlsContext::Instance().GetCtx()) ;
+
+    // 客户端还没有发送 ClientHello ：握手等待可读
+    assert(server.Handshake() == CONTINUE_CODE && server.WantWrite() == false) ;
+    SSL* ssl = SSL_new(clientCtx) ;
+    SSL_set_fd(ssl , fds[1]) ;
+    thread client([&](){ assert(SSL_connect(ssl) == 1) ; }) ;
+    STATUS_CODE ret = CONTINUE_CODE ;
+    while((ret = server.Handshake()) == CONTINUE_CODE) usleep(1000) ;
+    client.join() ;
+    assert(ret == GOOD_CODE) ;
+
+    // 没有数据可读
+    Buffer buff ; int Errno = -1 ;
+    assert(server.Read(&buff , &Errno) == -1 && Errno == EWOULDBLOCK) ;
+
+    // Sendfile 分成多个 16K 的记录发送，offset 按实际发送的字节推进
+    string content ;
+    for(int i = 0 ; content.size() < 40000 ; ++i) content += to_string(i) + "," ;
+    FILE* file = tmpfile() ;
+    fwrite(content.data() , 1 , content.size() , file) ; fflush(file) ;
+    off_t offset = 10 ;
+    while(offset < static_cast<off_t>(content.size())) {
+        off_t before = offset ;
+        ssize_t len = server.Sendfile(fileno(file) , &offset , content.size() - offset) ;
+        assert(len > 0 && len <= 16384 && offset == before + len) ;
+    }
+    fclose(file) ;
+    string received ;
+    char out[16384] ;
+    while(received.size() < content.size() - 10) {
+        int len = SSL_read(ssl , out , sizeof(out)) ;
+        assert(len > 0) ;
+        received.append(out , len) ;
+    }
+    assert(received == content.substr(10)) ;
+
+    // 对端不读，socket 写满之后返回 EWOULDBLOCK ；对端开始读之后重试同一段内容，数据完整且有序
+    const size_t total = 4 * 1024 * 1024 ;
+    string data(total , 0) ;
+    for(size_t i = 0 ; i < total ; ++i) data[i] = static_cast<char>('a' + i % 26) ;
+    size_t sent = 0 ;
+    ssize_t len = 0 ;
+    while((len = server.Write(data.data() + sent , min<size_t>(total - sent , 16384))) > 0) sent += len ;
+    assert(len == -1 && errno == EWOULDBLOCK && sent < total) ;
+    received.clear() ;
+    thread reader([&](){
+        while(received.size() < total) {
+            int n = SSL_read(ssl , out , sizeof(out)) ;
+            assert(n > 0) ;
+            received.append(out , n) ;
+        }
+    }) ;
+    while(sent < total) {
+        len = server.Write(data.data() + sent , min<size_t>(total - sent , 16384)) ;
+        if(len > 0) sent += len ;
+        else {
+            assert(errno == EWOULDBLOCK) ;
+            usleep(100) ;
+        }
+    }
+    reader.join() ;
+    assert(received == data) ;
+
+    // 对端关闭连接：读到 close_notify 返回 0
+    SSL_shutdown(ssl) ;
+    while((len = server.Read(&buff , &Errno)) < 0 && Errno == EWOULDBLOCK) usleep(1000) ;
+    assert(len == 0) ;
+    SSL_free(ssl) ;
+    server.close() ;
+    close(fds[0]) ; close(fds[1]) ;
+    SSL_CTX_free(clientCtx) ;
+    cout<<"test_tls_io pass"<<endl ;
+}
+
+int main(){
+    test_plain() ;
+    makeCertificate() ;
+    assert(TlsContext::Instance().init(CERT_FILE.data() , KEY_FILE.data() , 300)) ;
+    test_tls() ;
+    test_tls_io() ;
+    remove(CERT_FILE.data()) ;
+    remove(KEY_FILE.data()) ;
+    return 0 ;
+}
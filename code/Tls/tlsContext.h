@@ -0,0 +1,86 @@
+#ifndef TLS_CONTEXT_H
+#define TLS_CONTEXT_H
+
+#include <string>
+#include <string.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "../Log/log.h"
+
+// 所有 TLS 连接共享一个 SSL_CTX ：证书、会话缓存和 session ticket 的密钥都在这里，
+// 同一个 SSL_CTX 签发的 ticket 在任意连接上都能恢复会话
+class TlsContext {
+public :
+    static TlsContext& Instance() {
+        static TlsContext context ;
+        return context ;
+    }
+
+    bool init(const char* certFile , const char* keyFile , const long sessionTimeout) {
+        if(ctx_ != nullptr) return true ;
+        SSL_CTX* ctx = SSL_CTX_new(TLS_server_method()) ;
+        if(ctx == nullptr) return error_("SSL_CTX_new") ;
+        SSL_CTX_set_min_proto_version(ctx , TLS1_2_VERSION) ;
+        uint64_t options = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_IGNORE_UNEXPECTED_EOF ;
+#ifdef SSL_OP_ENABLE_KTLS
+        // 握手完成后由内核加解密，sendfile / writev 可以继续零拷贝发送静态文件；内核或套件不支持时自动退回用户态
+        options |= SSL_OP_ENABLE_KTLS ;
+#endif
+        SSL_CTX_set_options(ctx , options) ;
+        // 非阻塞写：允许部分写入，EAGAIN 之后重试时缓冲区地址可以变化（Buffer 扩容或者片段推进）；空闲连接释放读写缓冲区
+        SSL_CTX_set_mode(ctx , SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS) ;
+        if(SSL_CTX_use_certificate_chain_file(ctx , certFile) != 1 ||
+           SSL_CTX_use_PrivateKey_file(ctx , keyFile , SSL_FILETYPE_PEM) != 1 ||
+           SSL_CTX_check_private_key(ctx) != 1) {
+            SSL_CTX_free(ctx) ;
+            return error_("load certificate") ;
+        }
+        // 会话恢复：TLS 1.3 / 1.2 默认签发 session ticket ，另外保留服务端会话缓存给不支持 ticket 的客户端
+        static const unsigned char SESSION_ID_CONTEXT[] = "TinyWebServer" ;
+        SSL_CTX_set_session_id_context(ctx , SESSION_ID_CONTEXT , sizeof(SESSION_ID_CONTEXT) - 1) ;
+        SSL_CTX_set_session_cache_mode(ctx , SSL_SESS_CACHE_SERVER) ;
+        SSL_CTX_set_timeout(ctx , sessionTimeout) ;
+        SSL_CTX_set_alpn_select_cb(ctx , selectAlpn_ , nullptr) ;
+        ctx_ = ctx ;
+        LOG_INFO("tls init success , cert: %s" , certFile) ;
+        return true ;
+    }
+
+    // nullptr 表示没有开启 TLS
+    SSL_CTX* GetCtx() const {
+        return ctx_ ;
+    }
+
+private :
+    TlsContext() : ctx_(nullptr) {
+
+    }
+
+    ~TlsContext() {
+        if(ctx_ != nullptr) SSL_CTX_free(ctx_) ;
+    }
+
+    TlsContext(const TlsContext&) = delete ;
+    TlsContext& operator=(const TlsContext&) = delete ;
+
+    static bool error_(const char* step) {
+        LOG_ERROR("tls %s error : %s" , step , ERR_error_string(ERR_get_error() , nullptr)) ;
+        ERR_clear_error() ;
+        return false ;
+    }
+
+    // ALPN 优先选择 h2 ，客户端随后直接发送 HTTP/2 连接前言，走 prior knowledge 的流程
+    static int selectAlpn_(SSL* , const unsigned char** out , unsigned char* outLen , const unsigned char* in , unsigned int inLen , void*) {
+        static const unsigned char PROTOCOLS[] = "\x02h2\x08http/1.1" ;
+        unsigned char* selected = nullptr ;
+        if(SSL_select_next_proto(&selected , outLen , PROTOCOLS , sizeof(PROTOCOLS) - 1 , in , inLen) != OPENSSL_NPN_NEGOTIATED) {
+            return SSL_TLSEXT_ERR_NOACK ;
+        }
+        *out = selected ;
+        return SSL_TLSEXT_ERR_OK ;
+    }
+
+    SSL_CTX* ctx_ ;
+} ;
+
+#endif
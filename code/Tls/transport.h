@@ -0,0 +1,202 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "../Buffer/buffer.h"
+#include "../Log/log.h"
+#include "../Common/commonConfig.h"
+
+// 连接的读写通道：明文直接读写 fd ；TLS 用非阻塞的 SSL_read / SSL_write ，
+// 握手后内核接管了发送方向的加密（kTLS）时，writev / sendfile 仍然直接作用在 fd 上，保持零拷贝
+// 出错时和系统调用一样返回 -1 并设置 errno ，EWOULDBLOCK 表示等待下一次 EPOLLIN / EPOLLOUT
+class Transport {
+public :
+    Transport(const int fd , SSL_CTX* ctx) : fd_(fd) , ssl_(nullptr) , is_Tls_(ctx != nullptr) , is_Handshake_(false) , 
+                                             is_WantWrite_(false) , is_KtlsSend_(false) {
+        if(is_Tls_ == false) return ;
+        ssl_ = SSL_new(ctx) ;
+        if(ssl_ == nullptr || SSL_set_fd(ssl_ , fd_) != 1) { // 握手时直接失败，不能退回明文
+            LOG_ERROR("tls SSL_new %d error : %s" , fd_ , ERR_error_string(ERR_get_error() , nullptr)) ;
+            ERR_clear_error() ;
+            if(ssl_ != nullptr) SSL_free(ssl_) ;
+            ssl_ = nullptr ;
+            return ;
+        }
+        SSL_set_accept_state(ssl_) ;
+    }
+
+    ~Transport() {
+        close() ;
+    }
+
+    // 必须在 close(fd) 之前调用，尽量发送 close_notify ，不等待对端回应
+    void close() {
+        if(ssl_ == nullptr) return ;
+        if(is_Handshake_) SSL_shutdown(ssl_) ;
+        SSL_free(ssl_) ;
+        ssl_ = nullptr ;
+        ERR_clear_error() ;
+    }
+
+    int GetFd() const {
+        return fd_ ;
+    }
+
+    bool IsTls() const {
+        return is_Tls_ ;
+    }
+
+    bool IsHandshakeDone() const {
+        return is_Tls_ == false || is_Handshake_ ;
+    }
+
+    // 握手还没完成时，下一步需要等待可写还是可读
+    bool WantWrite() const {
+        return is_WantWrite_ ;
+    }
+
+    STATUS_CODE Handshake() {
+        if(ssl_ == nullptr) return CLOSE_CONNECTION ;
+        int ret = SSL_do_handshake(ssl_) ;
+        if(ret == 1) {
+            is_Handshake_ = true ; is_WantWrite_ = false ;
+#ifdef SSL_OP_ENABLE_KTLS
+            is_KtlsSend_ = BIO_get_ktls_send(SSL_get_wbio(ssl_)) == 1 ;
+#endif
+            LOG_INFO("tls %d handshake %s %s , reused:%d , ktls send:%d" , fd_ , SSL_get_version(ssl_) ,
+                     SSL_get_cipher_name(ssl_) , SSL_session_reused(ssl_) , is_KtlsSend_) ;
+            return GOOD_CODE ;
+        }
+        int err = SSL_get_error(ssl_ , ret) ;
+        if(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            is_WantWrite_ = err == SSL_ERROR_WANT_WRITE ;
+            return CONTINUE_CODE ;
+        }
+        LOG_WARN("tls %d handshake error %d : %s" , fd_ , err , ERR_error_string(ERR_get_error() , nullptr)) ;
+        ERR_clear_error() ;
+        return CLOSE_CONNECTION ;
+    }
+
+    // 读到 Buffer 中，返回值和 Buffer::ReadFd 一致：0 表示对端关闭
+    ssize_t Read(Buffer* buff , int* saveErrno) {
+        if(is_Tls_ == false) return buff->ReadFd(fd_ , saveErrno) ;
+        ssize_t total = 0 ;
+        // 每次最多读 128K ，但 SSL 内部已经解密的数据要读完，它们不会再触发 epoll
+        while(total < MAX_READ_ONCE || SSL_pending(ssl_) > 0) {
+            buff->EnsureWriteable(TLS_RECORD_SIZE) ;
+            ERR_clear_error() ;
+            int len = SSL_read(ssl_ , buff->BufferEnd() , TLS_RECORD_SIZE) ;
+            if(len > 0) {
+                buff->HasWritten(len) ;
+                total += len ;
+                continue ;
+            }
+            int err = SSL_get_error(ssl_ , len) ;
+            if(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+                if(total > 0) return total ;
+                *saveErrno = EWOULDBLOCK ;
+                return -1 ;
+            }
+            if(total > 0) return total ; // 先处理已经读到的数据，下一次再报告关闭或者出错
+            if(err == SSL_ERROR_ZERO_RETURN) return 0 ;
+            *saveErrno = sslErrno_(err) ;
+            return -1 ;
+        }
+        return total ;
+    }
+
+    ssize_t Write(const void* data , size_t len) {
+        struct iovec iov = { const_cast<void*>(data) , len } ;
+        return Writev(&iov , 1) ;
+    }
+
+    ssize_t Writev(const struct iovec* iov , int iovCnt) {
+        if(is_Tls_ == false || is_KtlsSend_) return ::writev(fd_ , iov , iovCnt) ;
+        // 小片段先拼成一个记录再加密，避免响应头、分段头各自成为一个 TLS 记录
+        const char* data = static_cast<const char*>(iov[0].iov_base) ;
+        size_t len = iov[0].iov_len ;
+        if(len < TLS_RECORD_SIZE && iovCnt > 1) {
+            char* staging = staging_() ;
+            len = 0 ;
+            for(int i = 0 ; i < iovCnt && len < TLS_RECORD_SIZE ; ++i) {
+                size_t n = std::min(iov[i].iov_len , TLS_RECORD_SIZE - len) ;
+                memcpy(staging + len , iov[i].iov_base , n) ;
+                len += n ;
+            }
+            data = staging ;
+        }
+        return sslWrite_(data , len) ;
+    }
+
+    // sendfile 语义：从 offset 处发送文件内容并推进 offset
+    ssize_t Sendfile(int fileFd , off_t* offset , size_t len) {
+        if(is_Tls_ == false) return ::sendfile(fd_ , fileFd , offset , len) ;
+#ifdef SSL_OP_ENABLE_KTLS
+        if(is_KtlsSend_) {
+            ossl_ssize_t ret = SSL_sendfile(ssl_ , fileFd , *offset , len , 0) ;
+            if(ret > 0) {
+                *offset += ret ;
+                return ret ;
+            }
+            int err = SSL_get_error(ssl_ , static_cast<int>(ret)) ;
+            errno = err == SSL_ERROR_WANT_WRITE ? EWOULDBLOCK : sslErrno_(err) ;
+            return -1 ;
+        }
+#endif
+        // 用户态加密只能先读出来；EAGAIN 之后重试的仍然是同一段内容，满足 SSL_write 的重试要求
+        char* staging = staging_() ;
+        ssize_t n = 0 ;
+        do {
+            n = pread(fileFd , staging , std::min(len , TLS_RECORD_SIZE) , *offset) ;
+        }while(n < 0 && errno == EINTR) ;
+        if(n <= 0) return n ;
+        ssize_t ret = sslWrite_(staging , n) ;
+        if(ret > 0) *offset += ret ;
+        return ret ;
+    }
+
+private :
+    static constexpr size_t TLS_RECORD_SIZE = 16384 ;      // 一个 TLS 记录最多携带的明文
+    static constexpr ssize_t MAX_READ_ONCE = 128 * 1024 ;
+
+    static char* staging_() {
+        static thread_local char staging[TLS_RECORD_SIZE] ;
+        return staging ;
+    }
+
+    ssize_t sslWrite_(const char* data , size_t len) {
+        ERR_clear_error() ;
+        int ret = SSL_write(ssl_ , data , static_cast<int>(len)) ;
+        if(ret > 0) return ret ;
+        int err = SSL_get_error(ssl_ , ret) ;
+        errno = (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) ? EWOULDBLOCK : sslErrno_(err) ;
+        return -1 ;
+    }
+
+    // SSL_ERROR_SYSCALL 时 errno 就是底层的错误，其他错误统一当作协议错误
+    int sslErrno_(int err) const {
+        int saved = errno ;
+        if(err != SSL_ERROR_SYSCALL) {
+            saved = EPROTO ;
+        }else if(saved == 0) { // 对端直接断开了 TCP 
+            saved = ECONNRESET ;
+        }
+        LOG_WARN("tls %d io error %d , errno %d : %s" , fd_ , err , saved , ERR_error_string(ERR_get_error() , nullptr)) ;
+        ERR_clear_error() ;
+        return saved ;
+    }
+
+    int fd_ ;
+    SSL* ssl_ ;
+    bool is_Tls_ ;
+    bool is_Handshake_ ;
+    bool is_WantWrite_ ;
+    bool is_KtlsSend_ ;                     // 内核负责发送方向的加密
+} ;
+
+#endif